@@ -25,9 +25,15 @@
 #define EBADF        9  // Bad file descriptor
 #define EACCES       13 // Permission denied
 #define EEXIST       17 // File exists
+#define ENODEV       19 // No such device
 #define ENOTDIR      20 // Not a directory
 #define EISDIR       21 // Is a directory
 #define EMFILE       24 // Too many open files
+#define EFBIG        27 // File too large
+#define ENOSPC       28 // No space left on device
+#define ESPIPE       29 // Illegal seek
+#define EROFS        30 // Read-only file system
 #define ENAMETOOLONG 36 // Filename too long
+#define ETIMEDOUT    110 // Timed out
 
 #endif /* _PLENJOS_ERRNO_H */
\ No newline at end of file
@@ -34,6 +34,11 @@ typedef enum {
     SYSCALL_UNLINK,
     SYSCALL_SYMLINK,
     SYSCALL_READLINK,
+    SYSCALL_FSYNC,
+    SYSCALL_READV,
+    SYSCALL_WRITEV,
+    SYSCALL_PREADV, // Positional variants leave the descriptor's seek position untouched
+    SYSCALL_PWRITEV,
 
     // Other
     SYSCALL_MEMMAP = 0x40,
@@ -49,6 +54,8 @@ typedef enum {
     SYSCALL_SLEEP,
 
     SYSCALL_SPAWN,
+
+    SYSCALL_MEMUNMAP, // File mappings can only be unmapped as a whole
 } syscalls_call;
 
 typedef uint8_t syscall_open_flags_t;
@@ -0,0 +1,15 @@
+#ifndef _PLENJOS_UIO_H
+#define _PLENJOS_UIO_H 1
+
+#include <stddef.h>
+
+// Maximum number of segments accepted by the vectored I/O syscalls
+#define PLENJOS_IOV_MAX 1024
+
+// Layout matches POSIX struct iovec
+struct plenjos_iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+
+#endif /* _PLENJOS_UIO_H */
@@ -16,6 +16,7 @@
 
 #include "arch/x86_64/irq.h"
 #include "cpu/cpu.h"
+#include "timer/timer.h"
 
 // osdev wiki and
 // https://github.com/baponkar/KeblaOS/blob/main/kernel/src/arch/interrupt/apic/apic.c
@@ -60,13 +61,13 @@ bool is_apic_enabled() {
 uint64_t apic_timer_tpms;
 
 void apic_calibrate_timer() {
-    write_reg(APIC_TIMER_DIV, 0b11);
+    write_reg(APIC_TIMER_DIV, APIC_TIMER_DIV_16);
 
     write_reg(APIC_TIMER_INITCNT, 0xFFFFFFFF);
 
     pit_sleep(1000);
 
-    write_reg(APIC_LVT_TIMER, 0x10000);
+    write_reg(APIC_LVT_TIMER, APIC_LVT_MASKED);
 
     // Figure out how many APIC timer ticks have passed
     uint32_t apic_ticks = ReadRegister(APIC_TIMER_CURRCNT);
@@ -74,30 +75,43 @@ void apic_calibrate_timer() {
     apic_timer_tpms = apic_tmr_freq / 1000;
 }
 
-// static volatile uint64_t apic_timer_ticks[MAX_CORES] = {0};
-
 void apic_timer_irq_handler(registers_t *regs, void *data) {
-    // apic_timer_ticks[get_curr_core()]++;
-    // apic_send_eoi();
-    // TODO: implement this
+    timer_irq(regs);
 }
 
-/* void apic_timer_sleep(uint32_t mills) {
-    uint64_t end = apic_timer_ticks[get_curr_core()] + mills;
+void apic_timer_init() {
+    irq_register_routine(APIC_TIMER_IRQ, apic_timer_irq_handler, NULL);
 
-    while (apic_timer_ticks[get_curr_core()] < end) {
-        asm volatile("hlt");
+    // The LAPIC timers all run at the bus clock, so the BSP's calibration is good for every core
+    if (!apic_timer_tpms) {
+        apic_calibrate_timer();
     }
-} */
 
-void apic_start_timer() {
-    irq_register_routine(16, apic_timer_irq_handler, NULL);
+    // The divider must match the one used for calibration. One-shot mode; writing the initial count starts it.
+    write_reg(APIC_TIMER_DIV, APIC_TIMER_DIV_16);
+    write_reg(APIC_LVT_TIMER, APIC_TIMER_IRQ + 32);
+    write_reg(APIC_TIMER_INITCNT, 0);
+}
+
+void apic_timer_oneshot_ns(uint64_t ns) {
+    if (ns == 0 || apic_timer_tpms == 0) {
+        write_reg(APIC_TIMER_INITCNT, 0);
+        return;
+    }
 
-    apic_calibrate_timer();
+    // The count register is only 32 bits wide; a longer wait just ends in an early interrupt that re-arms the timer
+    if (ns > APIC_TIMER_MAX_ONESHOT_NS) {
+        ns = APIC_TIMER_MAX_ONESHOT_NS;
+    }
+
+    uint64_t ticks = (ns * apic_timer_tpms) / 1000000;
+    if (ticks == 0) {
+        ticks = 1;
+    } else if (ticks > 0xFFFFFFFF) {
+        ticks = 0xFFFFFFFF;
+    }
 
-    write_reg(APIC_LVT_TIMER, 48 | 0x20000);
-    write_reg(APIC_TIMER_DIV, 0b111);
-    write_reg(APIC_TIMER_INITCNT, apic_timer_tpms);
+    write_reg(APIC_TIMER_INITCNT, (uint32_t)ticks);
 }
 
 uint32_t get_lapic_id() {
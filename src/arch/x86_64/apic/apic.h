@@ -13,6 +13,11 @@
 #define APIC_TIMER_CURRCNT 0x390
 #define APIC_TIMER_DIV 0x3E0
 
+#define APIC_LVT_MASKED 0x10000
+#define APIC_TIMER_DIV_16 0x3
+
+#define APIC_TIMER_MAX_ONESHOT_NS 1000000000ULL // 1 s
+
 #define LAPIC_ID_REG 0x20
 
 extern uint64_t LAPIC_BASE;
@@ -23,7 +28,10 @@ uint64_t cpu_get_apic_base();
 void enable_apic();
 bool is_apic_enabled();
 void apic_send_eoi();
-void apic_start_timer();
+// Puts this core's LAPIC timer in one-shot mode, stopped; the first call calibrates it against the PIT
+void apic_timer_init();
+// Fires the LAPIC timer IRQ on this core once, ns from now; 0 stops it
+void apic_timer_oneshot_ns(uint64_t ns);
 uint32_t get_lapic_id();
 uint32_t ReadRegister(uint32_t reg);
 void send_ipi(uint8_t apic_id, uint8_t vector);
\ No newline at end of file
@@ -92,6 +92,19 @@ void ioapic_restore_masks(uint32_t *prev_low_dwords, uint8_t max_irqs) {
     }
 }
 
+void ioapic_set_masked(uint8_t irq, bool masked) {
+    uint32_t reg_low = IOAPICREDTBL(irq);
+    uint32_t low     = ioapic_read((void *)IOAPIC_ADDR, reg_low);
+
+    if (masked) {
+        low |= (1 << 16);
+    } else {
+        low &= ~(1 << 16);
+    }
+
+    ioapic_write((void *)IOAPIC_ADDR, reg_low, low);
+}
+
 void enable_ioapic() {
     outb(0x22, 0x70); // select the IOAPIC indirect register
     outb(0x23, 0x01); // sets the IOAPIC indirect register to 1
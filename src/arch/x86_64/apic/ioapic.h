@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 extern uint64_t IOAPIC_ADDR;
@@ -12,4 +13,5 @@ void ioapic_route_all_irq(uint8_t lapic_id, uint32_t flags);
 void ioapic_route_irq(uint8_t irq_no, uint8_t apic_id, uint8_t vector_no, uint32_t flags);
 
 void ioapic_mask_all_except(uint8_t allowed_irq, uint32_t *prev_low_dwords, uint8_t max_irqs);
-void ioapic_restore_masks(uint32_t *prev_low_dwords, uint8_t max_irqs);
\ No newline at end of file
+void ioapic_restore_masks(uint32_t *prev_low_dwords, uint8_t max_irqs);
+void ioapic_set_masked(uint8_t irq, bool masked);
\ No newline at end of file
@@ -13,6 +13,7 @@
 #include "memory/detect.h"
 #include "timer/hpet.h"
 #include "timer/pit.h"
+#include "timer/timer.h"
 
 #include <cpuid.h>
 #include <stdbool.h>
@@ -40,7 +41,6 @@ void init_x86_64() {
 
     // hpet_init();
     pit_init();
-    // apic_start_timer();
 
     PIC_remap(PIC1, PIC2);
     pic_disable();
@@ -54,6 +54,9 @@ void init_x86_64() {
 
     setup_bs_gs_base();
 
+    // Needs the PIT ticking (for calibration) and the gs base (for the IRQ stub) set up
+    timer_init();
+
     // ReadRegister(0x60);
 }
 
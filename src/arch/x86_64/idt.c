@@ -8,6 +8,7 @@
 #include "memory/kmalloc.h"
 #include "memory/mm.h"
 #include "proc/scheduler.h"
+#include "syscall/mem/memmap.h"
 
 #include <stdbool.h>
 #include <stdint.h>
@@ -141,7 +142,7 @@ void dump_machine_check_msrs() {
     }
 }
 
-__attribute__((noreturn)) void exception_handler(registers_t *regs) {
+void exception_handler(registers_t *regs) {
     // asm volatile ("cli; hlt"); // Completely hangs the computer
 
     uint64_t cr3 = get_cr3_addr();
@@ -156,6 +157,21 @@ __attribute__((noreturn)) void exception_handler(registers_t *regs) {
         regs               = (registers_t *)phys_to_virt(regs_phys);
     }
 
+    // Not-present faults inside a file mapping are just pages that haven't been read in yet. A page cache miss reads
+    // the page from disk right here, with interrupts off and outside any kernel thread, so the faulting core is stuck
+    // in the fault (halted or spinning on the drive) until the read completes; nothing else is scheduled on it.
+    if (regs->int_no == 14 && (regs->iret_cs & CS_MASK) == USER_CS && !(regs->err_code & 0x1)) {
+        thread_t *thread = (thread_t *)cores_threads[get_curr_core()];
+        if (thread) {
+            if (memmap_file_handle_fault(thread->parent, (pml4_t *)phys_to_virt(regs->cr3 & ~0xFFF), regs->cr2,
+                                         regs->err_code & 0x2)
+                == 0) {
+                // The saved cr3 is restored on the way out
+                return;
+            }
+        }
+    }
+
     release_console();
 
     if (regs->int_no == 14) {
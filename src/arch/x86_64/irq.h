@@ -8,6 +8,8 @@
 #define IDE_PRIMARY_IRQ   14
 #define IDE_SECONDARY_IRQ 15
 
+#define APIC_TIMER_IRQ 16
+
 #define IPI_TLB_SHOOTDOWN_IRQ 18
 #define IPI_TLB_FLUSH_IRQ     19
 #define IPI_KILL_IRQ          19
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+// Time-stamp counter; only meaningful for measuring intervals on CPUs with an invariant TSC
+static inline uint64_t rdtsc() {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
@@ -17,7 +17,7 @@
 #include "memory/detect.h"
 #include "memory/mm.h"
 #include "proc/scheduler.h"
-#include "timer/pit.h"
+#include "timer/timer.h"
 
 // TODO: do we want to enable sse/sse2/avx instructions?
 
@@ -118,7 +118,6 @@ void setup_other_core(struct limine_mp_info *mp_info) {
 
     // hpet_init();
     // pit_init();
-    // apic_start_timer();
 
     // irq_register_routine(IPI_TLB_SHOOTDOWN_IRQ, &ipi_tlb_shootdown_routine);
     // irq_register_routine(IPI_TLB_FLUSH_IRQ, &ipi_tlb_flush_routine);
@@ -135,6 +134,9 @@ void setup_other_core(struct limine_mp_info *mp_info) {
 
     kout(KERNEL_INFO, "Useable memory on detected core %d: %p\n\n", (int)get_curr_core(), PHYS_MEM_USEABLE_LENGTH);
 
+    // The BSP has already calibrated the LAPIC timer
+    timer_start_core();
+
     cpu_cores[mp_info->processor_id].online = true;
 
     // irq_register_routine(18, &ipi_routine);
@@ -165,7 +167,7 @@ void setup_other_cores() {
 
         while (!cpu_cores[i].online) {
             // Wait for core to come online
-            pit_sleep(5);
+            ksleep_blocking_ms(5, NULL);
         }
     }
 }
@@ -1,3 +1,4 @@
+#include <stddef.h>
 #include <stdint.h>
 
 #include "devices/io/ports.h"
@@ -28,6 +29,14 @@ void outw(uint16_t port, uint16_t value) {
     asm volatile("outw %0, %w1" : : "a"(value), "Nd"(port) : "memory");
 }
 
+void insw(uint16_t port, void *buffer, size_t count) {
+    asm volatile("rep insw" : "+D"(buffer), "+c"(count) : "d"(port) : "memory");
+}
+
+void outsw(uint16_t port, const void *buffer, size_t count) {
+    asm volatile("rep outsw" : "+S"(buffer), "+c"(count) : "d"(port) : "memory");
+}
+
 // 32-bit read
 uint32_t inl(uint16_t port) {
     uint32_t value;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 uint8_t inb(uint16_t port);
@@ -8,6 +9,10 @@ void outb(uint16_t port, uint8_t val);
 uint16_t inw(uint16_t port);
 void outw(uint16_t port, uint16_t value);
 
+// String variants (rep insw/outsw); count is in words
+void insw(uint16_t port, void *buffer, size_t count);
+void outsw(uint16_t port, const void *buffer, size_t count);
+
 uint32_t inl(uint16_t port);
 void outl(uint16_t port, uint32_t value);
 
@@ -2,6 +2,7 @@
 
 // Keyboard support is built-in; I don't plan to make it a config option.
 #include "devices/input/keyboard/keyboard.h"
+#include "devices/storage/mbr.h"
 
 #ifdef __KERNEL_SUPPORT_DEV_PCI
 # include "devices/pci/pci.h"
@@ -37,5 +38,8 @@ int device_manager_init() {
     ide_init();
 #endif
 
+    // Filesystems must be mounted before anything tries to open a file (e.g. init)
+    drive_wait_for_partition_probes();
+
     return 0;
 }
\ No newline at end of file
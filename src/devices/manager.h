@@ -24,6 +24,13 @@ typedef struct device device_t;
 #define __KERNEL_SUPPORT_DEV_STORAGE_ATA 1
 #define __KERNEL_SUPPORT_DEV_STORAGE_IDE 1
 
+#define __KERNEL_SUPPORT_DEV_STORAGE_SATA_AHCI 1
+
+#define __KERNEL_SUPPORT_DEV_STORAGE_RAMDISK 1
+
+#define __KERNEL_SUPPORT_DEV_VIRTIO             1
+#define __KERNEL_SUPPORT_DEV_STORAGE_VIRTIO_BLK 1
+
 /*
 section INPUT_DEVICES:
     option __KERNEL_SUPPORT_DEV_INPUT_KEYBOARD:
@@ -35,6 +42,7 @@ section INPUT_DEVICES:
 section PCI_DEVICES:
     option __KERNEL_SUPPORT_DEV_PCI:
         option __KERNEL_SUPPORT_DEV_PCIe
+        option __KERNEL_SUPPORT_DEV_VIRTIO
 
     option __KERNEL_SUPPORT_DEV_USB:
             option __KERNEL_SUPPORT_DEV_USB_HOST_UHCI
@@ -49,6 +57,11 @@ section STORAGE_DEVICES:
     option __KERNEL_SUPPORT_DEV_STORAGE_ATA:
         option __KERNEL_SUPPORT_DEV_STORAGE_IDE
         option __KERNEL_SUPPORT_DEV_STORAGE_SATA_AHCI
+
+    option __KERNEL_SUPPORT_DEV_STORAGE_RAMDISK
+
+    also requires __KERNEL_SUPPORT_DEV_VIRTIO:
+        option __KERNEL_SUPPORT_DEV_STORAGE_VIRTIO_BLK
 */
 
 /**
@@ -0,0 +1,104 @@
+#include "pci.h"
+
+#ifdef __KERNEL_SUPPORT_DEV_PCI
+
+# include "lib/stdio.h"
+# include "memory/kmalloc.h"
+
+# ifdef __KERNEL_SUPPORT_DEV_STORAGE_SATA_AHCI
+#  include "devices/storage/ahci.h"
+# endif
+
+# ifdef __KERNEL_SUPPORT_DEV_STORAGE_VIRTIO_BLK
+#  include "devices/storage/virtio_blk.h"
+# endif
+
+int pci_scan_process_mass_storage_controller(pci_device_t *dev) {
+    /* Virtio block device (transitional 0x1001 or modern 0x1042; reports itself as a SCSI controller) */
+    if (dev->vendor_id == PCI_VENDOR_VIRTIO && (dev->device_id == 0x1001 || dev->device_id == 0x1042)) {
+# ifdef __KERNEL_SUPPORT_DEV_STORAGE_VIRTIO_BLK
+        kout(KERNEL_INFO, "PCI: Initializing virtio block device (device ID %x)...\n", dev->device_id);
+        struct virtio_blk_device *virtio_blk_device
+            = (struct virtio_blk_device *)kmalloc_heap(sizeof(struct virtio_blk_device));
+        if (!virtio_blk_device) {
+            kout(KERNEL_SEVERE_FAULT, "OOM ERROR: PCI: Failed to allocate memory for virtio block device structure.\n");
+            return ERR_NO_MEM;
+        }
+
+        int res = virtio_blk_init(virtio_blk_device, dev);
+        if (res != 0) {
+            kout(KERNEL_SEVERE_FAULT, "PCI: ERROR: Failed to initialize virtio block device (res %d).\n", res);
+            kfree_heap(virtio_blk_device);
+            return ERR_NO_DRIVER;
+        }
+
+        kout(KERNEL_INFO, "PCI: Virtio block device initialized successfully.\n");
+        return 0;
+# else
+        kout(KERNEL_WARN,
+             "PCI: NO DRIVER (STORAGE_VIRTIO_BLK): Virtio block device detected, but virtio block support is not "
+             "enabled.\n");
+        return ERR_NO_DRIVER;
+# endif // __KERNEL_SUPPORT_DEV_STORAGE_VIRTIO_BLK
+    }
+
+    switch (dev->subclass_code) {
+
+    /* IDE controller; the legacy channels are driven by ide_init(), which looks this device up for bus mastering */
+    case PCI_SUBCLASS_IDE: {
+        return 0;
+    }
+
+    /* SATA controller */
+    case PCI_SUBCLASS_SERIAL_ATA: {
+        switch (dev->prog_if) {
+
+        /* AHCI Host Controller */
+        case PCI_PROGIF_SATA_AHCI_1_0: {
+# ifdef __KERNEL_SUPPORT_DEV_STORAGE_SATA_AHCI
+            kout(KERNEL_INFO, "PCI: Initializing AHCI SATA controller (ProgIF %x)...\n", dev->prog_if);
+            struct ahci_controller *ahci_controller
+                = (struct ahci_controller *)kmalloc_heap(sizeof(struct ahci_controller));
+            if (!ahci_controller) {
+                kout(KERNEL_SEVERE_FAULT, "OOM ERROR: PCI: Failed to allocate memory for AHCI controller structure.\n");
+                return ERR_NO_MEM;
+            }
+
+            int res = ahci_init(ahci_controller, dev);
+            if (res != 0) {
+                kout(KERNEL_SEVERE_FAULT, "PCI: ERROR: Failed to initialize AHCI controller (res %d).\n", res);
+                kfree_heap(ahci_controller);
+                return ERR_NO_DRIVER;
+            }
+
+            kout(KERNEL_INFO, "PCI: AHCI SATA controller initialized successfully.\n");
+            return 0;
+# else
+            kout(KERNEL_WARN,
+                 "PCI: NO DRIVER (STORAGE_SATA_AHCI): AHCI SATA controller detected (ProgIF %x), but AHCI support is "
+                 "not enabled.\n",
+                 dev->prog_if);
+# endif // __KERNEL_SUPPORT_DEV_STORAGE_SATA_AHCI
+            break;
+        }
+
+        /* Unknown */
+        default: {
+            kout(KERNEL_WARN, "PCI: NO DRIVER (SATA): SATA controller detected (ProgIF %x), but no driver is available.\n",
+                 dev->prog_if);
+        }
+        }
+
+        break;
+    }
+    default: {
+        kout(KERNEL_WARN, "PCI: NO DRIVER (MASS_STORAGE): Mass storage PCI device detected (Subclass %x, ProgIF %x).\n",
+             dev->subclass_code, dev->prog_if);
+        break;
+    }
+    }
+
+    return ERR_NO_DRIVER;
+}
+
+#endif // __KERNEL_SUPPORT_DEV_PCI
@@ -256,7 +256,7 @@ pci_device_t pci_check_device(uint8_t bus, uint8_t device, uint8_t function) {
         break;
     }
     case PCI_CLASS_MASS_STORAGE: {
-        kout(KERNEL_WARN, "PCI: NO DRIVER: Mass storage PCI device detected.\n");
+        pci_scan_process_mass_storage_controller(&dev);
         break;
     }
     case PCI_CLASS_NETWORK: {
@@ -64,6 +64,7 @@ int pci_clear_command_bits(uint8_t bus, uint8_t device, uint8_t function, uint16
 
 void pci_scan();
 
+int pci_scan_process_mass_storage_controller(pci_device_t *dev);
 int pci_scan_process_serial_bus_controller(pci_device_t *dev);
 
 #endif // __KERNEL_SUPPORT_DEV_PCI
\ No newline at end of file
@@ -0,0 +1,708 @@
+#include "ahci.h"
+
+#ifdef __KERNEL_SUPPORT_DEV_STORAGE_SATA_AHCI
+
+# include "arch/x86_64/apic/apic.h"
+# include "arch/x86_64/common.h"
+# include "arch/x86_64/irq.h"
+# include "cpu/cpu.h"
+# include "devices/io/ports.h"
+# include "kernel.h"
+# include "lib/stdio.h"
+# include "lib/string.h"
+# include "mbr.h"
+# include "memory/detect.h"
+# include "memory/kmalloc.h"
+# include "memory/mm.h"
+# include "plenjos/errno.h"
+# include "timer/timer.h"
+
+# include <stdatomic.h>
+# include <stdbool.h>
+# include <stdint.h>
+
+// ioapic_route_all_irq() only routes the first 21 legacy lines (and 0-2 are the PIT/keyboard/cascade)
+# define AHCI_MAX_ROUTED_IRQ 20
+
+# define AHCI_PORT_TIMEOUT_MS 500
+
+// Spins until (*reg & mask) == 0; returns false on timeout
+static bool ahci_wait_clear(volatile uint32_t *reg, uint32_t mask, uint64_t ms) {
+    uint64_t deadline = timer_now_ns() + ms * TIMER_NS_PER_MS;
+
+    while (*reg & mask) {
+        if (timer_now_ns() >= deadline) {
+            return false;
+        }
+        asm volatile("pause");
+    }
+
+    return true;
+}
+
+// Zeroed frame the HBA can reach, or 0
+static uint64_t ahci_alloc_frame(struct ahci_controller *controller) {
+    uint64_t phys = find_next_free_frame();
+    if (phys == 0) {
+        return 0;
+    }
+
+    if (!(controller->cap & AHCI_CAP_S64A) && phys >= UINT32_MAX) {
+        phys_mem_unref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(phys));
+        return 0;
+    }
+
+    memset((void *)phys_to_virt(phys), 0, PAGE_LEN);
+    return phys;
+}
+
+static void ahci_free_frame(void *virt) {
+    if (virt) {
+        phys_mem_unref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(virt_to_phys((uint64_t)virt)));
+    }
+}
+
+static int ahci_port_stop(volatile struct ahci_hba_port *regs) {
+    regs->cmd &= ~AHCI_PXCMD_ST;
+    if (!ahci_wait_clear(&regs->cmd, AHCI_PXCMD_CR, AHCI_PORT_TIMEOUT_MS)) {
+        return -EIO;
+    }
+
+    regs->cmd &= ~AHCI_PXCMD_FRE;
+    if (!ahci_wait_clear(&regs->cmd, AHCI_PXCMD_FR, AHCI_PORT_TIMEOUT_MS)) {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+static void ahci_port_start(volatile struct ahci_hba_port *regs) {
+    ahci_wait_clear(&regs->cmd, AHCI_PXCMD_CR, AHCI_PORT_TIMEOUT_MS);
+
+    regs->cmd |= AHCI_PXCMD_FRE;
+    regs->cmd |= AHCI_PXCMD_ST;
+}
+
+// Restarting the command engine clears PxCI and PxSACT, aborting everything in flight
+static void ahci_port_recover(struct ahci_port *port) {
+    volatile struct ahci_hba_port *regs = port->regs;
+
+    if (ahci_port_stop(regs) != 0) {
+        kout_nolock(KERNEL_SEVERE_EXTERNAL_FAULT, "AHCI: port %d did not stop during error recovery\n",
+                    port->port_no);
+    }
+
+    regs->serr = 0xFFFFFFFF;
+    regs->is   = 0xFFFFFFFF;
+
+    ahci_port_start(regs);
+}
+
+static void ahci_port_complete(struct ahci_port *port, uint32_t mask, int result) {
+    while (mask) {
+        int slot  = __builtin_ctz(mask);
+        mask     &= mask - 1;
+
+        struct ahci_slot *s = &port->slots[slot];
+
+        atomic_fetch_and(&port->slots_issued, ~(1U << slot));
+        s->result = result;
+        atomic_store(&s->done, true);
+
+        // Same protocol as the IDE completion: the waiter publishes its core before checking done
+        int waiter = atomic_load(&s->waiter_core);
+        if (waiter >= 0 && (uint32_t)waiter != get_curr_core()) {
+            send_ipi(cpu_cores[waiter].lapic_id, IPI_WAKEUP_IRQ + 32);
+        }
+    }
+}
+
+// Completes every issued slot the HBA is done with. Safe to call from the IRQ handler and from waiters at once.
+static void ahci_port_reap(struct ahci_port *port) {
+    atomic_store(&port->reap_pending, true);
+
+    while (atomic_load(&port->reap_pending)) {
+        if (atomic_flag_test_and_set_explicit(&port->reap_lock, memory_order_acquire)) {
+            return; // The holder will see reap_pending and go round again
+        }
+        atomic_store(&port->reap_pending, false);
+
+        volatile struct ahci_hba_port *regs = port->regs;
+
+        uint32_t is = regs->is;
+        regs->is    = is;
+
+        // slots_issued must be read before PxCI/PxSACT; a slot is only marked issued after its PxCI bit is set
+        uint32_t issued = atomic_load(&port->slots_issued);
+        uint32_t active = regs->ci | regs->sact;
+
+        ahci_port_complete(port, issued & ~active, 0);
+
+        bool recover = atomic_exchange(&port->needs_recovery, false);
+        if (is & AHCI_PXIS_ERRORS) {
+            kout_nolock(KERNEL_EXTERNAL_FAULT, "AHCI: port %d error (is %x, tfd %x, serr %x)\n", port->port_no, is,
+                        regs->tfd, regs->serr);
+            recover = true;
+        }
+
+        if (recover) {
+            // Without READ LOG EXT we can't tell which queued command failed, so fail everything still in flight
+            ahci_port_recover(port);
+            ahci_port_complete(port, issued & active, -EIO);
+        }
+
+        atomic_flag_clear_explicit(&port->reap_lock, memory_order_release);
+    }
+}
+
+void ahci_irq_routine(registers_t *regs, void *data) {
+    (void)regs;
+    struct ahci_controller *controller = (struct ahci_controller *)data;
+
+    uint32_t is = controller->hba->is;
+    if (!is) {
+        return; // Shared line; not ours
+    }
+
+    atomic_store(&controller->irq_seen, true);
+
+    for (int i = 0; i < AHCI_MAX_PORTS; i++) {
+        if (!(is & (1U << i))) {
+            continue;
+        }
+
+        if (controller->ports[i]) {
+            ahci_port_reap(controller->ports[i]);
+        } else {
+            controller->hba->ports[i].is = controller->hba->ports[i].is;
+        }
+    }
+
+    // Port status must be cleared before the HBA-level bit
+    controller->hba->is = is;
+}
+
+static int ahci_port_try_alloc_slot(struct ahci_port *port) {
+    uint32_t allocated = atomic_load(&port->slots_allocated);
+
+    while (true) {
+        uint32_t free = port->slot_mask & ~allocated;
+        if (!free) {
+            return -1;
+        }
+
+        int slot = __builtin_ctz(free);
+        if (atomic_compare_exchange_weak(&port->slots_allocated, &allocated, allocated | (1U << slot))) {
+            return slot;
+        }
+    }
+}
+
+static int ahci_port_alloc_slot(struct ahci_port *port) {
+    int slot;
+
+    while ((slot = ahci_port_try_alloc_slot(port)) < 0) {
+        ahci_port_reap(port);
+        asm volatile("pause");
+    }
+
+    return slot;
+}
+
+static void ahci_port_free_slot(struct ahci_port *port, int slot) {
+    atomic_fetch_and(&port->slots_allocated, ~(1U << slot));
+}
+
+/**
+ * Fills in the command header, FIS and PRDT for slot. buffer may be any kernel address (it doesn't need to be
+ * physically contiguous). Returns -EINVAL if the buffer can't be described.
+ */
+static int ahci_port_prepare(struct ahci_port *port, int slot, uint8_t command, uint64_t lba, uint32_t count,
+                             void *buffer, size_t bytes, bool write, bool queued) {
+    struct ahci_cmd_header *header = &port->cmd_list[slot];
+    struct ahci_cmd_table *table   = port->cmd_tables[slot];
+
+    if (((uint64_t)buffer & 1) || (bytes & 1)) {
+        return -EINVAL;
+    }
+
+    uint64_t virt    = (uint64_t)buffer;
+    size_t remaining = bytes;
+    size_t n         = 0;
+
+    while (remaining > 0) {
+        size_t chunk = PAGE_LEN - (virt & (PAGE_LEN - 1));
+        if (chunk > remaining) {
+            chunk = remaining;
+        }
+
+        uint64_t phys = get_kernel_physaddr(virt);
+        if (phys == 0 || (!(port->controller->cap & AHCI_CAP_S64A) && phys + chunk > 0x100000000ULL)) {
+            return -EINVAL;
+        }
+
+        struct ahci_prdt_entry *prev = n ? &table->prdt[n - 1] : NULL;
+        uint64_t prev_phys           = prev ? ((uint64_t)prev->dbau << 32) | prev->dba : 0;
+        size_t prev_bytes            = prev ? (size_t)prev->dbc + 1 : 0;
+
+        if (prev && prev_phys + prev_bytes == phys && prev_bytes + chunk <= AHCI_PRD_MAX_BYTES) {
+            prev->dbc = (uint32_t)(prev_bytes + chunk - 1);
+        } else {
+            if (n >= AHCI_PRDT_ENTRIES) {
+                return -EINVAL;
+            }
+
+            table->prdt[n].dba  = (uint32_t)phys;
+            table->prdt[n].dbau = (uint32_t)(phys >> 32);
+            table->prdt[n].rsv0 = 0;
+            table->prdt[n].dbc  = (uint32_t)(chunk - 1);
+            table->prdt[n].rsv1 = 0;
+            table->prdt[n].i    = 0;
+            n++;
+        }
+
+        virt      += chunk;
+        remaining -= chunk;
+    }
+
+    memset(table->cfis, 0, sizeof(table->cfis));
+    struct ahci_fis_reg_h2d *fis = (struct ahci_fis_reg_h2d *)table->cfis;
+
+    fis->fis_type = AHCI_FIS_TYPE_REG_H2D;
+    fis->c        = 1;
+    fis->command  = command;
+
+    fis->lba0 = (uint8_t)(lba & 0xFF);
+    fis->lba1 = (uint8_t)((lba >> 8) & 0xFF);
+    fis->lba2 = (uint8_t)((lba >> 16) & 0xFF);
+    fis->lba3 = (uint8_t)((lba >> 24) & 0xFF);
+    fis->lba4 = (uint8_t)((lba >> 32) & 0xFF);
+    fis->lba5 = (uint8_t)((lba >> 40) & 0xFF);
+
+    fis->device = command == ATA_CMD_IDENTIFY ? 0 : 0x40; // LBA mode
+
+    if (queued) {
+        // FPDMA: the sector count moves to the features field and the tag (= slot) goes in count
+        fis->featurel = (uint8_t)(count & 0xFF);
+        fis->featureh = (uint8_t)((count >> 8) & 0xFF);
+        fis->countl   = (uint8_t)(slot << 3);
+
+        if (write) {
+            fis->device |= 0x80; // FUA, so we never need a (non-queued) cache flush between NCQ commands
+        }
+    } else {
+        fis->countl = (uint8_t)(count & 0xFF);
+        fis->counth = (uint8_t)((count >> 8) & 0xFF);
+    }
+
+    header->cfl      = sizeof(struct ahci_fis_reg_h2d) / 4;
+    header->atapi    = 0;
+    header->write    = write ? 1 : 0;
+    header->prefetch = 0;
+    header->reset    = 0;
+    header->bist     = 0;
+    header->clear    = 0;
+    header->pmp      = 0;
+    header->prdtl    = (uint16_t)n;
+    header->prdbc    = 0;
+
+    return 0;
+}
+
+static void ahci_port_issue(struct ahci_port *port, int slot, bool queued) {
+    struct ahci_slot *s = &port->slots[slot];
+
+    atomic_store(&s->waiter_core, -1);
+    s->result = 0;
+    atomic_store(&s->done, false);
+
+    // The command table must be visible to the HBA before it's told to fetch it
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (queued) {
+        port->regs->sact = 1U << slot;
+    }
+    port->regs->ci = 1U << slot;
+
+    // Only now, so a concurrent reap can't see the slot as issued but not yet active
+    atomic_fetch_or(&port->slots_issued, 1U << slot);
+}
+
+// Waits for slot to complete and returns its result. Halts between checks once the controller's IRQ is known to work.
+static int ahci_port_wait(struct ahci_port *port, int slot) {
+    struct ahci_slot *s          = &port->slots[slot];
+    bool interrupts_were_enabled = are_interrupts_enabled();
+
+    uint64_t deadline = timer_now_ns() + AHCI_CMD_TIMEOUT_MS * TIMER_NS_PER_MS;
+
+    atomic_store(&s->waiter_core, (int)get_curr_core());
+
+    // Nothing else is guaranteed to wake this core from hlt if the IRQ never comes
+    int wakeup = set_core_wakeup_timeout(AHCI_CMD_TIMEOUT_MS, get_curr_core(), NULL);
+
+    while (true) {
+        // Catches completions that raced with us publishing waiter_core, and drives everything if there's no IRQ
+        ahci_port_reap(port);
+
+        if (interrupts_were_enabled) {
+            asm volatile("cli");
+        }
+
+        if (atomic_load(&s->done)) {
+            break;
+        }
+
+        if (timer_now_ns() >= deadline) {
+            kout(KERNEL_EXTERNAL_FAULT, "AHCI: command in slot %d on port %d timed out\n", slot, port->port_no);
+            atomic_store(&port->needs_recovery, true);
+            continue;
+        }
+
+        if (!interrupts_were_enabled) {
+            // Probably inside a syscall; don't let other IRQ handlers in, just poll
+            asm volatile("pause");
+        } else if (atomic_load(&port->controller->irq_seen)) {
+            // sti only takes effect after hlt has started, so a completion IRQ can't be lost in between
+            asm volatile("sti; hlt");
+        } else {
+            asm volatile("sti; pause");
+        }
+    }
+
+    atomic_store(&s->waiter_core, -1);
+    cancel_timeout(wakeup);
+
+    if (interrupts_were_enabled) {
+        asm volatile("sti");
+    }
+
+    return s->result;
+}
+
+// Runs a single non-queued command synchronously
+static int ahci_port_exec(struct ahci_port *port, uint8_t command, uint64_t lba, uint32_t count, void *buffer,
+                          size_t bytes, bool write) {
+    int slot = ahci_port_alloc_slot(port);
+
+    int res = ahci_port_prepare(port, slot, command, lba, count, buffer, bytes, write, false);
+    if (res == 0) {
+        ahci_port_issue(port, slot, false);
+        res = ahci_port_wait(port, slot);
+    }
+
+    ahci_port_free_slot(port, slot);
+    return res;
+}
+
+static ssize_t ahci_transfer(DRIVE_t *drive, uint64_t lba, size_t sectors, void *buffer, bool write) {
+    struct ahci_port *port = (struct ahci_port *)drive->internal_data;
+
+    if (!port) {
+        kout(KERNEL_SEVERE_FAULT, "Error: DRIVE internal_data is NULL in ahci_transfer\n");
+        return -1;
+    }
+
+    if (sectors == 0) {
+        return 0;
+    }
+
+    if (lba + sectors > drive->numsectors) {
+        return -EINVAL;
+    }
+
+    uint32_t bytes_per_sector = drive->logical_sector_size;
+    size_t max_sectors        = AHCI_MAX_BYTES_PER_COMMAND / bytes_per_sector;
+    uint8_t *buf              = (uint8_t *)buffer;
+    size_t done               = 0;
+    int res                   = 0;
+
+    uint8_t command = port->ncq ? (write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED)
+                                : (write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+
+    int batch[AHCI_MAX_SLOTS];
+
+    while (done < sectors && res == 0) {
+        // Queue as many commands as there are free slots (at least one), then wait for the whole batch. Without NCQ
+        // the HBA runs them one after the other anyway.
+        int n = 0;
+
+        while (done < sectors && n < AHCI_MAX_SLOTS) {
+            int slot = n == 0 ? ahci_port_alloc_slot(port) : ahci_port_try_alloc_slot(port);
+            if (slot < 0) {
+                break;
+            }
+
+            uint32_t count = (uint32_t)(sectors - done);
+            if (count > max_sectors) {
+                count = (uint32_t)max_sectors;
+            }
+
+            res = ahci_port_prepare(port, slot, command, lba + done, count, buf + done * bytes_per_sector,
+                                    (size_t)count * bytes_per_sector, write, port->ncq);
+            if (res != 0) {
+                ahci_port_free_slot(port, slot);
+                break;
+            }
+
+            ahci_port_issue(port, slot, port->ncq);
+            batch[n++]  = slot;
+            done       += count;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int slot_res = ahci_port_wait(port, batch[i]);
+            ahci_port_free_slot(port, batch[i]);
+
+            if (slot_res != 0 && res == 0) {
+                res = slot_res;
+            }
+        }
+    }
+
+    if (res != 0) {
+        kout(KERNEL_EXTERNAL_FAULT, "AHCI: %s of %lu sectors at lba %p failed on port %d (%d)\n",
+             write ? "write" : "read", sectors, (void *)lba, port->port_no, res);
+        return res == -EINVAL ? -EINVAL : -EIO;
+    }
+
+    return (ssize_t)(sectors * bytes_per_sector);
+}
+
+ssize_t ahci_read_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, void *buffer) {
+    return ahci_transfer(drive, lba, sectors, buffer, false);
+}
+
+ssize_t ahci_write_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, const void *buffer) {
+    return ahci_transfer(drive, lba, sectors, (void *)buffer, true);
+}
+
+int ahci_flush_cache_func(DRIVE_t *drive) {
+    struct ahci_port *port = (struct ahci_port *)drive->internal_data;
+
+    if (!port) {
+        kout(KERNEL_SEVERE_FAULT, "Error: DRIVE internal_data is NULL in ahci_flush_cache_func\n");
+        return -EIO;
+    }
+
+    // NCQ writes are FUA, so only plain DMA writes can still be sitting in the drive's cache
+    if (port->ncq) {
+        return 0;
+    }
+
+    int res = ahci_port_exec(port, ATA_CMD_CACHE_FLUSH, 0, 0, NULL, 0, false);
+    if (res != 0) {
+        kout(KERNEL_EXTERNAL_FAULT, "AHCI: cache flush failed on port %d (%d)\n", port->port_no, res);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+static void ahci_port_free(struct ahci_port *port) {
+    for (int i = 0; i < AHCI_MAX_SLOTS; i++) {
+        ahci_free_frame(port->cmd_tables[i]);
+    }
+    ahci_free_frame(port->cmd_list);
+    kfree_heap(port);
+}
+
+static int ahci_port_parse_identify(struct ahci_port *port) {
+    struct ata_identify *id = &port->identify;
+
+    port->drive.logical_sector_size = 512;
+    if (id->sector_size_info & 0x1000) {
+        port->drive.logical_sector_size = id->logical_sector_words * 2;
+    }
+
+    port->drive.physical_sector_size = port->drive.logical_sector_size;
+    if (id->sector_size_info & 0x000F) {
+        port->drive.physical_sector_size = port->drive.logical_sector_size * (1 << (id->sector_size_info & 0x000F));
+    }
+
+    if (id->command_set_support & (1 << 10)) {
+        port->drive.numsectors = id->sectors48;
+    } else {
+        port->drive.numsectors = id->sectors28;
+    }
+
+    if (port->drive.logical_sector_size == 0 || port->drive.numsectors == 0) {
+        return -EIO;
+    }
+
+    // Word 76 bit 8: NCQ supported; word 75: queue depth - 1
+    if ((port->controller->cap & AHCI_CAP_SNCQ) && (port->identify_raw[76] & (1 << 8))) {
+        uint32_t depth = (uint32_t)(port->identify_raw[75] & 0x1F) + 1;
+
+        port->ncq = true;
+        if (depth < port->slot_count) {
+            port->slot_mask  &= (1U << depth) - 1;
+            port->slot_count  = depth;
+        }
+    }
+
+    return 0;
+}
+
+static int ahci_port_init(struct ahci_controller *controller, int port_no) {
+    volatile struct ahci_hba_port *regs = &controller->hba->ports[port_no];
+
+    uint32_t ssts = regs->ssts;
+    if ((ssts & 0xF) != AHCI_PXSSTS_DET_PRESENT || ((ssts >> 8) & 0xF) != AHCI_PXSSTS_IPM_ACTIVE) {
+        return -ENOENT; // Nothing attached
+    }
+
+    if (regs->sig != AHCI_SIG_ATA) {
+        kout(KERNEL_WARN, "AHCI: port %d has an unsupported device (signature %x)\n", port_no, regs->sig);
+        return -ENOSYS;
+    }
+
+    struct ahci_port *port = kmalloc_heap(sizeof(struct ahci_port));
+    if (!port) {
+        kout(KERNEL_SEVERE_FAULT, "OOM Error: could not allocate AHCI port structure\n");
+        return -ENOMEM;
+    }
+    memset(port, 0, sizeof(struct ahci_port));
+    atomic_flag_clear(&port->reap_lock);
+
+    port->controller = controller;
+    port->regs       = regs;
+    port->port_no    = port_no;
+
+    uint32_t slots   = AHCI_CAP_NCS(controller->cap);
+    port->slot_mask  = slots >= 32 ? 0xFFFFFFFF : (1U << slots) - 1;
+    port->slot_count = slots >= 32 ? 32 : slots;
+
+    if (ahci_port_stop(regs) != 0) {
+        kout(KERNEL_EXTERNAL_FAULT, "AHCI: port %d did not stop\n", port_no);
+        kfree_heap(port);
+        return -EIO;
+    }
+
+    // The command list (1 KiB) and the received FIS area (256 bytes) share a page
+    uint64_t list_phys = ahci_alloc_frame(controller);
+    if (!list_phys) {
+        kout(KERNEL_SEVERE_FAULT, "OOM Error: could not allocate AHCI command list\n");
+        kfree_heap(port);
+        return -ENOMEM;
+    }
+    port->cmd_list = (struct ahci_cmd_header *)phys_to_virt(list_phys);
+
+    for (uint32_t i = 0; i < slots && i < AHCI_MAX_SLOTS; i++) {
+        uint64_t table_phys = ahci_alloc_frame(controller);
+        if (!table_phys) {
+            kout(KERNEL_SEVERE_FAULT, "OOM Error: could not allocate AHCI command table\n");
+            ahci_port_free(port);
+            return -ENOMEM;
+        }
+
+        port->cmd_tables[i]      = (struct ahci_cmd_table *)phys_to_virt(table_phys);
+        port->cmd_list[i].ctba  = (uint32_t)table_phys;
+        port->cmd_list[i].ctbau = (uint32_t)(table_phys >> 32);
+    }
+
+    regs->clb  = (uint32_t)list_phys;
+    regs->clbu = (uint32_t)(list_phys >> 32);
+    regs->fb   = (uint32_t)(list_phys + 1024);
+    regs->fbu  = (uint32_t)((list_phys + 1024) >> 32);
+
+    regs->serr = 0xFFFFFFFF;
+    regs->is   = 0xFFFFFFFF;
+    regs->ie   = AHCI_PXIS_DHRS | AHCI_PXIS_PSS | AHCI_PXIS_DSS | AHCI_PXIS_SDBS | AHCI_PXIS_ERRORS;
+
+    ahci_port_start(regs);
+
+    controller->ports[port_no] = port;
+
+    int res = ahci_port_exec(port, ATA_CMD_IDENTIFY, 0, 0, port->identify_raw, sizeof(port->identify_raw), false);
+    if (res == 0) {
+        res = ahci_port_parse_identify(port);
+    }
+
+    if (res != 0) {
+        kout(KERNEL_EXTERNAL_FAULT, "AHCI: IDENTIFY failed on port %d (%d)\n", port_no, res);
+        controller->ports[port_no] = NULL;
+        ahci_port_stop(regs);
+        ahci_port_free(port);
+        return res;
+    }
+
+    port->drive.internal_data = (void *)port;
+    strncpy(port->drive.model, port->identify.model, 40);
+    port->drive.model[40] = '\0';
+    strncpy(port->drive.interface, "AHCI", 15);
+    port->drive.interface[15] = '\0';
+    port->drive.irq           = controller->irq_no == 0xFF ? (uint32_t)-1 : controller->irq_no;
+    port->drive.read_sectors  = ahci_read_sectors_func;
+    port->drive.write_sectors = ahci_write_sectors_func;
+    port->drive.flush_cache   = ahci_flush_cache_func;
+
+    kout(KERNEL_INFO,
+         "Found SATA device on AHCI port %d. Sector size: %u bytes; %p sectors; NCQ %s (%d slots).\n", port_no,
+         port->drive.logical_sector_size, port->drive.numsectors, port->ncq ? "enabled" : "disabled",
+         (int)port->slot_count);
+
+    struct MBR *mbr = kmalloc_heap(sizeof(struct MBR));
+    if (!mbr) {
+        kout(KERNEL_SEVERE_FAULT, "OOM Error: could not allocate memory for MBR\n");
+        return 0;
+    }
+
+    drive_read_mbr(&port->drive, mbr);
+    kfree_heap(mbr);
+
+    return 0;
+}
+
+int ahci_init(struct ahci_controller *controller, pci_device_t *pci_dev) {
+    memset(controller, 0, sizeof(struct ahci_controller));
+    controller->irq_no = 0xFF;
+
+    uint64_t abar = pci_dev->bar5 & ~0xFULL;
+    if (abar == 0 || (pci_dev->bar5 & 0x1)) {
+        kout(KERNEL_EXTERNAL_FAULT, "AHCI: controller has no memory-mapped ABAR (bar5=%x)\n", pci_dev->bar5);
+        return -EIO;
+    }
+
+    pci_set_command_bits(pci_dev->bus, pci_dev->device, pci_dev->function,
+                         PCI_CMD_MEMORY_SPACE | PCI_CMD_BUS_MASTER);
+    pci_clear_command_bits(pci_dev->bus, pci_dev->device, pci_dev->function, PCI_CMD_INTERRUPT_DISABLE);
+
+    map_virtual_memory(abar, sizeof(struct ahci_hba_mem), PAGE_FLAG_PRESENT | PAGE_FLAG_WRITE, kernel_pml4);
+    controller->hba = (volatile struct ahci_hba_mem *)phys_to_virt(abar);
+
+    controller->hba->ghc |= AHCI_GHC_AE;
+    controller->cap       = controller->hba->cap;
+
+    // Interrupt line (low byte of config dword 0x3C)
+    uint8_t irq_line = (uint8_t)(pci_read(pci_dev->bus, pci_dev->device, pci_dev->function, PCI_REG_INTERRUPT_PIN)
+                                 & 0xFF);
+    if (irq_line > 2 && irq_line <= AHCI_MAX_ROUTED_IRQ) {
+        controller->irq_no = irq_line;
+        irq_register_routine(irq_line, ahci_irq_routine, controller);
+    } else {
+        kout(KERNEL_WARN, "AHCI: interrupt line %u isn't routed; completions will be polled\n", (uint32_t)irq_line);
+    }
+
+    controller->hba->is = 0xFFFFFFFF;
+
+    kout(KERNEL_INFO, "AHCI: version %x, %u command slots, NCQ %s, 64-bit %s\n", controller->hba->vs,
+         AHCI_CAP_NCS(controller->cap), (controller->cap & AHCI_CAP_SNCQ) ? "yes" : "no",
+         (controller->cap & AHCI_CAP_S64A) ? "yes" : "no");
+
+    // Interrupts have to be on before IDENTIFY so waiters can find out whether they may halt
+    controller->hba->ghc |= AHCI_GHC_IE;
+
+    uint32_t pi = controller->hba->pi;
+    int found   = 0;
+    for (int i = 0; i < AHCI_MAX_PORTS; i++) {
+        if ((pi & (1U << i)) && ahci_port_init(controller, i) == 0) {
+            found++;
+        }
+    }
+
+    kout(KERNEL_INFO, "AHCI: %d drive(s) attached\n", found);
+
+    return 0;
+}
+
+#endif // __KERNEL_SUPPORT_DEV_STORAGE_SATA_AHCI
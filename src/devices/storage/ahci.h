@@ -0,0 +1,267 @@
+/**
+ * @file ahci.h
+ * @brief AHCI SATA Support Header
+ *
+ * Header file for AHCI SATA host controller support. Requires PCI and ATA support.
+ *
+ * @pre PCI support
+ * @pre ATA support
+ */
+
+#pragma once
+
+#include "devices/manager.h"
+
+#ifdef __KERNEL_SUPPORT_DEV_STORAGE_SATA_AHCI
+
+# ifndef __KERNEL_SUPPORT_DEV_PCI
+#  error "AHCI support requires PCI support to be enabled"
+# else
+#  include "devices/pci/pci.h"
+# endif
+
+# ifndef __KERNEL_SUPPORT_DEV_STORAGE_ATA
+#  error "AHCI support requires storage ATA support to be enabled"
+# else
+#  include "ata/ata.h"
+# endif
+
+# include "drive.h"
+# include "lib/lock.h"
+
+# include <stdatomic.h>
+# include <stdbool.h>
+# include <stddef.h>
+# include <stdint.h>
+
+// https://wiki.osdev.org/AHCI
+// Serial ATA AHCI 1.3.1 Specification
+
+# define AHCI_MAX_PORTS 32
+# define AHCI_MAX_SLOTS 32
+
+// Each command table is one page: 128 bytes of FIS/ATAPI/reserved space followed by the PRDT
+# define AHCI_CMD_TABLE_SIZE 4096
+# define AHCI_PRDT_ENTRIES   ((AHCI_CMD_TABLE_SIZE - 0x80) / sizeof(struct ahci_prdt_entry))
+# define AHCI_PRD_MAX_BYTES  (4 * 1024 * 1024)
+
+// Large requests are split into commands of at most this size, which are all queued at once (NCQ)
+# define AHCI_MAX_BYTES_PER_COMMAND (128 * 1024)
+
+# define AHCI_CMD_TIMEOUT_MS 5000
+
+/**
+ * Generic host control (GHC) registers
+ */
+# define AHCI_CAP_S64A     (1U << 31)                    // 64-bit addressing
+# define AHCI_CAP_SNCQ     (1U << 30)                    // Native command queuing
+# define AHCI_CAP_NCS(cap) ((((cap) >> 8) & 0x1F) + 1) // Number of command slots
+
+# define AHCI_GHC_HR (1U << 0)  // HBA reset
+# define AHCI_GHC_IE (1U << 1)  // Interrupt enable
+# define AHCI_GHC_AE (1U << 31) // AHCI enable
+
+/**
+ * Port registers
+ */
+# define AHCI_PXCMD_ST  (1U << 0)  // Start
+# define AHCI_PXCMD_FRE (1U << 4)  // FIS receive enable
+# define AHCI_PXCMD_FR  (1U << 14) // FIS receive running
+# define AHCI_PXCMD_CR  (1U << 15) // Command list running
+
+# define AHCI_PXIS_DHRS (1U << 0)  // Device to host register FIS
+# define AHCI_PXIS_PSS  (1U << 1)  // PIO setup FIS
+# define AHCI_PXIS_DSS  (1U << 2)  // DMA setup FIS
+# define AHCI_PXIS_SDBS (1U << 3)  // Set device bits FIS (NCQ completions)
+# define AHCI_PXIS_DPS  (1U << 5)  // Descriptor processed
+# define AHCI_PXIS_IFS  (1U << 27) // Interface fatal error
+# define AHCI_PXIS_HBDS (1U << 28) // Host bus data error
+# define AHCI_PXIS_HBFS (1U << 29) // Host bus fatal error
+# define AHCI_PXIS_TFES (1U << 30) // Task file error
+
+# define AHCI_PXIS_ERRORS (AHCI_PXIS_IFS | AHCI_PXIS_HBDS | AHCI_PXIS_HBFS | AHCI_PXIS_TFES)
+
+# define AHCI_PXSSTS_DET_PRESENT 0x3
+# define AHCI_PXSSTS_IPM_ACTIVE  0x1
+
+# define AHCI_SIG_ATA   0x00000101
+# define AHCI_SIG_ATAPI 0xEB140101
+
+/**
+ * FIS types
+ */
+# define AHCI_FIS_TYPE_REG_H2D 0x27
+
+/**
+ * ATA commands used over AHCI (besides the ones in ata.h)
+ */
+# define ATA_CMD_READ_FPDMA_QUEUED  0x60
+# define ATA_CMD_WRITE_FPDMA_QUEUED 0x61
+
+struct ahci_hba_port {
+    uint32_t clb;  // Command list base (1K aligned)
+    uint32_t clbu;
+    uint32_t fb;   // FIS base (256 byte aligned)
+    uint32_t fbu;
+    uint32_t is;   // Interrupt status
+    uint32_t ie;   // Interrupt enable
+    uint32_t cmd;  // Command and status
+    uint32_t rsv0;
+    uint32_t tfd;  // Task file data
+    uint32_t sig;  // Signature
+    uint32_t ssts; // SATA status
+    uint32_t sctl; // SATA control
+    uint32_t serr; // SATA error
+    uint32_t sact; // SATA active (NCQ)
+    uint32_t ci;   // Command issue
+    uint32_t sntf;
+    uint32_t fbs;
+    uint32_t rsv1[11];
+    uint32_t vendor[4];
+};
+
+struct ahci_hba_mem {
+    uint32_t cap;
+    uint32_t ghc;
+    uint32_t is;
+    uint32_t pi; // Ports implemented
+    uint32_t vs;
+    uint32_t ccc_ctl;
+    uint32_t ccc_pts;
+    uint32_t em_loc;
+    uint32_t em_ctl;
+    uint32_t cap2;
+    uint32_t bohc;
+
+    uint8_t rsv[0xA0 - 0x2C];
+    uint8_t vendor[0x100 - 0xA0];
+
+    struct ahci_hba_port ports[AHCI_MAX_PORTS];
+};
+
+struct ahci_cmd_header {
+    uint8_t cfl      : 5; // Command FIS length in dwords
+    uint8_t atapi    : 1;
+    uint8_t write    : 1; // 1 = host to device
+    uint8_t prefetch : 1;
+
+    uint8_t reset : 1;
+    uint8_t bist  : 1;
+    uint8_t clear : 1; // Clear busy upon R_OK
+    uint8_t rsv0  : 1;
+    uint8_t pmp   : 4;
+
+    uint16_t prdtl; // PRDT entries
+
+    volatile uint32_t prdbc; // Bytes transferred
+
+    uint32_t ctba; // Command table base (128 byte aligned)
+    uint32_t ctbau;
+
+    uint32_t rsv1[4];
+} __attribute__((packed));
+
+struct ahci_prdt_entry {
+    uint32_t dba; // Data base address (word aligned)
+    uint32_t dbau;
+    uint32_t rsv0;
+
+    uint32_t dbc  : 22; // Byte count - 1 (bit 0 must be set; max 4 MiB)
+    uint32_t rsv1 : 9;
+    uint32_t i    : 1; // Interrupt on completion
+} __attribute__((packed));
+
+struct ahci_cmd_table {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t rsv[48];
+
+    struct ahci_prdt_entry prdt[];
+} __attribute__((packed));
+
+struct ahci_fis_reg_h2d {
+    uint8_t fis_type;
+
+    uint8_t pmport : 4;
+    uint8_t rsv0   : 3;
+    uint8_t c      : 1; // 1 = command, 0 = control
+
+    uint8_t command;
+    uint8_t featurel;
+
+    uint8_t lba0;
+    uint8_t lba1;
+    uint8_t lba2;
+    uint8_t device;
+
+    uint8_t lba3;
+    uint8_t lba4;
+    uint8_t lba5;
+    uint8_t featureh;
+
+    uint8_t countl;
+    uint8_t counth;
+    uint8_t icc;
+    uint8_t control;
+
+    uint8_t rsv1[4];
+} __attribute__((packed));
+
+struct ahci_controller;
+
+struct ahci_slot {
+    atomic_bool done;
+    int result; // 0 or a negative errno; valid once done is set
+    atomic_int waiter_core;
+};
+
+struct ahci_port {
+    struct ahci_controller *controller;
+    volatile struct ahci_hba_port *regs;
+    int port_no;
+
+    bool ncq;           // Both the HBA and the device support NCQ
+    uint32_t slot_mask;  // Usable command slots
+    uint32_t slot_count; // Bits set in slot_mask
+
+    struct ahci_cmd_header *cmd_list;
+    struct ahci_cmd_table *cmd_tables[AHCI_MAX_SLOTS];
+
+    // Slots handed out to callers, and the subset that has been written to PxCI/PxSACT
+    atomic_uint slots_allocated;
+    atomic_uint slots_issued;
+    struct ahci_slot slots[AHCI_MAX_SLOTS];
+
+    // Completions are reaped by whoever holds reap_lock; anyone who finds it taken sets reap_pending instead, so the
+    // holder goes round again (the IRQ handler can't spin on it)
+    atomic_flag reap_lock;
+    atomic_bool reap_pending;
+    atomic_bool needs_recovery;
+
+    union {
+        uint16_t identify_raw[256];
+        struct ata_identify identify;
+    };
+
+    struct DRIVE drive;
+};
+
+struct ahci_controller {
+    volatile struct ahci_hba_mem *hba;
+    uint32_t cap;
+    uint8_t irq_no; // 0xFF = no usable IRQ; completions are then polled
+
+    // Set by the IRQ handler the first time it runs; until then waiters poll instead of halting
+    atomic_bool irq_seen;
+
+    struct ahci_port *ports[AHCI_MAX_PORTS];
+};
+
+// pci_dev is only used during initialization (pci_scan() passes a temporary)
+int ahci_init(struct ahci_controller *controller, pci_device_t *pci_dev);
+
+ssize_t ahci_read_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, void *buffer);
+ssize_t ahci_write_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, const void *buffer);
+int ahci_flush_cache_func(DRIVE_t *drive);
+
+#endif // __KERNEL_SUPPORT_DEV_STORAGE_SATA_AHCI
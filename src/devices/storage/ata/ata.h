@@ -26,7 +26,11 @@ extern struct ide_device;
 
 #define ATA_CMD_IDENTIFY        0xEC
 #define ATA_CMD_IDENTIFY_PACKET 0xA1
-#define ATA_CMD_READ_SECTORS    0x24
+#define ATA_CMD_READ_SECTORS    0x24 // READ SECTORS EXT (LBA48)
+#define ATA_CMD_WRITE_SECTORS   0x34 // WRITE SECTORS EXT (LBA48)
+#define ATA_CMD_READ_DMA        0x25 // READ DMA EXT (LBA48)
+#define ATA_CMD_WRITE_DMA       0x35 // WRITE DMA EXT (LBA48)
+#define ATA_CMD_CACHE_FLUSH     0xEA // FLUSH CACHE EXT
 
 #define ATA_CMD_PACKET 0xA0
 
@@ -137,7 +141,7 @@ struct ata_info {
 };
 
 struct atapi_info {
-    // ATAPI specific info can go here
+    struct atapi_readahead *readahead; // NULL if there is no medium (or no memory); reads then go straight to the drive
 };
 
 int ata_parse_identify(struct ide_device *dev);
@@ -151,6 +155,7 @@ ssize_t atapi_write_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, c
 
 ssize_t pata_read_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, void *buffer);
 ssize_t pata_write_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, const void *buffer);
+int pata_flush_cache_func(DRIVE_t *drive);
 
 int atapi_ready_device(struct ide_device *dev);
 
@@ -7,6 +7,8 @@
 #include "devices/storage/ide.h"
 #include "lib/stdio.h"
 #include "memory/kmalloc.h"
+#include "plenjos/errno.h"
+#include "proc/scheduler.h"
 
 #include <stdatomic.h>
 #include <stdbool.h>
@@ -24,24 +26,12 @@ int atapi_parse_identify(struct ide_device *dev) {
 // Make sure to select the device and lock the bus first!
 int atapi_send_packet_command(struct ide_device *dev, const uint8_t *packet, size_t packet_len, void *buffer,
                               size_t buffer_len, int is_write, int is_dma) {
-    int res = 0;
+    int res          = 0;
+    bool dma_started = false;
+    size_t offset    = 0; // Bytes moved so far by PIO
 
-    bool interrupts_were_enabled = are_interrupts_enabled();
-
-    uint32_t *prev_low_dwords = NULL;
-
-    if (!interrupts_were_enabled) {
-        if (dev->drive.irq != (uint32_t)-1) {
-            prev_low_dwords = kmalloc_heap(sizeof(uint32_t) * 128);
-            if (!prev_low_dwords) {
-                kout(KERNEL_SEVERE_FAULT, "OOM Error: unable to allocate memory for IOAPIC masks backup\n");
-                return -1;
-            }
-            ioapic_mask_all_except(dev->drive.irq, prev_low_dwords, 128);
-        }
-
-        asm volatile("sti");
-    }
+    struct ide_irq_window window;
+    ide_irq_window_open(&window);
 
     // Implementation to send ATAPI PACKET command with the given packet
     if (packet_len % 2) {
@@ -63,6 +53,14 @@ int atapi_send_packet_command(struct ide_device *dev, const uint8_t *packet, siz
         goto cleanup;
     }
 
+    if (is_dma) {
+        // -EINVAL here means the buffer can't be used for DMA; callers fall back to PIO
+        res = ide_dma_prepare(dev, buffer, buffer_len, is_write);
+        if (res != 0) {
+            goto cleanup;
+        }
+    }
+
     outb(dev->channel->cmd_base + ATA_REG_FEATURES, is_dma ? 0x01 : 0x00); // Enable DMA if is_dma
 
     // Sectorcount and LBA low registers are currently unused. Send max_byte_count in LBA mid and high.
@@ -125,9 +123,16 @@ int atapi_send_packet_command(struct ide_device *dev, const uint8_t *packet, siz
         outw(dev->channel->cmd_base + ATA_REG_DATA, word);
     }
 
+    if (is_dma) {
+        ide_dma_start(dev);
+        dma_started = true;
+    }
+
     while (true) {
-        // TODO: timeout?
-        ide_wait_for_irq(dev);
+        if (ide_wait_for_irq(dev) != 0) {
+            res = -1;
+            goto cleanup;
+        }
 
         uint8_t status = atomic_load_explicit(&dev->channel->last_status, memory_order_acquire);
 
@@ -144,7 +149,8 @@ int atapi_send_packet_command(struct ide_device *dev, const uint8_t *packet, siz
         }
 
         if (is_dma) {
-            // Transfer complete
+            // Transfer complete (a DMA command only raises one IRQ)
+            ide_take_irq_status(dev);
             break;
         }
 
@@ -158,38 +164,33 @@ int atapi_send_packet_command(struct ide_device *dev, const uint8_t *packet, siz
             kout(KERNEL_WARN, "Warning: ATAPI device reported odd byte count (%d); ignoring last byte\n", bytecount);
         }
 
-        if (wordcount > 0) {
+        // Consume the completion before moving the data, because the last word of the block can raise the next IRQ
+        ide_take_irq_status(dev);
+
+        // Large transfers arrive in several DRQ blocks; each one continues where the previous one stopped
+        size_t buffer_words = wordcount;
+        if (buffer_words * 2 > buffer_len - offset) {
+            buffer_words = (buffer_len - offset) / 2;
+        }
+
+        if (buffer_words > 0) {
             if (is_write) {
                 // Write data to device
-                for (uint16_t i = 0; i < wordcount; i++) {
-                    // Delay this as long as possible to give us the best chance at detecting overlapping IRQs, but it
-                    // must ultimately be called before the last word is transfered, because the last word can trigger
-                    // another IRQ letting us know that we are done, and not calling this before that would lead to a
-                    // false positive.
-                    if (i == wordcount - 1) {
-                        atomic_fetch_sub_explicit(&dev->channel->irq_cnt, 1, memory_order_release);
-                    }
-
-                    uint16_t word = ((uint16_t *)buffer)[i];
-                    outw(dev->channel->cmd_base + ATA_REG_DATA, word);
-                }
+                outsw(dev->channel->cmd_base + ATA_REG_DATA, (uint8_t *)buffer + offset, buffer_words);
             } else {
                 // Read data from device
-                for (uint16_t i = 0; i < wordcount; i++) {
-                    // Delay this as long as possible to give us the best chance at detecting overlapping IRQs, but it
-                    // must ultimately be called before the last word is transfered, because the last word can trigger
-                    // another IRQ letting us know that we are done, and not calling this before that would lead to a
-                    // false positive.
-                    if (i == wordcount - 1) {
-                        atomic_fetch_sub_explicit(&dev->channel->irq_cnt, 1, memory_order_release);
-                    }
-
-                    uint16_t word           = inw(dev->channel->cmd_base + ATA_REG_DATA);
-                    ((uint16_t *)buffer)[i] = word;
-                }
+                insw(dev->channel->cmd_base + ATA_REG_DATA, (uint8_t *)buffer + offset, buffer_words);
+            }
+            offset += buffer_words * 2;
+        }
+
+        // The device wants more than fits in the buffer; drain (or pad) the rest so the command can complete
+        for (size_t i = buffer_words; i < wordcount; i++) {
+            if (is_write) {
+                outw(dev->channel->cmd_base + ATA_REG_DATA, 0);
+            } else {
+                (void)inw(dev->channel->cmd_base + ATA_REG_DATA);
             }
-        } else {
-            atomic_fetch_sub_explicit(&dev->channel->irq_cnt, 1, memory_order_release);
         }
     }
 
@@ -197,22 +198,57 @@ int atapi_send_packet_command(struct ide_device *dev, const uint8_t *packet, siz
     atomic_store_explicit(&dev->channel->irq_cnt, 0, memory_order_release);
 
 cleanup:
-    if (interrupts_were_enabled == 0) {
-        asm volatile("cli");
+    if (dma_started) {
+        int dma_res = ide_dma_finish(dev);
+        if (res == 0) {
+            res = dma_res;
+        }
     }
 
-    if (prev_low_dwords) {
-        ioapic_restore_masks(prev_low_dwords, 128);
-        kfree_heap(prev_low_dwords);
-    }
+    ide_irq_window_close(&window);
     return res;
 }
 
+static struct atapi_readahead *atapi_readahead_create(struct ide_device *dev) {
+    if (dev->logical_sector_size == 0 || dev->logical_sector_size > ATAPI_READAHEAD_WINDOW_BYTES
+        || (dev->logical_sector_size % 2) != 0) {
+        return NULL;
+    }
+
+    struct atapi_readahead *ra = kmalloc_heap(sizeof(struct atapi_readahead));
+    if (!ra) {
+        kout(KERNEL_WARN, "Warning: could not allocate ATAPI read-ahead state; reads will not be buffered\n");
+        return NULL;
+    }
+    memset(ra, 0, sizeof(struct atapi_readahead));
+
+    ra->dev  = dev;
+    ra->lock = MUTEX_INIT;
+
+    for (int i = 0; i < ATAPI_READAHEAD_WINDOWS; i++) {
+        ra->windows[i].ra   = ra;
+        ra->windows[i].data = kmalloc_heap(ATAPI_READAHEAD_WINDOW_BYTES);
+        if (!ra->windows[i].data) {
+            kout(KERNEL_WARN, "Warning: could not allocate ATAPI read-ahead window; reads will not be buffered\n");
+            for (int j = 0; j < i; j++) {
+                kfree_heap(ra->windows[j].data);
+            }
+            kfree_heap(ra);
+            return NULL;
+        }
+        atomic_init(&ra->windows[i].state, ATAPI_WINDOW_EMPTY);
+    }
+
+    return ra;
+}
+
 // We don't strictly need to lock the bus here; this is called during initialization. However, our select function does
 // it anyways.
 int atapi_ready_device(struct ide_device *dev) {
     // Implementation to ready the ATAPI device (e.g., check status, wait for readiness)
 
+    dev->atapi_info.readahead = NULL;
+
     int res = ide_select_bus(dev);
 
     if (res != 0) {
@@ -288,6 +324,8 @@ int atapi_ready_device(struct ide_device *dev) {
         dev->logical_sector_size  = block_size;
         dev->physical_sector_size = block_size;
         dev->numsectors           = (uint64_t)(max_lba + 1);
+
+        dev->atapi_info.readahead = atapi_readahead_create(dev);
     }
 
 finally:
@@ -301,52 +339,234 @@ finally:
     return res;
 }
 
-ssize_t atapi_read_sectors_func(struct DRIVE *drive, uint64_t lba, size_t sectors, void *buffer) {
-    struct ide_device *dev = (struct ide_device *)drive->internal_data;
-
-    if (!dev) {
-        kout(KERNEL_SEVERE_FAULT, "Error: DRIVE internal_data is NULL in atapi_read_sectors_func\n");
-        return -1;
-    }
-
-    if (sectors == 0) {
-        return 0;
-    }
-
+// Reads straight from the drive with a single READ(12)
+static int atapi_read_direct(struct ide_device *dev, uint64_t lba, size_t sectors, void *buffer) {
     int res = ide_select_bus(dev);
     if (res != 0) {
         kout(KERNEL_EXTERNAL_FAULT, "Error: could not select bus for ATAPI device\n");
-        return -1;
+        return -EIO;
     }
 
-    uint32_t bytes_per_sector = drive->logical_sector_size;
-    size_t total_bytes        = sectors * bytes_per_sector;
-    uint32_t sector_count     = (uint32_t)sectors;
+    size_t total_bytes    = sectors * dev->logical_sector_size;
+    uint32_t sector_count = (uint32_t)sectors;
 
-    // Construct READ(10) packet
-    uint8_t read_packet[12] = { ATAPI_COMMAND_READ_10,
+    // Construct READ(12) packet; unlike READ(10), the transfer length is 32 bits
+    uint8_t read_packet[12] = { ATAPI_COMMAND_READ_12,
                                 0,
                                 (uint8_t)((lba >> 24) & 0xFF),
                                 (uint8_t)((lba >> 16) & 0xFF),
                                 (uint8_t)((lba >> 8) & 0xFF),
                                 (uint8_t)(lba & 0xFF),
-                                0,
+                                (uint8_t)((sector_count >> 24) & 0xFF),
+                                (uint8_t)((sector_count >> 16) & 0xFF),
                                 (uint8_t)((sector_count >> 8) & 0xFF),
                                 (uint8_t)(sector_count & 0xFF),
                                 0,
-                                0,
                                 0 };
 
-    // printf("ATAPI READ(10): LBA=%p, Sector Count=%u, Total Bytes=%lu\n", (void *)lba, sector_count, total_bytes);
-    res = atapi_send_packet_command(dev, read_packet, sizeof(read_packet), buffer, total_bytes, 0, 0);
+    res = -EINVAL;
+    if (ide_dma_usable(dev, total_bytes)) {
+        res = atapi_send_packet_command(dev, read_packet, sizeof(read_packet), buffer, total_bytes, 0, 1);
+    }
+    if (res == -EINVAL) {
+        // Small transfer, no DMA support, or a buffer the bus master can't reach
+        res = atapi_send_packet_command(dev, read_packet, sizeof(read_packet), buffer, total_bytes, 0, 0);
+    }
 
     ide_unlock_bus(dev);
 
     if (res != 0) {
-        kout(KERNEL_EXTERNAL_FAULT, "Error: READ(10) command failed for ATAPI device (reading from lba %p, %lu sectors)\n", (void *)lba,
-               sectors);
+        kout(KERNEL_EXTERNAL_FAULT,
+             "Error: READ(12) command failed for ATAPI device (reading from lba %p, %lu sectors)\n", (void *)lba,
+             sectors);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+// Reads the window's range from the drive; the caller has moved it to FILLING. Returns the drive's result, since once
+// the window is VALID another reader may reclaim it at any time.
+static int atapi_window_fill(struct atapi_window *window) {
+    struct atapi_readahead *ra = window->ra;
+
+    int res = atapi_read_direct(ra->dev, window->lba, window->sectors, window->data);
+
+    mutex_lock(&ra->lock);
+    atomic_store_explicit(&window->state, res == 0 ? ATAPI_WINDOW_VALID : ATAPI_WINDOW_EMPTY, memory_order_release);
+    mutex_unlock(&ra->lock);
+
+    return res;
+}
+
+static void atapi_readahead_task(void *arg) {
+    struct atapi_window *window = (struct atapi_window *)arg;
+    struct atapi_readahead *ra  = window->ra;
+
+    // A reader may have needed the window first and filled it itself
+    mutex_lock(&ra->lock);
+    if (atomic_load_explicit(&window->state, memory_order_relaxed) != ATAPI_WINDOW_QUEUED) {
+        mutex_unlock(&ra->lock);
+        return;
+    }
+    atomic_store_explicit(&window->state, ATAPI_WINDOW_FILLING, memory_order_relaxed);
+    mutex_unlock(&ra->lock);
+
+    atapi_window_fill(window);
+}
+
+// Call with ra->lock held. Returns the window containing lba, if any.
+static struct atapi_window *atapi_readahead_find(struct atapi_readahead *ra, uint64_t lba) {
+    for (int i = 0; i < ATAPI_READAHEAD_WINDOWS; i++) {
+        struct atapi_window *window = &ra->windows[i];
+        if (atomic_load_explicit(&window->state, memory_order_relaxed) != ATAPI_WINDOW_EMPTY && window->lba <= lba
+            && lba < window->lba + window->sectors) {
+            return window;
+        }
+    }
+    return NULL;
+}
+
+// Call with ra->lock held. Picks the least recently used window that isn't being filled (or queued), except skip.
+static struct atapi_window *atapi_readahead_victim(struct atapi_readahead *ra, struct atapi_window *skip) {
+    struct atapi_window *victim = NULL;
+    for (int i = 0; i < ATAPI_READAHEAD_WINDOWS; i++) {
+        struct atapi_window *window = &ra->windows[i];
+        int state                   = atomic_load_explicit(&window->state, memory_order_relaxed);
+        if (window == skip || state == ATAPI_WINDOW_QUEUED || state == ATAPI_WINDOW_FILLING) {
+            continue;
+        }
+        if (!victim || window->last_used < victim->last_used) {
+            victim = window;
+        }
+    }
+    return victim;
+}
+
+// Call with ra->lock held. Claims a window for [lba, lba + window size), clamped to the end of the disc.
+static void atapi_readahead_claim(struct atapi_readahead *ra, struct atapi_window *window, uint64_t lba, int state) {
+    uint64_t window_sectors = ATAPI_READAHEAD_WINDOW_BYTES / ra->dev->logical_sector_size;
+    if (window_sectors > ra->dev->numsectors - lba) {
+        window_sectors = ra->dev->numsectors - lba;
+    }
+
+    window->lba       = lba;
+    window->sectors   = (uint32_t)window_sectors;
+    window->last_used = ++ra->use_clock;
+    atomic_store_explicit(&window->state, state, memory_order_relaxed);
+}
+
+static int atapi_readahead_read(struct atapi_readahead *ra, uint64_t lba, size_t sectors, uint8_t *buffer) {
+    uint32_t bytes_per_sector = ra->dev->logical_sector_size;
+
+    while (sectors > 0) {
+        mutex_lock(&ra->lock);
+
+        struct atapi_window *window = atapi_readahead_find(ra, lba);
+        int state = window ? atomic_load_explicit(&window->state, memory_order_relaxed) : ATAPI_WINDOW_EMPTY;
+
+        if (state == ATAPI_WINDOW_VALID) {
+            size_t n = window->lba + window->sectors - lba;
+            if (n > sectors) {
+                n = sectors;
+            }
+
+            memcpy(buffer, window->data + (lba - window->lba) * bytes_per_sector, n * bytes_per_sector);
+            window->last_used = ++ra->use_clock;
+
+            lba     += n;
+            buffer  += n * bytes_per_sector;
+            sectors -= n;
+
+            // Past the middle of the window: fetch the next one unless it's already there (or on its way)
+            uint64_t next_lba         = window->lba + window->sectors;
+            struct atapi_window *next = NULL;
+            bool queue_prefetch       = false;
+            if (lba >= window->lba + window->sectors / 2 && next_lba < ra->dev->numsectors
+                && !atapi_readahead_find(ra, next_lba)) {
+                next = atapi_readahead_victim(ra, window);
+                if (next) {
+                    atapi_readahead_claim(ra, next, next_lba, ATAPI_WINDOW_QUEUED);
+                    queue_prefetch = true;
+                }
+            }
+
+            mutex_unlock(&ra->lock);
+
+            if (queue_prefetch && delegate_kernel_task(atapi_readahead_task, next) != 0) {
+                // No room for the task; drop the prefetch, a reader will fill the window when it gets there
+                mutex_lock(&ra->lock);
+                if (atomic_load_explicit(&next->state, memory_order_relaxed) == ATAPI_WINDOW_QUEUED) {
+                    atomic_store_explicit(&next->state, ATAPI_WINDOW_EMPTY, memory_order_relaxed);
+                }
+                mutex_unlock(&ra->lock);
+            }
+            continue;
+        }
+
+        if (state == ATAPI_WINDOW_FILLING) {
+            // Someone else is already reading it
+            mutex_unlock(&ra->lock);
+            while (atomic_load_explicit(&window->state, memory_order_acquire) == ATAPI_WINDOW_FILLING) {
+                asm volatile("pause");
+            }
+            continue;
+        }
+
+        if (state == ATAPI_WINDOW_QUEUED) {
+            // The prefetch hasn't started yet; don't wait for a core to pick it up
+            atomic_store_explicit(&window->state, ATAPI_WINDOW_FILLING, memory_order_relaxed);
+        } else {
+            window = atapi_readahead_victim(ra, NULL);
+            if (!window) {
+                // Every window is busy; this read goes straight to the drive
+                mutex_unlock(&ra->lock);
+                return atapi_read_direct(ra->dev, lba, sectors, buffer);
+            }
+            atapi_readahead_claim(ra, window, lba, ATAPI_WINDOW_FILLING);
+        }
+
+        mutex_unlock(&ra->lock);
+
+        // The next pass copies out of the window under the lock, or fills it again if it was reclaimed meanwhile
+        int res = atapi_window_fill(window);
+        if (res != 0) {
+            return res;
+        }
+    }
+
+    return 0;
+}
+
+ssize_t atapi_read_sectors_func(struct DRIVE *drive, uint64_t lba, size_t sectors, void *buffer) {
+    struct ide_device *dev = (struct ide_device *)drive->internal_data;
+
+    if (!dev) {
+        kout(KERNEL_SEVERE_FAULT, "Error: DRIVE internal_data is NULL in atapi_read_sectors_func\n");
+        return -1;
+    }
+
+    if (sectors == 0) {
+        return 0;
+    }
+
+    if (lba >= dev->numsectors || sectors > dev->numsectors - lba || lba > UINT32_MAX || sectors > UINT32_MAX) {
+        return -EINVAL;
+    }
+
+    size_t total_bytes         = sectors * drive->logical_sector_size;
+    struct atapi_readahead *ra = dev->atapi_info.readahead;
+
+    int res;
+    if (ra && total_bytes <= ATAPI_READAHEAD_WINDOW_BYTES) {
+        res = atapi_readahead_read(ra, lba, sectors, (uint8_t *)buffer);
+    } else {
+        res = atapi_read_direct(dev, lba, sectors, buffer);
+    }
+
+    if (res != 0) {
         return -1;
     }
 
     return (ssize_t)total_bytes;
-}
\ No newline at end of file
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include "lib/lock.h"
+
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -14,7 +17,7 @@ extern struct ide_device;
  *  3. TEST UNIT READY to check if media is present (loop until ready or failure)
  *  4. REQUEST SENSE if TEST UNIT READY fails, to get error details
  *  5. READ CAPACITY (10) to get last LBA and block size
- *  6. READ (10) to read data blocks
+ *  6. READ (10) / READ (12) to read data blocks
  */
 
 // Identify device type and capabilities
@@ -31,6 +34,7 @@ extern struct ide_device;
 
 // Read data blocks from the disc
 #define ATAPI_COMMAND_READ_10 0x28 // 28h 00h lba[4] 00h count[2] 00h
+#define ATAPI_COMMAND_READ_12 0xA8 // A8h 00h lba[4] count[4] 00h 00h
 
 // Spin up / spin down disc (required for some drives)
 #define ATAPI_COMMAND_START_STOP_UNIT 0x1B // 1Bh 00h 00h 00h 00h 00h
@@ -38,6 +42,44 @@ extern struct ide_device;
 // Read drive parameters (rarely needed)
 #define ATAPI_COMMAND_MODE_SENSE_10 0x5A // 5Ah 00h 00h 00h 00h 00h 00h 00h 20h 00h
 
+/**
+ * Read-ahead. Discs are read in windows of ATAPI_READAHEAD_WINDOW_BYTES, and reads no larger than a window are served
+ * from them. Once a reader gets past the middle of a window, the next window is fetched by a kernel task, so a
+ * sequential reader (e.g. iso9660 loading a file one block at a time) mostly copies from memory while the drive streams
+ * ahead. Larger reads go straight to the drive.
+ */
+#define ATAPI_READAHEAD_WINDOW_BYTES (64 * 1024)
+#define ATAPI_READAHEAD_WINDOWS      2
+
+enum atapi_window_state {
+    ATAPI_WINDOW_EMPTY,
+    ATAPI_WINDOW_QUEUED,  // Claimed for a prefetch that hasn't started yet; a reader that needs it may fill it instead
+    ATAPI_WINDOW_FILLING, // Being read; wait for it
+    ATAPI_WINDOW_VALID,
+};
+
+struct atapi_readahead;
+
+struct atapi_window {
+    struct atapi_readahead *ra;
+
+    atomic_int state;
+    uint64_t lba;
+    uint32_t sectors;
+    uint64_t last_used;
+
+    uint8_t *data;
+};
+
+struct atapi_readahead {
+    struct ide_device *dev;
+
+    // Protects everything in the windows except the contents of data while a window is FILLING
+    mutex lock;
+    uint64_t use_clock;
+    struct atapi_window windows[ATAPI_READAHEAD_WINDOWS];
+};
+
 // Make sure to select the device and lock the bus first!
 int atapi_send_packet_command(struct ide_device *dev, const uint8_t *packet, size_t packet_len, void *buffer,
                               size_t buffer_len, int is_write, int is_dma);
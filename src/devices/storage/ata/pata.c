@@ -7,6 +7,7 @@
 #include "devices/storage/ide.h"
 #include "lib/stdio.h"
 #include "memory/kmalloc.h"
+#include "plenjos/errno.h"
 #include "timer/pit.h"
 
 #include <stdatomic.h>
@@ -18,25 +19,77 @@
  * Read data from PATA device
  */
 void pata_read_data(struct ide_device *dev, void *buffer, size_t bytes) {
-    // Implementation to read data from PATA device
-    size_t word_count = bytes / 2;
-    
-    for (size_t i = 0; i < word_count; i++) {
-        uint16_t word = inw(dev->channel->cmd_base + ATA_REG_DATA);
-        ((uint16_t *)buffer)[i] = word;
-    }
+    insw(dev->channel->cmd_base + ATA_REG_DATA, buffer, bytes / 2);
 }
 
 /**
  * Write data to PATA device
  */
 void pata_write_data(struct ide_device *dev, const void *buffer, size_t bytes) {
-    // Implementation to write data to PATA device
-    size_t word_count = bytes / 2;
-    
-    for (size_t i = 0; i < word_count; i++) {
-        outw(dev->channel->cmd_base + ATA_REG_DATA, ((uint16_t *)buffer)[i]);
+    outsw(dev->channel->cmd_base + ATA_REG_DATA, buffer, bytes / 2);
+}
+
+// Max sectors per READ/WRITE SECTORS EXT command; the count register is 16 bits wide but we keep each command short so
+// the bus isn't held for too long
+#define PATA_MAX_SECTORS_PER_COMMAND 256
+
+// Loads the LBA48 task file (high bytes first, then low bytes) and issues cmd
+static void pata_issue_lba48(struct ide_device *dev, uint64_t lba, uint32_t sector_count, uint8_t cmd) {
+    uint16_t io = dev->channel->cmd_base;
+
+    outb(io + ATA_REG_SECCOUNT, (uint8_t)((sector_count >> 8) & 0xFF));
+    outb(io + ATA_REG_LBA0, (uint8_t)((lba >> 24) & 0xFF));
+    outb(io + ATA_REG_LBA1, (uint8_t)((lba >> 32) & 0xFF));
+    outb(io + ATA_REG_LBA2, (uint8_t)((lba >> 40) & 0xFF));
+
+    outb(io + ATA_REG_SECCOUNT, (uint8_t)(sector_count & 0xFF));
+    outb(io + ATA_REG_LBA0, (uint8_t)(lba & 0xFF));
+    outb(io + ATA_REG_LBA1, (uint8_t)((lba >> 8) & 0xFF));
+    outb(io + ATA_REG_LBA2, (uint8_t)((lba >> 16) & 0xFF));
+
+    // The IRQ for this command must not be mistaken for a stale one
+    ide_prepare_irq(dev);
+
+    outb(io + ATA_REG_COMMAND, cmd);
+}
+
+static void pata_select_lba(struct ide_device *dev) {
+    outb(dev->channel->cmd_base + ATA_REG_HDDEVSEL, 0xA0 | 0x40 | (dev->drive_no << 4));
+    inb(dev->channel->ctrl_base); // 400ns delay
+    inb(dev->channel->ctrl_base);
+    inb(dev->channel->ctrl_base);
+    inb(dev->channel->ctrl_base);
+}
+
+// Runs one READ/WRITE DMA EXT command. Returns 0, -EINVAL if the buffer can't be used for DMA (the caller falls back to
+// PIO), or -EIO.
+static int pata_dma_transfer(struct ide_device *dev, uint64_t lba, uint32_t sector_count, void *buffer, bool write) {
+    size_t bytes = (size_t)sector_count * dev->drive.logical_sector_size;
+
+    int res = ide_dma_prepare(dev, buffer, bytes, write);
+    if (res != 0) {
+        return res;
     }
+
+    pata_issue_lba48(dev, lba, sector_count, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+    ide_dma_start(dev);
+
+    // A single IRQ for the whole command
+    if (ide_wait_for_irq(dev) != 0) {
+        ide_dma_finish(dev);
+        return -EIO;
+    }
+
+    uint8_t st = ide_take_irq_status(dev);
+    res        = ide_dma_finish(dev);
+
+    if (res != 0 || (st & (ATA_SR_ERR | ATA_SR_DF))) {
+        kout(KERNEL_EXTERNAL_FAULT, "PATA: DMA %s failed at lba %p (status %.2x)\n", write ? "write" : "read",
+             (void *)lba, st);
+        return -EIO;
+    }
+
+    return 0;
 }
 
 ssize_t pata_read_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, void *buffer) {
@@ -51,6 +104,10 @@ ssize_t pata_read_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, voi
         return 0;
     }
 
+    if (lba + sectors > drive->numsectors) {
+        return -EINVAL;
+    }
+
     // Lock bus
     int res = ide_select_bus(dev);
     if (res != 0) {
@@ -58,43 +115,208 @@ ssize_t pata_read_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, voi
         return -1;
     }
 
-    outb(dev->channel->cmd_base + ATA_REG_HDDEVSEL, 0xA0 | 0x40 | (dev->drive_no << 4));
-    inb(dev->channel->ctrl_base); // 400ns delay
-    inb(dev->channel->ctrl_base);
-    inb(dev->channel->ctrl_base);
-    inb(dev->channel->ctrl_base);
+    struct ide_irq_window window;
+    ide_irq_window_open(&window);
 
+    uint16_t io               = dev->channel->cmd_base;
     uint32_t bytes_per_sector = drive->logical_sector_size;
-    size_t total_bytes = sectors * bytes_per_sector;
-    uint32_t sector_count = (uint32_t)sectors;
+    uint8_t *out              = (uint8_t *)buffer;
+    size_t done               = 0;
 
-    // Construct READ(16) command
-    uint8_t read_cmd[16] = { ATA_CMD_IDENTIFY, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
-    
-    // Send READ(16) command with LBA and sector count
-    outb(dev->channel->cmd_base + ATA_REG_SECCOUNT, (uint8_t)((sector_count >> 8) & 0xFF));
-    outb(dev->channel->cmd_base + ATA_REG_LBA0, (uint8_t)((lba >> 24) & 0xFF));
-    outb(dev->channel->cmd_base + ATA_REG_LBA1, (uint8_t)((lba >> 32) & 0xFF));
-    outb(dev->channel->cmd_base + ATA_REG_LBA2, (uint8_t)((lba >> 40) & 0xFF));
+    pata_select_lba(dev);
 
-    // Send lower half of data
-    outb(dev->channel->cmd_base + ATA_REG_SECCOUNT, (uint8_t)(sector_count & 0xFF));
-    outb(dev->channel->cmd_base + ATA_REG_LBA0, (uint8_t)(lba & 0xFF));
-    outb(dev->channel->cmd_base + ATA_REG_LBA1, (uint8_t)((lba >> 8) & 0xFF));
-    outb(dev->channel->cmd_base + ATA_REG_LBA2, (uint8_t)((lba >> 16) & 0xFF));
+    while (done < sectors) {
+        uint32_t sector_count = (uint32_t)(sectors - done);
+        if (sector_count > PATA_MAX_SECTORS_PER_COMMAND) {
+            sector_count = PATA_MAX_SECTORS_PER_COMMAND;
+        }
+        uint64_t cur_lba = lba + done;
 
-    outb(dev->channel->cmd_base + ATA_REG_COMMAND, ATA_CMD_READ_SECTORS);
+        if (ata_wait_bsy_read_status(io) < 0) {
+            goto return_error;
+        }
 
-    // Wait for completion
-    while ((inb(dev->channel->cmd_base + ATA_REG_STATUS) & ATA_SR_BSY)) {
-        pit_sleep(1);
+        if (ide_dma_usable(dev, (size_t)sector_count * bytes_per_sector)) {
+            res = pata_dma_transfer(dev, cur_lba, sector_count, out + done * bytes_per_sector, false);
+            if (res == 0) {
+                done += sector_count;
+                continue;
+            } else if (res != -EINVAL) {
+                goto return_error;
+            }
+            // Otherwise fall back to PIO
+        }
+
+        pata_issue_lba48(dev, cur_lba, sector_count, ATA_CMD_READ_SECTORS);
+
+        // One IRQ per sector, raised once its data is ready in the device buffer
+        for (uint32_t i = 0; i < sector_count; i++) {
+            if (ide_wait_for_irq(dev) != 0) {
+                goto return_error;
+            }
+
+            uint8_t st = ide_take_irq_status(dev);
+            if ((st & (ATA_SR_ERR | ATA_SR_DF)) || !(st & ATA_SR_DRQ)) {
+                kout(KERNEL_EXTERNAL_FAULT, "PATA: read failed at lba %p (status %.2x)\n", (void *)(cur_lba + i), st);
+                goto return_error;
+            }
+
+            pata_read_data(dev, out + (done + i) * bytes_per_sector, bytes_per_sector);
+        }
+
+        done += sector_count;
     }
 
-    // Read data
-    pata_read_data(dev, buffer, total_bytes);
+    ide_irq_window_close(&window);
 
     // Unlock bus
     ide_unlock_bus(dev);
 
-    return (ssize_t)total_bytes;
+    return (ssize_t)(sectors * bytes_per_sector);
+
+return_error:
+    ide_irq_window_close(&window);
+    ide_unlock_bus(dev);
+    return -EIO;
+}
+
+ssize_t pata_write_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, const void *buffer) {
+    struct ide_device *dev = (struct ide_device *)drive->internal_data;
+
+    if (!dev) {
+        kout(KERNEL_SEVERE_FAULT, "Error: DRIVE internal_data is NULL in pata_write_sectors_func\n");
+        return -1;
+    }
+
+    if (sectors == 0) {
+        return 0;
+    }
+
+    if (lba + sectors > drive->numsectors) {
+        return -EINVAL;
+    }
+
+    // Lock bus
+    int res = ide_select_bus(dev);
+    if (res != 0) {
+        kout(KERNEL_EXTERNAL_FAULT, "Error: could not select bus for PATA device\n");
+        return -1;
+    }
+
+    struct ide_irq_window window;
+    ide_irq_window_open(&window);
+
+    uint16_t io               = dev->channel->cmd_base;
+    uint32_t bytes_per_sector = drive->logical_sector_size;
+    const uint8_t *in         = (const uint8_t *)buffer;
+    size_t done               = 0;
+    uint8_t st;
+
+    pata_select_lba(dev);
+
+    while (done < sectors) {
+        uint32_t sector_count = (uint32_t)(sectors - done);
+        if (sector_count > PATA_MAX_SECTORS_PER_COMMAND) {
+            sector_count = PATA_MAX_SECTORS_PER_COMMAND;
+        }
+        uint64_t cur_lba = lba + done;
+
+        if (ata_wait_bsy_read_status(io) < 0) {
+            goto return_error;
+        }
+
+        if (ide_dma_usable(dev, (size_t)sector_count * bytes_per_sector)) {
+            res = pata_dma_transfer(dev, cur_lba, sector_count, (void *)(in + done * bytes_per_sector), true);
+            if (res == 0) {
+                done += sector_count;
+                continue;
+            } else if (res != -EINVAL) {
+                goto return_error;
+            }
+            // Otherwise fall back to PIO
+        }
+
+        pata_issue_lba48(dev, cur_lba, sector_count, ATA_CMD_WRITE_SECTORS);
+
+        // The first sector is requested without an IRQ; after that the device raises one per sector it has accepted
+        // (including the last, which signals completion)
+        if (ata_wait_drq(io) < 0) {
+            kout(KERNEL_EXTERNAL_FAULT, "PATA: device did not request data for write at lba %p\n", (void *)cur_lba);
+            goto return_error;
+        }
+
+        for (uint32_t i = 0; i < sector_count; i++) {
+            pata_write_data(dev, in + (done + i) * bytes_per_sector, bytes_per_sector);
+
+            if (ide_wait_for_irq(dev) != 0) {
+                goto return_error;
+            }
+
+            st = ide_take_irq_status(dev);
+            bool last = i + 1 == sector_count;
+            if ((st & (ATA_SR_ERR | ATA_SR_DF)) || (!last && !(st & ATA_SR_DRQ))) {
+                kout(KERNEL_EXTERNAL_FAULT, "PATA: write failed at lba %p (status %.2x)\n", (void *)(cur_lba + i), st);
+                goto return_error;
+            }
+        }
+
+        done += sector_count;
+    }
+
+    ide_irq_window_close(&window);
+
+    // Unlock bus
+    ide_unlock_bus(dev);
+
+    return (ssize_t)(sectors * bytes_per_sector);
+
+return_error:
+    ide_irq_window_close(&window);
+    ide_unlock_bus(dev);
+    return -EIO;
+}
+
+int pata_flush_cache_func(DRIVE_t *drive) {
+    struct ide_device *dev = (struct ide_device *)drive->internal_data;
+
+    if (!dev) {
+        kout(KERNEL_SEVERE_FAULT, "Error: DRIVE internal_data is NULL in pata_flush_cache_func\n");
+        return -EIO;
+    }
+
+    // Lock bus
+    if (ide_select_bus(dev) != 0) {
+        kout(KERNEL_EXTERNAL_FAULT, "Error: could not select bus for PATA device\n");
+        return -EIO;
+    }
+
+    struct ide_irq_window window;
+    ide_irq_window_open(&window);
+
+    uint16_t io = dev->channel->cmd_base;
+    int res     = 0;
+
+    if (ata_wait_bsy_read_status(io) < 0) {
+        res = -EIO;
+        goto out;
+    }
+
+    // Make sure everything written so far actually reaches the platter
+    ide_prepare_irq(dev);
+    outb(io + ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
+    if (ide_wait_for_irq(dev) != 0) {
+        res = -EIO;
+        goto out;
+    }
+
+    uint8_t st = ide_take_irq_status(dev);
+    if (st & (ATA_SR_ERR | ATA_SR_DF)) {
+        kout(KERNEL_EXTERNAL_FAULT, "PATA: cache flush failed (status %.2x)\n", st);
+        res = -EIO;
+    }
+
+out:
+    ide_irq_window_close(&window);
+    ide_unlock_bus(dev);
+    return res;
 }
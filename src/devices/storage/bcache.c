@@ -0,0 +1,622 @@
+#include "bcache.h"
+
+#include "blkq.h"
+#include "lib/lock.h"
+#include "lib/stdio.h"
+#include "memory/kmalloc.h"
+#include "plenjos/errno.h"
+#include "timer/timer.h"
+
+#include <stdatomic.h>
+
+static bcache_buf_t *bcache_buckets[BCACHE_HASH_BUCKETS] = { 0 };
+
+// Every buffer ever allocated; buffers are recycled rather than freed
+static bcache_buf_t *bcache_bufs[BCACHE_MAX_BUFFERS] = { 0 };
+static size_t bcache_buf_count = 0;
+
+static size_t bcache_dirty   = 0;
+static uint64_t bcache_clock = 0;
+
+// Never held across drive I/O: reads drop it, and writeback takes the dirty buffers off under it before writing them
+static mutex bcache_lock = MUTEX_INIT;
+
+// Serializes writeback passes, so an fsync that finds nothing dirty knows that any writeback of its sectors which was
+// already in flight has finished (including the drive cache flush). Taken before bcache_lock.
+static mutex bcache_writeback_lock = MUTEX_INIT;
+
+// Bumped whenever cached contents change; a read that raced with a change doesn't populate the cache
+static uint64_t bcache_generation = 0;
+
+static atomic_bool bcache_flusher_armed = false;
+
+static inline size_t bcache_hash(DRIVE_t *drive, uint64_t lba) {
+    uint64_t h = ((uint64_t)drive >> 4) ^ (lba * 0x9E3779B97F4A7C15ULL);
+    return (size_t)((h >> 32) ^ h) % BCACHE_HASH_BUCKETS;
+}
+
+static bcache_buf_t *bcache_lookup(DRIVE_t *drive, uint64_t lba) {
+    bcache_buf_t *buf = bcache_buckets[bcache_hash(drive, lba)];
+    while (buf) {
+        if (buf->drive == drive && buf->lba == lba && (buf->flags & BCACHE_BUF_FLAG_VALID)) {
+            return buf;
+        }
+        buf = buf->hash_next;
+    }
+    return NULL;
+}
+
+static void bcache_unhash(bcache_buf_t *buf) {
+    if (!buf->drive) {
+        return;
+    }
+
+    bcache_buf_t **link = &bcache_buckets[bcache_hash(buf->drive, buf->lba)];
+    while (*link) {
+        if (*link == buf) {
+            *link = buf->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+
+    buf->hash_next = NULL;
+    buf->drive     = NULL;
+    buf->flags     = 0;
+    buf->last_used = 0;
+}
+
+static void bcache_mark_dirty(bcache_buf_t *buf) {
+    if (!(buf->flags & BCACHE_BUF_FLAG_DIRTY)) {
+        buf->flags |= BCACHE_BUF_FLAG_DIRTY;
+        bcache_dirty++;
+    }
+}
+
+// Returns an unused buffer hashed at (drive, lba) with no flags set, or NULL if every buffer is dirty or being written
+// back. Must be called with bcache_lock held.
+static bcache_buf_t *bcache_alloc_buffer_locked(DRIVE_t *drive, uint64_t lba) {
+    bcache_buf_t *buf = NULL;
+
+    if (bcache_buf_count < BCACHE_MAX_BUFFERS) {
+        buf = kmalloc_heap(sizeof(bcache_buf_t));
+        if (buf) {
+            memset(buf, 0, sizeof(bcache_buf_t));
+            buf->data = kmalloc_heap(drive->logical_sector_size);
+            if (!buf->data) {
+                kfree_heap(buf);
+                buf = NULL;
+            } else {
+                bcache_bufs[bcache_buf_count++] = buf;
+            }
+        }
+    }
+
+    if (!buf) {
+        // Evict the least recently used clean buffer
+        for (size_t i = 0; i < bcache_buf_count; i++) {
+            bcache_buf_t *candidate = bcache_bufs[i];
+            if (candidate->flags & (BCACHE_BUF_FLAG_DIRTY | BCACHE_BUF_FLAG_WRITEBACK)) {
+                continue;
+            }
+            if (!buf || candidate->last_used < buf->last_used) {
+                buf = candidate;
+            }
+        }
+
+        if (!buf) {
+            return NULL;
+        }
+
+        // Sector sizes can differ between drives
+        uint32_t old_size = buf->drive ? buf->drive->logical_sector_size : 0;
+        bcache_unhash(buf);
+        if (old_size != drive->logical_sector_size) {
+            uint8_t *data = kmalloc_heap(drive->logical_sector_size);
+            if (!data) {
+                kout(KERNEL_SEVERE_FAULT, "OOM Error: bcache: could not reallocate sector buffer\n");
+                return NULL;
+            }
+            kfree_heap(buf->data);
+            buf->data = data;
+        }
+    }
+
+    size_t bucket          = bcache_hash(drive, lba);
+    buf->drive             = drive;
+    buf->lba               = lba;
+    buf->flags             = 0;
+    buf->last_used         = ++bcache_clock;
+    buf->hash_next         = bcache_buckets[bucket];
+    bcache_buckets[bucket] = buf;
+
+    return buf;
+}
+
+static bool bcache_buf_before(bcache_buf_t *a, bcache_buf_t *b) {
+    if (a->drive != b->drive) {
+        return (uintptr_t)a->drive < (uintptr_t)b->drive;
+    }
+    return a->lba < b->lba;
+}
+
+// A contiguous run of dirty buffers, written with one request
+struct bcache_run {
+    DRIVE_t *drive;
+    uint64_t lba;
+    size_t count;
+    bcache_buf_t **bufs; // Slice of the sorted dirty list
+    uint8_t *data;       // Snapshot of the buffers, taken under bcache_lock
+    ssize_t result;
+
+    blk_request_t req;
+    atomic_size_t *pending; // Runs of the pass still in flight
+    bool plugged;           // Whether this run plugged its drive's queue (only the first run of each drive does)
+};
+
+static void bcache_run_done(blk_request_t *req, ssize_t result) {
+    struct bcache_run *run = (struct bcache_run *)req->data;
+
+    // The writeback pass may free run as soon as pending drops
+    run->result = result;
+    atomic_fetch_sub_explicit(run->pending, 1, memory_order_release);
+}
+
+// Collects the dirty buffers of drive (every drive if NULL) within [lba, lba + sectors), sorts them and splits them
+// into runs. Each run's buffers are snapshotted and marked clean and under writeback. Returns the number of runs, or a
+// negative errno; if there are any, the caller frees *list_out and *runs_out. Must be called with bcache_lock held.
+static int bcache_take_runs_locked(DRIVE_t *drive, uint64_t lba, uint64_t sectors, bcache_buf_t ***list_out,
+                                   struct bcache_run **runs_out) {
+    *list_out = NULL;
+    *runs_out = NULL;
+
+    if (bcache_dirty == 0) {
+        return 0;
+    }
+
+    bcache_buf_t **list = kmalloc_heap(sizeof(bcache_buf_t *) * bcache_dirty);
+    if (!list) {
+        kout(KERNEL_SEVERE_FAULT, "OOM Error: bcache_flush: could not allocate dirty list\n");
+        return -ENOMEM;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < bcache_buf_count && count < bcache_dirty; i++) {
+        bcache_buf_t *buf = bcache_bufs[i];
+        if (!buf->drive || !(buf->flags & BCACHE_BUF_FLAG_DIRTY)) {
+            continue;
+        }
+        if (drive && buf->drive != drive) {
+            continue;
+        }
+        if (buf->lba < lba || buf->lba - lba >= sectors) {
+            continue;
+        }
+        list[count++] = buf;
+    }
+
+    if (count == 0) {
+        kfree_heap(list);
+        return 0;
+    }
+
+    // Insertion sort by (drive, lba); the dirty set is usually small and already mostly ordered
+    for (size_t i = 1; i < count; i++) {
+        bcache_buf_t *key = list[i];
+        size_t j          = i;
+        while (j > 0 && bcache_buf_before(key, list[j - 1])) {
+            list[j] = list[j - 1];
+            j--;
+        }
+        list[j] = key;
+    }
+
+    struct bcache_run *runs = kmalloc_heap(sizeof(struct bcache_run) * count);
+    if (!runs) {
+        kout(KERNEL_SEVERE_FAULT, "OOM Error: bcache_flush: could not allocate run list\n");
+        kfree_heap(list);
+        return -ENOMEM;
+    }
+
+    int nruns = 0;
+    size_t i  = 0;
+    while (i < count) {
+        DRIVE_t *run_drive = list[i]->drive;
+        uint32_t ss        = run_drive->logical_sector_size;
+
+        size_t run = 1;
+        while (i + run < count && run < BCACHE_MAX_COALESCE_SECTORS && list[i + run]->drive == run_drive
+               && list[i + run]->lba == list[i]->lba + run) {
+            run++;
+        }
+
+        uint8_t *data = kmalloc_heap((size_t)run * ss);
+        if (!data) {
+            // Leave the rest dirty for the next pass
+            kout(KERNEL_SEVERE_FAULT, "OOM Error: bcache_flush: could not allocate staging buffer\n");
+            break;
+        }
+
+        for (size_t j = 0; j < run; j++) {
+            memcpy(data + j * ss, list[i + j]->data, ss);
+            list[i + j]->flags &= ~BCACHE_BUF_FLAG_DIRTY;
+            list[i + j]->flags |= BCACHE_BUF_FLAG_WRITEBACK;
+            bcache_dirty--;
+        }
+
+        runs[nruns++] = (struct bcache_run) {
+            .drive = run_drive, .lba = list[i]->lba, .count = run, .bufs = &list[i], .data = data, .result = 0,
+            .pending = NULL, .plugged = false
+        };
+
+        i += run;
+    }
+
+    if (nruns == 0) {
+        kfree_heap(runs);
+        kfree_heap(list);
+        return -ENOMEM;
+    }
+
+    *list_out = list;
+    *runs_out = runs;
+
+    return nruns;
+}
+
+// Ends the writeback of each run's buffers. Buffers whose write failed are dirty again, unless they were redirtied
+// meanwhile anyway. Must be called with bcache_lock held.
+static void bcache_finish_runs_locked(struct bcache_run *runs, int nruns) {
+    for (int r = 0; r < nruns; r++) {
+        for (size_t j = 0; j < runs[r].count; j++) {
+            bcache_buf_t *buf = runs[r].bufs[j];
+            buf->flags       &= ~BCACHE_BUF_FLAG_WRITEBACK;
+            if (runs[r].result < 0) {
+                bcache_mark_dirty(buf);
+            }
+        }
+    }
+}
+
+// Writes back the dirty buffers of drive (every drive if NULL) within [lba, lba + sectors), then flushes the write
+// cache of each drive written to. Must be called without bcache_lock held.
+static int bcache_writeback(DRIVE_t *drive, uint64_t lba, uint64_t sectors) {
+    mutex_lock(&bcache_writeback_lock);
+
+    bcache_buf_t **list     = NULL;
+    struct bcache_run *runs = NULL;
+
+    mutex_lock(&bcache_lock);
+    int nruns = bcache_take_runs_locked(drive, lba, sectors, &list, &runs);
+    mutex_unlock(&bcache_lock);
+
+    if (nruns <= 0) {
+        mutex_unlock(&bcache_writeback_lock);
+        return nruns;
+    }
+
+    atomic_size_t pending = (size_t)nruns;
+
+    // Queue every run before any of them is dispatched, so each drive's elevator sees the whole pass (and whatever
+    // else is queued) at once
+    for (int r = 0; r < nruns; r++) {
+        struct bcache_run *run = &runs[r];
+
+        run->pending = &pending;
+        run->plugged = (r == 0 || runs[r - 1].drive != run->drive) && blkq_plug(run->drive) == 0;
+        run->req     = (blk_request_t) { .lba     = run->lba,
+                                         .sectors = run->count,
+                                         .buffer  = run->data,
+                                         .write   = true,
+                                         .done    = bcache_run_done,
+                                         .data    = run };
+
+        int res = blkq_submit(run->drive, &run->req);
+        if (res < 0) {
+            run->result = res;
+            atomic_fetch_sub_explicit(&pending, 1, memory_order_relaxed);
+        }
+    }
+
+    for (int r = 0; r < nruns; r++) {
+        if (runs[r].plugged) {
+            blkq_unplug(runs[r].drive);
+        }
+    }
+
+    // Unplugging dispatched the runs unless someone else was dispatching already, in which case they will
+    while (atomic_load_explicit(&pending, memory_order_acquire) != 0) {
+        __builtin_ia32_pause();
+    }
+
+    int ret = 0;
+    for (int r = 0; r < nruns; r++) {
+        if (runs[r].result < 0) {
+            kout(KERNEL_EXTERNAL_FAULT, "bcache_flush: write of %u sectors at lba %p failed, errno %d\n",
+                 (uint32_t)runs[r].count, (void *)runs[r].lba, (int)runs[r].result);
+            ret = (int)runs[r].result;
+        }
+
+        // Runs are sorted by drive, so this flushes each drive once, after all of its writes
+        bool last_of_drive = r + 1 == nruns || runs[r + 1].drive != runs[r].drive;
+        if (last_of_drive && runs[r].drive->flush_cache) {
+            int res = runs[r].drive->flush_cache(runs[r].drive);
+            if (res < 0) {
+                ret = res;
+            }
+        }
+    }
+
+    mutex_lock(&bcache_lock);
+    bcache_finish_runs_locked(runs, nruns);
+    mutex_unlock(&bcache_lock);
+
+    for (int r = 0; r < nruns; r++) {
+        kfree_heap(runs[r].data);
+    }
+    kfree_heap(runs);
+    kfree_heap(list);
+
+    mutex_unlock(&bcache_writeback_lock);
+
+    return ret;
+}
+
+static void bcache_arm_flusher();
+
+static void bcache_flusher_callback(struct timer_timeout *timeout) {
+    (void)timeout;
+
+    atomic_store(&bcache_flusher_armed, false);
+    bcache_flush(NULL);
+
+    if (bcache_dirty_count() > 0) {
+        bcache_arm_flusher();
+    }
+}
+
+static void bcache_arm_flusher() {
+    bool expected = false;
+    if (!atomic_compare_exchange_strong(&bcache_flusher_armed, &expected, true)) {
+        return;
+    }
+
+    if (set_timeout(BCACHE_FLUSH_INTERVAL_MS, bcache_flusher_callback, NULL) < 0) {
+        kout(KERNEL_WARN, "bcache: couldn't arm the flusher; dirty buffers will only be written on fsync\n");
+        atomic_store(&bcache_flusher_armed, false);
+    }
+}
+
+ssize_t bcache_read(DRIVE_t *drive, uint64_t lba, size_t sectors, void *buffer) {
+    if (!drive || !buffer) {
+        return -EINVAL;
+    }
+    if (!drive->read_sectors) {
+        return -EIO;
+    }
+    if (sectors == 0) {
+        return 0;
+    }
+
+    uint32_t ss       = drive->logical_sector_size;
+    uint8_t *out      = (uint8_t *)buffer;
+    bool cache_misses = sectors <= BCACHE_READ_CACHE_MAX_SECTORS;
+
+    mutex_lock(&bcache_lock);
+
+    size_t i = 0;
+    while (i < sectors) {
+        bcache_buf_t *buf = bcache_lookup(drive, lba + i);
+        if (buf) {
+            memcpy(out + i * ss, buf->data, ss);
+            buf->last_used = ++bcache_clock;
+            i++;
+            continue;
+        }
+
+        // Read the whole run of missing sectors at once
+        size_t run = 1;
+        while (i + run < sectors && !bcache_lookup(drive, lba + i + run)) {
+            run++;
+        }
+
+        uint64_t generation = bcache_generation;
+        mutex_unlock(&bcache_lock);
+
+        ssize_t res = blkq_read(drive, lba + i, run, out + i * ss);
+
+        mutex_lock(&bcache_lock);
+
+        if (res < 0) {
+            mutex_unlock(&bcache_lock);
+            return res;
+        }
+
+        // Sectors cached while the lock was dropped are at least as new as what we read
+        bool raced = generation != bcache_generation;
+        for (size_t j = 0; j < run; j++) {
+            buf = bcache_lookup(drive, lba + i + j);
+            if (buf) {
+                memcpy(out + (i + j) * ss, buf->data, ss);
+                continue;
+            }
+            if (!cache_misses || raced) {
+                continue;
+            }
+
+            buf = bcache_alloc_buffer_locked(drive, lba + i + j);
+            if (!buf) {
+                cache_misses = false;
+                continue;
+            }
+            memcpy(buf->data, out + (i + j) * ss, ss);
+            buf->flags |= BCACHE_BUF_FLAG_VALID;
+        }
+
+        i += run;
+    }
+
+    mutex_unlock(&bcache_lock);
+
+    return (ssize_t)(sectors * ss);
+}
+
+ssize_t bcache_write(DRIVE_t *drive, uint64_t lba, size_t sectors, const void *buffer) {
+    if (!drive || !buffer) {
+        return -EINVAL;
+    }
+    if (!drive->write_sectors) {
+        return -EROFS;
+    }
+    if (lba + sectors > drive->numsectors) {
+        return -EINVAL;
+    }
+
+    uint32_t ss       = drive->logical_sector_size;
+    const uint8_t *in = (const uint8_t *)buffer;
+
+    mutex_lock(&bcache_lock);
+
+    for (size_t i = 0; i < sectors; i++) {
+        bcache_buf_t *buf = bcache_lookup(drive, lba + i);
+        if (!buf) {
+            buf = bcache_alloc_buffer_locked(drive, lba + i);
+        }
+        if (!buf) {
+            // Every buffer is dirty; write them back and try again. The sector may have been cached meanwhile.
+            mutex_unlock(&bcache_lock);
+            bcache_writeback(NULL, 0, UINT64_MAX);
+            mutex_lock(&bcache_lock);
+
+            buf = bcache_lookup(drive, lba + i);
+            if (!buf) {
+                buf = bcache_alloc_buffer_locked(drive, lba + i);
+            }
+            if (!buf) {
+                mutex_unlock(&bcache_lock);
+                return i ? (ssize_t)(i * ss) : -ENOMEM;
+            }
+        }
+
+        memcpy(buf->data, in + i * ss, ss);
+        bcache_generation++;
+        buf->flags     |= BCACHE_BUF_FLAG_VALID;
+        buf->last_used  = ++bcache_clock;
+        bcache_mark_dirty(buf);
+    }
+
+    mutex_unlock(&bcache_lock);
+
+    bcache_arm_flusher();
+
+    return (ssize_t)(sectors * ss);
+}
+
+int bcache_write_bytes(DRIVE_t *drive, uint64_t lba, size_t offset, size_t len, const void *buffer) {
+    if (!drive || !buffer) {
+        return -EINVAL;
+    }
+    if (!drive->write_sectors) {
+        return -EROFS;
+    }
+    if (offset + len > drive->logical_sector_size || lba >= drive->numsectors) {
+        return -EINVAL;
+    }
+
+    uint32_t ss  = drive->logical_sector_size;
+    bool partial = offset != 0 || len != ss;
+
+    // What's on disk, for a partial write to a sector that isn't cached. It's read without the lock held, so it's only
+    // good as long as nothing was staged in the meantime.
+    uint8_t *sector            = NULL;
+    bool have_sector           = false;
+    uint64_t sector_generation = 0;
+
+    bool wrote_back = false;
+    int res         = 0;
+
+    mutex_lock(&bcache_lock);
+
+    bcache_buf_t *buf;
+    while (!(buf = bcache_lookup(drive, lba))) {
+        if (partial && (!have_sector || sector_generation != bcache_generation)) {
+            if (!sector && !(sector = kmalloc_heap(ss))) {
+                res = -ENOMEM;
+                break;
+            }
+
+            sector_generation = bcache_generation;
+            mutex_unlock(&bcache_lock);
+
+            ssize_t read = blkq_read(drive, lba, 1, sector);
+
+            mutex_lock(&bcache_lock);
+            if (read < 0) {
+                res = (int)read;
+                break;
+            }
+            have_sector = true;
+            continue;
+        }
+
+        buf = bcache_alloc_buffer_locked(drive, lba);
+        if (buf) {
+            if (partial) {
+                memcpy(buf->data, sector, ss);
+            }
+            buf->flags |= BCACHE_BUF_FLAG_VALID;
+            break;
+        }
+
+        if (wrote_back) {
+            res = -ENOMEM;
+            break;
+        }
+
+        // Every buffer is dirty; write them back and try again
+        mutex_unlock(&bcache_lock);
+        bcache_writeback(NULL, 0, UINT64_MAX);
+        mutex_lock(&bcache_lock);
+        wrote_back = true;
+    }
+
+    if (buf) {
+        memcpy(buf->data + offset, buffer, len);
+        bcache_generation++;
+        buf->last_used = ++bcache_clock;
+        bcache_mark_dirty(buf);
+    }
+
+    mutex_unlock(&bcache_lock);
+
+    if (sector) {
+        kfree_heap(sector);
+    }
+
+    if (res < 0) {
+        return res;
+    }
+
+    bcache_arm_flusher();
+
+    return 0;
+}
+
+int bcache_flush(DRIVE_t *drive) {
+    return bcache_writeback(drive, 0, UINT64_MAX);
+}
+
+int bcache_flush_range(DRIVE_t *drive, uint64_t lba, uint64_t sectors) {
+    if (!drive) {
+        return -EINVAL;
+    }
+
+    return bcache_writeback(drive, lba, sectors);
+}
+
+size_t bcache_dirty_count() {
+    mutex_lock(&bcache_lock);
+    size_t count = bcache_dirty;
+    mutex_unlock(&bcache_lock);
+    return count;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "devices/storage/drive.h"
+#include "kernel.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Sector buffer cache shared by all block devices.
+ *
+ * Buffers are always exactly one logical sector of the drive they belong to. Writes are staged here and marked dirty;
+ * a periodic flusher (armed via set_timeout() whenever the first buffer becomes dirty) sorts the dirty buffers,
+ * coalesces contiguous runs into single requests and submits them all to the drive's request queue together (see
+ * blkq_plug()) before waiting for them. bcache_flush() and bcache_flush_range() force this
+ * synchronously (used by fsync). Either way, each drive written to has its write cache flushed once the pass is done.
+ *
+ * Writeback snapshots the dirty buffers and marks them clean before any I/O is issued, so the cache stays usable while
+ * it runs; a buffer written to meanwhile just becomes dirty again.
+ */
+
+#define BCACHE_HASH_BUCKETS 256
+#define BCACHE_MAX_BUFFERS  1024
+
+// Reads larger than this bypass the cache (but still see any cached/dirty sectors); this stops large file reads from
+// evicting metadata
+#define BCACHE_READ_CACHE_MAX_SECTORS 8
+
+// Maximum number of sectors merged into a single write_sectors() call by the flusher
+#define BCACHE_MAX_COALESCE_SECTORS 128
+
+#define BCACHE_FLUSH_INTERVAL_MS 5000
+
+#define BCACHE_BUF_FLAG_VALID 0x1
+#define BCACHE_BUF_FLAG_DIRTY 0x2
+// Its contents are being written back; it can't be evicted until that's done, or a read could overtake the write
+#define BCACHE_BUF_FLAG_WRITEBACK 0x4
+
+typedef struct bcache_buf bcache_buf_t;
+
+struct bcache_buf {
+    DRIVE_t *drive;
+    uint64_t lba;
+    uint32_t flags;
+    uint64_t last_used;
+
+    bcache_buf_t *hash_next;
+
+    uint8_t *data;
+};
+
+// Reads sectors, preferring cached copies. Returns bytes read or a negative errno.
+ssize_t bcache_read(DRIVE_t *drive, uint64_t lba, size_t sectors, void *buffer);
+
+// Stages whole-sector writes in the cache. Returns bytes written or a negative errno.
+ssize_t bcache_write(DRIVE_t *drive, uint64_t lba, size_t sectors, const void *buffer);
+
+// Stages a partial write within a single sector (read-modify-write). offset + len must be <= the sector size.
+int bcache_write_bytes(DRIVE_t *drive, uint64_t lba, size_t offset, size_t len, const void *buffer);
+
+// Writes back all dirty buffers belonging to drive (or to every drive if drive is NULL)
+int bcache_flush(DRIVE_t *drive);
+
+// Writes back only the dirty buffers of drive within [lba, lba + sectors)
+int bcache_flush_range(DRIVE_t *drive, uint64_t lba, uint64_t sectors);
+
+// Number of dirty buffers currently staged
+size_t bcache_dirty_count();
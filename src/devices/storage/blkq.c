@@ -0,0 +1,422 @@
+#include "blkq.h"
+
+#include "arch/x86_64/apic/apic.h"
+#include "arch/x86_64/common.h"
+#include "arch/x86_64/irq.h"
+#include "arch/x86_64/tsc.h"
+#include "cpu/cpu.h"
+#include "lib/lock.h"
+#include "lib/stdio.h"
+#include "lib/string.h"
+#include "memory/kmalloc.h"
+#include "plenjos/errno.h"
+#include "timer/timer.h"
+
+struct blk_queue {
+    mutex lock;
+    blk_request_t *head; // Sorted by LBA; equal LBAs stay in submission order
+    uint64_t next_lba;   // Where the elevator sweep continues from
+
+    // Set while some context is dispatching; only changed with lock held
+    atomic_bool dispatching;
+
+    // blkq_plug() depth; blkq_submit() doesn't dispatch while this is non-zero
+    atomic_int plugged;
+};
+
+struct blkq_waiter {
+    atomic_bool done;
+    ssize_t result;
+};
+
+static mutex blkq_create_lock = MUTEX_INIT;
+
+static struct blk_queue *blkq_get(DRIVE_t *drive) {
+    struct blk_queue *q = __atomic_load_n(&drive->queue, __ATOMIC_ACQUIRE);
+    if (q) {
+        return q;
+    }
+
+    mutex_lock(&blkq_create_lock);
+
+    q = drive->queue;
+    if (!q) {
+        q = kmalloc_heap(sizeof(struct blk_queue));
+        if (!q) {
+            kout(KERNEL_SEVERE_FAULT, "OOM Error: blkq: could not allocate request queue\n");
+        } else {
+            memset(q, 0, sizeof(struct blk_queue));
+            q->lock = MUTEX_INIT;
+            atomic_store(&q->dispatching, false);
+            atomic_store(&q->plugged, 0);
+            __atomic_store_n(&drive->queue, q, __ATOMIC_RELEASE);
+        }
+    }
+
+    mutex_unlock(&blkq_create_lock);
+
+    return q;
+}
+
+static void blkq_wake(int core) {
+    if (core >= 0 && (uint32_t)core != get_curr_core()) {
+        send_ipi(cpu_cores[core].lapic_id, IPI_WAKEUP_IRQ + 32);
+    }
+}
+
+// Must be called with q->lock held
+static void blkq_insert_locked(struct blk_queue *q, blk_request_t *req) {
+    blk_request_t **link = &q->head;
+    while (*link && (*link)->lba <= req->lba) {
+        link = &(*link)->next;
+    }
+    req->next = *link;
+    *link     = req;
+}
+
+// Unlinks the next batch: the request with the oldest expired deadline if there is one, otherwise the first request at
+// or after next_lba (wrapping around to the lowest LBA), plus every following request that continues it in the same
+// direction. Returns the batch as a NULL-terminated list. Must be called with q->lock held and the queue non-empty.
+static blk_request_t *blkq_take_batch_locked(struct blk_queue *q) {
+    uint64_t now          = timer_now_ns();
+    blk_request_t **start = NULL;
+
+    for (blk_request_t **link = &q->head; *link; link = &(*link)->next) {
+        if ((*link)->deadline <= now && (!start || (*link)->deadline < (*start)->deadline)) {
+            start = link;
+        }
+    }
+
+    if (!start) {
+        for (blk_request_t **link = &q->head; *link; link = &(*link)->next) {
+            if ((*link)->lba >= q->next_lba) {
+                start = link;
+                break;
+            }
+        }
+    }
+
+    if (!start) {
+        start = &q->head;
+    }
+
+    blk_request_t *first = *start;
+    blk_request_t *last  = first;
+    uint64_t end         = first->lba + first->sectors;
+    size_t total         = first->sectors;
+
+    while (last->next && last->next->write == first->write && last->next->lba == end
+           && total + last->next->sectors <= BLKQ_MAX_MERGE_SECTORS) {
+        last   = last->next;
+        end   += last->sectors;
+        total += last->sectors;
+    }
+
+    *start      = last->next;
+    last->next  = NULL;
+    q->next_lba = end;
+
+    return first;
+}
+
+// requests is how many queued requests the command carries, for the merge count
+static ssize_t blkq_issue(DRIVE_t *drive, bool write, uint64_t lba, size_t sectors, void *buffer, size_t requests) {
+    if (write && !drive->write_sectors) {
+        return -EROFS;
+    }
+    if (!write && !drive->read_sectors) {
+        return -EIO;
+    }
+
+    uint64_t start = rdtsc();
+
+    ssize_t res;
+    if (write) {
+        res = drive->write_sectors(drive, lba, sectors, buffer);
+    } else {
+        res = drive->read_sectors(drive, lba, sectors, buffer);
+    }
+
+    blkstat_command_done(drive, write, requests, res, rdtsc() - start);
+
+    return res;
+}
+
+// Hands each request in the batch its share of a merged command's result
+static void blkq_complete_batch(DRIVE_t *drive, blk_request_t *batch, ssize_t res) {
+    uint32_t ss   = drive->logical_sector_size;
+    size_t offset = 0;
+
+    while (batch) {
+        blk_request_t *next = batch->next; // done may free batch
+        size_t bytes        = batch->sectors * ss;
+
+        ssize_t result;
+        if (res < 0) {
+            result = res;
+        } else if ((size_t)res >= offset + bytes) {
+            result = (ssize_t)bytes;
+        } else if ((size_t)res > offset) {
+            result = (ssize_t)((size_t)res - offset);
+        } else {
+            result = -EIO;
+        }
+
+        blkstat_request_completed(drive, batch->write, rdtsc() - batch->submit_tsc);
+        batch->done(batch, result);
+
+        offset += bytes;
+        batch   = next;
+    }
+}
+
+static void blkq_dispatch_batch(DRIVE_t *drive, blk_request_t *batch) {
+    uint32_t ss = drive->logical_sector_size;
+    bool write  = batch->write;
+
+    // Merged requests can only be issued straight from the callers' memory if their buffers happen to line up
+    size_t total    = 0;
+    size_t requests = 0;
+    bool contiguous = true;
+    for (blk_request_t *req = batch; req; req = req->next) {
+        if ((uint8_t *)req->buffer != (uint8_t *)batch->buffer + total * ss) {
+            contiguous = false;
+        }
+        total += req->sectors;
+        requests++;
+    }
+
+    if (contiguous) {
+        blkq_complete_batch(drive, batch, blkq_issue(drive, write, batch->lba, total, batch->buffer, requests));
+        return;
+    }
+
+    uint8_t *staging = kmalloc_heap(total * ss);
+    if (!staging) {
+        // Fall back to issuing the requests one by one
+        while (batch) {
+            blk_request_t *next = batch->next;
+            batch->next         = NULL;
+            blkq_complete_batch(drive, batch, blkq_issue(drive, write, batch->lba, batch->sectors, batch->buffer, 1));
+            batch = next;
+        }
+        return;
+    }
+
+    if (write) {
+        size_t offset = 0;
+        for (blk_request_t *req = batch; req; req = req->next) {
+            memcpy(staging + offset, req->buffer, req->sectors * ss);
+            offset += req->sectors * ss;
+        }
+    }
+
+    ssize_t res = blkq_issue(drive, write, batch->lba, total, staging, requests);
+
+    if (!write && res > 0) {
+        size_t offset = 0;
+        for (blk_request_t *req = batch; req && offset < (size_t)res; req = req->next) {
+            size_t bytes = req->sectors * ss;
+            if (bytes > (size_t)res - offset) {
+                bytes = (size_t)res - offset;
+            }
+            memcpy(req->buffer, staging + offset, bytes);
+            offset += req->sectors * ss;
+        }
+    }
+
+    kfree_heap(staging);
+
+    blkq_complete_batch(drive, batch, res);
+}
+
+// Dispatches batches until the queue is empty. If own_done is given, the caller is a synchronous waiter; once its own
+// request has completed it hands dispatching over to another waiter if there is one, rather than serving everyone else
+// indefinitely. Must be called with q->dispatching claimed by the caller.
+static void blkq_run(DRIVE_t *drive, struct blk_queue *q, atomic_bool *own_done) {
+    while (true) {
+        mutex_lock(&q->lock);
+
+        bool stop = !q->head;
+        if (!stop && own_done && atomic_load_explicit(own_done, memory_order_acquire)) {
+            for (blk_request_t *req = q->head; req; req = req->next) {
+                if (req->waiter_core >= 0) {
+                    stop = true;
+                    break;
+                }
+            }
+        }
+
+        if (stop) {
+            atomic_store_explicit(&q->dispatching, false, memory_order_release);
+
+            // Anyone halted on a pending request re-checks the queue and one of them takes over
+            for (blk_request_t *req = q->head; req; req = req->next) {
+                blkq_wake(req->waiter_core);
+            }
+
+            mutex_unlock(&q->lock);
+            return;
+        }
+
+        blk_request_t *batch = blkq_take_batch_locked(q);
+
+        mutex_unlock(&q->lock);
+
+        blkq_dispatch_batch(drive, batch);
+    }
+}
+
+static bool blkq_try_claim(struct blk_queue *q) {
+    bool expected = false;
+    return atomic_compare_exchange_strong_explicit(&q->dispatching, &expected, true, memory_order_acq_rel,
+                                                   memory_order_relaxed);
+}
+
+static int blkq_enqueue(DRIVE_t *drive, struct blk_queue *q, blk_request_t *req) {
+    if (!req->done) {
+        return -EINVAL;
+    }
+    if (req->sectors == 0) {
+        req->done(req, 0);
+        return 0;
+    }
+
+    uint64_t deadline_ms = req->write ? BLKQ_WRITE_DEADLINE_MS : BLKQ_READ_DEADLINE_MS;
+    req->deadline        = timer_now_ns() + deadline_ms * TIMER_NS_PER_MS;
+    req->submit_tsc      = rdtsc();
+
+    blkstat_request_submitted(drive, req->write);
+
+    mutex_lock(&q->lock);
+    blkq_insert_locked(q, req);
+    mutex_unlock(&q->lock);
+
+    return 0;
+}
+
+int blkq_submit(DRIVE_t *drive, blk_request_t *req) {
+    if (!drive || !req || !req->buffer) {
+        return -EINVAL;
+    }
+
+    struct blk_queue *q = blkq_get(drive);
+    if (!q) {
+        return -ENOMEM;
+    }
+
+    req->waiter_core = -1;
+
+    int res = blkq_enqueue(drive, q, req);
+    if (res < 0 || req->sectors == 0) {
+        return res;
+    }
+
+    // If someone is already dispatching they'll pick this up before they stop (they re-check the queue under the lock
+    // before releasing it)
+    if (atomic_load(&q->plugged) == 0 && blkq_try_claim(q)) {
+        blkq_run(drive, q, NULL);
+    }
+
+    return 0;
+}
+
+int blkq_plug(DRIVE_t *drive) {
+    if (!drive) {
+        return -EINVAL;
+    }
+
+    struct blk_queue *q = blkq_get(drive);
+    if (!q) {
+        return -ENOMEM;
+    }
+
+    atomic_fetch_add(&q->plugged, 1);
+    return 0;
+}
+
+void blkq_unplug(DRIVE_t *drive) {
+    // Plugging created the queue
+    struct blk_queue *q = __atomic_load_n(&drive->queue, __ATOMIC_ACQUIRE);
+
+    if (atomic_fetch_sub(&q->plugged, 1) == 1 && blkq_try_claim(q)) {
+        blkq_run(drive, q, NULL);
+    }
+}
+
+static void blkq_sync_done(blk_request_t *req, ssize_t result) {
+    struct blkq_waiter *waiter = (struct blkq_waiter *)req->data;
+    int core                   = req->waiter_core;
+
+    // req lives on the waiter's stack, so it can't be touched once done is set
+    waiter->result = result;
+    atomic_store_explicit(&waiter->done, true, memory_order_release);
+
+    blkq_wake(core);
+}
+
+static ssize_t blkq_sync(DRIVE_t *drive, uint64_t lba, size_t sectors, void *buffer, bool write) {
+    if (!drive || !buffer) {
+        return -EINVAL;
+    }
+    if (sectors == 0) {
+        return 0;
+    }
+
+    struct blk_queue *q = blkq_get(drive);
+    if (!q) {
+        // Still usable without a queue, just unmerged
+        return blkq_issue(drive, write, lba, sectors, buffer, 1);
+    }
+
+    struct blkq_waiter waiter = { .done = ATOMIC_VAR_INIT(false), .result = 0 };
+    blk_request_t req         = {
+                .lba         = lba,
+                .sectors     = sectors,
+                .buffer      = buffer,
+                .write       = write,
+                .done        = blkq_sync_done,
+                .data        = &waiter,
+                .waiter_core = (int)get_curr_core(),
+    };
+
+    int res = blkq_enqueue(drive, q, &req);
+    if (res < 0) {
+        return res;
+    }
+
+    bool interrupts_were_enabled = are_interrupts_enabled();
+
+    while (!atomic_load_explicit(&waiter.done, memory_order_acquire)) {
+        if (blkq_try_claim(q)) {
+            blkq_run(drive, q, &waiter.done);
+            continue;
+        }
+
+        if (!interrupts_were_enabled) {
+            __builtin_ia32_pause();
+            continue;
+        }
+
+        // Halt until the dispatcher completes our request or gives up dispatching. Both happen with an IPI after the
+        // state we check here has changed, and sti only takes effect after hlt, so the wakeup can't be lost.
+        asm volatile("cli");
+        if (!atomic_load_explicit(&waiter.done, memory_order_acquire)
+            && atomic_load_explicit(&q->dispatching, memory_order_acquire)) {
+            asm volatile("sti; hlt");
+        } else {
+            asm volatile("sti");
+        }
+    }
+
+    return waiter.result;
+}
+
+ssize_t blkq_read(DRIVE_t *drive, uint64_t lba, size_t sectors, void *buffer) {
+    return blkq_sync(drive, lba, sectors, buffer, false);
+}
+
+ssize_t blkq_write(DRIVE_t *drive, uint64_t lba, size_t sectors, const void *buffer) {
+    // The buffer is only ever read for writes
+    return blkq_sync(drive, lba, sectors, (void *)buffer, true);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "devices/storage/drive.h"
+#include "kernel.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Per-drive block request queue.
+ *
+ * Requests carry a completion callback and are kept sorted by LBA. Whoever submits to an idle queue becomes its
+ * dispatcher: it sweeps the queue in one direction (C-LOOK), merges each run of adjacent requests going the same way into
+ * a single read_sectors()/write_sectors() call, and completes them. Requests that have waited past their deadline are
+ * dispatched first, so a busy region of the disk can't starve the rest.
+ *
+ * A caller with several requests to make plugs the queue first (blkq_plug()), so they all queue up and get sorted and
+ * merged before anything is dispatched; blkq_unplug() then dispatches them. The bcache writeback does this.
+ *
+ * blkq_read()/blkq_write() are synchronous wrappers. While they wait they take over dispatching whenever the queue goes
+ * idle, and otherwise halt until the dispatcher wakes them. They don't wait for an unplug.
+ *
+ * Overlapping requests are not ordered against each other; wait for a write to complete before reading the same
+ * sectors back.
+ */
+
+// Maximum number of sectors merged into a single driver call
+#define BLKQ_MAX_MERGE_SECTORS 128
+
+// Reads are usually waited on, writes usually aren't
+#define BLKQ_READ_DEADLINE_MS  50
+#define BLKQ_WRITE_DEADLINE_MS 500
+
+typedef struct blk_request blk_request_t;
+
+// result is the number of bytes transferred or a negative errno
+typedef void (*blk_request_done_func_t)(blk_request_t *req, ssize_t result);
+
+struct blk_request {
+    uint64_t lba;
+    size_t sectors;
+    void *buffer; // Must stay valid until done is called
+    bool write;
+
+    // Called exactly once, from whichever context dispatched the request. req may be freed from here.
+    blk_request_done_func_t done;
+    void *data;
+
+    // Private to the queue
+    uint64_t deadline;   // In timer_now_ns() nanoseconds
+    uint64_t submit_tsc; // For the request latency histogram
+    int waiter_core;     // Core halted in blkq_read()/blkq_write() waiting on this, or -1
+    blk_request_t *next;
+};
+
+// Queues req on drive. Unless the queue is plugged, this may dispatch (and complete) requests, including req, before
+// returning. Returns 0 or a negative errno; req->done is only called if this returns 0.
+int blkq_submit(DRIVE_t *drive, blk_request_t *req);
+
+// Holds back dispatching from blkq_submit() until the matching blkq_unplug(). Plugs nest and are shared by everyone
+// submitting to the drive. The last unplug dispatches whatever queued up, unless someone else is already dispatching.
+// blkq_plug() returns 0 or a negative errno; only unplug after it succeeded.
+int blkq_plug(DRIVE_t *drive);
+void blkq_unplug(DRIVE_t *drive);
+
+// Returns bytes transferred or a negative errno
+ssize_t blkq_read(DRIVE_t *drive, uint64_t lba, size_t sectors, void *buffer);
+ssize_t blkq_write(DRIVE_t *drive, uint64_t lba, size_t sectors, const void *buffer);
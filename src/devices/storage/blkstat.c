@@ -0,0 +1,254 @@
+#include "blkstat.h"
+
+#include "drive.h"
+#include "lib/lock.h"
+#include "lib/stdio.h"
+#include "lib/string.h"
+#include "memory/kmalloc.h"
+#include "plenjos/dirent.h"
+#include "plenjos/errno.h"
+#include "vfs/kernelfs.h"
+#include "vfs/vfs.h"
+
+#define BLKSTAT_SYS_DIR   "/sys"
+#define BLKSTAT_BLOCK_DIR "/sys/block"
+#define BLKSTAT_FS_MODE   0444
+
+// Big enough for the latency file with every bucket in use
+#define BLKSTAT_TEXT_MAX 8192
+
+static mutex blkstat_register_lock = MUTEX_INIT;
+static bool blkstat_block_dir_ready = false;
+static uint32_t blkstat_next_drive  = 0;
+
+static const char *blkstat_direction_names[BLKSTAT_DIRECTIONS] = { "read", "write" };
+
+static unsigned blkstat_bucket(uint64_t cycles) {
+    unsigned bucket = cycles ? 63 - (unsigned)__builtin_clzll(cycles) : 0;
+    return bucket < BLKSTAT_HIST_BUCKETS ? bucket : BLKSTAT_HIST_BUCKETS - 1;
+}
+
+void blkstat_request_submitted(DRIVE_t *drive, bool write) {
+    struct blkstat *stats = &drive->stats;
+
+    atomic_fetch_add_explicit(&stats->dir[write].requests, 1, memory_order_relaxed);
+
+    uint_fast32_t in_flight = atomic_fetch_add_explicit(&stats->in_flight, 1, memory_order_relaxed) + 1;
+    uint_fast32_t max       = atomic_load_explicit(&stats->max_in_flight, memory_order_relaxed);
+    while (in_flight > max
+           && !atomic_compare_exchange_weak_explicit(&stats->max_in_flight, &max, in_flight, memory_order_relaxed,
+                                                     memory_order_relaxed)) {
+    }
+}
+
+void blkstat_request_completed(DRIVE_t *drive, bool write, uint64_t cycles) {
+    struct blkstat *stats = &drive->stats;
+
+    atomic_fetch_add_explicit(&stats->dir[write].request_latency[blkstat_bucket(cycles)], 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&stats->in_flight, 1, memory_order_relaxed);
+}
+
+void blkstat_command_done(DRIVE_t *drive, bool write, size_t requests, ssize_t result, uint64_t cycles) {
+    struct blkstat_direction_stats *dir = &drive->stats.dir[write];
+
+    atomic_fetch_add_explicit(&dir->commands, 1, memory_order_relaxed);
+    if (requests > 1) {
+        atomic_fetch_add_explicit(&dir->merges, requests - 1, memory_order_relaxed);
+    }
+    if (result < 0) {
+        atomic_fetch_add_explicit(&dir->errors, 1, memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit(&dir->bytes, (uint64_t)result, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&dir->device_latency[blkstat_bucket(cycles)], 1, memory_order_relaxed);
+}
+
+// Text output (there is no snprintf in the kernel yet)
+
+struct blkstat_text {
+    char *buf;
+    size_t len;
+    size_t cap; // Output stops here
+};
+
+static void blkstat_put_str(struct blkstat_text *text, const char *str) {
+    while (*str && text->len < text->cap) {
+        text->buf[text->len++] = *str++;
+    }
+}
+
+static void blkstat_put_u64(struct blkstat_text *text, uint64_t value) {
+    char digits[21];
+    size_t n = 0;
+
+    do {
+        digits[n++]  = (char)('0' + value % 10);
+        value       /= 10;
+    } while (value);
+
+    while (n && text->len < text->cap) {
+        text->buf[text->len++] = digits[--n];
+    }
+}
+
+static void blkstat_put_field(struct blkstat_text *text, const char *prefix, const char *name, uint64_t value) {
+    if (prefix) {
+        blkstat_put_str(text, prefix);
+        blkstat_put_str(text, "_");
+    }
+    blkstat_put_str(text, name);
+    blkstat_put_str(text, " ");
+    blkstat_put_u64(text, value);
+    blkstat_put_str(text, "\n");
+}
+
+static void blkstat_format_stat(DRIVE_t *drive, struct blkstat_text *text) {
+    struct blkstat *stats = &drive->stats;
+
+    blkstat_put_str(text, "model ");
+    blkstat_put_str(text, drive->model);
+    blkstat_put_str(text, "\ninterface ");
+    blkstat_put_str(text, drive->interface);
+    blkstat_put_str(text, "\n");
+    blkstat_put_field(text, NULL, "sectors", drive->numsectors);
+    blkstat_put_field(text, NULL, "sector_size", drive->logical_sector_size);
+
+    for (int d = 0; d < BLKSTAT_DIRECTIONS; d++) {
+        struct blkstat_direction_stats *dir = &stats->dir[d];
+        const char *name                    = blkstat_direction_names[d];
+
+        blkstat_put_field(text, name, "requests", atomic_load_explicit(&dir->requests, memory_order_relaxed));
+        blkstat_put_field(text, name, "merges", atomic_load_explicit(&dir->merges, memory_order_relaxed));
+        blkstat_put_field(text, name, "commands", atomic_load_explicit(&dir->commands, memory_order_relaxed));
+        blkstat_put_field(text, name, "bytes", atomic_load_explicit(&dir->bytes, memory_order_relaxed));
+        blkstat_put_field(text, name, "errors", atomic_load_explicit(&dir->errors, memory_order_relaxed));
+    }
+
+    blkstat_put_field(text, NULL, "in_flight", atomic_load_explicit(&stats->in_flight, memory_order_relaxed));
+    blkstat_put_field(text, NULL, "max_in_flight", atomic_load_explicit(&stats->max_in_flight, memory_order_relaxed));
+}
+
+// One line per bucket that has any samples: the bucket's log2, then read device/request and write device/request counts
+static void blkstat_format_latency(DRIVE_t *drive, struct blkstat_text *text) {
+    struct blkstat *stats = &drive->stats;
+
+    blkstat_put_str(text, "# log2_cycles read_device read_request write_device write_request\n");
+
+    for (unsigned b = 0; b < BLKSTAT_HIST_BUCKETS; b++) {
+        uint64_t counts[2 * BLKSTAT_DIRECTIONS];
+        bool any = false;
+
+        for (int d = 0; d < BLKSTAT_DIRECTIONS; d++) {
+            counts[2 * d]     = atomic_load_explicit(&stats->dir[d].device_latency[b], memory_order_relaxed);
+            counts[2 * d + 1] = atomic_load_explicit(&stats->dir[d].request_latency[b], memory_order_relaxed);
+            any               = any || counts[2 * d] || counts[2 * d + 1];
+        }
+
+        if (!any) {
+            continue;
+        }
+
+        blkstat_put_u64(text, b);
+        for (int i = 0; i < 2 * BLKSTAT_DIRECTIONS; i++) {
+            blkstat_put_str(text, " ");
+            blkstat_put_u64(text, counts[i]);
+        }
+        blkstat_put_str(text, "\n");
+    }
+}
+
+// Formats the whole file on every read and copies out the part at the handle's position
+static ssize_t blkstat_file_read(vfs_handle_t *handle, void *buf, size_t len,
+                                 void (*format)(DRIVE_t *, struct blkstat_text *)) {
+    kernelfs_node_t *node = kernelfs_get_node_from_handle(handle);
+    if (!node || !node->func_args || !buf) {
+        return -EIO;
+    }
+
+    struct blkstat_text text = { .buf = kmalloc_heap(BLKSTAT_TEXT_MAX), .len = 0, .cap = BLKSTAT_TEXT_MAX };
+    if (!text.buf) {
+        return -ENOMEM;
+    }
+
+    format((DRIVE_t *)node->func_args, &text);
+
+    kernelfs_handle_instance_data_t *instance_data = (kernelfs_handle_instance_data_t *)handle->instance_data;
+
+    size_t copylen = 0;
+    if (instance_data->pos < text.len) {
+        copylen = min(text.len - instance_data->pos, len);
+        memcpy(buf, text.buf + instance_data->pos, copylen);
+        instance_data->pos += copylen;
+    }
+
+    kfree_heap(text.buf);
+
+    return (ssize_t)copylen;
+}
+
+static ssize_t blkstat_stat_read(vfs_handle_t *handle, void *buf, size_t len) {
+    return blkstat_file_read(handle, buf, len, blkstat_format_stat);
+}
+
+static ssize_t blkstat_latency_read(vfs_handle_t *handle, void *buf, size_t len) {
+    return blkstat_file_read(handle, buf, len, blkstat_format_latency);
+}
+
+// blkstat_register_lock must be held
+static int blkstat_make_block_dir() {
+    if (blkstat_block_dir_ready) {
+        return 0;
+    }
+
+    int res = vfs_mkdir(BLKSTAT_SYS_DIR, 0, 0, 0755);
+    if (res < 0 && res != -EEXIST) {
+        return res;
+    }
+    res = vfs_mkdir(BLKSTAT_BLOCK_DIR, 0, 0, 0755);
+    if (res < 0 && res != -EEXIST) {
+        return res;
+    }
+
+    blkstat_block_dir_ready = true;
+    return 0;
+}
+
+int blkstat_register(DRIVE_t *drive) {
+    if (!drive) {
+        return -EINVAL;
+    }
+
+    mutex_lock(&blkstat_register_lock);
+
+    int res = blkstat_make_block_dir();
+    if (res < 0) {
+        mutex_unlock(&blkstat_register_lock);
+        kout(KERNEL_WARN, "blkstat: could not create %s: %d\n", BLKSTAT_BLOCK_DIR, res);
+        return res;
+    }
+
+    // "/sys/block/drive" + up to 20 digits; the terminator's byte is left out of cap
+    char path[sizeof(BLKSTAT_BLOCK_DIR "/drive") + 20];
+    struct blkstat_text text = { .buf = path, .len = 0, .cap = sizeof(path) - 1 };
+    blkstat_put_str(&text, BLKSTAT_BLOCK_DIR "/drive");
+    blkstat_put_u64(&text, blkstat_next_drive++);
+    path[text.len] = '\0';
+
+    res = vfs_mkdir(path, 0, 0, 0755);
+    if (res == 0) {
+        res = kernelfs_helper_create_file(path, "stat", DT_REG, 0, 0, BLKSTAT_FS_MODE, blkstat_stat_read, NULL, NULL,
+                                          drive);
+    }
+    if (res == 0) {
+        res = kernelfs_helper_create_file(path, "latency", DT_REG, 0, 0, BLKSTAT_FS_MODE, blkstat_latency_read, NULL,
+                                          NULL, drive);
+    }
+
+    mutex_unlock(&blkstat_register_lock);
+
+    if (res < 0) {
+        kout(KERNEL_WARN, "blkstat: could not create %s: %d\n", path, res);
+    }
+
+    return res;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "kernel.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Per-drive I/O statistics, kept by the block request queue and readable as text under /sys/block/<drive>/ once the
+ * drive has been registered:
+ *
+ *  - stat:    request, merge, command, byte and error counts per direction, plus how many requests are in flight
+ *  - latency: log2 histograms of driver command latency ("device") and of submission-to-completion latency
+ *             ("request", which adds the time spent queued), in TSC cycles
+ *
+ * Comparing the two histograms tells whether slow I/O comes from the device itself or from waiting on the queue.
+ */
+
+typedef struct DRIVE DRIVE_t;
+
+// Bucket i counts latencies in [2^i, 2^(i+1)) cycles; bucket 0 also counts 0 and the last bucket everything above
+#define BLKSTAT_HIST_BUCKETS 48
+
+enum blkstat_direction {
+    BLKSTAT_READ,
+    BLKSTAT_WRITE,
+    BLKSTAT_DIRECTIONS,
+};
+
+struct blkstat_direction_stats {
+    atomic_uint_fast64_t requests; // Submitted to the queue
+    atomic_uint_fast64_t merges;   // Requests that were issued as part of another request's driver command
+    atomic_uint_fast64_t commands; // Driver calls
+    atomic_uint_fast64_t bytes;    // Transferred by successful driver calls
+    atomic_uint_fast64_t errors;   // Failed driver calls
+
+    atomic_uint_fast64_t device_latency[BLKSTAT_HIST_BUCKETS];
+    atomic_uint_fast64_t request_latency[BLKSTAT_HIST_BUCKETS];
+};
+
+struct blkstat {
+    struct blkstat_direction_stats dir[BLKSTAT_DIRECTIONS];
+
+    atomic_uint_fast32_t in_flight; // Requests submitted but not yet completed
+    atomic_uint_fast32_t max_in_flight;
+};
+
+// Called by blkq as requests move through the queue. cycles are TSC deltas.
+void blkstat_request_submitted(DRIVE_t *drive, bool write);
+void blkstat_request_completed(DRIVE_t *drive, bool write, uint64_t cycles);
+void blkstat_command_done(DRIVE_t *drive, bool write, size_t requests, ssize_t result, uint64_t cycles);
+
+// Creates /sys/block/driveN for drive (N counts up from 0 in registration order). Safe to call concurrently.
+int blkstat_register(DRIVE_t *drive);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "blkstat.h"
 #include "kernel.h"
 
 #include <stddef.h>
@@ -7,8 +8,11 @@
 
 typedef struct DRIVE DRIVE_t;
 
+struct blk_queue;
+
 typedef ssize_t (*drive_read_sectors_func_t)(DRIVE_t *drive, uint64_t lba, size_t sectors, void *buffer);
 typedef ssize_t (*drive_write_sectors_func_t)(DRIVE_t *drive, uint64_t lba, size_t sectors, const void *buffer);
+typedef int (*drive_flush_cache_func_t)(DRIVE_t *drive);
 
 struct DRIVE {
     uint64_t numsectors;
@@ -20,10 +24,19 @@ struct DRIVE {
 
     drive_read_sectors_func_t read_sectors;
     drive_write_sectors_func_t write_sectors;
+    // Optional; makes completed writes durable if the drive has a volatile write cache. write_sectors() doesn't do this
+    // itself, so the block cache calls it once per fsync/flusher pass rather than after every command.
+    drive_flush_cache_func_t flush_cache;
 
     // Optional; for convenience
     uint32_t irq;
 
     void *internal_data;
+
+    // Request queue; created by blkq on first use, so drivers should zero-initialize this
+    struct blk_queue *queue;
+
+    // Updated by the request queue; also needs zero-initializing
+    struct blkstat stats;
 };
 
@@ -0,0 +1,168 @@
+#include "gpt.h"
+
+#include "blkq.h"
+#include "lib/crc32.h"
+#include "lib/stdio.h"
+#include "memory/kmalloc.h"
+#include "plenjos/errno.h"
+
+// Type GUIDs in their on-disk (mixed-endian) byte order
+static const uint8_t gpt_type_efi_system[16] = { 0x28, 0x73, 0x2A, 0xC1, 0x1F, 0xF8, 0xD2, 0x11,
+                                                 0xBA, 0x4B, 0x00, 0xA0, 0xC9, 0x3E, 0xC9, 0x3B };
+static const uint8_t gpt_type_basic_data[16] = { 0xA2, 0xA0, 0xD0, 0xEB, 0xE5, 0xB9, 0x33, 0x44,
+                                                 0x87, 0xC0, 0x68, 0xB6, 0xB7, 0x26, 0x99, 0xC7 };
+static const uint8_t gpt_type_bios_boot[16]  = { 0x48, 0x61, 0x68, 0x21, 0x49, 0x64, 0x6F, 0x6E,
+                                                 0x74, 0x4E, 0x65, 0x65, 0x64, 0x45, 0x46, 0x49 };
+static const uint8_t gpt_type_linux_fs[16]   = { 0xAF, 0x3D, 0xC6, 0x0F, 0x83, 0x84, 0x72, 0x47,
+                                                 0x8E, 0x79, 0x3D, 0x69, 0xD8, 0x47, 0x7D, 0xE4 };
+static const uint8_t gpt_type_linux_swap[16] = { 0x6D, 0xFD, 0x57, 0x06, 0xAB, 0xA4, 0xC4, 0x43,
+                                                 0x84, 0xE5, 0x09, 0x33, 0xC8, 0x4B, 0x4F, 0x4F };
+
+// Reads the header at lba into header_out and validates everything that can be checked without the entry array
+static int gpt_read_header(DRIVE_t *drive, uint64_t lba, uint8_t *sector_buf, struct gpt_header *header_out) {
+    uint32_t ss = drive->logical_sector_size;
+
+    ssize_t res = blkq_read(drive, lba, 1, sector_buf);
+    if (res < 0) {
+        return (int)res;
+    }
+
+    memcpy(header_out, sector_buf, sizeof(struct gpt_header));
+
+    if (memcmp(header_out->signature, GPT_SIGNATURE, 8) != 0) {
+        return -EINVAL;
+    }
+    if (header_out->header_size < sizeof(struct gpt_header) || header_out->header_size > ss) {
+        return -EINVAL;
+    }
+
+    // The CRC covers the header with its own CRC field zeroed
+    uint32_t expected = header_out->header_crc32;
+
+    ((struct gpt_header *)sector_buf)->header_crc32 = 0;
+    if (crc32(0, sector_buf, header_out->header_size) != expected) {
+        return -EINVAL;
+    }
+
+    if (header_out->my_lba != lba || header_out->partition_entry_size < sizeof(struct gpt_partition_entry)
+        || (header_out->partition_entry_size % 8) != 0) {
+        return -EINVAL;
+    }
+
+    uint64_t array_bytes = (uint64_t)header_out->num_partition_entries * header_out->partition_entry_size;
+    if (array_bytes == 0 || array_bytes > GPT_MAX_ENTRY_ARRAY_BYTES) {
+        return -EINVAL;
+    }
+
+    uint64_t array_sectors = (array_bytes + ss - 1) / ss;
+    if (header_out->partition_entry_lba + array_sectors > drive->numsectors) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+static int gpt_read_entries(DRIVE_t *drive, struct gpt_header *header, uint8_t **entries_out) {
+    uint32_t ss          = drive->logical_sector_size;
+    size_t array_bytes   = (size_t)header->num_partition_entries * header->partition_entry_size;
+    size_t array_sectors = (array_bytes + ss - 1) / ss;
+
+    uint8_t *entries = kmalloc_heap(array_sectors * ss);
+    if (!entries) {
+        kout(KERNEL_SEVERE_FAULT, "OOM Error: could not allocate memory for GPT partition entries\n");
+        return -ENOMEM;
+    }
+
+    ssize_t res = blkq_read(drive, header->partition_entry_lba, array_sectors, entries);
+    if (res < 0) {
+        kfree_heap(entries);
+        return (int)res;
+    }
+
+    if (crc32(0, entries, array_bytes) != header->partition_entry_array_crc32) {
+        kfree_heap(entries);
+        return -EINVAL;
+    }
+
+    *entries_out = entries;
+    return 0;
+}
+
+int gpt_read(DRIVE_t *drive, struct gpt_header *header_out, uint8_t **entries_out) {
+    if (!drive || !header_out || !entries_out || drive->numsectors < 3) {
+        return -EINVAL;
+    }
+
+    uint8_t *sector_buf = kmalloc_heap(drive->logical_sector_size);
+    if (!sector_buf) {
+        kout(KERNEL_SEVERE_FAULT, "OOM Error: could not allocate memory for GPT header\n");
+        return -ENOMEM;
+    }
+
+    // Primary header at LBA 1; the backup is normally in the last sector, which the primary also records
+    int res = gpt_read_header(drive, 1, sector_buf, header_out);
+    if (res == 0) {
+        res = gpt_read_entries(drive, header_out, entries_out);
+    }
+
+    if (res != 0) {
+        uint64_t backup_lba = drive->numsectors - 1;
+        kout(KERNEL_WARN, "GPT: primary table invalid (%d); trying the backup at lba %p\n", res, (void *)backup_lba);
+
+        res = gpt_read_header(drive, backup_lba, sector_buf, header_out);
+        if (res == 0) {
+            res = gpt_read_entries(drive, header_out, entries_out);
+        }
+    }
+
+    kfree_heap(sector_buf);
+
+    if (res != 0) {
+        return res;
+    }
+
+    return (int)header_out->num_partition_entries;
+}
+
+gpt_partition_kind_t gpt_partition_kind(const struct gpt_partition_entry *entry) {
+    static const uint8_t unused[16] = { 0 };
+
+    if (memcmp(entry->type_guid, unused, 16) == 0) {
+        return GPT_PARTITION_UNUSED;
+    }
+    if (memcmp(entry->type_guid, gpt_type_efi_system, 16) == 0) {
+        return GPT_PARTITION_EFI_SYSTEM;
+    }
+    if (memcmp(entry->type_guid, gpt_type_basic_data, 16) == 0) {
+        return GPT_PARTITION_BASIC_DATA;
+    }
+    if (memcmp(entry->type_guid, gpt_type_bios_boot, 16) == 0) {
+        return GPT_PARTITION_BIOS_BOOT;
+    }
+    if (memcmp(entry->type_guid, gpt_type_linux_fs, 16) == 0) {
+        return GPT_PARTITION_LINUX_FILESYSTEM;
+    }
+    if (memcmp(entry->type_guid, gpt_type_linux_swap, 16) == 0) {
+        return GPT_PARTITION_LINUX_SWAP;
+    }
+    return GPT_PARTITION_OTHER;
+}
+
+const char *gpt_partition_kind_pretty(gpt_partition_kind_t kind) {
+    switch (kind) {
+    case GPT_PARTITION_UNUSED:
+        return "Unused";
+    case GPT_PARTITION_EFI_SYSTEM:
+        return "EFI System Partition";
+    case GPT_PARTITION_BASIC_DATA:
+        return "Basic Data";
+    case GPT_PARTITION_BIOS_BOOT:
+        return "BIOS Boot Partition";
+    case GPT_PARTITION_LINUX_FILESYSTEM:
+        return "Linux Filesystem";
+    case GPT_PARTITION_LINUX_SWAP:
+        return "Linux Swap";
+    default:
+        return "Unknown";
+    }
+}
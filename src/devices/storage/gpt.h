@@ -0,0 +1,61 @@
+#pragma once
+
+#include "drive.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// UEFI Specification 2.10, section 5.3 (GUID Partition Table Disk Layout)
+
+#define GPT_SIGNATURE "EFI PART"
+
+// Partition entry arrays larger than this are rejected (the usual array is 128 * 128 bytes = 16 KiB)
+#define GPT_MAX_ENTRY_ARRAY_BYTES (1024 * 1024)
+
+struct gpt_header {
+    char signature[8];
+    uint32_t revision;
+    uint32_t header_size;
+    uint32_t header_crc32; // Over header_size bytes, with this field zeroed
+    uint32_t reserved;
+    uint64_t my_lba;
+    uint64_t alternate_lba;
+    uint64_t first_usable_lba;
+    uint64_t last_usable_lba;
+    uint8_t disk_guid[16];
+    uint64_t partition_entry_lba;
+    uint32_t num_partition_entries;
+    uint32_t partition_entry_size;
+    uint32_t partition_entry_array_crc32;
+} __attribute__((packed));
+
+struct gpt_partition_entry {
+    uint8_t type_guid[16]; // All zero = unused
+    uint8_t unique_guid[16];
+    uint64_t starting_lba; // In logical sectors (unlike MBR)
+    uint64_t ending_lba;   // Inclusive
+    uint64_t attributes;
+    uint16_t name[36]; // UTF-16LE
+} __attribute__((packed));
+
+typedef enum gpt_partition_kind {
+    GPT_PARTITION_UNUSED,
+    GPT_PARTITION_EFI_SYSTEM,
+    GPT_PARTITION_BASIC_DATA, // FAT, exFAT or NTFS; the boot sector tells which
+    GPT_PARTITION_BIOS_BOOT,
+    GPT_PARTITION_LINUX_FILESYSTEM,
+    GPT_PARTITION_LINUX_SWAP,
+    GPT_PARTITION_OTHER,
+} gpt_partition_kind_t;
+
+/**
+ * Reads and validates the GPT on drive, falling back to the backup header at the end of the disk if the primary one is
+ * damaged. On success, *entries_out is a kmalloc'd copy of the partition entry array (free it with kfree_heap) and
+ * the number of entries is returned; entries are header.partition_entry_size bytes apart. Returns a negative errno if
+ * neither copy is valid.
+ */
+int gpt_read(DRIVE_t *drive, struct gpt_header *header_out, uint8_t **entries_out);
+
+gpt_partition_kind_t gpt_partition_kind(const struct gpt_partition_entry *entry);
+const char *gpt_partition_kind_pretty(gpt_partition_kind_t kind);
@@ -2,7 +2,11 @@
 
 #ifdef __KERNEL_SUPPORT_DEV_STORAGE_IDE
 
+# include "arch/x86_64/apic/apic.h"
+# include "arch/x86_64/apic/ioapic.h"
+# include "arch/x86_64/common.h"
 # include "arch/x86_64/irq.h"
+# include "cpu/cpu.h"
 # include "devices/io/ports.h"
 # include "kernel.h"
 # include "lib/lock.h"
@@ -10,7 +14,9 @@
 # include "lib/string.h"
 # include "mbr.h"
 # include "memory/kmalloc.h"
-# include "timer/pit.h"
+# include "memory/mm.h"
+# include "plenjos/errno.h"
+# include "timer/timer.h"
 
 # ifdef __KERNEL_SUPPORT_DEV_STORAGE_ATA
 #  include "devices/storage/ata/ata.h"
@@ -36,6 +42,7 @@ struct ide_channel legacy_ide_channels[2] = {
      .irq_no      = 14,
      .irq_cnt     = ATOMIC_VAR_INIT(0),
      .last_status = ATOMIC_VAR_INIT(0),
+     .waiter_core = ATOMIC_VAR_INIT(-1),
      .lock        = MUTEX_INIT,
      .selected    = -1 },
     { .cmd_base    = IDE_SECONDARY_CMD_BASE,
@@ -43,10 +50,16 @@ struct ide_channel legacy_ide_channels[2] = {
      .irq_no      = 15,
      .irq_cnt     = ATOMIC_VAR_INIT(0),
      .last_status = ATOMIC_VAR_INIT(0),
+     .waiter_core = ATOMIC_VAR_INIT(-1),
      .lock        = MUTEX_INIT,
      .selected    = -1 },
 };
 
+// Shared by every open IRQ window; the first opener saves the IOAPIC state and the last closer restores it
+static mutex ide_irq_window_lock = MUTEX_INIT;
+static int ide_irq_window_users  = 0;
+static uint32_t ide_irq_window_saved_masks[IDE_IOAPIC_MASK_IRQS];
+
 static void ide_lock_channel(struct ide_channel *channel) {
     mutex_lock(&channel->lock);
 }
@@ -107,7 +120,7 @@ enum ata_device_type ide_probe_device(struct ide_channel *channel, int drive_no,
 
     /* Send IDENTIFY command */
     outb(channel->cmd_base + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
-    pit_sleep(1); // Wait 1ms for device to respond
+    ksleep_blocking_ms(1, NULL); // Wait 1ms for device to respond
 
     /* Read status */
     status = inb(channel->cmd_base + ATA_REG_STATUS);
@@ -142,7 +155,7 @@ enum ata_device_type ide_probe_device(struct ide_channel *channel, int drive_no,
 
         // Now, send the IDENTIFY PACKET command (for packet devices)
         outb(channel->cmd_base + ATA_REG_COMMAND, ATA_CMD_IDENTIFY_PACKET);
-        pit_sleep(1); // Wait 1ms for device to respond
+        ksleep_blocking_ms(1, NULL); // Wait 1ms for device to respond
     } else {
         if (lba1 == 0 && lba2 == 0) {
             type = ATADEV_PATA; // PATA device
@@ -220,6 +233,14 @@ enum ata_device_type ide_probe_device(struct ide_channel *channel, int drive_no,
 
     dev->flags |= IDE_DEVICE_FLAG_PRESENT;
 
+    // IDENTIFY (PACKET) word 49 bit 8: DMA supported. We rely on the firmware having picked a transfer mode.
+    if (dev->identify_raw[49] & (1 << 8)) {
+        dev->flags |= IDE_DEVICE_FLAG_DMA_SUPPORT;
+        if (channel->bmide_base) {
+            dev->flags |= IDE_DEVICE_FLAG_DMA_ENABLED;
+        }
+    }
+
     dev->drive.internal_data = (void *)dev;
     strncpy(dev->drive.model, dev->identify.model, 40);
     dev->drive.model[40] = '\0';
@@ -234,11 +255,13 @@ enum ata_device_type ide_probe_device(struct ide_channel *channel, int drive_no,
     case ATADEV_PATAPI: {
         dev->drive.read_sectors  = atapi_read_sectors_func;
         dev->drive.write_sectors = NULL; // Not supported
+        dev->drive.flush_cache   = NULL;
         break;
     }
     case ATADEV_PATA: {
         dev->drive.read_sectors  = pata_read_sectors_func;
-        dev->drive.write_sectors = NULL; // TODO: implement
+        dev->drive.write_sectors = pata_write_sectors_func;
+        dev->drive.flush_cache   = pata_flush_cache_func;
         break;
     }
     default: {
@@ -256,6 +279,7 @@ enum ata_device_type ide_probe_device(struct ide_channel *channel, int drive_no,
 }
 
 void ide_irq_routine(registers_t *regs, void *data) {
+    (void)regs;
     struct ide_channel *channel = (struct ide_channel *)data;
 
     if (!mutex_is_locked(&channel->lock)) {
@@ -272,29 +296,94 @@ void ide_irq_routine(registers_t *regs, void *data) {
     atomic_store(&channel->last_status, inb(channel->cmd_base + ATA_REG_STATUS));
 
     // Increment IRQ processing count
-    if (atomic_fetch_add_explicit(&channel->irq_cnt, 1, memory_order_acquire) > 0) {
+    if (atomic_fetch_add_explicit(&channel->irq_cnt, 1, memory_order_acq_rel) > 0) {
         kout_nolock(
             KERNEL_WARN,
             "KERNEL ERROR/WARN: IDE bus w/ IRQ %d has multiple (%d) IRQs being processed simultaneously. IRQs may be "
             "lost. Are we moving too slowly?\n",
             (int)channel->irq_no, (int)atomic_load_explicit(&channel->irq_cnt, memory_order_acquire));
     }
+
+    // Wake the core sleeping on this channel. If it's us, returning from the IRQ already breaks it out of hlt.
+    int waiter = atomic_load_explicit(&channel->waiter_core, memory_order_acquire);
+    if (waiter >= 0 && (uint32_t)waiter != get_curr_core()) {
+        send_ipi(cpu_cores[waiter].lapic_id, IPI_WAKEUP_IRQ + 32);
+    }
+}
+
+// Finds the PCI IDE controller behind the legacy channels and sets up bus master DMA on both of them
+static void ide_setup_bus_master() {
+# ifdef __KERNEL_SUPPORT_DEV_PCI
+    for (uint32_t i = 0; i < pci_device_count; i++) {
+        pci_device_t *pci_dev = &pci_devices[i];
+
+        if (pci_dev->class_code != PCI_CLASS_MASS_STORAGE || pci_dev->subclass_code != PCI_SUBCLASS_IDE
+            || !(pci_dev->prog_if & PCI_PROGIF_IDE_MASTER_DMA)) {
+            continue;
+        }
+
+        // BAR4 must be an I/O BAR
+        if (!(pci_dev->bar4 & 0x1) || (pci_dev->bar4 & ~0x3U) == 0) {
+            kout(KERNEL_WARN, "IDE: controller has no usable bus master BAR (bar4=%x); using PIO only\n", pci_dev->bar4);
+            return;
+        }
+
+        uint16_t bmide_base = (uint16_t)(pci_dev->bar4 & ~0x3U);
+
+        pci_set_command_bits(pci_dev->bus, pci_dev->device, pci_dev->function,
+                             PCI_CMD_IO_SPACE | PCI_CMD_BUS_MASTER);
+
+        for (int ch = 0; ch < 2; ch++) {
+            struct ide_channel *channel = &legacy_ide_channels[ch];
+
+            // The PRD table must be dword aligned, below 4 GiB and must not cross a 64 KiB boundary; one frame is all
+            // three
+            uint64_t prdt_phys = find_next_free_frame();
+            if (prdt_phys == 0 || prdt_phys >= UINT32_MAX) {
+                kout(KERNEL_WARN, "IDE: couldn't allocate a PRD table below 4 GiB; channel %d stays on PIO\n", ch);
+                continue;
+            }
+
+            channel->prdt_phys  = prdt_phys;
+            channel->prdt       = (struct ide_prd *)phys_to_virt(prdt_phys);
+            channel->bmide_base = bmide_base + (ch ? 8 : 0);
+            memset(channel->prdt, 0, 4096);
+
+            // Stop the engine and clear any stale status (ERR and IRQ are write-1-to-clear)
+            outb(channel->bmide_base + IDE_BMR_COMMAND, 0);
+            outb(channel->bmide_base + IDE_BMR_STATUS, IDE_BMR_STATUS_ERR | IDE_BMR_STATUS_IRQ);
+        }
+
+        kout(KERNEL_INFO, "IDE: bus master DMA enabled (io=%x)\n", (uint32_t)bmide_base);
+        return;
+    }
+# endif
 }
 
 void ide_init() {
     // IDE currently only supports legacy channels, not PCI IDE controllers w/ different I/O bases
+    ide_setup_bus_master();
+
     irq_register_routine(IDE_PRIMARY_IRQ, ide_irq_routine, &legacy_ide_channels[0]);
     irq_register_routine(IDE_SECONDARY_IRQ, ide_irq_routine, &legacy_ide_channels[1]);
 
-    if (!(ide_probe_device(&legacy_ide_channels[0], 0, &legacy_ide_devices[0])
-          || ide_probe_device(&legacy_ide_channels[0], 1, &legacy_ide_devices[1]))) {
-        // Device(s) found on primary channel
+    // Make sure nIEN is clear so the devices actually raise IRQs; every transfer depends on them now
+    outb(legacy_ide_channels[0].ctrl_base, 0);
+    outb(legacy_ide_channels[1].ctrl_base, 0);
+
+    // Probe both drives on each channel (no short-circuiting; the slave must be probed even if the master exists)
+    bool primary_found    = ide_probe_device(&legacy_ide_channels[0], 0, &legacy_ide_devices[0]) != ATADEV_NONE;
+    primary_found        |= ide_probe_device(&legacy_ide_channels[0], 1, &legacy_ide_devices[1]) != ATADEV_NONE;
+    bool secondary_found  = ide_probe_device(&legacy_ide_channels[1], 0, &legacy_ide_devices[2]) != ATADEV_NONE;
+    secondary_found      |= ide_probe_device(&legacy_ide_channels[1], 1, &legacy_ide_devices[3]) != ATADEV_NONE;
+
+    if (!primary_found) {
+        // No device(s) found on primary channel
         kout(KERNEL_INFO, "Unregistering primary IDE IRQ handler\n");
         irq_unregister_routine(IDE_PRIMARY_IRQ);
     }
-    if (ide_probe_device(&legacy_ide_channels[1], 0, &legacy_ide_devices[2])
-        || ide_probe_device(&legacy_ide_channels[1], 1, &legacy_ide_devices[3])) {
-        // Device(s) found on secondary channel
+    if (!secondary_found) {
+        // No device(s) found on secondary channel
         kout(KERNEL_INFO, "Unregistering secondary IDE IRQ handler\n");
         irq_unregister_routine(IDE_SECONDARY_IRQ);
     }
@@ -323,14 +412,170 @@ int ide_select_bus(struct ide_device *dev) {
     return 0;
 }
 
+void ide_irq_window_open(struct ide_irq_window *window) {
+    window->interrupts_were_enabled = are_interrupts_enabled();
+    window->masked                  = false;
+
+    if (window->interrupts_were_enabled) {
+        return;
+    }
+
+    mutex_lock(&ide_irq_window_lock);
+    if (ide_irq_window_users++ == 0) {
+        ioapic_mask_all_except(IDE_PRIMARY_IRQ, ide_irq_window_saved_masks, IDE_IOAPIC_MASK_IRQS);
+        ioapic_set_masked(IDE_SECONDARY_IRQ, false);
+
+        // Keep the PIT running so ide_wait_for_irq() can time out on the BSP
+        ioapic_set_masked(0, false);
+        ioapic_set_masked(2, false);
+    }
+    mutex_unlock(&ide_irq_window_lock);
+
+    window->masked = true;
+}
+
+void ide_irq_window_close(struct ide_irq_window *window) {
+    if (!window->masked) {
+        return;
+    }
+
+    mutex_lock(&ide_irq_window_lock);
+    if (--ide_irq_window_users == 0) {
+        ioapic_restore_masks(ide_irq_window_saved_masks, IDE_IOAPIC_MASK_IRQS);
+    }
+    mutex_unlock(&ide_irq_window_lock);
+
+    window->masked = false;
+}
+
+void ide_prepare_irq(struct ide_device *dev) {
+    atomic_store_explicit(&dev->channel->last_status, 0, memory_order_release);
+    atomic_store_explicit(&dev->channel->irq_cnt, 0, memory_order_release);
+}
+
 int ide_wait_for_irq(struct ide_device *dev) {
-    while (atomic_load_explicit(&dev->channel->irq_cnt, memory_order_acquire) == 0) {
-        // Wait for IRQ to be processed
-        // TODO: this might need to be something else if the driver runs on a different core from the IRQ handler
-        // asm volatile("hlt");
-        asm volatile("pause");
+    struct ide_channel *channel  = dev->channel;
+    bool interrupts_were_enabled = are_interrupts_enabled();
+    int res                      = 0;
+
+    uint64_t deadline = timer_now_ns() + IDE_IRQ_TIMEOUT_MS * TIMER_NS_PER_MS;
+
+    atomic_store_explicit(&channel->waiter_core, (int)get_curr_core(), memory_order_release);
+
+    // Nothing else is guaranteed to wake this core from hlt if the IRQ never comes
+    int wakeup = set_core_wakeup_timeout(IDE_IRQ_TIMEOUT_MS, get_curr_core(), NULL);
+
+    while (true) {
+        asm volatile("cli");
+
+        if (atomic_load_explicit(&channel->irq_cnt, memory_order_acquire) != 0) {
+            break;
+        }
+
+        if (timer_now_ns() >= deadline) {
+            res = -ETIMEDOUT;
+            break;
+        }
+
+        // sti only takes effect after the following instruction, so an IRQ that arrives after the check above still
+        // wakes us from this hlt instead of being lost
+        asm volatile("sti; hlt");
+    }
+
+    atomic_store_explicit(&channel->waiter_core, -1, memory_order_release);
+    cancel_timeout(wakeup);
+
+    if (interrupts_were_enabled) {
+        asm volatile("sti");
+    }
+
+    if (res != 0) {
+        kout(KERNEL_EXTERNAL_FAULT, "Error: timed out waiting for IRQ %d on IDE channel (io=%x, drive=%d)\n",
+             (int)channel->irq_no, (uint32_t)channel->cmd_base, dev->drive_no);
+    }
+
+    return res;
+}
+
+bool ide_dma_usable(struct ide_device *dev, size_t bytes) {
+    return (dev->flags & IDE_DEVICE_FLAG_DMA_ENABLED) && bytes >= IDE_DMA_MIN_BYTES;
+}
+
+int ide_dma_prepare(struct ide_device *dev, void *buffer, size_t bytes, bool to_device) {
+    struct ide_channel *channel = dev->channel;
+
+    if (!channel->bmide_base || bytes == 0 || ((uint64_t)buffer & 1) || (bytes & 1)) {
+        return -EINVAL;
+    }
+
+    uint64_t virt    = (uint64_t)buffer;
+    size_t remaining = bytes;
+    size_t n         = 0;
+
+    while (remaining > 0) {
+        size_t chunk = PAGE_LEN - (virt & (PAGE_LEN - 1));
+        if (chunk > remaining) {
+            chunk = remaining;
+        }
+
+        uint64_t phys = get_kernel_physaddr(virt);
+        if (phys == 0 || phys + chunk > 0x100000000ULL) {
+            return -EINVAL;
+        }
+
+        // A chunk never crosses a page, so it can only cross a 64 KiB boundary by being merged into the previous PRD
+        struct ide_prd *prev = n ? &channel->prdt[n - 1] : NULL;
+        uint32_t prev_len    = prev ? (prev->byte_count ? prev->byte_count : 0x10000) : 0;
+        if (prev && prev->phys + prev_len == phys && (prev->phys & 0xFFFF) + prev_len + chunk <= 0x10000) {
+            prev->byte_count = (uint16_t)(prev_len + chunk); // Wraps to 0 (= 64 KiB) when the window is full
+        } else {
+            if (n >= IDE_PRDT_ENTRIES) {
+                return -EINVAL;
+            }
+            channel->prdt[n].phys       = (uint32_t)phys;
+            channel->prdt[n].byte_count = (uint16_t)chunk;
+            channel->prdt[n].flags      = 0;
+            n++;
+        }
+
+        virt      += chunk;
+        remaining -= chunk;
     }
+
+    channel->prdt[n - 1].flags = IDE_PRD_EOT;
+
+    outb(channel->bmide_base + IDE_BMR_COMMAND, 0);
+    outl(channel->bmide_base + IDE_BMR_PRDT, (uint32_t)channel->prdt_phys);
+    outb(channel->bmide_base + IDE_BMR_COMMAND, to_device ? 0 : IDE_BMR_CMD_READ);
+    outb(channel->bmide_base + IDE_BMR_STATUS, IDE_BMR_STATUS_ERR | IDE_BMR_STATUS_IRQ);
+
     return 0;
 }
 
+void ide_dma_start(struct ide_device *dev) {
+    uint16_t bm = dev->channel->bmide_base;
+    outb(bm + IDE_BMR_COMMAND, inb(bm + IDE_BMR_COMMAND) | IDE_BMR_CMD_START);
+}
+
+int ide_dma_finish(struct ide_device *dev) {
+    uint16_t bm = dev->channel->bmide_base;
+
+    uint8_t status = inb(bm + IDE_BMR_STATUS);
+    outb(bm + IDE_BMR_COMMAND, inb(bm + IDE_BMR_COMMAND) & ~IDE_BMR_CMD_START);
+    outb(bm + IDE_BMR_STATUS, IDE_BMR_STATUS_ERR | IDE_BMR_STATUS_IRQ);
+
+    if (status & IDE_BMR_STATUS_ERR) {
+        kout(KERNEL_EXTERNAL_FAULT, "IDE: bus master reported a DMA error (status %.2x)\n", status);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+uint8_t ide_take_irq_status(struct ide_device *dev) {
+    uint8_t status = atomic_load_explicit(&dev->channel->last_status, memory_order_acquire);
+    atomic_fetch_sub_explicit(&dev->channel->irq_cnt, 1, memory_order_acq_rel);
+    return status;
+}
+
 #endif // __KERNEL_SUPPORT_DEV_STORAGE_IDE
\ No newline at end of file
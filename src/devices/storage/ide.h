@@ -23,6 +23,8 @@
 # include "lib/lock.h"
 
 # include <stdatomic.h>
+# include <stdbool.h>
+# include <stddef.h>
 # include <stdint.h>
 
 /**
@@ -46,6 +48,46 @@
 
 typedef uint32_t ide_device_flags_t;
 
+/**
+ * Bus Master IDE registers, relative to a channel's bus master base (BAR4 of the PCI IDE controller, +8 for the
+ * secondary channel)
+ */
+# define IDE_BMR_COMMAND 0x0
+# define IDE_BMR_STATUS  0x2
+# define IDE_BMR_PRDT    0x4
+
+# define IDE_BMR_CMD_START 0x01
+# define IDE_BMR_CMD_READ  0x08 // Device -> memory
+
+# define IDE_BMR_STATUS_ACTIVE 0x01
+# define IDE_BMR_STATUS_ERR    0x02
+# define IDE_BMR_STATUS_IRQ    0x04
+
+// Transfers of at least this many bytes use DMA when the controller and device support it; smaller ones stay on PIO
+# define IDE_DMA_MIN_BYTES 4096
+
+// Set on the last entry of a PRD table
+# define IDE_PRD_EOT 0x8000
+
+/**
+ * Physical Region Descriptor. Each one describes a physically contiguous buffer below 4 GiB that doesn't cross a
+ * 64 KiB boundary.
+ */
+struct ide_prd {
+    uint32_t phys;
+    uint16_t byte_count; // 0 = 64 KiB
+    uint16_t flags;
+} __attribute__((packed));
+
+// Each channel's PRD table is a single page
+# define IDE_PRDT_ENTRIES (4096 / sizeof(struct ide_prd))
+
+// How long ide_wait_for_irq() sleeps before giving up on the device
+# define IDE_IRQ_TIMEOUT_MS 5000
+
+// Number of IOAPIC redirection entries saved/masked by ide_irq_window_open()
+# define IDE_IOAPIC_MASK_IRQS 128
+
 struct ide_channel {
     uint16_t cmd_base;
     uint16_t ctrl_base;
@@ -57,8 +99,16 @@ struct ide_channel {
     // Last read status register value (from IRQ handler)
     atomic_uchar last_status;
 
+    // Core sleeping in ide_wait_for_irq() on this channel (-1 = none). The IRQ handler sends it a wakeup IPI, since
+    // device IRQs are only ever delivered to the BSP.
+    atomic_int waiter_core;
+
     mutex lock;
     int selected; // -1 = none, 0 = master, 1 = slave
+
+    uint16_t bmide_base; // 0 = no bus master DMA on this channel
+    struct ide_prd *prdt;
+    uint64_t prdt_phys;
 };
 
 struct ide_device {
@@ -89,6 +139,16 @@ struct ide_device {
     struct DRIVE drive;
 };
 
+/**
+ * Lets the IDE IRQs through while the caller runs with interrupts disabled (e.g. from a syscall), so that
+ * ide_wait_for_irq() can sleep. Every other IOAPIC line apart from the PIT is masked for as long as any window is open;
+ * windows nest across channels so both channels can be busy at once.
+ */
+struct ide_irq_window {
+    bool interrupts_were_enabled;
+    bool masked;
+};
+
 void ide_init();
 
 int ide_lock_bus(struct ide_device *dev);
@@ -96,6 +156,34 @@ int ide_unlock_bus(struct ide_device *dev);
 
 // This also serves to lock the bus (as long as 0 is returned)
 int ide_select_bus(struct ide_device *dev);
+
+void ide_irq_window_open(struct ide_irq_window *window);
+void ide_irq_window_close(struct ide_irq_window *window);
+
+// Clears any stale completion; call this before issuing a command that will raise an IRQ
+void ide_prepare_irq(struct ide_device *dev);
+
+// Sleeps (hlt) until the channel's IRQ has fired. Returns 0, or -ETIMEDOUT after IDE_IRQ_TIMEOUT_MS.
 int ide_wait_for_irq(struct ide_device *dev);
 
+// Whether a transfer of this size should go through DMA on this device
+bool ide_dma_usable(struct ide_device *dev, size_t bytes);
+
+/**
+ * Builds the channel's PRD table for buffer (any kernel address; the pages don't need to be physically contiguous) and
+ * arms the bus master for the given direction. Returns -EINVAL if the buffer can't be described (odd address or length,
+ * memory above 4 GiB, too many fragments), in which case the caller should fall back to PIO. The bus must be locked.
+ */
+int ide_dma_prepare(struct ide_device *dev, void *buffer, size_t bytes, bool to_device);
+
+// Starts the transfer set up by ide_dma_prepare(); call this after the DMA command has been issued to the device
+void ide_dma_start(struct ide_device *dev);
+
+// Stops the bus master after the completion IRQ. Returns 0, or -EIO if the controller reported an error.
+int ide_dma_finish(struct ide_device *dev);
+
+// Consumes one completion and returns the status the IRQ handler read. Call this before transferring the data block,
+// since the transfer itself can raise the next IRQ.
+uint8_t ide_take_irq_status(struct ide_device *dev);
+
 #endif // __KERNEL_SUPPORT_DEV_STORAGE_IDE
\ No newline at end of file
@@ -1,8 +1,12 @@
 #include "mbr.h"
 
+#include "blkq.h"
 #include "drive.h"
+#include "gpt.h"
+#include "lib/lock.h"
 #include "lib/stdio.h"
 #include "memory/kmalloc.h"
+#include "proc/scheduler.h"
 #include "vfs/fat/exfat.h"
 #include "vfs/fat/fat.h"
 #include "vfs/fat/fat12.h"
@@ -11,6 +15,8 @@
 #include "vfs/fscommon.h"
 #include "vfs/iso9660/iso9660.h"
 
+#include <stdatomic.h>
+
 static char *mbr_pretty_partition_type(mbr_partition_type_t type) {
     switch (type) {
     case MBR_PARTITION_TYPE_EMPTY:
@@ -41,6 +47,8 @@ static char *mbr_pretty_partition_type(mbr_partition_type_t type) {
         return "Linux LVM";
     case MBR_PARTITION_TYPE_APPLE_HFS:
         return "Apple HFS/HFS+";
+    case MBR_PARTITION_TYPE_GPT_PROTECTIVE:
+        return "GPT Protective";
     case MBR_PARTITION_TYPE_EFI_SYSTEM: // Also BIOS Boot Partition
         return "EFI System Partition / BIOS Boot Partition";
     default:
@@ -48,6 +56,316 @@ static char *mbr_pretty_partition_type(mbr_partition_type_t type) {
     }
 }
 
+// A partition waiting for its filesystem to be probed
+struct partition_probe {
+    DRIVE_t *drive;
+    int number;    // 1-based, for messages
+    uint64_t lba;  // Start, in logical sectors
+    bool from_gpt; // GPT basic data partitions come in as MBR_PARTITION_TYPE_UNKNOWN; the boot sector decides
+    mbr_partition_type_t type;
+
+    struct partition_probe *next;
+};
+
+// Probes are queued here and picked up by kernel tasks (one is delegated per probe), so partitions on every drive are
+// probed concurrently. drive_wait_for_partition_probes() also drains the queue itself, so nothing depends on the
+// scheduler having a free core.
+static mutex partition_probe_lock                  = MUTEX_INIT;
+static struct partition_probe *partition_probe_head = NULL;
+static struct partition_probe *partition_probe_tail = NULL;
+static atomic_int partition_probes_outstanding      = 0; // Queued or running
+
+static void partition_probe_run(struct partition_probe *probe) {
+    DRIVE_t *drive   = probe->drive;
+    int i            = probe->number - 1;
+    uint64_t lba_act = probe->lba;
+
+    // GPT can describe partitions the filesystem drivers' 32-bit LBAs can't reach
+    if (lba_act > UINT32_MAX) {
+        kout(KERNEL_WARN, "    Partition %d starts at lba %p, beyond what the filesystem drivers can address; skipping\n",
+             i + 1, (void *)lba_act);
+        return;
+    }
+
+    uint8_t *buf = kmalloc_heap(drive->logical_sector_size);
+    if (!buf) {
+        kout(KERNEL_SEVERE_FAULT, "OOM Error: could not allocate memory for partition probe buffer\n");
+        return;
+    }
+    memset(buf, 0, drive->logical_sector_size);
+
+    if (read_first_sector(drive, lba_act, buf) < 0) {
+        kout(KERNEL_WARN, "Error reading first sector of partition %d\n", i + 1);
+        goto done;
+    }
+
+    if (!probe->from_gpt && lba_act == 16) {
+        // Potential ISO9660 partition (e.g., Live CD)
+        if (memcmp(buf + 1, "CD001", 5) == 0) {
+            lba_act = 0;
+
+            kout(KERNEL_INFO, "    ISO9660 filesystem detected on partition %d\n", i + 1);
+
+            if (buf[0] != 0x01) {
+                kout(KERNEL_WARN, "    Warning: Primary Volume Descriptor type is not 0x01 (got %02x)\n", buf[0]);
+                goto done;
+            }
+
+            struct filesystem_iso9660 *fs = kmalloc_heap(sizeof(struct filesystem_iso9660));
+            if (!fs) {
+                kout(KERNEL_SEVERE_FAULT, "OOM Error: could not allocate memory for ISO9660 filesystem structure\n");
+                goto done;
+            }
+            memset(fs, 0, sizeof(struct filesystem_iso9660));
+            memcpy(&fs->pvd, buf, sizeof(struct iso9660_primary_volume_descriptor));
+            fs->read_status |= 0x01; // Mark primary volume descriptor as read
+            if (iso9660_setup(fs, drive, lba_act) == 0) {
+                kout(KERNEL_INFO, "    ISO9660 setup successful on partition %d\n", i + 1);
+            } else {
+                kout(KERNEL_SEVERE_EXTERNAL_FAULT, "    Failed to setup ISO9660 filesystem on partition %d\n", i + 1);
+            }
+        }
+
+        goto done;
+    }
+
+    mbr_partition_type_t type = probe->type;
+    if (probe->from_gpt && type == MBR_PARTITION_TYPE_UNKNOWN) {
+        // GPT basic data: exFAT/NTFS have an OEM name at offset 3; anything else gets FAT detection
+        if (memcmp(buf + 3, "EXFAT   ", 8) == 0 || memcmp(buf + 3, "NTFS    ", 8) == 0) {
+            type = MBR_PARTITION_TYPE_NTFS;
+        } else {
+            type = MBR_PARTITION_TYPE_EFI_SYSTEM;
+        }
+    }
+
+    switch (type) {
+    case MBR_PARTITION_TYPE_FAT32:
+    case MBR_PARTITION_TYPE_FAT32_LBA: {
+        struct filesystem_fat32 *fs = kmalloc_heap(sizeof(struct filesystem_fat32));
+        memcpy(&fs->boot_sector_raw, (struct fat_boot_sector *)buf, sizeof(struct fat_boot_sector));
+        kout(KERNEL_INFO, "    FAT32 boot sector read successfully on partition %d\n", i + 1);
+        if (fat32_setup(fs, drive, lba_act) == 0) {
+            kout(KERNEL_INFO, "    FAT32 filesystem detected on partition %d: Total clusters: %u\n", i + 1,
+                 fs->total_clusters);
+            // Parse and list root directory for basic validation
+            fat32_parse_root(fs);
+        } else {
+            kout(KERNEL_SEVERE_EXTERNAL_FAULT, "    Failed to setup FAT32 filesystem on partition %d\n", i + 1);
+        }
+
+        break;
+    }
+    case MBR_PARTITION_TYPE_FAT16_SMALL:
+    case MBR_PARTITION_TYPE_FAT16_LARGE: {
+        break;
+    }
+    case MBR_PARTITION_TYPE_FAT12: {
+        struct filesystem_fat12 *fs = kmalloc_heap(sizeof(struct filesystem_fat12));
+        if (!fs) {
+            kout(KERNEL_SEVERE_FAULT, "OOM Error: could not allocate memory for FAT12 filesystem structure\n");
+            break;
+        }
+        memset(fs, 0, sizeof(struct filesystem_fat12));
+        memcpy(&fs->boot_sector_raw, (struct fat_boot_sector *)buf, sizeof(struct fat_boot_sector));
+        fs->read_status |= 0x01; // Mark boot sector as read
+        if (fat12_setup(fs, drive, lba_act) != 0) {
+            kout(KERNEL_SEVERE_EXTERNAL_FAULT, "    Failed to setup FAT12 filesystem on partition %d\n", i + 1);
+        }
+        break;
+    }
+    case MBR_PARTITION_TYPE_EFI_SYSTEM: {
+        // Can be FAT12, FAT16, or FAT32
+        fat_type_t fat_type = fat_detect_type(drive, lba_act, (struct fat_boot_sector *)buf);
+
+        switch (fat_type) {
+        case FAT_TYPE_12: {
+            kout(KERNEL_INFO, "    FAT12 filesystem detected on EFI System Partition %d\n", i + 1);
+            struct filesystem_fat12 *fs = kmalloc_heap(sizeof(struct filesystem_fat12));
+            memcpy(&fs->boot_sector_raw, (struct fat_boot_sector *)buf, sizeof(struct fat_boot_sector));
+            fs->read_status |= 0x01; // Mark boot sector as read
+            fat12_setup(fs, drive, lba_act);
+            break;
+        }
+        case FAT_TYPE_16: {
+            kout(KERNEL_INFO, "    FAT16 filesystem detected on EFI System Partition %d\n", i + 1);
+            struct filesystem_fat16 *fs = kmalloc_heap(sizeof(struct filesystem_fat16));
+            memcpy(&fs->boot_sector_raw, (struct fat_boot_sector *)buf, sizeof(struct fat_boot_sector));
+            fs->read_status |= 0x01; // Mark boot sector as read
+            fat16_setup(fs, drive, lba_act);
+            break;
+        }
+        case FAT_TYPE_32: {
+            kout(KERNEL_INFO, "    FAT32 filesystem detected on EFI System Partition %d\n", i + 1);
+            struct filesystem_fat32 *fs = kmalloc_heap(sizeof(struct filesystem_fat32));
+            memcpy(&fs->boot_sector_raw, (struct fat_boot_sector *)buf, sizeof(struct fat_boot_sector));
+            fs->read_status |= 0x01; // Mark boot sector as read
+            if (fat32_setup(fs, drive, lba_act) == 0) {
+                fat32_parse_root(fs);
+            }
+            break;
+        }
+        default: {
+            kout(KERNEL_INFO, "    Unknown or unsupported filesystem on EFI System Partition %d\n", i + 1);
+            break;
+        }
+        }
+        break;
+    }
+    case MBR_PARTITION_TYPE_NTFS: {
+        // NTFS or exFAT
+        char *signature = (buf + 3);
+        if (memcmp(signature, "EXFAT   ", 8) == 0) {
+            kout(KERNEL_INFO, "    exFAT filesystem detected on partition %d\n", i + 1);
+
+            struct filesystem_exfat *fs = kmalloc_heap(sizeof(struct filesystem_exfat));
+            memcpy(&fs->boot_sector, buf, sizeof(struct exfat_boot_sector));
+            fs->read_status |= 0x01; // Mark boot sector as read
+            int res          = exfat_setup(fs, drive, lba_act);
+            if (res == 0) {
+                kout(KERNEL_INFO, "    exFAT setup successful on partition %d: Total clusters: %u\n", i + 1,
+                     fs->total_clusters);
+            } else {
+                kout(KERNEL_SEVERE_EXTERNAL_FAULT, "    Failed to setup exFAT filesystem on partition %d\n", i + 1);
+            }
+        } else if (memcmp(signature, "NTFS    ", 8) == 0) {
+            kout(KERNEL_INFO, "    NTFS filesystem detected on partition %d\n", i + 1);
+        } else {
+            kout(KERNEL_SEVERE_EXTERNAL_FAULT,
+                 "    Unknown filesystem signature (%.8s, jmp %02x %02x %02x) on NTFS partition %d\n", signature,
+                 (uint8_t)buf[0], (uint8_t)buf[1], (uint8_t)buf[2], i + 1);
+        }
+        break;
+    }
+    default: {
+        break;
+    }
+    }
+
+done:
+    kfree_heap(buf);
+}
+
+// Runs one queued probe; returns false if the queue was empty
+static bool partition_probe_run_one() {
+    mutex_lock(&partition_probe_lock);
+    struct partition_probe *probe = partition_probe_head;
+    if (probe) {
+        partition_probe_head = probe->next;
+        if (!partition_probe_head) {
+            partition_probe_tail = NULL;
+        }
+    }
+    mutex_unlock(&partition_probe_lock);
+
+    if (!probe) {
+        return false;
+    }
+
+    partition_probe_run(probe);
+    kfree_heap(probe);
+
+    atomic_fetch_sub(&partition_probes_outstanding, 1);
+    return true;
+}
+
+static void partition_probe_task(void *arg) {
+    (void)arg;
+    partition_probe_run_one();
+}
+
+static void partition_probe_submit(DRIVE_t *drive, int number, uint64_t lba, mbr_partition_type_t type, bool from_gpt) {
+    struct partition_probe *probe = kmalloc_heap(sizeof(struct partition_probe));
+    if (!probe) {
+        kout(KERNEL_SEVERE_FAULT, "OOM Error: could not allocate memory for partition probe\n");
+        return;
+    }
+
+    probe->drive    = drive;
+    probe->number   = number;
+    probe->lba      = lba;
+    probe->type     = type;
+    probe->from_gpt = from_gpt;
+    probe->next     = NULL;
+
+    atomic_fetch_add(&partition_probes_outstanding, 1);
+
+    mutex_lock(&partition_probe_lock);
+    if (partition_probe_tail) {
+        partition_probe_tail->next = probe;
+    } else {
+        partition_probe_head = probe;
+    }
+    partition_probe_tail = probe;
+    mutex_unlock(&partition_probe_lock);
+
+    // If the task queue is full, whoever waits for the probes runs this one
+    delegate_kernel_task(partition_probe_task, NULL);
+}
+
+void drive_wait_for_partition_probes() {
+    while (partition_probe_run_one()) {
+    }
+
+    while (atomic_load(&partition_probes_outstanding) > 0) {
+        asm volatile("pause");
+    }
+}
+
+static void drive_read_gpt(struct DRIVE *drive) {
+    struct gpt_header header;
+    uint8_t *entries = NULL;
+
+    int count = gpt_read(drive, &header, &entries);
+    if (count < 0) {
+        kout(KERNEL_EXTERNAL_FAULT, "Error: protective MBR found, but no valid GPT (%d)\n", count);
+        return;
+    }
+
+    kout(KERNEL_INFO, "GPT read successfully from drive (%d entries)\n", count);
+
+    for (int i = 0; i < count; i++) {
+        struct gpt_partition_entry *part
+            = (struct gpt_partition_entry *)(entries + (size_t)i * header.partition_entry_size);
+
+        gpt_partition_kind_t kind = gpt_partition_kind(part);
+        if (kind == GPT_PARTITION_UNUSED) {
+            continue;
+        }
+
+        if (part->starting_lba < header.first_usable_lba || part->ending_lba > header.last_usable_lba
+            || part->ending_lba < part->starting_lba) {
+            kout(KERNEL_WARN, "  Partition %d: outside the usable area; skipping\n", i + 1);
+            continue;
+        }
+
+        kout(KERNEL_INFO, "  Partition %d: Type %s, Start LBA: %p, Size (sectors): %p\n", i + 1,
+             gpt_partition_kind_pretty(kind), (void *)part->starting_lba,
+             (void *)(part->ending_lba - part->starting_lba + 1));
+
+        switch (kind) {
+        case GPT_PARTITION_EFI_SYSTEM: {
+            partition_probe_submit(drive, i + 1, part->starting_lba, MBR_PARTITION_TYPE_EFI_SYSTEM, true);
+            break;
+        }
+        case GPT_PARTITION_BASIC_DATA: {
+            partition_probe_submit(drive, i + 1, part->starting_lba, MBR_PARTITION_TYPE_UNKNOWN, true);
+            break;
+        }
+        default: {
+            break;
+        }
+        }
+    }
+
+    kfree_heap(entries);
+
+    // Hybrid ISOs with a GPT keep the ISO9660 volume outside every partition; its descriptors start at LBA 16
+    if (drive->logical_sector_size == 2048) {
+        partition_probe_submit(drive, 0, 16, MBR_PARTITION_TYPE_EMPTY, false);
+    }
+}
+
 // Note: MBR lba values are defined in 512-byte sectors, regardless of the drive's logical sector size
 void drive_read_mbr(struct DRIVE *drive, struct MBR *mbr_out) {
     if (!drive || !mbr_out) {
@@ -60,6 +378,9 @@ void drive_read_mbr(struct DRIVE *drive, struct MBR *mbr_out) {
         return;
     }
 
+    // Every driver comes through here once per drive, so this is where drives show up under /sys/block
+    blkstat_register(drive);
+
     uint8_t *buf = kmalloc_heap(drive->logical_sector_size);
     if (!buf) {
         kout(KERNEL_SEVERE_FAULT, "OOM Error: could not allocate memory for MBR read buffer\n");
@@ -67,7 +388,7 @@ void drive_read_mbr(struct DRIVE *drive, struct MBR *mbr_out) {
     }
 
     // MBR is located in the first sector (LBA 0)
-    ssize_t res = drive->read_sectors(drive, 0, 1, buf);
+    ssize_t res = blkq_read(drive, 0, 1, buf);
     if (res < 0) {
         kout(KERNEL_EXTERNAL_FAULT, "Error reading MBR from drive\n");
         kfree_heap(buf);
@@ -80,152 +401,34 @@ void drive_read_mbr(struct DRIVE *drive, struct MBR *mbr_out) {
     }
 
     memcpy(mbr_out, buf, sizeof(struct MBR));
+    kfree_heap(buf);
 
     kout(KERNEL_INFO, "MBR read successfully from drive\n");
     kout(KERNEL_INFO, "MBR Signature: %x\n", mbr_out->signature);
+
+    for (int i = 0; i < 4; i++) {
+        if (mbr_out->signature == 0xAA55
+            && mbr_out->partitions[i].partition_type == MBR_PARTITION_TYPE_GPT_PROTECTIVE) {
+            drive_read_gpt(drive);
+            return;
+        }
+    }
+
     kout(KERNEL_INFO, "Partitions:\n");
     for (int i = 0; i < 4; i++) {
         struct mbr_partition_entry *part = &mbr_out->partitions[i];
 
-        uint32_t lba_act = part->starting_lba * 512 / drive->logical_sector_size;
+        uint64_t lba_act = (uint64_t)part->starting_lba * 512 / drive->logical_sector_size;
 
         if (part->partition_type != 0x00) {
             kout(KERNEL_INFO, "  Partition %d: Type %s (%x), Bootable: %s, Start LBA: %u, Size (sectors): %u\n", i + 1,
                  mbr_pretty_partition_type(part->partition_type), part->partition_type,
-                 (part->boot_indicator == 0x80) ? "Yes" : "No", lba_act, part->size_in_sectors);
-        }
-
-        memset(buf, 0, drive->logical_sector_size);
-
-        if (read_first_sector(drive, lba_act, buf) < 0) {
-            kout(KERNEL_WARN, "Error reading first sector of partition %d\n", i + 1);
-            continue;
-        }
-
-        if (lba_act == 16) {
-            // Potential ISO9660 partition (e.g., Live CD)
-            if (memcmp(buf + 1, "CD001", 5) == 0) {
-                lba_act = 0;
-
-                kout(KERNEL_INFO, "    ISO9660 filesystem detected on partition %d\n", i + 1);
-
-                if (buf[0] != 0x01) {
-                    kout(KERNEL_WARN, "    Warning: Primary Volume Descriptor type is not 0x01 (got %02x)\n", buf[0]);
-                    continue;
-                }
-
-                struct filesystem_iso9660 *fs = kmalloc_heap(sizeof(struct filesystem_iso9660));
-                if (!fs) {
-                    kout(KERNEL_SEVERE_FAULT,
-                         "OOM Error: could not allocate memory for ISO9660 filesystem structure\n");
-                    continue;
-                }
-                memset(fs, 0, sizeof(struct filesystem_iso9660));
-                memcpy(&fs->pvd, buf, sizeof(struct iso9660_primary_volume_descriptor));
-                fs->read_status |= 0x01; // Mark primary volume descriptor as read
-                if (iso9660_setup(fs, drive, lba_act) == 0) {
-                    kout(KERNEL_INFO, "    ISO9660 setup successful on partition %d\n", i + 1);
-                } else {
-                    kout(KERNEL_SEVERE_EXTERNAL_FAULT, "    Failed to setup ISO9660 filesystem on partition %d\n",
-                         i + 1);
-                }
-            }
-
-            continue;
+                 (part->boot_indicator == 0x80) ? "Yes" : "No", (uint32_t)lba_act, part->size_in_sectors);
         }
 
-        switch (part->partition_type) {
-        case MBR_PARTITION_TYPE_FAT32:
-        case MBR_PARTITION_TYPE_FAT32_LBA: {
-            struct filesystem_fat32 *fs = kmalloc_heap(sizeof(struct filesystem_fat32));
-            memcpy(&fs->boot_sector_raw, (struct fat_boot_sector *)buf, sizeof(struct fat_boot_sector));
-            kout(KERNEL_INFO, "    FAT32 boot sector read successfully on partition %d\n", i + 1);
-            if (fat32_setup(fs, drive, lba_act) == 0) {
-                kout(KERNEL_INFO, "    FAT32 filesystem detected on partition %d: Total clusters: %u\n", i + 1,
-                     fs->total_clusters);
-                // Parse and list root directory for basic validation
-                fat32_parse_root(fs);
-            } else {
-                kout(KERNEL_SEVERE_EXTERNAL_FAULT, "    Failed to setup FAT32 filesystem on partition %d\n", i + 1);
-            }
-
-            break;
-        }
-        case MBR_PARTITION_TYPE_FAT16_SMALL:
-        case MBR_PARTITION_TYPE_FAT16_LARGE: {
-            break;
-        }
-        case MBR_PARTITION_TYPE_FAT12: {
-            break;
-        }
-        case MBR_PARTITION_TYPE_EFI_SYSTEM: {
-            // Can be FAT12, FAT16, or FAT32
-            fat_type_t fat_type = fat_detect_type(drive, lba_act, (struct fat_boot_sector *)buf);
-
-            switch (fat_type) {
-            case FAT_TYPE_12: {
-                kout(KERNEL_INFO, "    FAT12 filesystem detected on EFI System Partition %d\n", i + 1);
-                struct filesystem_fat12 *fs = kmalloc_heap(sizeof(struct filesystem_fat12));
-                memcpy(&fs->boot_sector_raw, (struct fat_boot_sector *)buf, sizeof(struct fat_boot_sector));
-                fs->read_status |= 0x01; // Mark boot sector as read
-                fat12_setup(fs, drive, lba_act);
-                break;
-            }
-            case FAT_TYPE_16: {
-                kout(KERNEL_INFO, "    FAT16 filesystem detected on EFI System Partition %d\n", i + 1);
-                struct filesystem_fat16 *fs = kmalloc_heap(sizeof(struct filesystem_fat16));
-                memcpy(&fs->boot_sector_raw, (struct fat_boot_sector *)buf, sizeof(struct fat_boot_sector));
-                fs->read_status |= 0x01; // Mark boot sector as read
-                fat16_setup(fs, drive, lba_act);
-                break;
-            }
-            case FAT_TYPE_32: {
-                kout(KERNEL_INFO, "    FAT32 filesystem detected on EFI System Partition %d\n", i + 1);
-                struct filesystem_fat32 *fs = kmalloc_heap(sizeof(struct filesystem_fat32));
-                memcpy(&fs->boot_sector_raw, (struct fat_boot_sector *)buf, sizeof(struct fat_boot_sector));
-                fs->read_status |= 0x01; // Mark boot sector as read
-                if (fat32_setup(fs, drive, lba_act) == 0) {
-                    fat32_parse_root(fs);
-                }
-                break;
-            }
-            default: {
-                kout(KERNEL_INFO, "    Unknown or unsupported filesystem on EFI System Partition %d\n", i + 1);
-                break;
-            }
-            }
-            break;
-        }
-        case MBR_PARTITION_TYPE_NTFS: {
-            // NTFS or exFAT
-            char *signature = (buf + 3);
-            if (memcmp(signature, "EXFAT   ", 8) == 0) {
-                kout(KERNEL_INFO, "    exFAT filesystem detected on partition %d\n", i + 1);
-
-                struct filesystem_exfat *fs = kmalloc_heap(sizeof(struct filesystem_exfat));
-                memcpy(&fs->boot_sector, buf, sizeof(struct exfat_boot_sector));
-                fs->read_status |= 0x01; // Mark boot sector as read
-                int res          = exfat_setup(fs, drive, lba_act);
-                if (res == 0) {
-                    kout(KERNEL_INFO, "    exFAT setup successful on partition %d: Total clusters: %u\n", i + 1,
-                         fs->total_clusters);
-                } else {
-                    kout(KERNEL_SEVERE_EXTERNAL_FAULT, "    Failed to setup exFAT filesystem on partition %d\n", i + 1);
-                }
-            } else if (memcmp(signature, "NTFS    ", 8) == 0) {
-                kout(KERNEL_INFO, "    NTFS filesystem detected on partition %d\n", i + 1);
-            } else {
-                kout(KERNEL_SEVERE_EXTERNAL_FAULT,
-                     "    Unknown filesystem signature (%.8s, jmp %02x %02x %02x) on NTFS partition %d\n", signature,
-                     (uint8_t)buf[0], (uint8_t)buf[1], (uint8_t)buf[2], i + 1);
-            }
-            break;
-        }
-        default: {
-            break;
-        }
+        // Empty entries are still probed: an ISO's system area has none, but its volume descriptors are at LBA 16
+        if (part->partition_type != MBR_PARTITION_TYPE_EMPTY || lba_act != 0) {
+            partition_probe_submit(drive, i + 1, lba_act, part->partition_type, false);
         }
     }
-
-    kfree_heap(buf);
-}
\ No newline at end of file
+}
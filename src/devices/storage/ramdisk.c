@@ -0,0 +1,91 @@
+#include "ramdisk.h"
+
+#ifdef __KERNEL_SUPPORT_DEV_STORAGE_RAMDISK
+
+# include "lib/stdio.h"
+# include "lib/string.h"
+# include "mbr.h"
+# include "memory/kmalloc.h"
+# include "plenjos/errno.h"
+
+ssize_t ramdisk_read_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, void *buffer) {
+    struct ramdisk *rd = (struct ramdisk *)drive->internal_data;
+
+    if (!rd || !buffer) {
+        return -EINVAL;
+    }
+
+    if (lba >= drive->numsectors || sectors > drive->numsectors - lba) {
+        return -EINVAL;
+    }
+
+    memcpy(buffer, rd->base + lba * RAMDISK_SECTOR_SIZE, sectors * RAMDISK_SECTOR_SIZE);
+    return (ssize_t)(sectors * RAMDISK_SECTOR_SIZE);
+}
+
+ssize_t ramdisk_write_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, const void *buffer) {
+    struct ramdisk *rd = (struct ramdisk *)drive->internal_data;
+
+    if (!rd || !buffer) {
+        return -EINVAL;
+    }
+
+    if (rd->read_only) {
+        return -EROFS;
+    }
+
+    if (lba >= drive->numsectors || sectors > drive->numsectors - lba) {
+        return -EINVAL;
+    }
+
+    memcpy(rd->base + lba * RAMDISK_SECTOR_SIZE, buffer, sectors * RAMDISK_SECTOR_SIZE);
+    return (ssize_t)(sectors * RAMDISK_SECTOR_SIZE);
+}
+
+int ramdisk_create(void *base, uint64_t bytes, bool read_only, const char *name, struct ramdisk **out) {
+    if (!base || bytes < RAMDISK_SECTOR_SIZE) {
+        return -EINVAL;
+    }
+
+    struct ramdisk *rd = kmalloc_heap(sizeof(struct ramdisk));
+    if (!rd) {
+        kout(KERNEL_SEVERE_FAULT, "OOM Error: could not allocate memory for RAM disk\n");
+        return -ENOMEM;
+    }
+    memset(rd, 0, sizeof(struct ramdisk));
+
+    rd->base      = (uint8_t *)base;
+    rd->read_only = read_only;
+
+    rd->drive.internal_data = (void *)rd;
+    strncpy(rd->drive.model, name ? name : "RAM disk", 40);
+    rd->drive.model[40] = '\0';
+    strncpy(rd->drive.interface, "RAM", 15);
+    rd->drive.interface[15]        = '\0';
+    rd->drive.logical_sector_size  = RAMDISK_SECTOR_SIZE;
+    rd->drive.physical_sector_size = RAMDISK_SECTOR_SIZE;
+    rd->drive.numsectors           = bytes / RAMDISK_SECTOR_SIZE;
+    rd->drive.irq                  = 0;
+    rd->drive.read_sectors         = ramdisk_read_sectors_func;
+    rd->drive.write_sectors        = read_only ? NULL : ramdisk_write_sectors_func;
+
+    kout(KERNEL_INFO, "RAM disk %s: %p bytes at %p%s\n", rd->drive.model,
+         (void *)(rd->drive.numsectors * RAMDISK_SECTOR_SIZE), base, read_only ? " (read-only)" : "");
+
+    if (out) {
+        *out = rd;
+    }
+
+    struct MBR *mbr = kmalloc_heap(sizeof(struct MBR));
+    if (!mbr) {
+        kout(KERNEL_SEVERE_FAULT, "OOM Error: could not allocate memory for MBR\n");
+        return 0;
+    }
+
+    drive_read_mbr(&rd->drive, mbr);
+    kfree_heap(mbr);
+
+    return 0;
+}
+
+#endif // __KERNEL_SUPPORT_DEV_STORAGE_RAMDISK
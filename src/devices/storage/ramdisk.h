@@ -0,0 +1,40 @@
+/**
+ * @file ramdisk.h
+ * @brief RAM Disk Support Header
+ *
+ * Header file for memory-backed block devices. A RAM disk serves reads and writes straight out of a buffer (usually a
+ * Limine module), so filesystem images loaded with the kernel never touch a real disk.
+ */
+
+#pragma once
+
+#include "devices/manager.h"
+
+#ifdef __KERNEL_SUPPORT_DEV_STORAGE_RAMDISK
+
+# include "drive.h"
+
+# include <stdbool.h>
+# include <stddef.h>
+# include <stdint.h>
+
+# define RAMDISK_SECTOR_SIZE 512
+
+// Limine modules whose string (module_string in limine.conf) is this are attached as RAM disks
+# define RAMDISK_MODULE_STRING "ramdisk"
+
+struct ramdisk {
+    uint8_t *base;
+    bool read_only;
+
+    struct DRIVE drive;
+};
+
+// Attaches [base, base + bytes) as a drive and probes its partitions. A trailing partial sector is ignored. The memory
+// must stay valid (and, unless read_only is set, writable) for as long as the drive exists.
+int ramdisk_create(void *base, uint64_t bytes, bool read_only, const char *name, struct ramdisk **out);
+
+ssize_t ramdisk_read_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, void *buffer);
+ssize_t ramdisk_write_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, const void *buffer);
+
+#endif // __KERNEL_SUPPORT_DEV_STORAGE_RAMDISK
@@ -0,0 +1,586 @@
+#include "virtio_blk.h"
+
+#ifdef __KERNEL_SUPPORT_DEV_STORAGE_VIRTIO_BLK
+
+# include "arch/x86_64/apic/apic.h"
+# include "arch/x86_64/common.h"
+# include "arch/x86_64/irq.h"
+# include "cpu/cpu.h"
+# include "kernel.h"
+# include "lib/stdio.h"
+# include "lib/string.h"
+# include "mbr.h"
+# include "memory/detect.h"
+# include "memory/kmalloc.h"
+# include "memory/mm.h"
+# include "plenjos/errno.h"
+# include "timer/timer.h"
+
+# include <stdatomic.h>
+# include <stdbool.h>
+# include <stdint.h>
+
+// ioapic_route_all_irq() only routes the first 21 legacy lines (and 0-2 are the PIT/keyboard/cascade)
+# define VIRTIO_BLK_MAX_ROUTED_IRQ 20
+
+# define VIRTIO_BLK_WANTED_FEATURES                                                                                  \
+     ((1ULL << VIRTIO_F_RING_INDIRECT_DESC) | (1ULL << VIRTIO_BLK_F_SEG_MAX) | (1ULL << VIRTIO_BLK_F_RO)             \
+      | (1ULL << VIRTIO_BLK_F_BLK_SIZE) | (1ULL << VIRTIO_BLK_F_FLUSH) | (1ULL << VIRTIO_BLK_F_MQ))
+
+static void virtio_blk_queue_complete(struct virtio_blk_queue *q, uint32_t head) {
+    uint32_t slot_no = head / q->descs_per_slot;
+    if (slot_no >= q->depth) {
+        kout_nolock(KERNEL_SEVERE_EXTERNAL_FAULT, "virtio-blk: device completed unknown descriptor %u\n", head);
+        return;
+    }
+
+    struct virtio_blk_slot *slot = &q->slots[slot_no];
+    uint8_t status               = *(volatile uint8_t *)(slot->page + VIRTIO_BLK_SLOT_STATUS_OFF);
+
+    slot->result = status == VIRTIO_BLK_S_OK ? 0 : -EIO;
+    atomic_store(&slot->done, true);
+
+    // Same protocol as the IDE and AHCI completions: the waiter publishes its core before checking done
+    int waiter = atomic_load(&slot->waiter_core);
+    if (waiter >= 0 && (uint32_t)waiter != get_curr_core()) {
+        send_ipi(cpu_cores[waiter].lapic_id, IPI_WAKEUP_IRQ + 32);
+    }
+}
+
+// Consumes the used ring. Safe to call from the IRQ handler and from waiters at once.
+static void virtio_blk_queue_reap(struct virtio_blk_queue *q) {
+    atomic_store(&q->reap_pending, true);
+
+    while (atomic_load(&q->reap_pending)) {
+        if (atomic_flag_test_and_set_explicit(&q->reap_lock, memory_order_acquire)) {
+            return; // The holder will see reap_pending and go round again
+        }
+        atomic_store(&q->reap_pending, false);
+
+        uint32_t head, len;
+        while (virtq_pop(&q->vq, &head, &len)) {
+            virtio_blk_queue_complete(q, head);
+        }
+
+        atomic_flag_clear_explicit(&q->reap_lock, memory_order_release);
+    }
+}
+
+void virtio_blk_irq_routine(registers_t *regs, void *data) {
+    (void)regs;
+    struct virtio_blk_device *dev = (struct virtio_blk_device *)data;
+
+    // Reading the ISR acknowledges the interrupt
+    if (!(virtio_pci_isr(&dev->vdev) & VIRTIO_PCI_ISR_QUEUE)) {
+        return; // Shared line, or a configuration change
+    }
+
+    atomic_store(&dev->irq_seen, true);
+
+    for (uint16_t i = 0; i < dev->nqueues; i++) {
+        virtio_blk_queue_reap(&dev->queues[i]);
+    }
+}
+
+static int virtio_blk_try_alloc_slot(struct virtio_blk_queue *q) {
+    uint32_t allocated = atomic_load(&q->slots_allocated);
+    uint32_t mask      = q->depth >= 32 ? 0xFFFFFFFF : (1U << q->depth) - 1;
+
+    while (true) {
+        uint32_t free = mask & ~allocated;
+        if (!free) {
+            return -1;
+        }
+
+        int slot = __builtin_ctz(free);
+        if (atomic_compare_exchange_weak(&q->slots_allocated, &allocated, allocated | (1U << slot))) {
+            return slot;
+        }
+    }
+}
+
+static int virtio_blk_alloc_slot(struct virtio_blk_queue *q) {
+    int slot;
+
+    while ((slot = virtio_blk_try_alloc_slot(q)) < 0) {
+        virtio_blk_queue_reap(q);
+        asm volatile("pause");
+    }
+
+    return slot;
+}
+
+static void virtio_blk_free_slot(struct virtio_blk_queue *q, int slot) {
+    atomic_fetch_and(&q->slots_allocated, ~(1U << slot));
+}
+
+/**
+ * Builds the descriptor chain for a request in slot: header, data segments, status. With indirect descriptors the chain
+ * lives in the slot's page and a single ring descriptor points at it; otherwise it uses the slot's run of ring
+ * descriptors. buffer may be any kernel address. Returns the head descriptor, or -EINVAL if the buffer can't be
+ * described.
+ */
+static int virtio_blk_prepare(struct virtio_blk_queue *q, int slot_no, uint32_t type, uint64_t sector, void *buffer,
+                              size_t bytes) {
+    struct virtio_blk_slot *slot = &q->slots[slot_no];
+    bool indirect                = q->descs_per_slot == 1;
+
+    volatile struct virtq_desc *table = indirect ? (volatile struct virtq_desc *)slot->page
+                                                 : &q->vq.desc[slot_no * q->descs_per_slot];
+    uint16_t base                     = indirect ? 0 : (uint16_t)(slot_no * q->descs_per_slot);
+
+    uint16_t data_flags = type == VIRTIO_BLK_T_IN ? VIRTQ_DESC_F_WRITE : 0;
+
+    uint64_t virt    = (uint64_t)buffer;
+    size_t remaining = bytes;
+    uint16_t n       = 1; // Entry 0 is the header
+
+    while (remaining > 0) {
+        size_t chunk = PAGE_LEN - (virt & (PAGE_LEN - 1));
+        if (chunk > remaining) {
+            chunk = remaining;
+        }
+
+        uint64_t phys = get_kernel_physaddr(virt);
+        if (phys == 0) {
+            return -EINVAL;
+        }
+
+        volatile struct virtq_desc *prev = &table[n - 1];
+        if (n > 1 && prev->addr + prev->len == phys && (uint64_t)prev->len + chunk <= UINT32_MAX) {
+            prev->len += (uint32_t)chunk;
+        } else {
+            if (n > q->max_segs) {
+                return -EINVAL;
+            }
+
+            table[n].addr  = phys;
+            table[n].len   = (uint32_t)chunk;
+            table[n].flags = data_flags;
+            n++;
+        }
+
+        virt      += chunk;
+        remaining -= chunk;
+    }
+
+    struct virtio_blk_req_header *header = (struct virtio_blk_req_header *)(slot->page + VIRTIO_BLK_SLOT_HDR_OFF);
+    header->type                         = type;
+    header->reserved                     = 0;
+    header->sector                       = sector;
+
+    *(volatile uint8_t *)(slot->page + VIRTIO_BLK_SLOT_STATUS_OFF) = 0xFF;
+
+    table[0].addr  = slot->page_phys + VIRTIO_BLK_SLOT_HDR_OFF;
+    table[0].len   = sizeof(struct virtio_blk_req_header);
+    table[0].flags = 0;
+
+    table[n].addr  = slot->page_phys + VIRTIO_BLK_SLOT_STATUS_OFF;
+    table[n].len   = 1;
+    table[n].flags = VIRTQ_DESC_F_WRITE;
+    table[n].next  = 0;
+
+    for (uint16_t i = 0; i < n; i++) {
+        table[i].flags |= VIRTQ_DESC_F_NEXT;
+        table[i].next   = (uint16_t)(base + i + 1);
+    }
+
+    if (!indirect) {
+        return base;
+    }
+
+    volatile struct virtq_desc *ring_desc = &q->vq.desc[slot_no];
+    ring_desc->addr                       = slot->page_phys;
+    ring_desc->len                        = (uint32_t)(n + 1) * sizeof(struct virtq_desc);
+    ring_desc->flags                      = VIRTQ_DESC_F_INDIRECT;
+    ring_desc->next                       = 0;
+
+    return slot_no;
+}
+
+static void virtio_blk_issue(struct virtio_blk_queue *q, int slot_no, uint16_t head) {
+    struct virtio_blk_slot *slot = &q->slots[slot_no];
+
+    atomic_store(&slot->waiter_core, -1);
+    slot->result = 0;
+    atomic_store(&slot->done, false);
+
+    mutex_lock(&q->submit_lock);
+    virtq_push(&q->vq, head);
+    virtq_kick(&q->vq);
+    mutex_unlock(&q->submit_lock);
+}
+
+// Waits for slot to complete and returns its result. Halts between checks once the device's IRQ is known to work.
+static int virtio_blk_wait(struct virtio_blk_queue *q, int slot_no) {
+    struct virtio_blk_slot *slot = &q->slots[slot_no];
+    bool interrupts_were_enabled = are_interrupts_enabled();
+    bool warned                  = false;
+
+    uint64_t deadline = timer_now_ns() + VIRTIO_BLK_CMD_TIMEOUT_MS * TIMER_NS_PER_MS;
+
+    atomic_store(&slot->waiter_core, (int)get_curr_core());
+
+    // Makes sure the core wakes from hlt to print the warning below even if the IRQ never comes
+    int wakeup = set_core_wakeup_timeout(VIRTIO_BLK_CMD_TIMEOUT_MS, get_curr_core(), NULL);
+
+    while (true) {
+        // Catches completions that raced with us publishing waiter_core, and drives everything if there's no IRQ
+        virtio_blk_queue_reap(q);
+
+        if (interrupts_were_enabled) {
+            asm volatile("cli");
+        }
+
+        if (atomic_load(&slot->done)) {
+            break;
+        }
+
+        // Virtio has no way to abort a single request, and the device may still write into the buffer, so all we can
+        // do is keep waiting
+        if (!warned && timer_now_ns() >= deadline) {
+            kout(KERNEL_EXTERNAL_FAULT, "virtio-blk: request in slot %d on queue %u is taking a long time\n", slot_no,
+                 (uint32_t)q->vq.index);
+            warned = true;
+        }
+
+        if (!interrupts_were_enabled) {
+            // Probably inside a syscall; don't let other IRQ handlers in, just poll
+            asm volatile("pause");
+        } else if (atomic_load(&q->dev->irq_seen)) {
+            // sti only takes effect after hlt has started, so a completion IRQ can't be lost in between
+            asm volatile("sti; hlt");
+        } else {
+            asm volatile("sti; pause");
+        }
+    }
+
+    atomic_store(&slot->waiter_core, -1);
+    cancel_timeout(wakeup);
+
+    if (interrupts_were_enabled) {
+        asm volatile("sti");
+    }
+
+    return slot->result;
+}
+
+static struct virtio_blk_queue *virtio_blk_pick_queue(struct virtio_blk_device *dev) {
+    return &dev->queues[get_curr_core() % dev->nqueues];
+}
+
+// Runs a single request synchronously
+static int virtio_blk_exec(struct virtio_blk_queue *q, uint32_t type, uint64_t sector, void *buffer, size_t bytes) {
+    int slot = virtio_blk_alloc_slot(q);
+
+    int res = virtio_blk_prepare(q, slot, type, sector, buffer, bytes);
+    if (res >= 0) {
+        virtio_blk_issue(q, slot, (uint16_t)res);
+        res = virtio_blk_wait(q, slot);
+    }
+
+    virtio_blk_free_slot(q, slot);
+    return res;
+}
+
+static ssize_t virtio_blk_transfer(DRIVE_t *drive, uint64_t lba, size_t sectors, void *buffer, bool write) {
+    struct virtio_blk_device *dev = (struct virtio_blk_device *)drive->internal_data;
+
+    if (!dev) {
+        kout(KERNEL_SEVERE_FAULT, "Error: DRIVE internal_data is NULL in virtio_blk_transfer\n");
+        return -1;
+    }
+
+    if (sectors == 0) {
+        return 0;
+    }
+
+    if (lba + sectors > drive->numsectors) {
+        return -EINVAL;
+    }
+
+    // Submit on this CPU's queue, so concurrent callers on different CPUs never share a ring
+    struct virtio_blk_queue *q = virtio_blk_pick_queue(dev);
+
+    uint32_t bytes_per_sector = drive->logical_sector_size;
+    size_t max_bytes          = (size_t)q->max_segs * PAGE_LEN;
+    if (max_bytes > VIRTIO_BLK_MAX_BYTES_PER_COMMAND) {
+        max_bytes = VIRTIO_BLK_MAX_BYTES_PER_COMMAND;
+    }
+
+    // A misaligned buffer can need one more segment than its size suggests
+    size_t max_sectors = (max_bytes - PAGE_LEN) / bytes_per_sector;
+    if (max_sectors == 0) {
+        max_sectors = 1;
+    }
+
+    uint8_t *buf  = (uint8_t *)buffer;
+    uint32_t type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    size_t done   = 0;
+    int res       = 0;
+
+    int batch[VIRTIO_BLK_MAX_DEPTH];
+
+    while (done < sectors && res == 0) {
+        // Queue as many requests as there are free slots (at least one), then wait for the whole batch
+        int n = 0;
+
+        while (done < sectors && n < VIRTIO_BLK_MAX_DEPTH) {
+            int slot = n == 0 ? virtio_blk_alloc_slot(q) : virtio_blk_try_alloc_slot(q);
+            if (slot < 0) {
+                break;
+            }
+
+            size_t count = sectors - done;
+            if (count > max_sectors) {
+                count = max_sectors;
+            }
+
+            int head = virtio_blk_prepare(q, slot, type, (lba + done) * dev->sectors_per_block,
+                                          buf + done * bytes_per_sector, count * bytes_per_sector);
+            if (head < 0) {
+                res = head;
+                virtio_blk_free_slot(q, slot);
+                break;
+            }
+
+            virtio_blk_issue(q, slot, (uint16_t)head);
+            batch[n++]  = slot;
+            done       += count;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int slot_res = virtio_blk_wait(q, batch[i]);
+            virtio_blk_free_slot(q, batch[i]);
+
+            if (slot_res != 0 && res == 0) {
+                res = slot_res;
+            }
+        }
+    }
+
+    if (res != 0) {
+        kout(KERNEL_EXTERNAL_FAULT, "virtio-blk: %s of %lu sectors at lba %p failed (%d)\n", write ? "write" : "read",
+             sectors, (void *)lba, res);
+        return res == -EINVAL ? -EINVAL : -EIO;
+    }
+
+    return (ssize_t)(sectors * bytes_per_sector);
+}
+
+ssize_t virtio_blk_read_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, void *buffer) {
+    return virtio_blk_transfer(drive, lba, sectors, buffer, false);
+}
+
+ssize_t virtio_blk_write_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, const void *buffer) {
+    return virtio_blk_transfer(drive, lba, sectors, (void *)buffer, true);
+}
+
+int virtio_blk_flush_cache_func(DRIVE_t *drive) {
+    struct virtio_blk_device *dev = (struct virtio_blk_device *)drive->internal_data;
+
+    if (!dev) {
+        kout(KERNEL_SEVERE_FAULT, "Error: DRIVE internal_data is NULL in virtio_blk_flush_cache_func\n");
+        return -EIO;
+    }
+
+    // Without the feature the device has no writeback cache to flush
+    if (!virtio_has_feature(&dev->vdev, VIRTIO_BLK_F_FLUSH)) {
+        return 0;
+    }
+
+    int res = virtio_blk_exec(virtio_blk_pick_queue(dev), VIRTIO_BLK_T_FLUSH, 0, NULL, 0);
+    if (res != 0) {
+        kout(KERNEL_EXTERNAL_FAULT, "virtio-blk: cache flush failed (%d)\n", res);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+static void virtio_blk_free_queues(struct virtio_blk_device *dev, uint16_t count) {
+    for (uint16_t i = 0; i < count; i++) {
+        for (int j = 0; j < VIRTIO_BLK_MAX_DEPTH; j++) {
+            if (dev->queues[i].slots[j].page_phys) {
+                phys_mem_unref_frame(
+                    (phys_mem_free_frame_t *)phys_addr_to_frame_addr(dev->queues[i].slots[j].page_phys));
+            }
+        }
+    }
+    kfree_heap(dev->queues);
+    dev->queues = NULL;
+}
+
+static int virtio_blk_queue_init(struct virtio_blk_device *dev, struct virtio_blk_queue *q, uint16_t index,
+                                 uint32_t seg_max) {
+    memset(q, 0, sizeof(struct virtio_blk_queue));
+    q->dev         = dev;
+    q->submit_lock = MUTEX_INIT;
+    atomic_flag_clear(&q->reap_lock);
+
+    int res = virtq_init(&dev->vdev, &q->vq, index, VIRTQ_MAX_SIZE);
+    if (res != 0) {
+        return res;
+    }
+
+    if (virtio_has_feature(&dev->vdev, VIRTIO_F_RING_INDIRECT_DESC)) {
+        q->depth          = q->vq.size < VIRTIO_BLK_MAX_DEPTH ? q->vq.size : VIRTIO_BLK_MAX_DEPTH;
+        q->descs_per_slot = 1;
+        q->max_segs       = VIRTIO_BLK_MAX_SEGS;
+    } else {
+        // Split the ring evenly; each slot needs room for the header, status and at least one segment
+        q->depth = q->vq.size / 4 < VIRTIO_BLK_MAX_DEPTH ? q->vq.size / 4 : VIRTIO_BLK_MAX_DEPTH;
+        if (q->depth == 0) {
+            return -EIO;
+        }
+        q->descs_per_slot = q->vq.size / q->depth;
+        q->max_segs       = q->descs_per_slot - 2;
+    }
+
+    if (seg_max != 0 && seg_max < q->max_segs) {
+        q->max_segs = (uint16_t)seg_max;
+    }
+
+    for (uint16_t i = 0; i < q->depth; i++) {
+        uint64_t phys = find_next_free_frame();
+        if (phys == 0) {
+            kout(KERNEL_SEVERE_FAULT, "OOM Error: could not allocate virtio-blk request page\n");
+            return -ENOMEM;
+        }
+
+        q->slots[i].page      = (uint8_t *)phys_to_virt(phys);
+        q->slots[i].page_phys = phys;
+        memset(q->slots[i].page, 0, PAGE_LEN);
+        atomic_store(&q->slots[i].waiter_core, -1);
+    }
+
+    return 0;
+}
+
+int virtio_blk_init(struct virtio_blk_device *dev, pci_device_t *pci_dev) {
+    memset(dev, 0, sizeof(struct virtio_blk_device));
+    dev->irq_no = 0xFF;
+
+    int res = virtio_pci_init(&dev->vdev, pci_dev);
+    if (res != 0) {
+        kout(KERNEL_WARN, "virtio-blk: device has no virtio 1.0 interface; legacy-only devices aren't supported\n");
+        return res;
+    }
+
+    if (!dev->vdev.device_cfg) {
+        virtio_pci_set_failed(&dev->vdev);
+        return -ENOSYS;
+    }
+
+    res = virtio_pci_negotiate(&dev->vdev, VIRTIO_BLK_WANTED_FEATURES);
+    if (res != 0) {
+        kout(KERNEL_EXTERNAL_FAULT, "virtio-blk: feature negotiation failed (%d)\n", res);
+        virtio_pci_set_failed(&dev->vdev);
+        return res;
+    }
+
+    // Configuration fields wider than 32 bits can tear; re-read until the generation is stable
+    volatile uint8_t *cfg = dev->vdev.device_cfg;
+    uint64_t capacity;
+    uint32_t blk_size, seg_max;
+    uint16_t num_queues;
+    uint8_t generation;
+
+    do {
+        generation = dev->vdev.common->config_generation;
+        capacity   = *(volatile uint64_t *)(cfg + VIRTIO_BLK_CFG_CAPACITY);
+        seg_max    = virtio_has_feature(&dev->vdev, VIRTIO_BLK_F_SEG_MAX)
+                         ? *(volatile uint32_t *)(cfg + VIRTIO_BLK_CFG_SEG_MAX)
+                         : 0;
+        blk_size   = virtio_has_feature(&dev->vdev, VIRTIO_BLK_F_BLK_SIZE)
+                         ? *(volatile uint32_t *)(cfg + VIRTIO_BLK_CFG_BLK_SIZE)
+                         : 512;
+        num_queues = virtio_has_feature(&dev->vdev, VIRTIO_BLK_F_MQ)
+                         ? *(volatile uint16_t *)(cfg + VIRTIO_BLK_CFG_NUM_QUEUES)
+                         : 1;
+    } while (generation != dev->vdev.common->config_generation);
+
+    if (blk_size < 512 || (blk_size & 511) != 0 || capacity < blk_size / 512) {
+        kout(KERNEL_EXTERNAL_FAULT, "virtio-blk: bad geometry (capacity %p, block size %u)\n", (void *)capacity,
+             blk_size);
+        virtio_pci_set_failed(&dev->vdev);
+        return -EIO;
+    }
+
+    // One queue per CPU, as far as the device goes
+    int cores = get_n_cores();
+    if (num_queues == 0) {
+        num_queues = 1;
+    }
+    if (num_queues > cores) {
+        num_queues = (uint16_t)cores;
+    }
+    if (num_queues > virtio_pci_num_queues(&dev->vdev)) {
+        num_queues = virtio_pci_num_queues(&dev->vdev);
+    }
+
+    dev->queues = kmalloc_heap(sizeof(struct virtio_blk_queue) * num_queues);
+    if (!dev->queues) {
+        kout(KERNEL_SEVERE_FAULT, "OOM Error: could not allocate virtio-blk queues\n");
+        virtio_pci_set_failed(&dev->vdev);
+        return -ENOMEM;
+    }
+    memset(dev->queues, 0, sizeof(struct virtio_blk_queue) * num_queues);
+
+    for (uint16_t i = 0; i < num_queues; i++) {
+        res = virtio_blk_queue_init(dev, &dev->queues[i], i, seg_max);
+        if (res != 0) {
+            kout(KERNEL_EXTERNAL_FAULT, "virtio-blk: could not set up queue %u (%d)\n", (uint32_t)i, res);
+            virtio_blk_free_queues(dev, (uint16_t)(i + 1));
+            virtio_pci_set_failed(&dev->vdev);
+            return res;
+        }
+    }
+    dev->nqueues = num_queues;
+
+    // Interrupt line (low byte of config dword 0x3C). There's no MSI-X support yet, so every queue shares it.
+    uint8_t irq_line = (uint8_t)(pci_read(pci_dev->bus, pci_dev->device, pci_dev->function, PCI_REG_INTERRUPT_PIN)
+                                 & 0xFF);
+    if (irq_line > 2 && irq_line <= VIRTIO_BLK_MAX_ROUTED_IRQ) {
+        dev->irq_no = irq_line;
+        irq_register_routine(irq_line, virtio_blk_irq_routine, dev);
+    } else {
+        kout(KERNEL_WARN, "virtio-blk: no usable IRQ line (%u); completions will be polled\n", (uint32_t)irq_line);
+    }
+
+    virtio_pci_set_ready(&dev->vdev);
+
+    dev->sectors_per_block = blk_size / 512;
+
+    dev->drive.internal_data        = (void *)dev;
+    dev->drive.logical_sector_size  = blk_size;
+    dev->drive.physical_sector_size = blk_size;
+    dev->drive.numsectors           = capacity / dev->sectors_per_block;
+    strncpy(dev->drive.model, "Virtio Block Device", 40);
+    dev->drive.model[40] = '\0';
+    strncpy(dev->drive.interface, "VIRTIO", 15);
+    dev->drive.interface[15] = '\0';
+    dev->drive.irq           = dev->irq_no == 0xFF ? (uint32_t)-1 : dev->irq_no;
+    dev->drive.read_sectors  = virtio_blk_read_sectors_func;
+    dev->drive.write_sectors
+        = virtio_has_feature(&dev->vdev, VIRTIO_BLK_F_RO) ? NULL : virtio_blk_write_sectors_func;
+    dev->drive.flush_cache = virtio_blk_flush_cache_func;
+
+    kout(KERNEL_INFO, "Found virtio block device. Sector size: %u bytes; %p sectors; %u queue(s); indirect %s%s.\n",
+         blk_size, dev->drive.numsectors, (uint32_t)dev->nqueues,
+         virtio_has_feature(&dev->vdev, VIRTIO_F_RING_INDIRECT_DESC) ? "enabled" : "disabled",
+         virtio_has_feature(&dev->vdev, VIRTIO_BLK_F_RO) ? "; read-only" : "");
+
+    struct MBR *mbr = kmalloc_heap(sizeof(struct MBR));
+    if (!mbr) {
+        kout(KERNEL_SEVERE_FAULT, "OOM Error: could not allocate memory for MBR\n");
+        return 0;
+    }
+
+    drive_read_mbr(&dev->drive, mbr);
+    kfree_heap(mbr);
+
+    return 0;
+}
+
+#endif // __KERNEL_SUPPORT_DEV_STORAGE_VIRTIO_BLK
@@ -0,0 +1,128 @@
+/**
+ * @file virtio_blk.h
+ * @brief Virtio Block Device Support Header
+ *
+ * Header file for virtio-blk over the virtio PCI transport. Requires virtio support.
+ *
+ * @pre Virtio support
+ */
+
+#pragma once
+
+#include "devices/manager.h"
+
+#ifdef __KERNEL_SUPPORT_DEV_STORAGE_VIRTIO_BLK
+
+# ifndef __KERNEL_SUPPORT_DEV_VIRTIO
+#  error "Virtio block support requires virtio support to be enabled"
+# else
+#  include "devices/virtio/virtio.h"
+# endif
+
+# include "drive.h"
+# include "lib/lock.h"
+
+# include <stdatomic.h>
+# include <stdbool.h>
+# include <stddef.h>
+# include <stdint.h>
+
+// Virtual I/O Device (VIRTIO) Version 1.0, section 5.2
+
+# define VIRTIO_PCI_DEVICE_ID_BLOCK_TRANSITIONAL 0x1001
+# define VIRTIO_PCI_DEVICE_ID_BLOCK              0x1042
+
+/**
+ * Feature bits
+ */
+# define VIRTIO_BLK_F_SEG_MAX  2
+# define VIRTIO_BLK_F_RO       5
+# define VIRTIO_BLK_F_BLK_SIZE 6
+# define VIRTIO_BLK_F_FLUSH    9
+# define VIRTIO_BLK_F_MQ       12
+
+/**
+ * Device configuration layout offsets
+ */
+# define VIRTIO_BLK_CFG_CAPACITY   0  // u64, in 512-byte sectors
+# define VIRTIO_BLK_CFG_SEG_MAX    12 // u32
+# define VIRTIO_BLK_CFG_BLK_SIZE   20 // u32
+# define VIRTIO_BLK_CFG_NUM_QUEUES 34 // u16
+
+# define VIRTIO_BLK_T_IN    0
+# define VIRTIO_BLK_T_OUT   1
+# define VIRTIO_BLK_T_FLUSH 4
+
+# define VIRTIO_BLK_S_OK 0
+
+// Requests in flight per queue
+# define VIRTIO_BLK_MAX_DEPTH 32
+
+// Each slot owns one page: its indirect descriptor table, then the request header and status byte
+# define VIRTIO_BLK_MAX_SEGS        128
+# define VIRTIO_BLK_SLOT_HDR_OFF    3072
+# define VIRTIO_BLK_SLOT_STATUS_OFF (VIRTIO_BLK_SLOT_HDR_OFF + sizeof(struct virtio_blk_req_header))
+
+# define VIRTIO_BLK_MAX_BYTES_PER_COMMAND (512 * 1024)
+
+# define VIRTIO_BLK_CMD_TIMEOUT_MS 5000
+
+struct virtio_blk_req_header {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector; // Always in 512-byte units
+} __attribute__((packed));
+
+struct virtio_blk_device;
+
+struct virtio_blk_slot {
+    atomic_bool done;
+    int result; // 0 or a negative errno; valid once done is set
+    atomic_int waiter_core;
+
+    uint8_t *page;
+    uint64_t page_phys;
+};
+
+struct virtio_blk_queue {
+    struct virtio_blk_device *dev;
+    struct virtq vq;
+
+    uint16_t depth;          // Usable slots
+    uint16_t descs_per_slot; // 1 with indirect descriptors; otherwise each slot owns a fixed run of the ring
+    uint16_t max_segs;       // Data segments per request
+
+    atomic_uint slots_allocated;
+    struct virtio_blk_slot slots[VIRTIO_BLK_MAX_DEPTH];
+
+    // The available ring has a single producer
+    mutex submit_lock;
+
+    // Same scheme as AHCI: whoever holds reap_lock consumes the used ring, anyone else just sets reap_pending
+    atomic_flag reap_lock;
+    atomic_bool reap_pending;
+};
+
+struct virtio_blk_device {
+    struct virtio_pci_device vdev;
+
+    uint8_t irq_no; // 0xFF = no usable IRQ; completions are then polled
+    atomic_bool irq_seen;
+
+    uint32_t sectors_per_block; // 512-byte virtio sectors per logical sector
+
+    // One queue per CPU where the device offers enough; submitters use queues[core % nqueues]
+    uint16_t nqueues;
+    struct virtio_blk_queue *queues;
+
+    struct DRIVE drive;
+};
+
+// pci_dev is only used during initialization (pci_scan() passes a temporary)
+int virtio_blk_init(struct virtio_blk_device *dev, pci_device_t *pci_dev);
+
+ssize_t virtio_blk_read_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, void *buffer);
+ssize_t virtio_blk_write_sectors_func(DRIVE_t *drive, uint64_t lba, size_t sectors, const void *buffer);
+int virtio_blk_flush_cache_func(DRIVE_t *drive);
+
+#endif // __KERNEL_SUPPORT_DEV_STORAGE_VIRTIO_BLK
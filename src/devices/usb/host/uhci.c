@@ -9,6 +9,7 @@
 # include "lib/stdio.h"
 # include "memory/kmalloc.h"
 # include "memory/mm.h"
+# include "proc/kthread.h"
 # include "timer/pit.h"
 # include "timer/timer.h"
 
@@ -69,11 +70,7 @@ static inline int link_td(struct uhci_td *prev, struct uhci_td *next) {
 
 int uhci_insert_qh(uhci_controller_t *controller, struct uhci_qh *qh) {
     /* Don't need to lock QH from the UHCI controller; only protect from other kernel processes */
-    int ints = are_interrupts_enabled();
-    if (ints) {
-        asm volatile("cli");
-    }
-    mutex_lock(&controller->qh_lock);
+    bool ints = spin_lock_irqsave(&controller->qh_lock);
     /* printf("uhci packet: %p, td %p\n\n", get_physaddr32((uint64_t)qh, kernel_pml4),
            get_physaddr(qh->data_first_td, kernel_pml4)); */
 
@@ -87,28 +84,23 @@ int uhci_insert_qh(uhci_controller_t *controller, struct uhci_qh *qh) {
                                            .type     = UHCI_FRAME_LIST_ENTRY_TYPE_QH,
                                            .reserved = 0 };
 
-    mutex_unlock(&controller->qh_lock);
-    if (ints) {
-        asm volatile("sti");
-    }
+    spin_unlock_irqrestore(&controller->qh_lock, ints);
 
     return 0;
 }
 
 # define UHCI_WAIT_PRIO 1000
 
-int uhci_wait_td(volatile struct uhci_td *td, uint32_t timeout_ms) {
-    uint32_t elapsed = 0;
-
-    /* TODO: use IRQs instead of polling */
-    while (td->status & UHCI_TD_ACTIVE) {
-        if (elapsed >= timeout_ms) {
-            printf("uhci_wait_td: timeout reached\n");
-            return -1;
-        }
+static bool uhci_td_done(void *arg) {
+    return !(((volatile struct uhci_td *)arg)->status & UHCI_TD_ACTIVE);
+}
 
-        ksleep_nonblocking_ms(1, UHCI_WAIT_PRIO);
-        elapsed++;
+/* The TD should have IOC set (or be followed by one that does and stops on error), otherwise nothing wakes us before
+ * the timeout */
+int uhci_wait_td(uhci_controller_t *controller, volatile struct uhci_td *td, uint32_t timeout_ms) {
+    if (wait_event_timeout_ms(&controller->td_waiters, uhci_td_done, (void *)td, timeout_ms) < 0) {
+        printf("uhci_wait_td: timeout reached\n");
+        return -1;
     }
 
     if (td->status & UHCI_TD_ERR_MASK) {
@@ -121,15 +113,11 @@ int uhci_wait_td(volatile struct uhci_td *td, uint32_t timeout_ms) {
 
 /* All TDs in the chain *should* be done before this function. If not, the driver shouldn't break, but uhci_wait_td()
  * might cause this function to take a decent amount of time as it has to wait for the timeout for each incomplete TD.
- * This function does NOT free the QH or TDs.
+ * The waiting happens after qh_lock is dropped, since it may sleep. This function does NOT free the QH or TDs.
  */
 int uhci_remove_qh(uhci_controller_t *controller, struct uhci_qh *qh) {
     /* Protect QH from other kernel processes */
-    int ints = are_interrupts_enabled();
-    if (ints) {
-        asm volatile("cli");
-    }
-    mutex_lock(&controller->qh_lock);
+    bool ints = spin_lock_irqsave(&controller->qh_lock);
 
     /* Ensure controller doesn't execute any more TDs in this chain (everything should already be inactive before this
      * function is called, but this is just to be safe) */
@@ -144,14 +132,11 @@ int uhci_remove_qh(uhci_controller_t *controller, struct uhci_qh *qh) {
         prev->horiz_link_ptr = qh->horiz_link_ptr;
     }
 
+    spin_unlock_irqrestore(&controller->qh_lock, ints);
+
     /* Wait for all TDs to complete */
     for (struct uhci_td *td = (struct uhci_td *)qh->data_first_td; td; td = (struct uhci_td *)td->data_next) {
-        uhci_wait_td(td, 100);
-    }
-
-    mutex_unlock(&controller->qh_lock);
-    if (ints) {
-        asm volatile("sti");
+        uhci_wait_td(controller, td, 100);
     }
 
     return 0;
@@ -315,7 +300,7 @@ int uhci_control_transfer(uhci_controller_t *controller, uint8_t device_address,
     /* Add into QH schedule */
     uhci_insert_qh(controller, qh);
 
-    res = uhci_wait_td(status_td, timeout_ms);
+    res = uhci_wait_td(controller, status_td, timeout_ms);
 
     if (res == -1) {
         /* Timeout */
@@ -412,9 +397,12 @@ int uhci_bulk_transfer(usb_endpoint_t *endpoint, uint8_t *buffer, size_t length,
         toggle ^= 1;
     }
 
+    /* Interrupt once the last TD is done, so uhci_wait_td() gets woken */
+    prev->status |= UHCI_TD_IOC;
+
     /* Add into QH schedule */
     uhci_insert_qh(dev->host_driver_data, qh);
-    res = uhci_wait_td(prev, timeout_ms);
+    res = uhci_wait_td(dev->host_driver_data, prev, timeout_ms);
 
     if (res == -1) {
         /* Timeout */
@@ -447,6 +435,17 @@ struct uhci_dev_status_poll_args {
     void *callback_data;
 };
 
+/* Runs the completion callback on a kernel thread of its own: it typically resets the port and enumerates the device,
+ * which means hundreds of milliseconds of sleeps and control transfers that can block there instead of halting a core */
+static void uhci_dev_status_callback_thread(void *data) {
+    struct uhci_dev_status_poll_args *args = (struct uhci_dev_status_poll_args *)data;
+
+    args->callback(args->callback_data);
+
+    // We free this afterwords since the callback might want to access it
+    if (args->free_after_completion) kfree_heap(args);
+}
+
 void uhci_dev_status_poll_callback(struct timer_timeout *data) {
     struct uhci_dev_status_poll_args *args = (struct uhci_dev_status_poll_args *)data->data;
 
@@ -456,18 +455,22 @@ void uhci_dev_status_poll_callback(struct timer_timeout *data) {
         && (port_status & args->desired_status_clear_mask) == 0) {
         // Desired status reached
 
+        if (args->callback && kthread_run("uhci-port", uhci_dev_status_callback_thread, args) == 0) {
+            return;
+        }
+
+        // No callback, or no memory for a thread; then it runs here
         if (args->callback) {
             args->callback(args->callback_data);
         }
 
-        // We free this afterwords since the callback might want to access it
         if (args->free_after_completion) kfree_heap(args);
         return;
     }
 
     if (args->repeat_count > 0) {
         args->repeat_count--;
-        set_timeout(args->timeout_ms, uhci_dev_status_poll_callback, data);
+        set_timeout(args->timeout_ms, uhci_dev_status_poll_callback, args);
     } else {
         printf("uhci: port %d did not reach desired status of 0x%04x set and 0x%04x clear within timeout\n",
                args->port_num, args->desired_status_set_mask, args->desired_status_clear_mask);
@@ -555,12 +558,18 @@ void uhci_device_connected_callback_func(void *data) {
 }
 
 void uhci_irq_routine(registers_t *regs, void *data) {
+    (void)regs;
     uhci_controller_t *controller = (uhci_controller_t *)data;
 
     uint16_t status = uhci_read_register(controller, UHCI_IO_USBSTS);
     uhci_write_register(controller, UHCI_IO_USBSTS, status & 0x07); /* Clear INT, ERR, etc. */
 
-    printf("uhci: irq: status = %.4x", status);
+    if (status & (UHCI_STSREG_INT | UHCI_STSREG_ERRINT)) {
+        /* A TD with IOC completed, or one errored out: let the waiters re-check theirs */
+        wait_queue_wake_all(&controller->td_waiters);
+    } else if (status & ~UHCI_STSREG_HALTED) {
+        printf("uhci: irq: status = %.4x\n", status);
+    }
 }
 
 int uhci_init(uhci_controller_t *controller, pci_device_t *pci_dev) {
@@ -590,6 +599,7 @@ int uhci_init(uhci_controller_t *controller, pci_device_t *pci_dev) {
     /* Next, start populating the controller struct */
     memset(controller, 0, sizeof(uhci_controller_t));
     controller->pci_dev = pci_dev;
+    wait_queue_init(&controller->td_waiters);
 
     /* The I/O base address can technically be at any BAR; we must find one with bit 0 set */
     for (int bar_idx = 0; bar_idx < 6; bar_idx++) {
@@ -28,6 +28,7 @@
 
 # include "kernel.h"
 # include "lib/lock.h"
+# include "proc/wait.h"
 
 # include <stddef.h>
 # include <stdint.h>
@@ -245,7 +246,9 @@ struct uhci_controller {
     uint8_t dev_addresses[127]; /* address = index + 1; 1 = used */
     mutex dev_addresses_lock;
 
-    mutex qh_lock;
+    spinlock_t qh_lock;
+
+    wait_queue_t td_waiters; /* Woken by the IRQ whenever a TD with IOC completes or errors */
 
     /* These must be 16-byte aligned */
     struct uhci_qh qh_1ms __attribute__((aligned(16)));
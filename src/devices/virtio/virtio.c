@@ -0,0 +1,279 @@
+#include "virtio.h"
+
+#ifdef __KERNEL_SUPPORT_DEV_VIRTIO
+
+# include "kernel.h"
+# include "lib/stdio.h"
+# include "lib/string.h"
+# include "memory/detect.h"
+# include "memory/mm.h"
+# include "plenjos/errno.h"
+
+# include <stdatomic.h>
+
+# define PCI_REG_STATUS_CMD  0x04
+# define PCI_STATUS_CAP_LIST (1U << (16 + 4))
+# define PCI_REG_CAP_POINTER 0x34
+# define PCI_REG_BAR0        0x10
+
+// Physical base of a memory BAR (0 for I/O BARs, which the modern capabilities never point at in practice)
+static uint64_t virtio_pci_bar_phys(pci_device_t *pci_dev, uint8_t bar) {
+    if (bar > 5) {
+        return 0;
+    }
+
+    uint32_t low = pci_read(pci_dev->bus, pci_dev->device, pci_dev->function, PCI_REG_BAR0 + bar * 4);
+    if (low & 0x1) {
+        return 0;
+    }
+
+    uint64_t phys = low & ~0xFULL;
+    if (((low >> 1) & 0x3) == 0x2 && bar < 5) {
+        uint32_t high  = pci_read(pci_dev->bus, pci_dev->device, pci_dev->function, PCI_REG_BAR0 + (bar + 1) * 4);
+        phys          |= (uint64_t)high << 32;
+    }
+
+    return phys;
+}
+
+static volatile void *virtio_pci_map(uint64_t phys, uint32_t len) {
+    uint64_t start = phys & ~(uint64_t)(PAGE_LEN - 1);
+    uint64_t end   = (phys + len + PAGE_LEN - 1) & ~(uint64_t)(PAGE_LEN - 1);
+
+    map_virtual_memory(start, end - start, PAGE_FLAG_PRESENT | PAGE_FLAG_WRITE, kernel_pml4);
+    return (volatile void *)phys_to_virt(phys);
+}
+
+int virtio_pci_init(struct virtio_pci_device *vdev, pci_device_t *pci_dev) {
+    memset(vdev, 0, sizeof(struct virtio_pci_device));
+    vdev->bus      = pci_dev->bus;
+    vdev->device   = pci_dev->device;
+    vdev->function = pci_dev->function;
+
+    uint32_t status = pci_read(pci_dev->bus, pci_dev->device, pci_dev->function, PCI_REG_STATUS_CMD);
+    if (!(status & PCI_STATUS_CAP_LIST)) {
+        return -ENOSYS;
+    }
+
+    uint8_t ptr = (uint8_t)(pci_read(pci_dev->bus, pci_dev->device, pci_dev->function, PCI_REG_CAP_POINTER) & 0xFC);
+
+    // The list can't be longer than config space; this bounds a malformed (looping) list
+    for (int n = 0; ptr != 0 && n < 48; n++) {
+        uint32_t header = pci_read(pci_dev->bus, pci_dev->device, pci_dev->function, ptr);
+        uint8_t cap_id  = (uint8_t)(header & 0xFF);
+        uint8_t next    = (uint8_t)((header >> 8) & 0xFC);
+        uint8_t type    = (uint8_t)((header >> 24) & 0xFF);
+
+        if (cap_id == VIRTIO_PCI_CAP_ID) {
+            uint8_t bar     = (uint8_t)(pci_read(pci_dev->bus, pci_dev->device, pci_dev->function, ptr + 4) & 0xFF);
+            uint32_t offset = pci_read(pci_dev->bus, pci_dev->device, pci_dev->function, ptr + 8);
+            uint32_t length = pci_read(pci_dev->bus, pci_dev->device, pci_dev->function, ptr + 12);
+            uint64_t base   = virtio_pci_bar_phys(pci_dev, bar);
+
+            if (base != 0 && length != 0) {
+                switch (type) {
+                case VIRTIO_PCI_CAP_COMMON_CFG: {
+                    if (!vdev->common) {
+                        vdev->common = (volatile struct virtio_pci_common_cfg *)virtio_pci_map(base + offset, length);
+                    }
+                    break;
+                }
+                case VIRTIO_PCI_CAP_NOTIFY_CFG: {
+                    if (!vdev->notify_base) {
+                        vdev->notify_base = (volatile uint8_t *)virtio_pci_map(base + offset, length);
+                        vdev->notify_off_multiplier
+                            = pci_read(pci_dev->bus, pci_dev->device, pci_dev->function, ptr + 16);
+                    }
+                    break;
+                }
+                case VIRTIO_PCI_CAP_ISR_CFG: {
+                    if (!vdev->isr) {
+                        vdev->isr = (volatile uint8_t *)virtio_pci_map(base + offset, length);
+                    }
+                    break;
+                }
+                case VIRTIO_PCI_CAP_DEVICE_CFG: {
+                    if (!vdev->device_cfg) {
+                        vdev->device_cfg = (volatile uint8_t *)virtio_pci_map(base + offset, length);
+                    }
+                    break;
+                }
+                default: {
+                    break;
+                }
+                }
+            }
+        }
+
+        ptr = next;
+    }
+
+    if (!vdev->common || !vdev->notify_base || !vdev->isr) {
+        return -ENOSYS;
+    }
+
+    pci_set_command_bits(pci_dev->bus, pci_dev->device, pci_dev->function,
+                         PCI_CMD_MEMORY_SPACE | PCI_CMD_BUS_MASTER);
+    pci_clear_command_bits(pci_dev->bus, pci_dev->device, pci_dev->function, PCI_CMD_INTERRUPT_DISABLE);
+
+    // Reset, then wait for the device to acknowledge it
+    vdev->common->device_status = 0;
+    while (vdev->common->device_status != 0) {
+        asm volatile("pause");
+    }
+
+    vdev->common->device_status = VIRTIO_STATUS_ACKNOWLEDGE;
+    vdev->common->device_status = VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER;
+
+    return 0;
+}
+
+int virtio_pci_negotiate(struct virtio_pci_device *vdev, uint64_t wanted) {
+    volatile struct virtio_pci_common_cfg *common = vdev->common;
+
+    common->device_feature_select = 0;
+    uint64_t offered              = common->device_feature;
+    common->device_feature_select = 1;
+    offered                      |= (uint64_t)common->device_feature << 32;
+
+    if (!((offered >> VIRTIO_F_VERSION_1) & 1)) {
+        return -ENOSYS;
+    }
+
+    vdev->features = offered & (wanted | (1ULL << VIRTIO_F_VERSION_1));
+
+    common->driver_feature_select = 0;
+    common->driver_feature        = (uint32_t)vdev->features;
+    common->driver_feature_select = 1;
+    common->driver_feature        = (uint32_t)(vdev->features >> 32);
+
+    common->device_status |= VIRTIO_STATUS_FEATURES_OK;
+    if (!(common->device_status & VIRTIO_STATUS_FEATURES_OK)) {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+uint16_t virtio_pci_num_queues(struct virtio_pci_device *vdev) {
+    return vdev->common->num_queues;
+}
+
+void virtio_pci_set_ready(struct virtio_pci_device *vdev) {
+    vdev->common->device_status |= VIRTIO_STATUS_DRIVER_OK;
+}
+
+void virtio_pci_set_failed(struct virtio_pci_device *vdev) {
+    vdev->common->device_status |= VIRTIO_STATUS_FAILED;
+}
+
+uint8_t virtio_pci_isr(struct virtio_pci_device *vdev) {
+    return *vdev->isr;
+}
+
+static void *virtq_alloc_page(uint64_t *phys_out) {
+    uint64_t phys = find_next_free_frame();
+    if (phys == 0) {
+        return NULL;
+    }
+
+    void *virt = (void *)phys_to_virt(phys);
+    memset(virt, 0, PAGE_LEN);
+    *phys_out = phys;
+    return virt;
+}
+
+int virtq_init(struct virtio_pci_device *vdev, struct virtq *vq, uint16_t index, uint16_t max_size) {
+    volatile struct virtio_pci_common_cfg *common = vdev->common;
+
+    memset(vq, 0, sizeof(struct virtq));
+
+    common->queue_select = index;
+    uint16_t size        = common->queue_size;
+    if (size == 0) {
+        return -ENOENT;
+    }
+
+    if (max_size > VIRTQ_MAX_SIZE) {
+        max_size = VIRTQ_MAX_SIZE;
+    }
+    if (size > max_size) {
+        // Split queue sizes must be a power of two
+        size = 1;
+        while ((uint32_t)size * 2 <= max_size) {
+            size *= 2;
+        }
+    }
+
+    uint64_t desc_phys = 0, avail_phys = 0, used_phys = 0;
+    void *desc  = virtq_alloc_page(&desc_phys);
+    void *avail = virtq_alloc_page(&avail_phys);
+    void *used  = virtq_alloc_page(&used_phys);
+
+    if (!desc || !avail || !used) {
+        kout(KERNEL_SEVERE_FAULT, "OOM Error: virtio: could not allocate virtqueue %u\n", (uint32_t)index);
+        if (desc) {
+            phys_mem_unref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(desc_phys));
+        }
+        if (avail) {
+            phys_mem_unref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(avail_phys));
+        }
+        if (used) {
+            phys_mem_unref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(used_phys));
+        }
+        return -ENOMEM;
+    }
+
+    vq->index = index;
+    vq->size  = size;
+    vq->desc  = (volatile struct virtq_desc *)desc;
+    vq->avail = (volatile struct virtq_avail *)avail;
+    vq->used  = (volatile struct virtq_used *)used;
+
+    common->queue_size   = size;
+    common->queue_desc   = desc_phys;
+    common->queue_driver = avail_phys;
+    common->queue_device = used_phys;
+
+    uint32_t notify_off = (uint32_t)common->queue_notify_off * vdev->notify_off_multiplier;
+    vq->notify          = (volatile uint16_t *)(vdev->notify_base + notify_off);
+
+    common->queue_enable = 1;
+
+    return 0;
+}
+
+void virtq_push(struct virtq *vq, uint16_t head) {
+    uint16_t idx                    = vq->avail->idx;
+    vq->avail->ring[idx % vq->size] = head;
+
+    // The descriptors and ring entry must be visible before the index that publishes them
+    atomic_thread_fence(memory_order_seq_cst);
+    vq->avail->idx = (uint16_t)(idx + 1);
+}
+
+void virtq_kick(struct virtq *vq) {
+    // The new avail index must be visible before we read the device's notification suppression flag
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!(vq->used->flags & VIRTQ_USED_F_NO_NOTIFY)) {
+        *vq->notify = vq->index;
+    }
+}
+
+bool virtq_pop(struct virtq *vq, uint32_t *head_out, uint32_t *len_out) {
+    if (vq->last_used_idx == vq->used->idx) {
+        return false;
+    }
+
+    // Don't read the entry before the index that says it's there
+    atomic_thread_fence(memory_order_acquire);
+
+    volatile struct virtq_used_elem *elem = &vq->used->ring[vq->last_used_idx % vq->size];
+    *head_out                             = elem->id;
+    *len_out                              = elem->len;
+    vq->last_used_idx++;
+
+    return true;
+}
+
+#endif // __KERNEL_SUPPORT_DEV_VIRTIO
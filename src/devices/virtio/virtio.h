@@ -0,0 +1,170 @@
+/**
+ * @file virtio.h
+ * @brief Virtio PCI Transport Support Header
+ *
+ * Header file for the virtio 1.0 ("modern") PCI transport and split virtqueues. Device drivers (virtio-blk, ...) build
+ * on this. Legacy-only devices are not supported.
+ *
+ * @pre PCI support
+ */
+
+#pragma once
+
+#include "devices/manager.h"
+
+#ifdef __KERNEL_SUPPORT_DEV_VIRTIO
+
+# ifndef __KERNEL_SUPPORT_DEV_PCI
+#  error "Virtio support requires PCI support to be enabled"
+# else
+#  include "devices/pci/pci.h"
+# endif
+
+# include <stdbool.h>
+# include <stddef.h>
+# include <stdint.h>
+
+// Virtual I/O Device (VIRTIO) Version 1.0, section 4.1
+// https://docs.oasis-open.org/virtio/virtio/v1.0/virtio-v1.0.html
+
+/**
+ * Device status bits
+ */
+# define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+# define VIRTIO_STATUS_DRIVER      0x02
+# define VIRTIO_STATUS_DRIVER_OK   0x04
+# define VIRTIO_STATUS_FEATURES_OK 0x08
+# define VIRTIO_STATUS_FAILED      0x80
+
+/**
+ * Device-independent feature bits
+ */
+# define VIRTIO_F_RING_INDIRECT_DESC 28
+# define VIRTIO_F_VERSION_1          32
+
+/**
+ * PCI capability types (vendor-specific capability, ID 0x09)
+ */
+# define VIRTIO_PCI_CAP_ID         0x09
+# define VIRTIO_PCI_CAP_COMMON_CFG 1
+# define VIRTIO_PCI_CAP_NOTIFY_CFG 2
+# define VIRTIO_PCI_CAP_ISR_CFG    3
+# define VIRTIO_PCI_CAP_DEVICE_CFG 4
+
+# define VIRTIO_PCI_ISR_QUEUE 0x1
+
+// Queue sizes are capped so each ring part fits in a single page
+# define VIRTQ_MAX_SIZE 256
+
+# define VIRTQ_DESC_F_NEXT     1
+# define VIRTQ_DESC_F_WRITE    2 // Device writes (otherwise device reads)
+# define VIRTQ_DESC_F_INDIRECT 4
+
+# define VIRTQ_USED_F_NO_NOTIFY 1
+
+struct virtio_pci_common_cfg {
+    uint32_t device_feature_select;
+    uint32_t device_feature;
+    uint32_t driver_feature_select;
+    uint32_t driver_feature;
+    uint16_t msix_config;
+    uint16_t num_queues;
+    uint8_t device_status;
+    uint8_t config_generation;
+
+    uint16_t queue_select;
+    uint16_t queue_size;
+    uint16_t queue_msix_vector;
+    uint16_t queue_enable;
+    uint16_t queue_notify_off;
+    uint64_t queue_desc;
+    uint64_t queue_driver; // Available ring
+    uint64_t queue_device; // Used ring
+};
+
+struct virtq_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed));
+
+struct virtq_avail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} __attribute__((packed));
+
+struct virtq_used_elem {
+    uint32_t id; // Head descriptor of the completed chain
+    uint32_t len;
+} __attribute__((packed));
+
+struct virtq_used {
+    uint16_t flags;
+    uint16_t idx;
+    struct virtq_used_elem ring[];
+} __attribute__((packed));
+
+struct virtio_pci_device {
+    uint8_t bus;
+    uint8_t device;
+    uint8_t function;
+
+    volatile struct virtio_pci_common_cfg *common;
+    volatile uint8_t *isr;
+    volatile uint8_t *device_cfg;
+    volatile uint8_t *notify_base;
+    uint32_t notify_off_multiplier;
+
+    uint64_t features; // Negotiated
+};
+
+struct virtq {
+    uint16_t index;
+    uint16_t size;
+
+    volatile struct virtq_desc *desc;
+    volatile struct virtq_avail *avail;
+    volatile struct virtq_used *used;
+
+    volatile uint16_t *notify;
+
+    // Next used ring entry to consume
+    uint16_t last_used_idx;
+};
+
+// Finds and maps the modern capabilities, resets the device and acknowledges it. Returns -ENOSYS for legacy-only
+// devices.
+int virtio_pci_init(struct virtio_pci_device *vdev, pci_device_t *pci_dev);
+
+// Offers the intersection of wanted and the device's features and sets FEATURES_OK. VIRTIO_F_VERSION_1 is always
+// requested. Returns -EIO if the device rejects the result.
+int virtio_pci_negotiate(struct virtio_pci_device *vdev, uint64_t wanted);
+
+static inline bool virtio_has_feature(struct virtio_pci_device *vdev, int bit) {
+    return (vdev->features >> bit) & 1;
+}
+
+uint16_t virtio_pci_num_queues(struct virtio_pci_device *vdev);
+
+// Sets DRIVER_OK (or FAILED)
+void virtio_pci_set_ready(struct virtio_pci_device *vdev);
+void virtio_pci_set_failed(struct virtio_pci_device *vdev);
+
+// Reads and clears the ISR status
+uint8_t virtio_pci_isr(struct virtio_pci_device *vdev);
+
+// Allocates and enables queue index with at most max_size entries. Returns -ENOENT if the queue doesn't exist.
+int virtq_init(struct virtio_pci_device *vdev, struct virtq *vq, uint16_t index, uint16_t max_size);
+
+// Publishes the chain starting at head. Not safe against concurrent callers on the same queue.
+void virtq_push(struct virtq *vq, uint16_t head);
+
+// Notifies the device of new available entries unless it asked not to be
+void virtq_kick(struct virtq *vq);
+
+// Takes the next completed chain off the used ring. Not safe against concurrent callers on the same queue.
+bool virtq_pop(struct virtq *vq, uint32_t *head_out, uint32_t *len_out);
+
+#endif // __KERNEL_SUPPORT_DEV_VIRTIO
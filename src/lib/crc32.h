@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3, reflected 0xEDB88320), as used by GPT, zlib and Ethernet. Pass 0 as crc to start; pass a previous
+// result to continue over more data.
+uint32_t crc32(uint32_t crc, const void *data, size_t len);
@@ -1,5 +1,8 @@
 #include "lib/lock.h"
 
+#include "arch/x86_64/common.h"
+#include "arch/x86_64/tsc.h"
+
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -19,35 +22,120 @@ bool mutex_is_locked(mutex *m) {
     return atomic_load_explicit((_Atomic bool *)m, memory_order_acquire);
 }
 
+void spin_lock_init(spinlock_t *lock) {
+    atomic_store(&lock->next, 0);
+    atomic_store(&lock->owner, 0);
+    lock->acquisitions = 0;
+    lock->contended    = 0;
+    lock->wait_tsc     = 0;
+}
+
+void spin_lock(spinlock_t *lock) {
+    unsigned ticket = atomic_fetch_add_explicit(&lock->next, 1, memory_order_relaxed);
+    unsigned owner  = atomic_load_explicit(&lock->owner, memory_order_acquire);
+
+    if (owner == ticket) {
+        lock->acquisitions++;
+        return;
+    }
+
+    uint64_t start = rdtsc();
+    while (owner != ticket) {
+        // Everyone ahead of us holds the lock for a while, so there is no point polling the line until then
+        for (unsigned i = ticket - owner; i > 0; i--) {
+            __builtin_ia32_pause();
+        }
+        owner = atomic_load_explicit(&lock->owner, memory_order_acquire);
+    }
+
+    lock->acquisitions++;
+    lock->contended++;
+    lock->wait_tsc += rdtsc() - start;
+}
+
+bool spin_trylock(spinlock_t *lock) {
+    unsigned owner = atomic_load_explicit(&lock->owner, memory_order_relaxed);
+    unsigned next  = owner;
+    if (!atomic_compare_exchange_strong_explicit(&lock->next, &next, owner + 1, memory_order_acquire,
+                                                 memory_order_relaxed)) {
+        return false;
+    }
+
+    lock->acquisitions++;
+    return true;
+}
+
+void spin_unlock(spinlock_t *lock) {
+    // Only the holder writes owner
+    unsigned owner = atomic_load_explicit(&lock->owner, memory_order_relaxed);
+    atomic_store_explicit(&lock->owner, owner + 1, memory_order_release);
+}
+
+bool spin_is_locked(spinlock_t *lock) {
+    return atomic_load_explicit(&lock->owner, memory_order_acquire)
+        != atomic_load_explicit(&lock->next, memory_order_relaxed);
+}
+
+bool spin_lock_irqsave(spinlock_t *lock) {
+    bool ints = are_interrupts_enabled();
+    asm volatile("cli" ::: "memory");
+    spin_lock(lock);
+    return ints;
+}
+
+void spin_unlock_irqrestore(spinlock_t *lock, bool ints) {
+    spin_unlock(lock);
+    if (ints) {
+        asm volatile("sti" ::: "memory");
+    }
+}
+
 void rw_lock_init(rw_lock_t *lock) {
     atomic_store(&lock->state, 0);
     atomic_store(&lock->writers_waiting, 0);
+    atomic_store(&lock->writer_next, 0);
+    atomic_store(&lock->writer_owner, 0);
+    atomic_store(&lock->write_gen, 0);
 }
 
-static inline void cpu_relax(void) {
-    atomic_signal_fence(memory_order_acquire);
+static void rw_lock_backoff(unsigned *delay) {
+    for (unsigned i = 0; i < *delay; i++) {
+        __builtin_ia32_pause();
+    }
+    if (*delay < RW_LOCK_MAX_BACKOFF) {
+        *delay *= 2;
+    }
 }
 
 void rw_lock_read_lock(rw_lock_t *lock) {
-    int v;
+    unsigned delay = 1;
 
     for (;;) {
-        v = atomic_load_explicit(&lock->state, memory_order_acquire);
+        unsigned v = atomic_load_explicit(&lock->state, memory_order_relaxed);
 
-        /* Writer active or writer pending */
-        if (v < 0 || atomic_load_explicit(&lock->writers_waiting, memory_order_acquire)) {
-            cpu_relax();
-            continue;
+        // Writer active or waiting
+        if (!(v & RW_LOCK_WRITER) && atomic_load_explicit(&lock->writers_waiting, memory_order_relaxed) == 0
+            && atomic_compare_exchange_weak_explicit(&lock->state, &v, v + 1, memory_order_acquire,
+                                                     memory_order_relaxed)) {
+            return;
         }
 
-        /* Try to increment reader count */
+        rw_lock_backoff(&delay);
+    }
+}
+
+bool rw_lock_try_read_lock(rw_lock_t *lock) {
+    unsigned v = atomic_load_explicit(&lock->state, memory_order_relaxed);
+
+    // Only another reader changing the count makes the exchange fail; then try again
+    while (!(v & RW_LOCK_WRITER) && atomic_load_explicit(&lock->writers_waiting, memory_order_relaxed) == 0) {
         if (atomic_compare_exchange_weak_explicit(&lock->state, &v, v + 1, memory_order_acquire,
                                                   memory_order_relaxed)) {
-            return;
+            return true;
         }
-
-        cpu_relax();
     }
+
+    return false;
 }
 
 void rw_lock_read_unlock(rw_lock_t *lock) {
@@ -55,76 +143,118 @@ void rw_lock_read_unlock(rw_lock_t *lock) {
 }
 
 void rw_lock_write_lock(rw_lock_t *lock) {
-    int expected;
+    atomic_fetch_add_explicit(&lock->writers_waiting, 1, memory_order_relaxed);
 
-    atomic_fetch_add_explicit(&lock->writers_waiting, 1, memory_order_acquire);
+    unsigned ticket = atomic_fetch_add_explicit(&lock->writer_next, 1, memory_order_relaxed);
+    unsigned delay  = 1;
+    while (atomic_load_explicit(&lock->writer_owner, memory_order_acquire) != ticket) {
+        rw_lock_backoff(&delay);
+    }
 
+    // First in line; now wait for the readers (and any upgradeable reader) to leave
+    delay = 1;
     for (;;) {
-        expected = 0;
-
-        /* Try to acquire lock exclusively */
-        if (atomic_compare_exchange_weak_explicit(&lock->state, &expected, -1, memory_order_acquire,
+        unsigned expected = 0;
+        if (atomic_compare_exchange_weak_explicit(&lock->state, &expected, RW_LOCK_WRITER, memory_order_acquire,
                                                   memory_order_relaxed)) {
             break;
         }
-
-        cpu_relax();
+        rw_lock_backoff(&delay);
     }
 
-    atomic_fetch_sub_explicit(&lock->writers_waiting, 1, memory_order_release);
+    // The next writer may queue up on the state now
+    atomic_store_explicit(&lock->writer_owner, ticket + 1, memory_order_release);
+    atomic_fetch_sub_explicit(&lock->writers_waiting, 1, memory_order_relaxed);
 }
 
 void rw_lock_write_unlock(rw_lock_t *lock) {
+    atomic_fetch_add_explicit(&lock->write_gen, 1, memory_order_relaxed);
     atomic_store_explicit(&lock->state, 0, memory_order_release);
 }
 
 bool rw_lock_is_write_locked(rw_lock_t *lock) {
-    int v = atomic_load_explicit(&lock->state, memory_order_acquire);
-    return v < 0;
+    return atomic_load_explicit(&lock->state, memory_order_acquire) & RW_LOCK_WRITER;
 }
 
-void rw_lock_upgrade_read_to_write(rw_lock_t *lock) {
-    atomic_fetch_add_explicit(&lock->writers_waiting, 1, memory_order_acquire);
+void rw_lock_upgradeable_lock(rw_lock_t *lock) {
+    unsigned delay = 1;
 
-    // First, release our read lock
-    atomic_fetch_sub_explicit(&lock->state, 1, memory_order_release);
+    for (;;) {
+        unsigned v = atomic_load_explicit(&lock->state, memory_order_relaxed);
 
-    int expected;
+        if (!(v & (RW_LOCK_WRITER | RW_LOCK_UPGRADEABLE))
+            && atomic_load_explicit(&lock->writers_waiting, memory_order_relaxed) == 0
+            && atomic_compare_exchange_weak_explicit(&lock->state, &v, v | RW_LOCK_UPGRADEABLE, memory_order_acquire,
+                                                     memory_order_relaxed)) {
+            return;
+        }
 
-    for (;;) {
-        expected = 0;
+        rw_lock_backoff(&delay);
+    }
+}
+
+void rw_lock_upgradeable_unlock(rw_lock_t *lock) {
+    atomic_fetch_and_explicit(&lock->state, ~RW_LOCK_UPGRADEABLE, memory_order_release);
+}
+
+bool rw_lock_try_read_to_upgradeable(rw_lock_t *lock) {
+    unsigned v = atomic_load_explicit(&lock->state, memory_order_relaxed);
+
+    // Waiting writers don't matter; we are in already
+    while (!(v & RW_LOCK_UPGRADEABLE)) {
+        if (atomic_compare_exchange_weak_explicit(&lock->state, &v, (v - 1) | RW_LOCK_UPGRADEABLE,
+                                                  memory_order_acquire, memory_order_relaxed)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void rw_lock_upgrade_to_write(rw_lock_t *lock) {
+    // Keeps new readers out; queued writers can't get in either, as they need the state to be zero
+    atomic_fetch_add_explicit(&lock->writers_waiting, 1, memory_order_relaxed);
 
-        /* Try to acquire lock exclusively */
-        if (atomic_compare_exchange_weak_explicit(&lock->state, &expected, -1, memory_order_acquire,
+    unsigned delay = 1;
+    for (;;) {
+        unsigned expected = RW_LOCK_UPGRADEABLE;
+        if (atomic_compare_exchange_weak_explicit(&lock->state, &expected, RW_LOCK_WRITER, memory_order_acquire,
                                                   memory_order_relaxed)) {
             break;
         }
-
-        cpu_relax();
+        rw_lock_backoff(&delay);
     }
 
-    atomic_fetch_sub_explicit(&lock->writers_waiting, 1, memory_order_release);
+    atomic_fetch_sub_explicit(&lock->writers_waiting, 1, memory_order_relaxed);
 }
 
 void rw_lock_downgrade_write_to_read(rw_lock_t *lock) {
+    atomic_fetch_add_explicit(&lock->write_gen, 1, memory_order_relaxed);
     atomic_store_explicit(&lock->state, 1, memory_order_release);
 }
 
-/* bool rw_lock_try_delete_lock(rw_lock_t *lock) {
-    int expected = 0;
+unsigned rw_lock_write_generation(rw_lock_t *lock) {
+    return atomic_load_explicit(&lock->write_gen, memory_order_relaxed);
+}
 
-    bool res = atomic_compare_exchange_strong_explicit(
-        &lock->state, &expected, -1,
-        memory_order_acquire,
-        memory_order_relaxed);
+bool rw_lock_read_begin(rw_lock_t *lock, unsigned *gen_out) {
+    // A writer bumps the generation before it clears RW_LOCK_WRITER, so seeing the bit clear after loading the
+    // generation means that generation covers every write that finished
+    unsigned gen = atomic_load_explicit(&lock->write_gen, memory_order_acquire);
+    if (atomic_load_explicit(&lock->state, memory_order_acquire) & RW_LOCK_WRITER) {
+        return false;
+    }
 
-    if (res) {
+    *gen_out = gen;
+    return true;
+}
+
+bool rw_lock_read_validate(rw_lock_t *lock, unsigned gen) {
+    // Orders the caller's reads before the checks
+    atomic_thread_fence(memory_order_acquire);
 
+    if (atomic_load_explicit(&lock->state, memory_order_relaxed) & RW_LOCK_WRITER) {
+        return false;
     }
+    return atomic_load_explicit(&lock->write_gen, memory_order_relaxed) == gen;
 }
-
-// This allows us to promote our lock without risk of destruction between
-void rw_lock_promote_read_to_write_lock(rw_lock_t *lock) {
-    // Pre-reserve write lock
-    atomic_store(&lock->writer, 1);
-} */
\ No newline at end of file
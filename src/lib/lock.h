@@ -12,25 +12,82 @@ void mutex_lock(mutex *m);
 void mutex_unlock(mutex *m);
 bool mutex_is_locked(mutex *m);
 
-// This lock allows multiple readers but only one writer (and no readers when writing)
+/**
+ * Ticket spinlock: waiters take a ticket and are served in order, and each one spins reading the owner field with a
+ * backoff proportional to its distance from the front, so a contended lock is handed over fairly instead of to whoever
+ * wins the cache line. The counters are only written by the holder, so they need no atomics; read them as a snapshot.
+ */
+typedef struct spinlock {
+    atomic_uint next;  // Next ticket to hand out
+    atomic_uint owner; // Ticket being served
+
+    uint64_t acquisitions;
+    uint64_t contended; // Acquisitions that had to wait
+    uint64_t wait_tsc;  // TSC cycles spent waiting in those
+} spinlock_t;
+
+#define SPINLOCK_INIT { .next = 0, .owner = 0, .acquisitions = 0, .contended = 0, .wait_tsc = 0 }
+
+void spin_lock_init(spinlock_t *lock);
+void spin_lock(spinlock_t *lock);
+bool spin_trylock(spinlock_t *lock);
+void spin_unlock(spinlock_t *lock);
+bool spin_is_locked(spinlock_t *lock);
+
+// For locks also taken from IRQ handlers: disables interrupts, then locks. Returns whether interrupts were enabled;
+// pass that to the restore.
+bool spin_lock_irqsave(spinlock_t *lock);
+void spin_unlock_irqrestore(spinlock_t *lock, bool ints);
+
+/**
+ * Reader-writer lock that prefers writers: once a writer is waiting, new readers hold off until it has had its turn, and
+ * writers get the lock in the order they arrived. Waiters back off exponentially with pause.
+ *
+ * There is also an upgradeable read mode. It coexists with plain readers but excludes writers and other upgradeable
+ * readers, so its holder can turn it into a write lock without anyone else writing in between; nothing read under it
+ * has to be checked again after the upgrade.
+ */
+#define RW_LOCK_WRITER      0x80000000U
+#define RW_LOCK_UPGRADEABLE 0x40000000U
+#define RW_LOCK_READERS     0x3FFFFFFFU // Mask for the plain reader count
+
+// Upper bound on the pause loop between two looks at a contended lock
+#define RW_LOCK_MAX_BACKOFF 1024
+
 typedef struct rw_lock {
-    atomic_int state;
-    atomic_int writers_waiting;
+    atomic_uint state;           // RW_LOCK_WRITER, RW_LOCK_UPGRADEABLE and the reader count
+    atomic_uint writers_waiting; // Includes an upgrader waiting for readers to drain
+    atomic_uint writer_next;     // Tickets that order writers among themselves
+    atomic_uint writer_owner;
+    atomic_uint write_gen; // Bumped by every write unlock
 } rw_lock_t;
 
 void rw_lock_init(rw_lock_t *lock);
 void rw_lock_read_lock(rw_lock_t *lock);
+// Fails instead of waiting if a writer holds the lock or is waiting for it
+bool rw_lock_try_read_lock(rw_lock_t *lock);
 void rw_lock_read_unlock(rw_lock_t *lock);
 void rw_lock_write_lock(rw_lock_t *lock);
 void rw_lock_write_unlock(rw_lock_t *lock);
 bool rw_lock_is_write_locked(rw_lock_t *lock);
 
-// Unlike downgrading, this DOES allow other things to acquire a write lock in between. There is no way around this;
-// read locks aren't exclusive, so, if we try to upgrade multiple different ones concurrently, one will have to go
-// first, so the other one has to wait until the first one is done, and other write locks can be acquired during this
-// upgrade. Because of this, a true upgrade is impossible; the best we can do is preventing new readers (but not
-// necessarily writers) from acquiring the lock while we wait.
-void rw_lock_upgrade_read_to_write(rw_lock_t *lock);
+void rw_lock_upgradeable_lock(rw_lock_t *lock);
+void rw_lock_upgradeable_unlock(rw_lock_t *lock);
+// Turns a held read lock into an upgradeable one without letting go; fails if someone else holds the upgradeable mode
+bool rw_lock_try_read_to_upgradeable(rw_lock_t *lock);
+// Waits for the plain readers to leave; release with rw_lock_write_unlock() (or downgrade)
+void rw_lock_upgrade_to_write(rw_lock_t *lock);
+
+// This completely bypasses any waiting writers; use only when necessary
+void rw_lock_downgrade_write_to_read(rw_lock_t *lock);
+
+// Changes whenever a write lock is released. Equal values read under the lock at two points mean nobody wrote in between.
+unsigned rw_lock_write_generation(rw_lock_t *lock);
 
-// This completely bypasses any waiting writers UNLIKE upgrading; use only when necessary
-void rw_lock_downgrade_write_to_read(rw_lock_t *lock);
\ No newline at end of file
+/**
+ * Optimistic reading without taking the lock, seqlock style: rw_lock_read_begin() fails while the lock is write-locked,
+ * and rw_lock_read_validate() succeeds only if nobody has write-locked it since. Whatever was read in between is only
+ * to be trusted once validated.
+ */
+bool rw_lock_read_begin(rw_lock_t *lock, unsigned *gen_out);
+bool rw_lock_read_validate(rw_lock_t *lock, unsigned gen);
@@ -3,6 +3,7 @@
 #include "arch/platform.h"
 #include "cpu/cpu.h"
 #include "devices/manager.h"
+#include "devices/storage/ramdisk.h"
 #include "exec/elf.h"
 #include "lib/serial.h"
 #include "lib/stdio.h"
@@ -13,9 +14,10 @@
 #include "proc/scheduler.h"
 #include "proc/thread.h"
 #include "syscall/syscall.h"
+#include "plenjos/errno.h"
 #include "timer/pit.h"
 #include "vfs/fscache.h"
-#include "vfs/iso9660/iso9660.h"
+#include "vfs/initramfs/initramfs.h"
 #include "vfs/vfs.h"
 
 #include <limine.h>
@@ -148,6 +150,105 @@ _Noreturn void panic_nomsg() {
 
 #define LINKER_OFFS 0x7fff80000000ULL
 
+#ifdef __KERNEL_SUPPORT_DEV_STORAGE_RAMDISK
+// Attaches every module tagged RAMDISK_MODULE_STRING as a RAM disk. Module memory is ours for good, so the disks are
+// writable in place.
+static void load_ramdisk_modules() {
+    if (!module_request.response) {
+        return;
+    }
+
+    for (uint64_t i = 0; i < module_request.response->module_count; i++) {
+        struct limine_file *module = module_request.response->modules[i];
+        if (!module->string || strncmp(module->string, RAMDISK_MODULE_STRING, sizeof(RAMDISK_MODULE_STRING)) != 0) {
+            continue;
+        }
+
+        int res = ramdisk_create(module->address, module->size, false, module->path, NULL);
+        if (res < 0) {
+            kout(KERNEL_WARN, "Could not attach module %s as a RAM disk: %d\n", module->path, res);
+        }
+    }
+}
+#endif
+
+// Mounts the first module tagged INITRAMFS_MODULE_STRING at /initramfs
+static void load_initramfs_module() {
+    if (!module_request.response) {
+        return;
+    }
+
+    for (uint64_t i = 0; i < module_request.response->module_count; i++) {
+        struct limine_file *module = module_request.response->modules[i];
+        if (!module->string
+            || strncmp(module->string, INITRAMFS_MODULE_STRING, sizeof(INITRAMFS_MODULE_STRING)) != 0) {
+            continue;
+        }
+
+        int res = initramfs_setup(module->address, module->size, INITRAMFS_MODULE_STRING);
+        if (res < 0) {
+            kout(KERNEL_WARN, "Could not mount module %s as the initramfs: %d\n", module->path, res);
+        }
+        return;
+    }
+}
+
+// Where the boot binaries are looked for, in order; the initramfs needs no disk driver
+static const char *boot_roots[] = { "/" INITRAMFS_MODULE_STRING "/", "/iso9660/" };
+
+/**
+ * Reads name (e.g. "bin/init") from the first boot root that has it, storing its full path in path_out. Files in the
+ * initramfs are returned in place; anything else is read into a kmalloc'd buffer, and *owned_out tells the caller to
+ * free it. Returns the file's size, or a negative errno if no boot root has it.
+ */
+static ssize_t read_boot_file(const char *name, char *path_out, size_t path_len, void **buf_out, bool *owned_out) {
+    int res = -ENOENT;
+
+    for (size_t i = 0; i < sizeof(boot_roots) / sizeof(boot_roots[0]); i++) {
+        size_t root_len = strlen(boot_roots[i]);
+        if (root_len + strlen(name) + 1 > path_len) {
+            return -ENAMETOOLONG;
+        }
+        strncpy(path_out, boot_roots[i], path_len);
+        strncpy(path_out + root_len, name, path_len - root_len);
+
+        vfs_handle_t *handle = NULL;
+        res                  = vfs_open(path_out, SYSCALL_OPEN_FLAG_READ, 0, 0, &handle);
+        if (res != 0) {
+            continue;
+        }
+
+        const void *data;
+        ssize_t size = initramfs_file_data(handle->backing_node, &data);
+        if (size >= 0) {
+            vfs_close(handle);
+            *buf_out   = (void *)data;
+            *owned_out = false;
+            return size;
+        }
+
+        uint64_t file_size = (uint64_t)handle->backing_node->size;
+        void *buf          = kmalloc_heap(file_size);
+        if (!buf) {
+            panic("OOM error allocating memory for elf buffer\n");
+        }
+
+        ssize_t read_bytes = vfs_read(handle, buf, file_size);
+        vfs_close(handle);
+        if (read_bytes < 0) {
+            panic("Error reading %s: %d\n", path_out, (int)read_bytes);
+        } else if ((uint64_t)read_bytes != file_size) {
+            panic("Short read reading %s: expected %p, got %p\n", path_out, (void *)file_size, (void *)read_bytes);
+        }
+
+        *buf_out   = buf;
+        *owned_out = true;
+        return read_bytes;
+    }
+
+    return res;
+}
+
 // The following will be our kernel's entry point.
 // If renaming kmain() to something else, make sure to change the
 // linker script accordingly.
@@ -201,60 +302,38 @@ void kmain(void) {
 
     vfs_init();
 
+    load_initramfs_module();
+
+#ifdef __KERNEL_SUPPORT_DEV_STORAGE_RAMDISK
+    // Before the device manager, so that it also waits for the RAM disks' partitions to be probed
+    load_ramdisk_modules();
+#endif
+
     device_manager_init();
 
     syscalls_init();
 
     clear();
 
-    vfs_handle_t *ld_handle = NULL;
-    int res                 = vfs_open("/iso9660/lib/ld.so", SYSCALL_OPEN_FLAG_READ, 0, 0, &ld_handle);
-    void *linker_elf_buf    = NULL;
-    ssize_t linker_read_bytes;
-    if (res == 0) {
-        kout(KERNEL_INFO, "Loading ld.so from iso9660...\n\n");
-        uint64_t file_size = ((struct vfs_iso9660_cache_node_data *)ld_handle->backing_node->internal_data)
-                                 ->dir_record->data_length_le;
-
-        linker_elf_buf = kmalloc_heap(file_size);
-        if (!linker_elf_buf) {
-            panic("OOM error allocating memory for elf buffer\n");
-        }
-
-        linker_read_bytes = vfs_read(ld_handle, linker_elf_buf, file_size);
-        vfs_close(ld_handle);
-        if (linker_read_bytes < 0) {
-            panic("Error reading iso9660/lib/ld.so: %d\n", (int)linker_read_bytes);
-        } else if ((uint64_t)linker_read_bytes != file_size) {
-            panic("Short read reading iso9660/lib/ld.so: expected %p, got %p\n", (void *)file_size,
-                   (void *)linker_read_bytes);
-        }
-    } else {
-        panic("Error opening iso9660/lib/ld.so: %d\n", res);
+    char linker_path[32];
+    void *linker_elf_buf;
+    bool linker_owned;
+    ssize_t linker_read_bytes
+        = read_boot_file("lib/ld.so", linker_path, sizeof(linker_path), &linker_elf_buf, &linker_owned);
+    if (linker_read_bytes < 0) {
+        panic("Error opening lib/ld.so: %d\n", (int)linker_read_bytes);
     }
-
-    // ld_handle has already been closed
-
-    res = vfs_open("/iso9660/bin/init", SYSCALL_OPEN_FLAG_READ, 0, 0, &ld_handle);
-    if (res == 0) {
-        kout(KERNEL_INFO, "Loading init from iso9660...\n\n");
-        uint64_t file_size = ((struct vfs_iso9660_cache_node_data *)ld_handle->backing_node->internal_data)
-                                 ->dir_record->data_length_le;
+    kout(KERNEL_INFO, "Loading ld.so from %s...\n\n", linker_path);
+
+    char init_path[32];
+    void *elf_buf;
+    bool elf_owned;
+    ssize_t read_bytes = read_boot_file("bin/init", init_path, sizeof(init_path), &elf_buf, &elf_owned);
+    if (read_bytes >= 0) {
+        kout(KERNEL_INFO, "Loading init from %s...\n\n", init_path);
         proc_t *shell_proc = create_proc("init", NULL);
 
         uint64_t entry;
-        void *elf_buf = kmalloc_heap(file_size);
-        if (!elf_buf) {
-            panic("OOM error allocating memory for elf buffer\n");
-        }
-
-        ssize_t read_bytes = vfs_read(ld_handle, elf_buf, file_size);
-        vfs_close(ld_handle);
-        if (read_bytes < 0) {
-            panic("Error reading iso9660/bin/init: %d\n", (int)read_bytes);
-        } else if ((uint64_t)read_bytes != file_size) {
-            panic("Short read reading iso9660/bin/init: expected %p, got %p\n", (void *)file_size, (void *)read_bytes);
-        }
 
         kout(KERNEL_INFO, "Read %p bytes for init and %p bytes for ld.so\n", (void *)read_bytes, (void *)linker_read_bytes);
 
@@ -265,7 +344,9 @@ void kmain(void) {
 
         // 0x7fff80000000ULL
         loadelf(elf_buf, shell_proc->pml4, &entry, 0x400000ULL);
-        kfree_heap(elf_buf);
+        if (elf_owned) {
+            kfree_heap(elf_buf);
+        }
 
         thread_t *shell_thread = create_thread(shell_proc, "init_t0", (void *)linker_entry, NULL);
 
@@ -276,7 +357,7 @@ void kmain(void) {
         uint64_t *rsp = rsp_og;
 
         // First, setup the stack
-        const char *argv0 = "/iso9660/bin/init";
+        const char *argv0 = init_path;
         const char *argv1 = NULL;
 
         const char *envp0 = NULL;
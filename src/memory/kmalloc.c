@@ -2,6 +2,7 @@
 
 #include "arch/x86_64/common.h"
 #include "kernel.h"
+#include "lib/lock.h"
 #include "lib/stdio.h"
 #include "lib/string.h"
 #include "memory/detect.h"
@@ -46,26 +47,8 @@ static inline bool is_page_misaligned(uint64_t ptr) {
 
 #define HEAP_HEADER_LEN sizeof(heap_segment_info_t)
 
-// bool kheap_locked = false;
-static atomic_flag kheap_locked_atomic = ATOMIC_FLAG_INIT;
-
-void lock_kheap() {
-    /* for (;;) {
-        if (!kheap_locked) {
-            kheap_locked = true;
-            return;
-        }
-    } */
-    while (atomic_flag_test_and_set_explicit(&kheap_locked_atomic, __ATOMIC_ACQUIRE)) {
-        // Wait
-        __builtin_ia32_pause();
-    }
-}
-
-void unlock_kheap() {
-    // kheap_locked = false;
-    atomic_flag_clear_explicit(&kheap_locked_atomic, __ATOMIC_RELEASE);
-}
+// Also taken by allocations from IRQ handlers, so always with interrupts disabled
+static spinlock_t kheap_lock = SPINLOCK_INIT;
 
 uint64_t *alloc_before_kheap() {
     uint64_t *frame = (uint64_t *)phys_to_virt(find_next_free_frame());
@@ -175,11 +158,7 @@ void *kmalloc_heap(uint64_t size) {
     if (size % HEAP_GRANULARITY) size = size + HEAP_GRANULARITY - (size % HEAP_GRANULARITY); // Align to 2 bytes
     if (size < HEAP_ALLOC_MIN) size = HEAP_ALLOC_MIN;
 
-    bool ints = are_interrupts_enabled();
-    if (ints) {
-        asm volatile("cli");
-    }
-    lock_kheap();
+    bool ints = spin_lock_irqsave(&kheap_lock);
 
     heap_segment_info_t *cur_seg = (heap_segment_info_t *)atomic_load(&kheap_start);
 
@@ -191,10 +170,7 @@ void *kmalloc_heap(uint64_t size) {
 
                 cur_seg->free = false;
 
-                unlock_kheap();
-                if (ints) {
-                    asm volatile("sti");
-                }
+                spin_unlock_irqrestore(&kheap_lock, ints);
                 // TODO: once this code is well-tested, these checks can be removed
                 if ((uint64_t)cur_seg % HEAP_GRANULARITY) {
                     panic("ERROR: cur_seg is not aligned to HEAP_GRANULARITY.\n");
@@ -203,10 +179,7 @@ void *kmalloc_heap(uint64_t size) {
             } else if (cur_seg->size == size) {
                 cur_seg->free = false;
 
-                unlock_kheap();
-                if (ints) {
-                    asm volatile("sti");
-                }
+                spin_unlock_irqrestore(&kheap_lock, ints);
                 if ((uint64_t)cur_seg % HEAP_GRANULARITY) {
                     panic("ERROR: cur_seg is not aligned to HEAP_GRANULARITY.\n");
                 }
@@ -224,11 +197,7 @@ void *kmalloc_heap(uint64_t size) {
 
     seg->free = false;
 
-    unlock_kheap();
-
-    if (ints) {
-        asm volatile("sti");
-    }
+    spin_unlock_irqrestore(&kheap_lock, ints);
 
     if ((uint64_t)seg % HEAP_GRANULARITY) {
         panic("ERROR: cur_seg is not aligned to HEAP_GRANULARITY.\n");
@@ -246,19 +215,19 @@ void kfree_heap(void *ptr) {
 
     heap_segment_info_t *cur_seg = (heap_segment_info_t *)((uint64_t)ptr - HEAP_HEADER_LEN);
 
-    lock_kheap();
+    bool ints = spin_lock_irqsave(&kheap_lock);
 
     if (cur_seg->free) {
         printf("ERROR: double free or corruption\n");
 
-        unlock_kheap();
+        spin_unlock_irqrestore(&kheap_lock, ints);
         return;
     }
 
     cur_seg->free = true;
     // TODO: merge segments
 
-    unlock_kheap();
+    spin_unlock_irqrestore(&kheap_lock, ints);
 }
 
 void *kmalloc(uint64_t size) {
@@ -33,8 +33,14 @@ page_t *find_page_using_alloc(uint64_t virt, bool autocreate, uint64_t *alloc_fu
 page_t *find_page(uint64_t virt, bool autocreate, pml4_t *pml4);
 
 uint64_t get_physaddr(uint64_t virt, pml4_t *pml4);
+
+// Returns the page table covering the 2 MiB region containing virt, or NULL if it doesn't exist. Never allocates.
+pt_t *find_page_table(uint64_t virt, pml4_t *pml4);
 uint32_t get_physaddr32(uint64_t virt, pml4_t *pml4);
 
+// Physical address behind any kernel address (heap, image or HHDM), e.g. for building DMA descriptors. 0 if unmapped.
+uint64_t get_kernel_physaddr(uint64_t virt);
+
 void free_page_table(pml4_t *pml4_virt);
 
 // Physical memory manager
@@ -252,6 +252,31 @@ uint64_t get_physaddr(uint64_t virt, pml4_t *pml4) {
     return (page.frame << 12) + (virt & 0xFFF);
 }
 
+pt_t *find_page_table(uint64_t virt, pml4_t *pml4) {
+    uint32_t pml4_index, pdpt_index, pd_index, pt_index;
+
+    if (!pml4) return NULL;
+
+    addr_split(virt, &pml4_index, &pdpt_index, &pd_index, &pt_index);
+
+    dir_entry_t pml4_entry = pml4->entries[pml4_index];
+
+    if (!pml4_entry.present) return NULL;
+
+    pdpt_t *pdpt_table     = (pdpt_t *)phys_to_virt(pml4_entry.base_addr << 12);
+    dir_entry_t pdpt_entry = pdpt_table->entries[pdpt_index];
+
+    if (!pdpt_entry.present) return NULL;
+
+    pd_t *pd_table       = (pd_t *)phys_to_virt(pdpt_entry.base_addr << 12);
+    dir_entry_t pd_entry = pd_table->entries[pd_index];
+
+    // reserved_1 holds the PS bit; huge pages have no page table to return
+    if (!pd_entry.present || (pd_entry.reserved_1 & 0x2)) return NULL;
+
+    return (pt_t *)phys_to_virt(pd_entry.base_addr << 12);
+}
+
 uint32_t get_physaddr32(uint64_t virt, pml4_t *pml4) {
     uint64_t phys = get_physaddr(virt, pml4);
 
@@ -263,6 +288,14 @@ uint32_t get_physaddr32(uint64_t virt, pml4_t *pml4) {
     return phys & 0xFFFFFFFF;
 }
 
+uint64_t get_kernel_physaddr(uint64_t virt) {
+    // The HHDM may be mapped with huge pages, which get_physaddr() doesn't walk
+    if (virt >= HHDM_OFFSET && virt < KERNEL_HEAP_START_ADDR) {
+        return virt_to_phys(virt);
+    }
+    return get_physaddr(virt, kernel_pml4);
+}
+
 void init_paging() {
     kernel_pml4_phys = get_cr3_addr();
     kernel_pml4      = (pml4_t *)phys_to_virt(kernel_pml4_phys);
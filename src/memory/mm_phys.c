@@ -9,7 +9,7 @@
 #include <stdint.h>
 
 // TODO: can we make parts of these frames atomic instead, allowing us to avoid locking the entire PMM?
-static mutex phys_mem_lock = MUTEX_INIT;
+static spinlock_t phys_mem_lock = SPINLOCK_INIT;
 
 // PMM doesn't need to be locked
 uint32_t phys_mem_ref_frame(phys_mem_free_frame_t *frame) {
@@ -46,12 +46,14 @@ uint64_t *alloc() {
 }
 
 uint64_t find_next_free_frame() {
-    mutex_lock(&phys_mem_lock);
+    // The heap allocates frames with interrupts disabled, and IRQ handlers allocate from the heap
+    bool ints = spin_lock_irqsave(&phys_mem_lock);
 
     phys_mem_free_frame_t *frame = phys_mem_frame_map_next_free;
 
     if ((!frame) || frame >= (phys_mem_frame_map + phys_mem_frame_map_size)) {
         printf("No free frames! Last one: %p.\n", fm2);
+        spin_unlock_irqrestore(&phys_mem_lock, ints);
         return 0;
         // hcf();
     }
@@ -97,7 +99,7 @@ uint64_t find_next_free_frame() {
     frame->next_free = 0;
     frame->prev_free = 0;
 
-    mutex_unlock(&phys_mem_lock);
+    spin_unlock_irqrestore(&phys_mem_lock, ints);
 
     return frame_addr_to_phys_addr((uint64_t)frame);
 }
@@ -0,0 +1,287 @@
+#include "proc/kthread.h"
+
+#include "arch/x86_64/common.h"
+#include "cpu/cpu.h"
+#include "lib/lock.h"
+#include "lib/stdio.h"
+#include "lib/string.h"
+#include "memory/kmalloc.h"
+#include "plenjos/errno.h"
+#include "proc/scheduler.h"
+#include "timer/timer.h"
+
+// Saves the callee-saved registers on the current stack, stores rsp in *save_rsp, and resumes whatever load_rsp saved
+extern void kthread_switch(uint64_t *save_rsp, uint64_t load_rsp);
+// Where a new thread's first kthread_switch() returns to; aligns the stack and calls kthread_entry()
+extern void kthread_trampoline();
+
+// Kernel thread each core is running, and where that core's scheduler loop is parked meanwhile
+static kthread_t *cores_kthreads[MAX_CORES];
+static uint64_t scheduler_loop_rsp[MAX_CORES];
+
+// Ready kernel threads, oldest first. Wakeups come from IRQ handlers too, so interrupts stay off while the lock is held.
+static spinlock_t kthread_ready_lock = SPINLOCK_INIT;
+static kthread_t *kthread_ready_head;
+static kthread_t *kthread_ready_tail;
+static atomic_uint kthread_ready_count;
+
+static void kthread_ready_push(kthread_t *thread) {
+    bool ints = spin_lock_irqsave(&kthread_ready_lock);
+
+    thread->ready_next = NULL;
+    if (kthread_ready_tail) {
+        kthread_ready_tail->ready_next = thread;
+    } else {
+        kthread_ready_head = thread;
+    }
+    kthread_ready_tail = thread;
+    atomic_fetch_add_explicit(&kthread_ready_count, 1, memory_order_relaxed);
+
+    spin_unlock_irqrestore(&kthread_ready_lock, ints);
+
+    scheduler_wake_for_work(thread->last_core >= 0 ? (uint32_t)thread->last_core : get_curr_core());
+}
+
+// Called with interrupts disabled
+static kthread_t *kthread_ready_pop() {
+    if (atomic_load_explicit(&kthread_ready_count, memory_order_relaxed) == 0) {
+        return NULL;
+    }
+
+    spin_lock(&kthread_ready_lock);
+    kthread_t *thread = kthread_ready_head;
+    if (thread) {
+        kthread_ready_head = thread->ready_next;
+        if (!kthread_ready_head) {
+            kthread_ready_tail = NULL;
+        }
+        atomic_fetch_sub_explicit(&kthread_ready_count, 1, memory_order_relaxed);
+    }
+    spin_unlock(&kthread_ready_lock);
+
+    return thread;
+}
+
+bool kthread_pending() {
+    return atomic_load_explicit(&kthread_ready_count, memory_order_relaxed) > 0;
+}
+
+kthread_t *kthread_create(const char *name, kthread_func_t func, void *arg) {
+    kthread_t *thread = kmalloc_heap(sizeof(kthread_t));
+    if (!thread) {
+        return NULL;
+    }
+    memset(thread, 0, sizeof(kthread_t));
+
+    thread->stack = kmalloc_heap(KTHREAD_STACK_SIZE);
+    if (!thread->stack) {
+        kfree_heap(thread);
+        return NULL;
+    }
+
+    thread->func = func;
+    thread->arg  = arg;
+    strncpy(thread->name, name, KTHREAD_NAME_LEN - 1);
+    thread->last_core = -1;
+    atomic_store_explicit(&thread->state, KTHREAD_READY, memory_order_relaxed);
+
+    // The first switch to the thread pops six zeroed callee-saved registers and returns into the trampoline
+    uint64_t *sp = (uint64_t *)((uint8_t *)thread->stack + KTHREAD_STACK_SIZE);
+    *--sp        = (uint64_t)kthread_trampoline;
+    for (int i = 0; i < 6; i++) {
+        *--sp = 0;
+    }
+    thread->rsp = (uint64_t)sp;
+
+    return thread;
+}
+
+void kthread_start(kthread_t *thread) {
+    kthread_ready_push(thread);
+}
+
+int kthread_run(const char *name, kthread_func_t func, void *arg) {
+    kthread_t *thread = kthread_create(name, func, arg);
+    if (!thread) {
+        return -ENOMEM;
+    }
+    kthread_start(thread);
+    return 0;
+}
+
+__attribute__((noreturn)) void kthread_entry() {
+    kthread_t *thread = kthread_current();
+
+    // The scheduler loop switches with interrupts disabled
+    asm volatile("sti");
+    thread->func(thread->arg);
+
+    kthread_exit();
+}
+
+kthread_t *kthread_current() {
+    return cores_kthreads[get_curr_core()];
+}
+
+bool kthread_can_sleep() {
+    return are_interrupts_enabled() && kthread_current() != NULL;
+}
+
+void kthread_prepare_block() {
+    atomic_store(&kthread_current()->state, KTHREAD_BLOCKED);
+}
+
+void kthread_finish_block() {
+    kthread_t *thread        = kthread_current();
+    kthread_state_t expected = KTHREAD_BLOCKED;
+    if (!atomic_compare_exchange_strong(&thread->state, &expected, KTHREAD_RUNNING)) {
+        // Someone woke us and the thread is already on the ready queue; switch out so it isn't on two cores at once
+        kthread_schedule();
+    }
+}
+
+void kthread_schedule() {
+    kthread_t *thread = kthread_current();
+    if (!thread) {
+        panic("Kernel Programming Error: kthread_schedule() called outside of a kernel thread\n");
+    }
+
+    bool ints = are_interrupts_enabled();
+    asm volatile("cli");
+
+    kthread_switch(&thread->rsp, scheduler_loop_rsp[get_curr_core()]);
+
+    // Running again, maybe on another core
+    if (ints) {
+        asm volatile("sti");
+    }
+}
+
+void kthread_yield() {
+    kthread_schedule();
+}
+
+__attribute__((noreturn)) void kthread_exit() {
+    kthread_t *thread = kthread_current();
+    if (!thread) {
+        panic("Kernel Programming Error: kthread_exit() called outside of a kernel thread\n");
+    }
+
+    asm volatile("cli");
+    atomic_store(&thread->state, KTHREAD_DEAD);
+    kthread_switch(&thread->rsp, scheduler_loop_rsp[get_curr_core()]);
+
+    panic("Kernel Programming Error: a dead kernel thread was resumed\n");
+}
+
+void kthread_wake(kthread_t *thread) {
+    kthread_state_t expected = KTHREAD_BLOCKED;
+    if (atomic_compare_exchange_strong(&thread->state, &expected, KTHREAD_READY)) {
+        kthread_ready_push(thread);
+    }
+}
+
+static void kthread_wakeup_callback(struct timer_timeout *timeout) {
+    kthread_t *thread = timeout->data;
+
+    atomic_store(&thread->wakeup_state, KTHREAD_WAKEUP_FIRING);
+    kthread_wake(thread);
+    // The thread may exit as soon as it sees this
+    atomic_store_explicit(&thread->wakeup_state, KTHREAD_WAKEUP_IDLE, memory_order_release);
+}
+
+int kthread_set_wakeup_ns(uint64_t ns) {
+    kthread_t *thread = kthread_current();
+
+    atomic_store(&thread->wakeup_state, KTHREAD_WAKEUP_ARMED);
+    int res = set_timeout_ns(ns, kthread_wakeup_callback, thread);
+    if (res < 0) {
+        atomic_store(&thread->wakeup_state, KTHREAD_WAKEUP_IDLE);
+        return res;
+    }
+
+    thread->wakeup_timeout = res;
+    return 0;
+}
+
+void kthread_clear_wakeup() {
+    kthread_t *thread = kthread_current();
+
+    if (atomic_load(&thread->wakeup_state) == KTHREAD_WAKEUP_ARMED && cancel_timeout(thread->wakeup_timeout) == 0) {
+        atomic_store(&thread->wakeup_state, KTHREAD_WAKEUP_IDLE);
+        return;
+    }
+
+    // The callback is queued or running, and still uses the thread
+    while (atomic_load_explicit(&thread->wakeup_state, memory_order_acquire) != KTHREAD_WAKEUP_IDLE) {
+        kthread_yield();
+    }
+}
+
+uint64_t kthread_sleep_ms(uint64_t milliseconds) {
+    kthread_t *thread = kthread_current();
+    uint64_t start    = timer_now_ns();
+    uint64_t deadline = UINT64_MAX;
+    if (milliseconds < (UINT64_MAX - start) / TIMER_NS_PER_MS) {
+        deadline = start + milliseconds * TIMER_NS_PER_MS;
+    }
+
+    uint64_t now;
+    while ((now = timer_now_ns()) < deadline) {
+        // A timeout may fire a little before timer_now_ns() reaches the deadline; then it is armed again for the rest
+        if (atomic_load(&thread->wakeup_state) == KTHREAD_WAKEUP_IDLE && kthread_set_wakeup_ns(deadline - now) < 0) {
+            kthread_yield();
+            continue;
+        }
+
+        kthread_prepare_block();
+        if (atomic_load(&thread->wakeup_state) != KTHREAD_WAKEUP_ARMED) {
+            kthread_finish_block();
+        } else {
+            kthread_schedule();
+        }
+    }
+
+    kthread_clear_wakeup();
+
+    return (timer_now_ns() - start) / TIMER_NS_PER_MS;
+}
+
+bool kthread_run_next(uint32_t curr_core) {
+    kthread_t *thread = kthread_ready_pop();
+    if (!thread) {
+        return false;
+    }
+
+    // A wakeup can requeue a thread before it has finished switching out on another core
+    while (atomic_load_explicit(&thread->on_cpu, memory_order_acquire)) {
+        __builtin_ia32_pause();
+    }
+
+    atomic_store_explicit(&thread->on_cpu, true, memory_order_relaxed);
+    atomic_store(&thread->state, KTHREAD_RUNNING);
+    thread->last_core         = (int32_t)curr_core;
+    cores_kthreads[curr_core] = thread;
+
+    kthread_switch(&scheduler_loop_rsp[curr_core], thread->rsp);
+
+    cores_kthreads[curr_core] = NULL;
+
+    switch (atomic_load(&thread->state)) {
+    case KTHREAD_DEAD:
+        kfree_heap(thread->stack);
+        kfree_heap(thread);
+        return true;
+    case KTHREAD_RUNNING:
+        // Yielded
+        atomic_store(&thread->state, KTHREAD_READY);
+        kthread_ready_push(thread);
+        break;
+    default:
+        // Blocked, or already woken and requeued
+        break;
+    }
+
+    atomic_store_explicit(&thread->on_cpu, false, memory_order_release);
+    return true;
+}
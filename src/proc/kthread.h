@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Kernel threads: kernel code with a stack of its own, so unlike kernel tasks (which run to completion on the scheduler
+ * loop's stack) it can block. Kernel threads are scheduled cooperatively from the scheduler loop, ahead of user threads;
+ * one runs until it blocks, yields or exits, and then switches back to the loop of whichever core it is on. Any core
+ * may pick a ready kernel thread up.
+ *
+ * Blocking follows the usual pattern, which proc/wait.h wraps for the common cases:
+ *
+ *     kthread_prepare_block();
+ *     if (condition) {
+ *         kthread_finish_block();
+ *     } else {
+ *         kthread_schedule();
+ *     }
+ *
+ * A waker makes the condition true first and then calls kthread_wake(), so a wakeup that lands between the check and
+ * kthread_schedule() is not lost: the thread is just requeued straight away.
+ */
+
+#define KTHREAD_STACK_SIZE 0x4000 // 16 KiB
+#define KTHREAD_NAME_LEN   32
+
+typedef void (*kthread_func_t)(void *arg);
+
+typedef enum {
+    KTHREAD_READY,   // On the ready queue, or about to be
+    KTHREAD_RUNNING, // On a core
+    KTHREAD_BLOCKED, // Waiting for kthread_wake()
+    KTHREAD_DEAD,    // Exited; freed by the scheduler loop it switched back to
+} kthread_state_t;
+
+typedef enum {
+    KTHREAD_WAKEUP_IDLE,
+    KTHREAD_WAKEUP_ARMED,  // A timeout will wake the thread
+    KTHREAD_WAKEUP_FIRING, // The timeout's callback is running
+} kthread_wakeup_state_t;
+
+typedef struct kthread kthread_t;
+
+struct kthread {
+    uint64_t rsp; // Saved while switched out; kthread_switch() keeps the callee-saved registers on the stack
+    void *stack;
+    kthread_func_t func;
+    void *arg;
+    char name[KTHREAD_NAME_LEN];
+
+    _Atomic(kthread_state_t) state;
+    // Set while a core is executing on the thread's stack; a core that picks the thread up waits for it to clear, since
+    // a wakeup can requeue the thread before it has switched out
+    atomic_bool on_cpu;
+    int32_t last_core;
+
+    kthread_t *ready_next; // Ready queue link; only touched with the queue's lock held
+
+    // Timed wakeups (see kthread_set_wakeup_ns())
+    _Atomic(kthread_wakeup_state_t) wakeup_state;
+    int wakeup_timeout;
+};
+
+// Returns NULL if out of memory. The thread doesn't run until kthread_start().
+kthread_t *kthread_create(const char *name, kthread_func_t func, void *arg);
+void kthread_start(kthread_t *thread);
+// Creates and starts a thread; returns -ENOMEM if it couldn't be created
+int kthread_run(const char *name, kthread_func_t func, void *arg);
+
+__attribute__((noreturn)) //
+void kthread_exit();
+
+// The kernel thread running on this core, or NULL outside of one (kernel tasks, syscalls, IRQ handlers)
+kthread_t *kthread_current();
+// Whether the caller may block: it is a kernel thread and interrupts are enabled. Callers must not hold spinlocks.
+bool kthread_can_sleep();
+
+void kthread_prepare_block();
+// Undoes kthread_prepare_block() when the condition turned out to be true already
+void kthread_finish_block();
+// Switches back to the scheduler loop; returns once the thread is running again. Without a kthread_prepare_block()
+// first, this is a yield.
+void kthread_schedule();
+void kthread_yield();
+// Makes a blocked thread ready; does nothing if it isn't blocked. Safe from IRQ handlers.
+void kthread_wake(kthread_t *thread);
+
+// Arms a timeout that kthread_wake()s the calling thread ns from now; returns a negative errno if it can't. The state
+// turns from ARMED to FIRING just before the wakeup, so a thread that sees it ARMED after kthread_prepare_block() will be
+// woken.
+int kthread_set_wakeup_ns(uint64_t ns);
+// Cancels the calling thread's timed wakeup, or waits for its callback to finish if it has already fired
+void kthread_clear_wakeup();
+
+// Blocks the calling kernel thread for at least milliseconds; returns how many milliseconds actually passed
+uint64_t kthread_sleep_ms(uint64_t milliseconds);
+
+// Scheduler loop side: runs one ready kernel thread until it switches back; returns false if there was none
+bool kthread_run_next(uint32_t curr_core);
+bool kthread_pending();
@@ -15,6 +15,7 @@
 #include "memory/mm.h"
 #include "proc/scheduler.h"
 #include "proc/thread.h"
+#include "syscall/mem/memmap.h"
 
 #include <stdint.h>
 
@@ -155,9 +156,18 @@ void process_exit(proc_t *proc) {
         process_exit(proc->first_child);
     }
 
-    lock_ready_threads();
+    // Stops scheduler_tick() from requeueing a thread that is preempted from here on; seq_cst pairs with the check it
+    // makes under the run queue lock
+    __atomic_store_n(&proc->state, DEAD, __ATOMIC_SEQ_CST);
+
+    // Take the process's threads off the run queues first, so no core can pick one up while they are being freed
+    for (thread_t *t = (thread_t *)proc->threads; t; t = (thread_t *)t->next) {
+        thread_unready(t);
+    }
 
     for (size_t i = 0; i < MAX_CORES; i++) {
+        bool ints = lock_core_run_queue(i);
+
         if (cores_threads[i] && (cores_threads[i]->parent == proc)) {
             if (cores_threads[i]->state == RUNNING) {
                 // We're currently running on this core, we need to switch to another thread
@@ -170,6 +180,8 @@ void process_exit(proc_t *proc) {
             cores_threads[i]         = NULL;
             cpu_cores[i].status     &= ~1;
         }
+
+        unlock_core_run_queue(i, ints);
     }
 
     // Free all threads
@@ -194,7 +206,7 @@ void process_exit(proc_t *proc) {
         thread = next_thread;
     }
 
-    unlock_ready_threads();
+    memmap_file_release_all(proc);
 
     // Unref page table
     free_page_table((pml4_t *)proc->pml4);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "kernel.h"
+#include "lib/lock.h"
 #include "lib/structures/rbtree.h"
 #include "memory/mm_common.h"
 #include "vfs/vfs.h"
@@ -47,6 +48,10 @@ struct proc {
 
     _Atomic(pid_t) next_thread_index;
 
+    // File-backed mappings (see syscall/mem/memmap.h)
+    struct memmap_file_region *file_maps;
+    mutex file_maps_lock;
+
     uid_t uid;
     char *cwd; // Page-aligned; 4096 bytes
     // TODO: should cwd be a file descriptor instead?
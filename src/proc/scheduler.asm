@@ -62,24 +62,24 @@ _finalize_task_switch:
     swapgs
     ; Next, load the registers_t struct into r15:
     mov r15, rdi
+
+    ; Build the iret frame on this (kernel) stack rather than the thread's: a preempted thread may have live data in
+    ; the red zone below its rsp. The kernel stack and the thread struct are mapped in every address space.
+    push 0x23           ; user data segment; 0x20 | 0x3
+    push qword [r15 + REG_IRET_RSP]
+    push qword [r15 + REG_IRET_RFLAGS]
+    push 0x1B           ; user code segment; 0x18 | 0x3
+    push qword [r15 + REG_IRET_RIP]
+
     mov rdi, [r15 + CR_REG_CR3]   ; Prepare for page table loading
-    mov rsp, [r15 + REG_IRET_RSP] ; Load new thread's stack
 
     ; After loading the new thread's page table, we are still in ring 0, so we can access
     ; kernel data structures that are mapped into the process's address space.
     mov cr3, rdi ; Load new thread's page tables
     mov rbp, [r15 + GEN_REG_RBP]
-    mov r14, [r15 + REG_IRET_RIP]
-    xor rax, rax ; zeroes out the entire rax register; otherwise the topmost bits might be wrong when we push it to stack
     mov ax, 0x23        ; user data segment; 0x20 | 0x3
     mov ds, ax
     mov es, ax
-    push rax            ; push user data segment
-    lea rax, [rsp + 0x08] ; the offset is needed because we have already pushed user data segment to the stack
-    push rax            ; push user stack
-    push qword [r15 + REG_IRET_RFLAGS]
-    push 0x1B           ; user code segment; 0x18 | 0x3
-    push r14            ; push user instruction pointer
     load_task_general_registers
     .end:
     iretq
@@ -101,4 +101,31 @@ cpu_scheduler_task:
 .hang:
     hlt
     jmp .hang
-    
\ No newline at end of file
+    
+; void kthread_switch(uint64_t *save_rsp, uint64_t load_rsp)
+; Only the callee-saved registers need to survive; the caller has interrupts disabled.
+global kthread_switch
+kthread_switch:
+    push rbx
+    push rbp
+    push r12
+    push r13
+    push r14
+    push r15
+    mov [rdi], rsp
+    mov rsp, rsi
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbp
+    pop rbx
+    ret
+
+; A new kernel thread's first kthread_switch() returns here
+global kthread_trampoline
+extern kthread_entry
+kthread_trampoline:
+    and rsp, -16
+    call kthread_entry
+    ud2
@@ -3,173 +3,414 @@
 #include "arch/x86_64/apic/apic.h"
 #include "arch/x86_64/common.h"
 #include "arch/x86_64/cpuid/cpuid.h"
+#include "arch/x86_64/gdt/gdt.h"
 #include "arch/x86_64/irq.h"
 #include "cpu/cpu.h"
 #include "lib/stdio.h"
+#include "lib/string.h"
 #include "memory/mm.h"
+#include "plenjos/errno.h"
+#include "proc/kthread.h"
 #include "proc/proc.h"
 #include "proc/thread.h"
-#include "timer/pit.h"
+#include "timer/timer.h"
 
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 
+// Must be a power of two
 #define MAX_KERNEL_TASKS 8192
 
-/* TODO: IMPORTANT: if we have 2 kernel tasks alternating time on one CPU, their stacks would currently be the same,
- * leading to corruption as RSP is switched but push/pop could interfere with the other process' stack. Each kernel task
- * should have its own stack if it can alternate time with another. */
-
+/**
+ * Kernel tasks are queued in a bounded multi-producer multi-consumer ring (Dmitry Vyukov's design), so IRQ handlers can
+ * delegate work without spinning on a lock another core holds. Every cell carries a sequence number telling whose turn
+ * it is: a producer at position pos may fill the cell once its sequence is pos, and then sets it to pos + 1; a consumer
+ * at pos may empty it once its sequence is pos + 1, and then hands it to the producer one lap later (pos +
+ * MAX_KERNEL_TASKS). Producers and consumers claim positions with a CAS on their own counter and never touch each
+ * other's.
+ */
 typedef struct {
-    _Atomic(kernel_task_func_t) func;
+    // Stored relative to the cell's index, so the zeroed ring starts out with every cell free for the first lap
+    atomic_size_t seq;
+    kernel_task_func_t func;
     void *arg;
 } kernel_task_t;
 
-volatile thread_t *volatile ready_threads      = NULL;
-volatile thread_t *volatile ready_threads_last = NULL;
-
 volatile thread_t *volatile cores_threads[MAX_CORES] = { 0 };
 
-volatile kernel_task_t volatile ready_kernel_tasks[MAX_KERNEL_TASKS] = { 0 };
+run_queue_t run_queues[MAX_CORES];
+
+static volatile uint32_t sched_quantum_ms = SCHED_DEFAULT_QUANTUM_MS;
+
+static kernel_task_t ready_kernel_tasks[MAX_KERNEL_TASKS];
 
-// TODO: make this a ring buffer
-static volatile size_t ready_kernel_tasks_head = 0ULL;
-static volatile size_t ready_kernel_tasks_tail = 0ULL;
-static atomic_flag kernel_tasks_lock_atomic    = ATOMIC_FLAG_INIT;
+// On separate cache lines, so producers and consumers don't bounce one line between them
+__attribute__((aligned(64))) static atomic_size_t kernel_tasks_enqueue_pos;
+__attribute__((aligned(64))) static atomic_size_t kernel_tasks_dequeue_pos;
 
-// static _Atomic(uint32_t) ready_threads_lock = (uint32_t)-1;
-static atomic_flag ready_threads_locked_atomic = ATOMIC_FLAG_INIT;
+// Cores halted in their scheduler loop with nothing to do. Whoever wakes one clears its bit first, so two wakers never
+// pick the same core.
+static _Atomic(uint64_t) idle_cores[(MAX_CORES + 63) / 64];
+
+static size_t kernel_task_load_seq(kernel_task_t *cell, size_t index) {
+    return atomic_load_explicit(&cell->seq, memory_order_acquire) + index;
+}
+
+static void kernel_task_store_seq(kernel_task_t *cell, size_t index, size_t seq) {
+    atomic_store_explicit(&cell->seq, seq - index, memory_order_release);
+}
 
-uint32_t lock_ready_threads() {
-    /* for (;;) {
-        atomic
-        if (ready_threads_lock == (uint32_t)-1) {
-            ready_threads_lock = get_curr_core();
-            return ready_threads_lock;
+static int kernel_task_enqueue(kernel_task_func_t func, void *arg) {
+    size_t pos = atomic_load_explicit(&kernel_tasks_enqueue_pos, memory_order_relaxed);
+    kernel_task_t *cell;
+    for (;;) {
+        size_t index   = pos & (MAX_KERNEL_TASKS - 1);
+        cell           = &ready_kernel_tasks[index];
+        intptr_t ahead = (intptr_t)(kernel_task_load_seq(cell, index) - pos);
+        if (ahead == 0) {
+            // On failure the CAS reloads pos
+            if (atomic_compare_exchange_weak_explicit(&kernel_tasks_enqueue_pos, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (ahead < 0) {
+            // The cell still holds the task from one lap ago
+            return -ENOSPC;
+        } else {
+            // Another producer took this position
+            pos = atomic_load_explicit(&kernel_tasks_enqueue_pos, memory_order_relaxed);
         }
-    } */
-    while (atomic_flag_test_and_set_explicit(&ready_threads_locked_atomic, __ATOMIC_ACQUIRE)) {
-        // Wait
-        __builtin_ia32_pause();
     }
+
+    cell->func = func;
+    cell->arg  = arg;
+    kernel_task_store_seq(cell, pos & (MAX_KERNEL_TASKS - 1), pos + 1);
+    return 0;
+}
+
+// Returns false if the ring is empty, or its oldest task is still being written
+static bool kernel_task_dequeue(kernel_task_func_t *func_out, void **arg_out) {
+    size_t pos = atomic_load_explicit(&kernel_tasks_dequeue_pos, memory_order_relaxed);
+    kernel_task_t *cell;
+    for (;;) {
+        size_t index   = pos & (MAX_KERNEL_TASKS - 1);
+        cell           = &ready_kernel_tasks[index];
+        intptr_t ahead = (intptr_t)(kernel_task_load_seq(cell, index) - (pos + 1));
+        if (ahead == 0) {
+            if (atomic_compare_exchange_weak_explicit(&kernel_tasks_dequeue_pos, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (ahead < 0) {
+            return false;
+        } else {
+            // Another consumer took this position
+            pos = atomic_load_explicit(&kernel_tasks_dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    *func_out = cell->func;
+    *arg_out  = cell->arg;
+    kernel_task_store_seq(cell, pos & (MAX_KERNEL_TASKS - 1), pos + MAX_KERNEL_TASKS);
+    return true;
+}
+
+bool lock_core_run_queue(uint32_t core) {
+    return spin_lock_irqsave(&run_queues[core].lock);
+}
+
+void unlock_core_run_queue(uint32_t core, bool ints) {
+    spin_unlock_irqrestore(&run_queues[core].lock, ints);
+}
+
+// The following run_queue_*_locked functions need rq->lock held
+
+static void run_queue_push_locked(run_queue_t *rq, uint32_t core, thread_t *thread) {
+    thread->run_prev  = rq->tail;
+    thread->run_next  = NULL;
+    thread->run_queue = (int32_t)core;
+
+    if (rq->tail) {
+        rq->tail->run_next = thread;
+    } else {
+        rq->head = thread;
+    }
+    rq->tail = thread;
+
+    atomic_fetch_add_explicit(&rq->length, 1, memory_order_relaxed);
 }
 
-void unlock_ready_threads() {
-    // ready_threads_lock = (uint32_t)-1;
-    atomic_flag_clear_explicit(&ready_threads_locked_atomic, __ATOMIC_RELEASE);
+static void run_queue_remove_locked(run_queue_t *rq, thread_t *thread) {
+    if (thread->run_prev) {
+        thread->run_prev->run_next = thread->run_next;
+    } else {
+        rq->head = thread->run_next;
+    }
+    if (thread->run_next) {
+        thread->run_next->run_prev = thread->run_prev;
+    } else {
+        rq->tail = thread->run_prev;
+    }
+
+    thread->run_prev  = NULL;
+    thread->run_next  = NULL;
+    thread->run_queue = -1;
+
+    atomic_fetch_sub_explicit(&rq->length, 1, memory_order_relaxed);
 }
 
-void lock_kernel_tasks() {
-    while (atomic_flag_test_and_set_explicit(&kernel_tasks_lock_atomic, __ATOMIC_ACQUIRE)) {
-        // Wait
-        __builtin_ia32_pause();
+static thread_t *run_queue_pop_locked(run_queue_t *rq) {
+    thread_t *thread = rq->head;
+    if (thread) {
+        run_queue_remove_locked(rq, thread);
     }
+    return thread;
 }
 
-void unlock_kernel_tasks() {
-    atomic_flag_clear_explicit(&kernel_tasks_lock_atomic, __ATOMIC_RELEASE);
+static bool kernel_tasks_pending() {
+    return atomic_load_explicit(&kernel_tasks_enqueue_pos, memory_order_relaxed)
+        != atomic_load_explicit(&kernel_tasks_dequeue_pos, memory_order_relaxed);
 }
 
-void send_wakeup_ipi() {
-    uint32_t curr_core = get_curr_core();
+static bool core_claim_idle(uint32_t core) {
+    uint64_t bit = 1ULL << (core % 64);
+    return atomic_fetch_and(&idle_cores[core / 64], ~bit) & bit;
+}
 
-    for (size_t i = 0; i < get_n_cores(); i++) {
-        if (cpu_cores[i].online && i != curr_core) {
-            // There's a core without a thread assigned, wake it up
-            // printf("Waking up core %d\n", i);
-            send_ipi(cpu_cores[i].lapic_id, IPI_WAKEUP_IRQ + 32); // IPI for wakeup
+// Nearest idle core at or after start (wrapping around), or -1
+static int32_t find_idle_core(uint32_t start) {
+    uint32_t n_words = ((uint32_t)get_n_cores() + 63) / 64;
+    uint32_t first   = start / 64;
+
+    // The first word is looked at twice: from start up, and at the very end for the cores below start
+    for (uint32_t i = 0; i <= n_words; i++) {
+        uint32_t word = (first + i) % n_words;
+        uint64_t bits = atomic_load(&idle_cores[word]);
+        if (i == 0) {
+            bits &= ~0ULL << (start % 64);
+        } else if (i == n_words) {
+            bits &= (1ULL << (start % 64)) - 1;
+        }
+
+        if (bits) {
+            return (int32_t)(word * 64 + __builtin_ctzll(bits));
         }
     }
+    return -1;
 }
 
-static void thread_unready_nolock(thread_t *thread) {
-    if (!ready_threads) {
-        return;
+// Claims and IPIs the nearest idle core at or after start; returns whether there was one
+static bool wake_idle_core(uint32_t start) {
+    for (;;) {
+        int32_t core = find_idle_core(start);
+        if (core < 0) {
+            return false;
+        }
+        // Someone else may have claimed it in the meantime; then look again
+        if (core_claim_idle((uint32_t)core)) {
+            send_ipi(cpu_cores[core].lapic_id, IPI_WAKEUP_IRQ + 32);
+            return true;
+        }
     }
+}
 
-    thread->state = ASLEEP;
+// Whether this core is in its scheduler loop with no thread assigned, so it looks at the kernel tasks and every run
+// queue (by stealing) before it halts. A kernel thread leaves cores_threads empty too, but it only goes back to the loop
+// when it blocks or yields, so work can't wait on it.
+static bool curr_core_will_look_for_work(uint32_t curr_core) {
+    return cores_threads[curr_core] == NULL && kthread_current() == NULL;
+}
 
-    thread_t *cur = ready_threads;
+/**
+ * Gets somebody to run work that was just published: nobody if this core will pick it up itself, otherwise one idle
+ * core, starting the search at preferred. The fence pairs with the one in a core going idle: either that core sees the
+ * new work before it halts, or we see its idle bit here.
+ */
+void scheduler_wake_for_work(uint32_t preferred) {
+    atomic_thread_fence(memory_order_seq_cst);
 
-    if (cur == thread) {
-        ready_threads = thread->next;
-        if (!ready_threads) {
-            ready_threads_last = NULL;
-        }
+    uint32_t curr_core = get_curr_core();
+    if (preferred != curr_core && core_claim_idle(preferred)) {
+        send_ipi(cpu_cores[preferred].lapic_id, IPI_WAKEUP_IRQ + 32);
         return;
     }
 
-    while (cur->next) {
-        if (cur->next == thread) {
-            cur->next = thread->next;
-            break;
-        }
-        cur = cur->next;
+    if (curr_core_will_look_for_work(curr_core)) {
+        return;
     }
+
+    wake_idle_core(preferred);
 }
 
 void thread_unready(thread_t *thread) {
-    lock_ready_threads();
+    // The thread can be stolen onto another core's queue between reading run_queue and locking that queue, so check
+    // again once the lock is held
+    for (;;) {
+        int32_t core = __atomic_load_n(&thread->run_queue, __ATOMIC_ACQUIRE);
+        if (core < 0) {
+            thread->state = ASLEEP;
+            return;
+        }
+
+        run_queue_t *rq = &run_queues[core];
+        bool ints       = spin_lock_irqsave(&rq->lock);
+
+        if (thread->run_queue == core) {
+            run_queue_remove_locked(rq, thread);
+            thread->state = ASLEEP;
+            spin_unlock_irqrestore(&rq->lock, ints);
+            return;
+        }
+
+        spin_unlock_irqrestore(&rq->lock, ints);
+    }
+}
 
-    thread_unready_nolock(thread);
+// Picks the queue for a thread that is becoming runnable: the core it last ran on, which probably still has some of its
+// working set cached, unless that core's queue is clearly longer than the current core's.
+static uint32_t thread_pick_run_queue(thread_t *thread) {
+    uint32_t curr_core = get_curr_core();
+    int32_t last_core  = thread->last_core;
+
+    if (last_core < 0 || (uint32_t)last_core == curr_core || !cpu_cores[last_core].online) {
+        return curr_core;
+    }
+
+    uint32_t last_len = atomic_load_explicit(&run_queues[last_core].length, memory_order_relaxed);
+    uint32_t curr_len = atomic_load_explicit(&run_queues[curr_core].length, memory_order_relaxed);
 
-    unlock_ready_threads();
+    return last_len > curr_len + SCHED_AFFINITY_IMBALANCE ? curr_core : (uint32_t)last_core;
 }
 
 void thread_ready(thread_t *thread) {
-    asm volatile("cli");
-    lock_ready_threads();
+    uint32_t core   = thread_pick_run_queue(thread);
+    run_queue_t *rq = &run_queues[core];
+
+    bool ints = spin_lock_irqsave(&rq->lock);
 
     thread->state = READY;
+    run_queue_push_locked(rq, core, thread);
 
-    if (!ready_threads) {
-        ready_threads      = thread;
-        ready_threads_last = thread;
-    } else {
-        ready_threads_last->next = thread;
-        ready_threads_last       = thread;
-    }
+    spin_unlock_irqrestore(&rq->lock, ints);
 
-    /* for (size_t i = 0; i < get_n_cores(); i++) {
-        if (cpu_cores[i].online && !cores_threads[i]) {
-            // There's a core without a thread assigned, wake it up
-            printf("Waking up core %d for thread %p\n", i, ready_threads->tid);
-            // send_ipi(i, IPI_TLB_FLUSH_IRQ + 32); // IPI for tlb flush
-            // pit_sleep(100);
-            cores_threads[i] = ready_threads;
-            thread_unready_nolock(ready_threads);
-            send_ipi(cpu_cores[i].lapic_id, IPI_TLB_FLUSH_IRQ + 32); // IPI for tlb flush
-            break;
+    // The queue's core is preferred: that's where the thread's cache footprint is, or the current core anyway
+    scheduler_wake_for_work(core);
+}
+
+/**
+ * Moves half (rounded up) of the longest other run queue onto this core's queue, taking from the head: those threads
+ * have waited longest, so their cache footprint on the victim is the coldest. Among equally long queues the nearest
+ * core (by index) is preferred. Returns whether anything was stolen.
+ */
+static bool run_queue_steal(uint32_t curr_core) {
+    uint32_t n_cores = (uint32_t)get_n_cores();
+
+    int32_t victim      = -1;
+    uint32_t victim_len = 0;
+    for (uint32_t distance = 1; distance < n_cores; distance++) {
+        // Alternate between the cores above and below this one
+        for (int side = 0; side < 2; side++) {
+            uint32_t core = side ? (curr_core + n_cores - distance) % n_cores : (curr_core + distance) % n_cores;
+            if (!cpu_cores[core].online) {
+                continue;
+            }
+
+            uint32_t len = atomic_load_explicit(&run_queues[core].length, memory_order_relaxed);
+            if (len > victim_len) {
+                victim     = (int32_t)core;
+                victim_len = len;
+            }
         }
-    } */
+    }
 
-    unlock_ready_threads();
-    asm volatile("sti");
+    if (victim < 0) {
+        return false;
+    }
+
+    // Lock both queues in index order so two cores stealing from each other can't deadlock
+    run_queue_t *own    = &run_queues[curr_core];
+    run_queue_t *other  = &run_queues[victim];
+    run_queue_t *first  = (uint32_t)victim < curr_core ? other : own;
+    run_queue_t *second = first == own ? other : own;
+
+    bool ints = spin_lock_irqsave(&first->lock);
+    spin_lock(&second->lock);
 
-    send_wakeup_ipi();
+    uint32_t len   = atomic_load_explicit(&other->length, memory_order_relaxed);
+    uint32_t count = (len + 1) / 2;
+    for (uint32_t i = 0; i < count; i++) {
+        thread_t *thread = run_queue_pop_locked(other);
+        run_queue_push_locked(own, curr_core, thread);
+    }
+
+    spin_unlock(&second->lock);
+    spin_unlock_irqrestore(&first->lock, ints);
+
+    return count > 0;
 }
 
-__attribute__((noreturn)) void start_scheduler() {
-    /* uint32_t curr_core = lock_ready_threads();
-    printf("Starting scheduler on core %d\n", curr_core);
-
-    for (size_t i = 0; i < get_n_cores(); i++) {
-        if (!ready_threads) {
-            printf("No more ready threads to assign to core %d\n", i);
-            ready_threads_last = NULL;
-            break;
-        }
+int scheduler_set_quantum_ms(uint32_t ms) {
+    if (ms == 0) {
+        return -EINVAL;
+    }
+
+    sched_quantum_ms = ms;
+    return 0;
+}
+
+uint32_t scheduler_get_quantum_ms() {
+    return sched_quantum_ms;
+}
+
+static uint64_t scheduler_quantum_ns() {
+    return (uint64_t)sched_quantum_ms * TIMER_NS_PER_MS;
+}
+
+void scheduler_tick(registers_t *regs) {
+    uint32_t curr_core = get_curr_core();
+    run_queue_t *rq    = &run_queues[curr_core];
+
+    // Only user code is preempted (syscalls run to completion), and only in favour of a thread waiting here or kernel
+    // tasks and kernel threads nobody else is running; idle cores steal from this queue on their own. Otherwise the
+    // thread gets another slice, so work that shows up meanwhile waits at most that long.
+    bool waiting
+        = atomic_load_explicit(&rq->length, memory_order_relaxed) > 0 || kernel_tasks_pending() || kthread_pending();
+    if ((regs->iret_cs & CS_MASK) != USER_CS || !waiting) {
+        timer_set_slice(scheduler_quantum_ns());
+        return;
+    }
 
-        printf("Assigning thread to core %d\n", i);
+    // Interrupts are already off in IRQ context
+    spin_lock(&rq->lock);
 
-        cores_threads[i] = ready_threads;
+    thread_t *thread = (thread_t *)cores_threads[curr_core];
 
-        ready_threads = ready_threads->next;
+    // process_exit() may have got here first (and its kill IPI is on the way), or be about to free the thread
+    if (!thread || thread->state != RUNNING || __atomic_load_n(&thread->parent->state, __ATOMIC_SEQ_CST) == DEAD) {
+        spin_unlock(&rq->lock);
+        return;
     }
 
-    unlock_ready_threads(); */
+    // regs is on this core's kernel stack, which cpu_scheduler_task() is about to reuse
+    memcpy((void *)&thread->regs, regs, sizeof(registers_t));
+    asm volatile("fxsave64 (%0)" : : "r"(thread->fpu_state) : "memory");
+
+    cores_threads[curr_core]     = NULL;
+    cpu_cores[curr_core].status &= ~1;
+    thread->state                = READY;
+    run_queue_push_locked(rq, curr_core, thread);
 
+    spin_unlock(&rq->lock);
+
+    // gs still points at the thread's base, which the next core to run the thread will rewrite
+    write_msr(IA32_GS_BASE, (uint64_t)cpu_cores[curr_core].kernel_gs_base);
+
+    apic_send_eoi();
+    cpu_scheduler_task();
+}
+
+__attribute__((noreturn)) void start_scheduler() {
     cpu_cores[0].online = true;
     cpu_scheduler_task();
 }
@@ -179,6 +420,9 @@ extern void restore_cpu_state(registers_t *regs);
 extern void _finalize_task_switch(registers_t *regs);
 
 __attribute__((noreturn)) void cpu_scheduler_task_c() {
+    // Whatever ran on this core before is gone, and an idle core takes no scheduler ticks
+    timer_set_slice(0);
+
     asm volatile("sti");
 
     uint32_t curr_core = get_curr_core();
@@ -186,50 +430,69 @@ __attribute__((noreturn)) void cpu_scheduler_task_c() {
     for (;;) {
         asm volatile("cli");
 
-        lock_kernel_tasks();
-        if (ready_kernel_tasks_head != ready_kernel_tasks_tail) {
-            // There's a kernel task to run
-            kernel_task_func_t func = ready_kernel_tasks[ready_kernel_tasks_tail].func;
-            void *arg               = ready_kernel_tasks[ready_kernel_tasks_tail].arg;
-            ready_kernel_tasks_tail = (ready_kernel_tasks_tail + 1) % MAX_KERNEL_TASKS;
-            unlock_kernel_tasks();
+        kernel_task_func_t func;
+        void *arg;
+        if (kernel_task_dequeue(&func, &arg)) {
             asm volatile("sti");
             // Execute the kernel task
             func(arg);
             continue;
         }
-        unlock_kernel_tasks();
 
-        lock_ready_threads();
+        // Kernel threads come before user threads; this returns once the thread blocks, yields or exits
+        if (kthread_run_next(curr_core)) {
+            continue;
+        }
+
+        run_queue_t *rq = &run_queues[curr_core];
+
+        spin_lock(&rq->lock);
         if (cores_threads[curr_core]) {
             cores_threads[curr_core]->state = RUNNING;
-            unlock_ready_threads();
+            spin_unlock(&rq->lock);
             cpu_cores[curr_core].status |= 1;
+            timer_set_slice(scheduler_quantum_ns());
             // There's a thread assigned to this core, start executing it
-            printf("Starting thread %p on core %d\n", cores_threads[curr_core]->tid, curr_core);
             // The thread's regs are the first item in the struct
             assign_thread_to_cpu(cores_threads[curr_core]);
             cores_threads[curr_core]->state  = ASLEEP;
             cores_threads[curr_core]         = NULL;
             cpu_cores[curr_core].status     &= ~1;
         } else {
-            unlock_ready_threads();
+            spin_unlock(&rq->lock);
         }
 
-        lock_ready_threads();
+        // Popping and assigning happen under the same lock so process_exit() can't free the thread in between
+        spin_lock(&rq->lock);
+        thread_t *next = run_queue_pop_locked(rq);
+        if (next) {
+            cores_threads[curr_core] = next;
+            next->last_core          = (int32_t)curr_core;
+            spin_unlock(&rq->lock);
+            continue;
+        }
+        spin_unlock(&rq->lock);
 
-        if (ready_threads) {
-            cores_threads[curr_core] = ready_threads;
-            thread_unready_nolock(ready_threads);
-            printf("Assigned thread %p to core %d\n", cores_threads[curr_core]->tid, curr_core);
-            unlock_ready_threads();
+        if (run_queue_steal(curr_core)) {
             continue;
         }
 
-        unlock_ready_threads();
+        // Advertise the core as idle, then look once more: work published before the bit was set shows up here, and
+        // whoever publishes after that sees the bit and sends an IPI
+        atomic_fetch_or(&idle_cores[curr_core / 64], 1ULL << (curr_core % 64));
+        atomic_thread_fence(memory_order_seq_cst);
 
-        asm volatile("sti");
-        asm volatile("hlt");
+        if (kernel_tasks_pending() || kthread_pending() || atomic_load_explicit(&rq->length, memory_order_relaxed) > 0
+            || run_queue_steal(curr_core)) {
+            core_claim_idle(curr_core);
+            continue;
+        }
+
+        // sti only takes effect after hlt has started, so a wakeup IPI can't be lost in between
+        asm volatile("sti; hlt");
+
+        // A timer or device IRQ rather than a waker may have ended the hlt
+        core_claim_idle(curr_core);
     }
 }
 
@@ -246,10 +509,8 @@ void assign_thread_to_cpu(thread_t *thread) {
     thread->base->proc             = (uint64_t)thread->parent;
     thread->base->kernel_pml4_phys = (uint64_t)kernel_pml4_phys;
 
-    // The thread's regs are the first item in the struct
-    printf("Thread info: regs addr %p, regs phys addr %p %p, stack %p, base %p, base proc %p\n", &thread->regs,
-           get_physaddr((uint64_t)&thread->regs, thread->parent->pml4),
-           get_physaddr((uint64_t)&thread->regs, kernel_pml4), thread->regs.iret_rsp, thread->base, thread->base->proc);
+    // The kernel never touches the FPU, so the thread's state survives until it is back in user mode
+    asm volatile("fxrstor64 (%0)" : : "r"(thread->fpu_state) : "memory");
 
     // write_msr(IA32_KERNEL_GS_BASE, (uint64_t)thread->base);
     write_msr(IA32_GS_BASE, (uint64_t)thread->base);
@@ -258,35 +519,22 @@ void assign_thread_to_cpu(thread_t *thread) {
 }
 
 int delegate_kernel_task(kernel_task_func_t func, void *arg) {
-    // This blocks interrupts and can also be called from an IRQ handler, so we should keep it as fast as possible
-
+    // Safe from IRQ handlers. Interrupts stay off between claiming a cell and filling it, so consumers never wait for a
+    // producer that an IRQ got in front of.
     bool ints = are_interrupts_enabled();
     if (ints) {
         asm volatile("cli");
     }
 
-    int res = 0;
-
-    lock_kernel_tasks();
-
-    size_t next_head = (ready_kernel_tasks_head + 1) % MAX_KERNEL_TASKS;
-    if (next_head == ready_kernel_tasks_tail) {
-        // No space
-        res = -1;
-        goto cleanup;
-    }
+    int res = kernel_task_enqueue(func, arg);
 
-    ready_kernel_tasks[ready_kernel_tasks_head].func = func;
-    ready_kernel_tasks[ready_kernel_tasks_head].arg  = arg;
-    ready_kernel_tasks_head                          = next_head;
-
-cleanup:
-    unlock_kernel_tasks();
     if (ints) {
         asm volatile("sti");
     }
 
-    send_wakeup_ipi();
+    if (res == 0) {
+        scheduler_wake_for_work(get_curr_core());
+    }
 
     return res;
-}
\ No newline at end of file
+}
@@ -4,9 +4,30 @@
 #include "proc/thread.h"
 
 #include "cpu/cpu.h"
+#include "lib/lock.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
 
 typedef void (*kernel_task_func_t)(void *);
 
+// A thread is queued on its last core unless that queue is longer than the current core's by more than this
+#define SCHED_AFFINITY_IMBALANCE 2
+
+// Time slice a user thread gets before it is preempted in favour of another thread waiting on the same core
+#define SCHED_DEFAULT_QUANTUM_MS 10
+
+// Per-core run queue; threads are linked through their run_prev/run_next fields. The lock also protects the core's
+// cores_threads entry, and is also taken from IRQ context, so interrupts stay off while it is held.
+typedef struct run_queue {
+    spinlock_t lock;
+    thread_t *head;
+    thread_t *tail;
+    atomic_uint length; // Readable without the lock, for load balancing
+} run_queue_t;
+
+extern run_queue_t run_queues[MAX_CORES];
+
 extern volatile thread_t * volatile cores_threads[MAX_CORES];
 
 void thread_ready(thread_t *thread);
@@ -15,9 +36,22 @@ void thread_unready(thread_t *thread);
 void assign_thread_to_cpu(thread_t *thread);
 extern void cpu_scheduler_task();
 
-uint32_t lock_ready_threads();
-void unlock_ready_threads();
+// Locks core's run queue (and cores_threads[core]) with interrupts disabled; pass the result to the unlock
+bool lock_core_run_queue(uint32_t core);
+void unlock_core_run_queue(uint32_t core, bool ints);
+
+// Called from the LAPIC timer IRQ when the running thread's slice is used up. If it interrupted user code and something
+// else is waiting on this core, saves the thread's state, requeues it and does not return.
+void scheduler_tick(registers_t *regs);
+
+// Returns -EINVAL for a zero quantum
+int scheduler_set_quantum_ms(uint32_t ms);
+uint32_t scheduler_get_quantum_ms();
+
+// Gets one core to look for newly queued work, preferring the given one; no IPI if the current core will find it
+void scheduler_wake_for_work(uint32_t preferred);
 
+// Queues func(arg) to run on some core's scheduler loop; safe from IRQ handlers. Returns -ENOSPC if the queue is full.
 int delegate_kernel_task(kernel_task_func_t func, void *arg);
 
 __attribute__((noreturn)) //
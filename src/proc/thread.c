@@ -14,6 +14,12 @@ pid_t next_tid = 0;
 
 #define DEFAULT_FLAGS 0x202 // Enable interrupts
 
+// Offsets into the fxsave area and their power-on values
+#define THREAD_FPU_FCW_OFFSET    0
+#define THREAD_FPU_MXCSR_OFFSET  24
+#define THREAD_FPU_DEFAULT_FCW   0x37F
+#define THREAD_FPU_DEFAULT_MXCSR 0x1F80
+
 // Stacks start below this address and grow downwards
 #define USER_STACK_TOP 0x0000800000000000UL
 
@@ -36,6 +42,8 @@ thread_t *create_thread(proc_t *proc, const char *name, void (*func)(void *), vo
     thread->state           = ASLEEP;
     thread->tid             = next_tid++;
     thread->index_in_parent = atomic_fetch_add(&(proc->next_thread_index), 1);
+    thread->run_queue       = -1;
+    thread->last_core       = -1;
 
     uint64_t p = 0;
 
@@ -75,6 +83,10 @@ thread_t *create_thread(proc_t *proc, const char *name, void (*func)(void *), vo
     printf("Thread info: func addr %p, func phys addr %p\n", func, get_physaddr((uint64_t)func, proc->pml4));
     thread->regs.rdi = (uint64_t)arg;
 
+    // Start with x87 and SSE exceptions masked, as after FNINIT and on reset
+    *(uint16_t *)&thread->fpu_state[THREAD_FPU_FCW_OFFSET]   = THREAD_FPU_DEFAULT_FCW;
+    *(uint32_t *)&thread->fpu_state[THREAD_FPU_MXCSR_OFFSET] = THREAD_FPU_DEFAULT_MXCSR;
+
     // Set the page table
     thread->regs.cr3 = virt_to_phys((uint64_t)proc->pml4) & ~0xFFF;
 
@@ -2,6 +2,7 @@
 
 #include "proc/proc.h"
 
+#include <stddef.h>
 #include <stdint.h>
 
 // TODO: use page faults to potentially map more pages on stack overflow?
@@ -9,10 +10,15 @@
 #define THREAD_STACK_SIZE     0x100000            // 1 MiB
 #define THREAD_MAX_STACK_SIZE 0x10000000 - 0x1000 // 256 MiB - 4 KiB guard page
 
+// Size of the fxsave area holding a thread's x87/SSE state while it is preempted
+#define THREAD_FPU_STATE_SIZE 512
+
 typedef struct thread thread_t;
 
 struct thread {
     volatile registers_t regs;
+    uint8_t fpu_state[THREAD_FPU_STATE_SIZE]; // fxsave64/fxrstor64 need this 16-byte aligned
+
 
     pid_t tid;
     pid_t index_in_parent;
@@ -32,7 +38,16 @@ struct thread {
     
     rbnode_t scheduler_node;
     uint64_t scheduler_prio;
+
+    // Run queue links (see proc/scheduler.c); only touched with the queue's lock held
+    thread_t *run_prev;
+    thread_t *run_next;
+    int32_t run_queue; // Core whose run queue holds the thread, or -1
+    int32_t last_core; // Core the thread last ran on, or -1
 } __attribute__((packed));
 
+// Threads are page aligned, so this only has to hold for the offset
+_Static_assert(offsetof(thread_t, fpu_state) % 16 == 0, "thread_t.fpu_state must be 16-byte aligned");
+
 thread_t *create_thread(proc_t *proc, const char *name, void (*func)(void *), void *arg);
 void release_thread(thread_t *thread);
\ No newline at end of file
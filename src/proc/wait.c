@@ -0,0 +1,208 @@
+#include "proc/wait.h"
+
+#include "arch/x86_64/common.h"
+#include "plenjos/errno.h"
+#include "timer/timer.h"
+
+static void wait_queue_remove_locked(wait_queue_t *queue, wait_queue_entry_t *entry) {
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        queue->head = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        queue->tail = entry->prev;
+    }
+
+    entry->prev   = NULL;
+    entry->next   = NULL;
+    entry->queued = false;
+}
+
+void wait_queue_init(wait_queue_t *queue) {
+    spin_lock_init(&queue->lock);
+    queue->head = NULL;
+    queue->tail = NULL;
+}
+
+void wait_queue_prepare(wait_queue_t *queue, wait_queue_entry_t *entry) {
+    bool ints = spin_lock_irqsave(&queue->lock);
+
+    if (!entry->queued) {
+        entry->thread = kthread_current();
+        entry->prev   = queue->tail;
+        entry->next   = NULL;
+        entry->queued = true;
+        if (queue->tail) {
+            queue->tail->next = entry;
+        } else {
+            queue->head = entry;
+        }
+        queue->tail = entry;
+    }
+
+    // Under the lock, so a waker that dequeues the entry sees the thread blocked
+    kthread_prepare_block();
+
+    spin_unlock_irqrestore(&queue->lock, ints);
+}
+
+void wait_queue_finish(wait_queue_t *queue, wait_queue_entry_t *entry) {
+    bool ints = spin_lock_irqsave(&queue->lock);
+    if (entry->queued) {
+        wait_queue_remove_locked(queue, entry);
+    }
+    spin_unlock_irqrestore(&queue->lock, ints);
+
+    kthread_finish_block();
+}
+
+static int wait_queue_wake(wait_queue_t *queue, bool all) {
+    int woken = 0;
+    bool ints = spin_lock_irqsave(&queue->lock);
+
+    while (queue->head) {
+        wait_queue_entry_t *entry = queue->head;
+        kthread_t *thread         = entry->thread;
+        // Once dequeued, the entry may go away with the waiter's stack frame
+        wait_queue_remove_locked(queue, entry);
+        kthread_wake(thread);
+        woken++;
+
+        if (!all) {
+            break;
+        }
+    }
+
+    spin_unlock_irqrestore(&queue->lock, ints);
+    return woken;
+}
+
+int wait_queue_wake_one(wait_queue_t *queue) {
+    return wait_queue_wake(queue, false);
+}
+
+int wait_queue_wake_all(wait_queue_t *queue) {
+    return wait_queue_wake(queue, true);
+}
+
+void completion_init(completion_t *completion) {
+    atomic_store(&completion->done, false);
+    wait_queue_init(&completion->waiters);
+}
+
+void completion_reinit(completion_t *completion) {
+    atomic_store(&completion->done, false);
+}
+
+void completion_complete(completion_t *completion) {
+    atomic_store(&completion->done, true);
+    wait_queue_wake_all(&completion->waiters);
+}
+
+bool completion_is_done(completion_t *completion) {
+    return atomic_load(&completion->done);
+}
+
+static bool completion_done_condition(void *arg) {
+    return atomic_load(&((completion_t *)arg)->done);
+}
+
+void completion_wait(completion_t *completion) {
+    completion_wait_timeout_ms(completion, UINT64_MAX);
+}
+
+int completion_wait_timeout_ms(completion_t *completion, uint64_t milliseconds) {
+    return wait_event_timeout_ms(&completion->waiters, completion_done_condition, completion, milliseconds);
+}
+
+int wait_event_timeout_ms(wait_queue_t *queue, wait_condition_func_t condition, void *arg, uint64_t milliseconds) {
+    uint64_t start    = timer_now_ns();
+    uint64_t deadline = UINT64_MAX;
+    if (milliseconds < (UINT64_MAX - start) / TIMER_NS_PER_MS) {
+        deadline = start + milliseconds * TIMER_NS_PER_MS;
+    }
+
+    if (!kthread_can_sleep()) {
+        while (!condition(arg)) {
+            if (timer_now_ns() >= deadline) {
+                return -ETIMEDOUT;
+            }
+            __builtin_ia32_pause();
+        }
+        return 0;
+    }
+
+    kthread_t *thread        = kthread_current();
+    wait_queue_entry_t entry = { 0 };
+    int res                  = 0;
+
+    for (;;) {
+        uint64_t now = timer_now_ns();
+        if (now >= deadline) {
+            res = -ETIMEDOUT;
+            break;
+        }
+        if (deadline != UINT64_MAX && atomic_load(&thread->wakeup_state) == KTHREAD_WAKEUP_IDLE
+            && kthread_set_wakeup_ns(deadline - now) < 0) {
+            // Nothing would wake us at the deadline, so keep checking
+            kthread_yield();
+            continue;
+        }
+
+        wait_queue_prepare(queue, &entry);
+        if (condition(arg)) {
+            break;
+        }
+        kthread_schedule();
+    }
+
+    wait_queue_finish(queue, &entry);
+    kthread_clear_wakeup();
+
+    return condition(arg) ? 0 : res;
+}
+
+void kmutex_init(kmutex_t *m) {
+    atomic_store(&m->locked, false);
+    wait_queue_init(&m->waiters);
+}
+
+bool kmutex_trylock(kmutex_t *m) {
+    return !atomic_exchange_explicit(&m->locked, true, memory_order_acquire);
+}
+
+void kmutex_lock(kmutex_t *m) {
+    if (kmutex_trylock(m)) {
+        return;
+    }
+
+    if (!kthread_can_sleep()) {
+        while (!kmutex_trylock(m)) {
+            __builtin_ia32_pause();
+        }
+        return;
+    }
+
+    wait_queue_entry_t entry = { 0 };
+    for (;;) {
+        wait_queue_prepare(&m->waiters, &entry);
+        // seq_cst, like the store in kmutex_unlock(): either we see it unlocked, or the unlocker sees us queued
+        if (!atomic_load(&m->locked) && kmutex_trylock(m)) {
+            break;
+        }
+        kthread_schedule();
+    }
+    wait_queue_finish(&m->waiters, &entry);
+}
+
+void kmutex_unlock(kmutex_t *m) {
+    atomic_store(&m->locked, false);
+    wait_queue_wake_one(&m->waiters);
+}
+
+bool kmutex_is_locked(kmutex_t *m) {
+    return atomic_load(&m->locked);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "lib/lock.h"
+#include "proc/kthread.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Blocking primitives on top of kernel threads. Only kernel threads with interrupts enabled actually sleep (see
+ * kthread_can_sleep()); anything else that has to wait (kernel tasks, syscalls, early boot) spins instead, as it always
+ * did. Waking is safe from IRQ handlers.
+ */
+
+typedef struct wait_queue_entry wait_queue_entry_t;
+
+// Lives on the waiter's stack for the duration of one wait
+struct wait_queue_entry {
+    kthread_t *thread;
+    wait_queue_entry_t *prev;
+    wait_queue_entry_t *next;
+    bool queued;
+};
+
+typedef struct wait_queue {
+    spinlock_t lock; // Taken with interrupts disabled
+    wait_queue_entry_t *head;
+    wait_queue_entry_t *tail;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT { .lock = SPINLOCK_INIT, .head = NULL, .tail = NULL }
+
+void wait_queue_init(wait_queue_t *queue);
+
+/**
+ * Queues the calling kernel thread on queue (if entry isn't queued already) and marks it blocked. Check the wait
+ * condition after this, then either kthread_schedule() or, if it already holds, go straight to wait_queue_finish().
+ */
+void wait_queue_prepare(wait_queue_t *queue, wait_queue_entry_t *entry);
+// Dequeues entry if no waker has, and leaves the thread running
+void wait_queue_finish(wait_queue_t *queue, wait_queue_entry_t *entry);
+
+// These return how many threads were woken
+int wait_queue_wake_one(wait_queue_t *queue);
+int wait_queue_wake_all(wait_queue_t *queue);
+
+typedef bool (*wait_condition_func_t)(void *arg);
+
+/**
+ * Waits until condition(arg) holds, for at most milliseconds (UINT64_MAX waits forever); returns 0 once it does, or
+ * -ETIMEDOUT. Whoever makes the condition true wakes the queue afterwards. Callers that can't sleep spin instead.
+ */
+int wait_event_timeout_ms(wait_queue_t *queue, wait_condition_func_t condition, void *arg, uint64_t milliseconds);
+
+// A one-shot event: once completed, every wait returns straight away until the completion is reinitialised
+typedef struct completion {
+    atomic_bool done;
+    wait_queue_t waiters;
+} completion_t;
+
+#define COMPLETION_INIT { .done = false, .waiters = WAIT_QUEUE_INIT }
+
+void completion_init(completion_t *completion);
+void completion_reinit(completion_t *completion);
+void completion_complete(completion_t *completion);
+bool completion_is_done(completion_t *completion);
+void completion_wait(completion_t *completion);
+// Returns 0 once completed, or -ETIMEDOUT
+int completion_wait_timeout_ms(completion_t *completion, uint64_t milliseconds);
+
+// A mutex whose waiters sleep; unlike spinlock_t, it may be held across blocking calls
+typedef struct kmutex {
+    atomic_bool locked;
+    wait_queue_t waiters;
+} kmutex_t;
+
+#define KMUTEX_INIT { .locked = false, .waiters = WAIT_QUEUE_INIT }
+
+void kmutex_init(kmutex_t *m);
+void kmutex_lock(kmutex_t *m);
+bool kmutex_trylock(kmutex_t *m);
+void kmutex_unlock(kmutex_t *m);
+bool kmutex_is_locked(kmutex_t *m);
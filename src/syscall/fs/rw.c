@@ -11,6 +11,45 @@
 
 #include "plenjos/errno.h"
 
+// Moves len bytes between a user buffer and the file without a kernel bounce buffer: the user range is pinned in
+// bounded chunks and each chunk's kernel-mapped fragments are handed to the filesystem as a scatter list. write means
+// "write to the file" (so the user pages are only read). offset < 0 means "use (and advance) the handle's own
+// position". Returns the number of bytes transferred, or a negative errno if nothing was.
+static ssize_t syscall_fs_helper_user_transfer(vfs_handle_t *handle, uint64_t user_ptr, size_t len, off_t offset,
+                                               bool write, pml4_t *current_pml4) {
+    size_t done = 0;
+
+    while (done < len) {
+        user_buf_pin_t pin;
+
+        ssize_t pinned = pin_user_buf(user_ptr + done, len - done, !write, current_pml4, &pin);
+        if (pinned < 0) {
+            return done ? (ssize_t)done : pinned;
+        }
+
+        ssize_t res;
+        if (offset < 0) {
+            res = write ? vfs_writev(handle, pin.frags, pin.nfrags) : vfs_readv(handle, pin.frags, pin.nfrags);
+        } else {
+            res = write ? vfs_pwritev(handle, pin.frags, pin.nfrags, offset + (off_t)done)
+                        : vfs_preadv(handle, pin.frags, pin.nfrags, offset + (off_t)done);
+        }
+
+        unpin_user_buf(&pin);
+
+        if (res < 0) {
+            return done ? (ssize_t)done : res;
+        }
+
+        done += (size_t)res;
+        if (res < pinned) {
+            break;
+        }
+    }
+
+    return (ssize_t)done;
+}
+
 ssize_t syscall_routine_read(int fd, void *buf, size_t count, proc_t *proc, pml4_t *current_pml4) {
     vfs_handle_t *handle = NULL;
 
@@ -20,41 +59,150 @@ ssize_t syscall_routine_read(int fd, void *buf, size_t count, proc_t *proc, pml4
         return res;
     }
 
-    void *buf_tmp = kmalloc_heap(count);
+    res = syscall_fs_helper_user_transfer(handle, (uint64_t)buf, count, -1, false, current_pml4);
+    if (res < 0 && res != -EFAULT) {
+        printf("syscall_routine_read: read of %p bytes failed for process %s (pid %p), errno %d\n", count, proc->name,
+               proc->pid, res);
+    }
+
+    return res;
+}
+
+ssize_t syscall_routine_write(int fd, uint64_t buf_ptr, size_t count, proc_t *proc, pml4_t *current_pml4) {
+    vfs_handle_t *handle = NULL;
+
+    ssize_t res = (ssize_t)syscall_fs_helper_get_not_dir_handle(fd, proc, &handle);
+    if (res < 0) {
+        printf("syscall_routine_write: failed to get non-directory handle\n");
+        return res;
+    }
+
+    return syscall_fs_helper_user_transfer(handle, buf_ptr, count, -1, true, current_pml4);
+}
+
+// Copies a user iovec array into a new kernel allocation (which must be freed) and sums the segment lengths
+static int syscall_fs_helper_copy_iovec(uint64_t iov_ptr, int iovcnt, pml4_t *current_pml4,
+                                        struct plenjos_iovec **out, size_t *total_out) {
+    if (iovcnt < 0 || iovcnt > PLENJOS_IOV_MAX) {
+        return -EINVAL;
+    }
+
+    *out       = NULL;
+    *total_out = 0;
+
+    if (iovcnt == 0) {
+        return 0;
+    }
+
+    if (iov_ptr == 0) {
+        return -EFAULT;
+    }
 
-    if (!buf_tmp) {
-        printf("syscall_routine_read: failed to allocate temporary buffer for read of %p bytes for process %s (pid %p)\n",
-               count, proc->name, proc->pid);
+    struct plenjos_iovec *iov = kmalloc_heap(sizeof(struct plenjos_iovec) * iovcnt);
+    if (!iov) {
         return -ENOMEM;
     }
 
-    // TODO: (SECURITY RISK) check that the final output buffer is valid before reading from the fs at all.
-    res = vfs_read(handle, buf_tmp, count);
+    int check = copy_to_kernel_buf(iov, (void *)iov_ptr, sizeof(struct plenjos_iovec) * iovcnt, current_pml4);
+    if (check < 0) {
+        kfree_heap(iov);
+        return check;
+    }
 
-    if (res > 0) {
-        int check = copy_to_user_buf(buf, buf_tmp, res, false, current_pml4);
-        if (check < 0) {
-            printf("syscall_routine_read: failed to copy data to user buffer %p for process %s (pid %p), errno %d\n", buf,
-                   proc->name, proc->pid, check);
-            kfree_heap(buf_tmp);
-            return (ssize_t)check;
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len > (size_t)INT64_MAX - total) {
+            kfree_heap(iov);
+            return -EINVAL;
         }
+        total += iov[i].iov_len;
     }
 
-    kfree_heap(buf_tmp);
-    return res;
+    *out       = iov;
+    *total_out = total;
+    return 0;
 }
 
-ssize_t syscall_routine_write(int fd, const void *buf, size_t count, proc_t *proc) {
+// Each user segment is pinned and passed straight to the filesystem; the transfer stops at the first short segment.
+// offset < 0 means "use (and advance) the handle's own position".
+static ssize_t syscall_fs_helper_vectored_transfer(int fd, uint64_t iov_ptr, int iovcnt, off_t offset, bool write,
+                                                   proc_t *proc, pml4_t *current_pml4) {
     vfs_handle_t *handle = NULL;
 
     ssize_t res = (ssize_t)syscall_fs_helper_get_not_dir_handle(fd, proc, &handle);
     if (res < 0) {
-        printf("syscall_routine_write: failed to get non-directory handle\n");
         return res;
     }
 
-    return vfs_write(handle, buf, count);
+    struct plenjos_iovec *iov = NULL;
+    size_t total              = 0;
+
+    res = syscall_fs_helper_copy_iovec(iov_ptr, iovcnt, current_pml4, &iov, &total);
+    if (res < 0 || total == 0) {
+        if (iov) {
+            kfree_heap(iov);
+        }
+        return res;
+    }
+
+    size_t done = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) {
+            continue;
+        }
+
+        res = syscall_fs_helper_user_transfer(handle, (uint64_t)iov[i].iov_base, iov[i].iov_len,
+                                              (offset < 0) ? -1 : offset + (off_t)done, write, current_pml4);
+        if (res < 0) {
+            printf("syscall_routine_%sv: segment %d (%p) failed for process %s (pid %p), errno %d\n",
+                   write ? "write" : "read", i, iov[i].iov_base, proc->name, proc->pid, res);
+            break;
+        }
+
+        done += (size_t)res;
+        if ((size_t)res < iov[i].iov_len) {
+            break;
+        }
+    }
+
+    kfree_heap(iov);
+    return (done || res >= 0) ? (ssize_t)done : res;
+}
+
+ssize_t syscall_routine_readv(int fd, uint64_t iov_ptr, int iovcnt, proc_t *proc, pml4_t *current_pml4) {
+    return syscall_fs_helper_vectored_transfer(fd, iov_ptr, iovcnt, -1, false, proc, current_pml4);
+}
+
+ssize_t syscall_routine_writev(int fd, uint64_t iov_ptr, int iovcnt, proc_t *proc, pml4_t *current_pml4) {
+    return syscall_fs_helper_vectored_transfer(fd, iov_ptr, iovcnt, -1, true, proc, current_pml4);
+}
+
+ssize_t syscall_routine_preadv(int fd, uint64_t iov_ptr, int iovcnt, off_t offset, proc_t *proc,
+                               pml4_t *current_pml4) {
+    if (offset < 0) {
+        return -EINVAL;
+    }
+    return syscall_fs_helper_vectored_transfer(fd, iov_ptr, iovcnt, offset, false, proc, current_pml4);
+}
+
+ssize_t syscall_routine_pwritev(int fd, uint64_t iov_ptr, int iovcnt, off_t offset, proc_t *proc,
+                                pml4_t *current_pml4) {
+    if (offset < 0) {
+        return -EINVAL;
+    }
+    return syscall_fs_helper_vectored_transfer(fd, iov_ptr, iovcnt, offset, true, proc, current_pml4);
+}
+
+int syscall_routine_fsync(int fd, proc_t *proc) {
+    vfs_handle_t *handle = NULL;
+
+    int res = syscall_fs_helper_get_handle_and_check_backing_node(fd, proc, &handle);
+    if (res < 0) {
+        printf("syscall_routine_fsync: failed to get handle with backing node\n");
+        return res;
+    }
+
+    return vfs_fsync(handle);
 }
 
 off_t syscall_routine_lseek(int fd, off_t offset, int whence, proc_t *proc) {
@@ -13,25 +13,7 @@ void syscall_handle_fs_call(registers_t *regs, proc_t *proc, pml4_t *current_pml
         break;
     }
     case SYSCALL_WRITE: {
-        void *kbuf = kmalloc_heap((size_t)regs->rdx);
-        if (!kbuf) {
-            printf("syscall_routine: failed to allocate kernel buffer for write syscall of %p bytes\n",
-                   (size_t)regs->rdx);
-            regs->rax = (uint64_t)-ENOMEM;
-            break;
-        }
-
-        int check = copy_to_kernel_buf(kbuf, (void *)regs->rcx, (size_t)regs->rdx, current_pml4);
-        if (check < 0) {
-            printf("syscall_routine: failed to copy data from user buffer %p for process %s (pid %p), errno %d\n",
-                   (void *)regs->rcx, proc->name, proc->pid, check);
-            kfree_heap(kbuf);
-            regs->rax = (uint64_t)check;
-            break;
-        }
-
-        regs->rax = (uint64_t)syscall_routine_write(regs->rbx, (const void *)kbuf, (size_t)regs->rdx, proc);
-        kfree_heap(kbuf);
+        regs->rax = (uint64_t)syscall_routine_write(regs->rbx, regs->rcx, (size_t)regs->rdx, proc, current_pml4);
         break;
     }
     case SYSCALL_OPEN: {
@@ -113,6 +95,28 @@ void syscall_handle_fs_call(registers_t *regs, proc_t *proc, pml4_t *current_pml
     case SYSCALL_UNLINK:
     case SYSCALL_SYMLINK:
     case SYSCALL_READLINK: */
+    case SYSCALL_FSYNC: {
+        regs->rax = (uint64_t)syscall_routine_fsync((int)regs->rbx, proc);
+        break;
+    }
+    case SYSCALL_READV: {
+        regs->rax = (uint64_t)syscall_routine_readv((int)regs->rbx, regs->rcx, (int)regs->rdx, proc, current_pml4);
+        break;
+    }
+    case SYSCALL_WRITEV: {
+        regs->rax = (uint64_t)syscall_routine_writev((int)regs->rbx, regs->rcx, (int)regs->rdx, proc, current_pml4);
+        break;
+    }
+    case SYSCALL_PREADV: {
+        regs->rax = (uint64_t)syscall_routine_preadv((int)regs->rbx, regs->rcx, (int)regs->rdx, (off_t)regs->rsi, proc,
+                                                     current_pml4);
+        break;
+    }
+    case SYSCALL_PWRITEV: {
+        regs->rax = (uint64_t)syscall_routine_pwritev((int)regs->rbx, regs->rcx, (int)regs->rdx, (off_t)regs->rsi,
+                                                      proc, current_pml4);
+        break;
+    }
     default: {
         printf("syscall_handle_fs_call: unrecognized filesystem syscall %p\n", call);
         regs->rax = (uint64_t)-ENOSYS;
@@ -46,8 +46,19 @@ int syscall_fs_helper_get_not_dir_handle(int fd, proc_t *proc, vfs_handle_t **ou
 
 // count must be <= SSIZE_MAX
 // These two functions don't work on directories; use getdents in place of read for directories.
+// Data buffers are an exception to rule 2 above: rather than being copied, they're pinned and handed to the filesystem
+// directly (see pin_user_buf), so write is passed a user-space pointer too.
 ssize_t syscall_routine_read(int fd, void *buf, size_t count, proc_t *proc, pml4_t *current_pml4);
-ssize_t syscall_routine_write(int fd, const void *buf, size_t count, proc_t *proc);
+ssize_t syscall_routine_write(int fd, uint64_t buf_ptr, size_t count, proc_t *proc, pml4_t *current_pml4);
+
+// Vectored variants; iov_ptr is a user-space pointer to iovcnt struct plenjos_iovec. The p* variants start at offset
+// and don't move the descriptor's seek position.
+ssize_t syscall_routine_readv(int fd, uint64_t iov_ptr, int iovcnt, proc_t *proc, pml4_t *current_pml4);
+ssize_t syscall_routine_writev(int fd, uint64_t iov_ptr, int iovcnt, proc_t *proc, pml4_t *current_pml4);
+ssize_t syscall_routine_preadv(int fd, uint64_t iov_ptr, int iovcnt, off_t offset, proc_t *proc,
+                               pml4_t *current_pml4);
+ssize_t syscall_routine_pwritev(int fd, uint64_t iov_ptr, int iovcnt, off_t offset, proc_t *proc,
+                                pml4_t *current_pml4);
 
 // If mode_if_create is used, the only bits that are honored are the permission bits (lower 9) and the special bits
 // (next 3 lowest: setuid, setgid, sticky). The create and directory flags can't be specified simultaneously; if the
@@ -89,4 +100,7 @@ void syscall_routine_unlink();
 // TODO: if unlinkat() is implemented, it should have a flag to allow deletion of directories (but unlink() should not)
 
 void syscall_routine_symlink();
-void syscall_routine_readlink();
\ No newline at end of file
+void syscall_routine_readlink();
+
+// Writes any data staged for fd back to its device before returning
+int syscall_routine_fsync(int fd, proc_t *proc);
\ No newline at end of file
@@ -3,9 +3,12 @@
 #include "kernel.h"
 #include "lib/stdio.h"
 #include "lib/string.h"
+#include "memory/kmalloc.h"
 #include "memory/mm.h"
 #include "plenjos/errno.h"
 #include "syscall/syscall_helpers.h"
+#include "vfs/fscache.h"
+#include "vfs/pagecache.h"
 
 int syscall_routine_memmap(void *addr, size_t length, syscall_memmap_flags_t flags, pml4_t *current_pml4) {
     uint64_t voffs = (uint64_t)addr - ((uint64_t)addr % PAGE_LEN);
@@ -40,6 +43,268 @@ int syscall_routine_memmap(void *addr, size_t length, syscall_memmap_flags_t fla
     return 0;
 }
 
+int syscall_routine_memmap_file(void *addr, size_t length, syscall_memmap_flags_t flags, int fd, size_t file_offset,
+                                proc_t *proc, pml4_t *current_pml4) {
+    uint64_t start = (uint64_t)addr;
+
+    if (start == 0 || start % PAGE_LEN != 0 || file_offset % PAGE_LEN != 0 || length == 0) {
+        return -EINVAL;
+    }
+
+    if (length % PAGE_LEN != 0) {
+        length += PAGE_LEN - (length % PAGE_LEN);
+    }
+
+    uint64_t end = start + length;
+    if (end < start || end > KERNEL_START_ADDR) {
+        return -EINVAL;
+    }
+
+    vfs_handle_t *fd_handle = proc_get_fd(proc, fd);
+    if (!fd_handle || !fd_handle->backing_node) {
+        return -EBADF;
+    }
+
+    if (fd_handle->backing_node->type == DT_DIR) {
+        return -EISDIR;
+    }
+
+    if (!(fd_handle->access & ACCESS_READ)) {
+        return -EACCES;
+    }
+
+    for (uint64_t voffs = start; voffs < end; voffs += PAGE_LEN) {
+        if (get_physaddr(voffs, current_pml4)) {
+            printf("syscall_routine_memmap_file: vaddr %p is already mapped\n", voffs);
+            return -EEXIST;
+        }
+    }
+
+    memmap_file_region_t *region = kmalloc_heap(sizeof(memmap_file_region_t));
+    if (!region) {
+        return -ENOMEM;
+    }
+
+    int res = vfs_dup(fd_handle, &region->handle);
+    if (res < 0) {
+        kfree_heap(region);
+        return res;
+    }
+
+    region->start       = start;
+    region->end         = end;
+    region->flags       = flags;
+    region->file_offset = file_offset;
+    atomic_init(&region->refs, 1);
+
+    mutex_lock(&proc->file_maps_lock);
+
+    for (memmap_file_region_t *r = proc->file_maps; r; r = r->next) {
+        if (start < r->end && r->start < end) {
+            mutex_unlock(&proc->file_maps_lock);
+            vfs_close(region->handle);
+            kfree_heap(region);
+            return -EEXIST;
+        }
+    }
+
+    region->next    = proc->file_maps;
+    proc->file_maps = region;
+
+    mutex_unlock(&proc->file_maps_lock);
+
+    return 0;
+}
+
+static void memmap_file_region_put(memmap_file_region_t *region) {
+    if (atomic_fetch_sub(&region->refs, 1) == 1) {
+        vfs_close(region->handle);
+        kfree_heap(region);
+    }
+}
+
+// Looks up the region containing page_addr; file_maps_lock must be held
+static memmap_file_region_t *memmap_file_find_region(proc_t *proc, uint64_t page_addr) {
+    memmap_file_region_t *region = proc->file_maps;
+    while (region && !(page_addr >= region->start && page_addr < region->end)) {
+        region = region->next;
+    }
+    return region;
+}
+
+int memmap_file_handle_fault(proc_t *proc, pml4_t *pml4, uint64_t addr, bool write) {
+    if (!proc || !pml4) {
+        return -EFAULT;
+    }
+
+    uint64_t page_addr = addr - (addr % PAGE_LEN);
+
+    mutex_lock(&proc->file_maps_lock);
+
+    memmap_file_region_t *region = memmap_file_find_region(proc, page_addr);
+    if (!region || (write && !(region->flags & SYSCALL_MEMMAP_FLAG_WR))) {
+        mutex_unlock(&proc->file_maps_lock);
+        return -EFAULT;
+    }
+
+    if (get_physaddr(page_addr, pml4)) {
+        // Another thread got here first
+        mutex_unlock(&proc->file_maps_lock);
+        return 0;
+    }
+
+    // Our reference keeps the region (and its handle) alive even if it's unmapped meanwhile
+    atomic_fetch_add(&region->refs, 1);
+
+    vfs_handle_t *handle                = region->handle;
+    uint64_t region_start               = region->start;
+    uint64_t file_offset                = region->file_offset;
+    syscall_memmap_flags_t region_flags = region->flags;
+
+    // The read below may wait for the drive's IRQ, so it can't happen with a spinlock held
+    mutex_unlock(&proc->file_maps_lock);
+
+    uint64_t index = (file_offset + (page_addr - region_start)) / PAGE_LEN;
+    uint64_t phys  = 0;
+
+    int res = pagecache_get_page(handle, index, &phys);
+    if (res < 0) {
+        printf("memmap_file_handle_fault: failed to read page %p of the mapping at %p (errno %d)\n", index,
+               region_start, res);
+        memmap_file_region_put(region);
+        return res;
+    }
+
+    uint64_t flags = PAGE_FLAG_PRESENT | PAGE_FLAG_USER | (region_flags & SYSCALL_MEMMAP_FLAG_EX ? 0 : PAGE_FLAG_NX);
+
+    if (region_flags & SYSCALL_MEMMAP_FLAG_WR) {
+        // Private copy; the cached page stays pristine for everyone else
+        uint64_t frame = find_next_free_frame();
+        if (!frame) {
+            phys_mem_unref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(phys));
+            memmap_file_region_put(region);
+            return -ENOMEM;
+        }
+
+        memcpy((void *)phys_to_virt(frame), (void *)phys_to_virt(phys), PAGE_LEN);
+        phys_mem_unref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(phys));
+
+        phys   = frame;
+        flags |= PAGE_FLAG_WRITE;
+    }
+
+    mutex_lock(&proc->file_maps_lock);
+
+    if (memmap_file_find_region(proc, page_addr) != region) {
+        // The mapping went away (or was replaced) while we were reading
+        mutex_unlock(&proc->file_maps_lock);
+        phys_mem_unref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(phys));
+        memmap_file_region_put(region);
+        return -EFAULT;
+    }
+
+    if (get_physaddr(page_addr, pml4)) {
+        // Another thread faulted the page in meanwhile
+        mutex_unlock(&proc->file_maps_lock);
+        phys_mem_unref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(phys));
+        memmap_file_region_put(region);
+        return 0;
+    }
+
+    // The reference taken above now belongs to the page table
+    map_virtual_memory_using_alloc(phys, page_addr, PAGE_LEN, flags, alloc_paging_node, pml4);
+
+    mutex_unlock(&proc->file_maps_lock);
+
+    memmap_file_region_put(region);
+    return 0;
+}
+
+void memmap_file_release_all(proc_t *proc) {
+    if (!proc) {
+        return;
+    }
+
+    mutex_lock(&proc->file_maps_lock);
+
+    memmap_file_region_t *region = proc->file_maps;
+    proc->file_maps              = NULL;
+
+    mutex_unlock(&proc->file_maps_lock);
+
+    while (region) {
+        memmap_file_region_t *next = region->next;
+        memmap_file_region_put(region);
+        region = next;
+    }
+}
+
+int syscall_routine_memunmap(void *addr, size_t length, proc_t *proc, pml4_t *current_pml4) {
+    uint64_t start = (uint64_t)addr;
+
+    if (start % PAGE_LEN != 0 || length == 0) {
+        return -EINVAL;
+    }
+
+    if (length % PAGE_LEN != 0) {
+        length += PAGE_LEN - (length % PAGE_LEN);
+    }
+
+    uint64_t end = start + length;
+    if (end < start || end > KERNEL_START_ADDR) {
+        return -EINVAL;
+    }
+
+    mutex_lock(&proc->file_maps_lock);
+
+    for (memmap_file_region_t *r = proc->file_maps; r; r = r->next) {
+        if (start < r->end && r->start < end && (r->start < start || r->end > end)) {
+            mutex_unlock(&proc->file_maps_lock);
+            return -EINVAL;
+        }
+    }
+
+    // Once the regions are gone, a fault still reading one of their pages notices and backs off, so nothing can be
+    // mapped into the range behind our back
+    memmap_file_region_t *removed = NULL;
+    memmap_file_region_t **link   = &proc->file_maps;
+    while (*link) {
+        memmap_file_region_t *r = *link;
+        if (start < r->end && r->start < end) {
+            *link   = r->next;
+            r->next = removed;
+            removed = r;
+        } else {
+            link = &r->next;
+        }
+    }
+
+    mutex_unlock(&proc->file_maps_lock);
+
+    for (uint64_t voffs = start; voffs < end; voffs += PAGE_LEN) {
+        page_t *page = find_page(voffs, false, current_pml4);
+        if (!page || !page->present) {
+            continue;
+        }
+
+        uint64_t frame = page->frame << 12;
+        map_virtual_memory_using_alloc(0, voffs, PAGE_LEN, 0, alloc_paging_node, current_pml4);
+
+        // Drops the page table's reference, like free_page_table() would have
+        if (frame) {
+            phys_mem_unref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(frame));
+        }
+    }
+
+    while (removed) {
+        memmap_file_region_t *next = removed->next;
+        memmap_file_region_put(removed);
+        removed = next;
+    }
+
+    return 0;
+}
+
 int syscall_routine_memmap_from_buffer(void *addr, size_t length, syscall_memmap_flags_t flags, void *buffer,
                                        size_t buffer_length, pml4_t *current_pml4) {
     int res = syscall_routine_memmap(addr, length, flags, current_pml4);
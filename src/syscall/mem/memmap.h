@@ -2,13 +2,52 @@
 
 #include "memory/mm_common.h"
 #include "plenjos/syscall.h"
+#include "proc/proc.h"
+#include "vfs/vfs.h"
 
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 
 int syscall_routine_memmap(void *addr, size_t length, syscall_memmap_flags_t flags, pml4_t *current_pml4);
+
+// A file-backed region of a process's address space. Pages are faulted in on first access from the page cache:
+// read-only regions map the cached frame itself (shared with every other mapping of the file), writeable regions get a
+// private copy of it.
+typedef struct memmap_file_region memmap_file_region_t;
+
+struct memmap_file_region {
+    uint64_t start;
+    uint64_t end;
+    syscall_memmap_flags_t flags;
+    size_t file_offset;
+
+    // Our own handle, so the mapping survives the descriptor being closed
+    vfs_handle_t *handle;
+
+    // One for being on the process's list, plus one per fault reading a page of it; the last one closes the handle
+    atomic_uint refs;
+
+    memmap_file_region_t *next;
+};
+
+// addr and file_offset must be page-aligned; length is rounded up to a whole number of pages. Nothing is read until
+// the pages are touched.
 int syscall_routine_memmap_file(void *addr, size_t length, syscall_memmap_flags_t flags, int fd, size_t file_offset,
-                                pml4_t *current_pml4);
+                                proc_t *proc, pml4_t *current_pml4);
+
+// Maps the page containing addr if it falls inside one of proc's file regions. Returns 0 if the page is now mapped,
+// -EFAULT if addr isn't file-backed (or a write was attempted on a read-only region), or another negative errno. A page
+// cache miss is read synchronously, so this can block the calling core on disk I/O; it's called from the page fault
+// handler and the user-copy walk, neither of which can sleep.
+int memmap_file_handle_fault(proc_t *proc, pml4_t *pml4, uint64_t addr, bool write);
+
+// Closes every file region of proc; the mapped frames themselves are released with the page table
+void memmap_file_release_all(proc_t *proc);
+
+// Unmaps every page in [addr, addr + length) and drops any file regions inside it. addr must be page-aligned; length is
+// rounded up to a whole number of pages. A file region that only partly overlaps the range fails with -EINVAL.
+int syscall_routine_memunmap(void *addr, size_t length, proc_t *proc, pml4_t *current_pml4);
 
 // NOTE: the addr does not need to be page-aligned. The buffer will be copied starting from addr, not from the first
 // page of the mapping. The parts of the mapping outside of the buffer are guaranteed to be zeroed.
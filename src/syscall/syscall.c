@@ -15,7 +15,7 @@
 #include "syscall/fs/syscall_fs.h"
 #include "syscall/mem/memmap.h"
 #include "syscall/syscall_helpers.h"
-#include "timer/pit.h"
+#include "timer/timer.h"
 
 #include <stdint.h>
 
@@ -217,7 +217,18 @@ void syscall_routine(registers_t *regs, void *data) {
 
         break;
     }
-    // case SYSCALL_MEMMAP_FILE:
+    case SYSCALL_MEMMAP_FILE: {
+        // (syscall) virtaddr size flags fd file_offset
+        regs->rax = (uint64_t)syscall_routine_memmap_file((void *)regs->rbx, (size_t)regs->rcx,
+                                                          (syscall_memmap_flags_t)regs->rdx, (int)regs->rsi,
+                                                          (size_t)regs->rdi, proc, current_pml4);
+        break;
+    }
+    case SYSCALL_MEMUNMAP: {
+        // (syscall) virtaddr size
+        regs->rax = (uint64_t)syscall_routine_memunmap((void *)regs->rbx, (size_t)regs->rcx, proc, current_pml4);
+        break;
+    }
     case SYSCALL_PRINT: {
         const char *str_ptr = NULL;
         regs->rax           = handle_string_arg(current_pml4, regs->rbx, &str_ptr);
@@ -251,9 +262,7 @@ void syscall_routine(registers_t *regs, void *data) {
         break;
     }
     case SYSCALL_SLEEP: {
-        asm volatile("sti");
-        pit_sleep((uint32_t)regs->rbx);
-        asm volatile("cli");
+        ksleep_blocking_ms((uint32_t)regs->rbx, NULL);
         break;
     }
     case SYSCALL_SPAWN: {
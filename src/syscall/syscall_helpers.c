@@ -9,89 +9,313 @@
 #include "plenjos/errno.h"
 #include "plenjos/limits.h"
 #include "proc/proc.h"
+#include "syscall/mem/memmap.h"
 
 #include <stdbool.h>
 
 // TODO: any attempts to read/write from an out-of-bounds buffer should kill the process (segfault?)
 
+// Caches the page table of the last 2 MiB region looked up, so walking a user buffer only does the full 4-level walk
+// once per region rather than once per page
+typedef struct user_walk {
+    pml4_t *pml4;
+    uint64_t region;
+    pt_t *pt;
+} user_walk_t;
+
+#define USER_WALK_REGION_SHIFT 21
+
+static inline void user_walk_init(user_walk_t *walk, pml4_t *pml4) {
+    walk->pml4   = pml4;
+    walk->region = UINT64_MAX;
+    walk->pt     = NULL;
+}
+
+// Returns the page backing addr if it is present and user accessible (and writeable, if write is set); NULL otherwise
+static page_t *user_walk_page(user_walk_t *walk, uint64_t addr, bool write) {
+    uint64_t region = addr >> USER_WALK_REGION_SHIFT;
+
+    if (region != walk->region) {
+        walk->pt     = find_page_table(addr, walk->pml4);
+        walk->region = region;
+    }
+
+    page_t *page = walk->pt ? &walk->pt->pages[(addr >> 12) & 0x1FF] : NULL;
+
+    if ((!page || !(page->present)) && memmap_file_handle_fault(_get_proc_kernel(), walk->pml4, addr, write) == 0) {
+        // A file mapping that hadn't been touched yet; its page table may not have existed before either
+        walk->pt = find_page_table(addr, walk->pml4);
+        page     = walk->pt ? &walk->pt->pages[(addr >> 12) & 0x1FF] : NULL;
+    }
+
+    if (!page || !(page->present)) {
+        printf("check_buf: page not mapped at addr %p\n", addr);
+        return NULL;
+    }
+    if (!page->user) {
+        printf("check_buf: permission denied (not user accessible) at addr %p\n", addr);
+        return NULL;
+    }
+    if (write && !page->rw) {
+        printf("check_buf: permission denied (not writeable) at addr %p\n", addr);
+        return NULL;
+    }
+
+    return page;
+}
+
+static inline uint64_t user_walk_kernel_addr(page_t *page, uint64_t addr) {
+    return phys_to_virt((page->frame << 12) + (addr % PAGE_LEN));
+}
+
+// Bulk copy; the kernel is built without SSE, and rep movsb is the fastest non-vector copy on CPUs with ERMSB
+static inline void user_copy_bytes(void *dest, const void *src, size_t n) {
+    asm volatile("rep movsb" : "+D"(dest), "+S"(src), "+c"(n) : : "memory");
+}
+
+// Finds the first NUL in s[0..n), a word at a time once aligned. s must not cross into an unmapped page.
+typedef uint64_t __attribute__((may_alias)) user_word_t;
+
+static size_t user_find_nul(const char *s, size_t n) {
+    size_t i = 0;
+
+    while (i < n && ((uint64_t)(s + i) & 7)) {
+        if (!s[i]) return i;
+        i++;
+    }
+
+    for (; i + 8 <= n; i += 8) {
+        user_word_t w = *(const user_word_t *)(s + i);
+        if ((w - 0x0101010101010101ULL) & ~w & 0x8080808080808080ULL) break;
+    }
+
+    for (; i < n; i++) {
+        if (!s[i]) return i;
+    }
+
+    return n;
+}
+
 int copy_to_user_buf(void *dest, void *src, size_t count, bool override_write_check, pml4_t *current_pml4) {
-    size_t first_page_len = PAGE_LEN - ((uint64_t)dest % PAGE_LEN);
-    size_t last_page_len  = ((uint64_t)dest + count) % PAGE_LEN;
+    user_walk_t walk;
+    user_walk_init(&walk, current_pml4);
 
     uint64_t offs = 0;
 
     while (offs < count) {
         uint64_t addr = (uint64_t)dest + offs;
 
-        page_t *page = find_page(addr, false, current_pml4);
-        if (!page || !(page->present)) {
-            printf("check_buf: page not mapped at addr %p\n", addr);
-            return -EFAULT;
-        }
-        if (!page->user) {
-            printf("check_buf: permission denied (not user accessible) at addr %p\n", addr);
-            return -EFAULT;
-        }
-        if (!page->rw && !override_write_check) {
-            printf("check_buf: permission denied (not writeable) at addr %p\n", addr);
+        page_t *page = user_walk_page(&walk, addr, !override_write_check);
+        if (!page) {
             return -EFAULT;
         }
 
-        if (offs == 0) {
-            // First page (or we only need 1 page); might not have to write a full page
-            size_t to_copy = (count < first_page_len) ? count : first_page_len;
-            memcpy((void *)phys_to_virt((page->frame << 12) + (addr % PAGE_LEN)), src + offs, to_copy);
-            offs += to_copy;
-        } else if (offs + PAGE_LEN > count) {
-            // Last page; might not have to write a full page
-            memcpy((void *)phys_to_virt((page->frame << 12) + (addr % PAGE_LEN)), src + offs, last_page_len);
-            offs += last_page_len;
-        } else {
-            // Full page
-            memcpy((void *)phys_to_virt(page->frame << 12), src + offs, PAGE_LEN);
-            offs += PAGE_LEN;
+        size_t to_copy = PAGE_LEN - (addr % PAGE_LEN);
+        if (to_copy > count - offs) {
+            to_copy = count - offs;
         }
+
+        user_copy_bytes((void *)user_walk_kernel_addr(page, addr), (uint8_t *)src + offs, to_copy);
+        offs += to_copy;
     }
 
     return 0;
 }
 
 int copy_to_kernel_buf(void *dest, void *src, size_t count, pml4_t *current_pml4) {
-    size_t first_page_len = PAGE_LEN - ((uint64_t)src % PAGE_LEN);
-    size_t last_page_len  = ((uint64_t)src + count) % PAGE_LEN;
+    user_walk_t walk;
+    user_walk_init(&walk, current_pml4);
 
     uint64_t offs = 0;
 
     while (offs < count) {
         uint64_t addr = (uint64_t)src + offs;
 
-        page_t *page = find_page(addr, false, current_pml4);
-        if (!page || !(page->present)) {
-            printf("check_buf: page not mapped at addr %p\n", addr);
+        page_t *page = user_walk_page(&walk, addr, false);
+        if (!page) {
             return -EFAULT;
         }
-        if (!page->user) {
-            printf("check_buf: permission denied (not user accessible) at addr %p\n", addr);
+
+        size_t to_copy = PAGE_LEN - (addr % PAGE_LEN);
+        if (to_copy > count - offs) {
+            to_copy = count - offs;
+        }
+
+        user_copy_bytes((uint8_t *)dest + offs, (void *)user_walk_kernel_addr(page, addr), to_copy);
+        offs += to_copy;
+    }
+
+    return 0;
+}
+
+ssize_t strnlen_user(uint64_t user_ptr, size_t max, pml4_t *current_pml4) {
+    if (user_ptr == 0) {
+        return -EFAULT;
+    }
+
+    user_walk_t walk;
+    user_walk_init(&walk, current_pml4);
+
+    size_t len = 0;
+
+    while (len < max) {
+        uint64_t addr = user_ptr + len;
+
+        page_t *page = user_walk_page(&walk, addr, false);
+        if (!page) {
             return -EFAULT;
         }
 
-        if (offs == 0) {
-            // First page (or we only need 1 page); might not have to read a full page
-            size_t to_copy = (count < first_page_len) ? count : first_page_len;
-            memcpy(dest + offs, (void *)phys_to_virt((page->frame << 12) + (addr % PAGE_LEN)), to_copy);
-            offs += to_copy;
-        } else if (offs + PAGE_LEN > count) {
-            // Last page; might not have to read a full page
-            memcpy(dest + offs, (void *)phys_to_virt((page->frame << 12) + (addr % PAGE_LEN)), last_page_len);
-            offs += last_page_len;
+        size_t chunk = PAGE_LEN - (addr % PAGE_LEN);
+        if (chunk > max - len) {
+            chunk = max - len;
+        }
+
+        size_t found = user_find_nul((const char *)user_walk_kernel_addr(page, addr), chunk);
+        len += found;
+
+        if (found < chunk) {
+            return (ssize_t)len;
+        }
+    }
+
+    return -ENAMETOOLONG;
+}
+
+ssize_t strncpy_from_user(char *dest, uint64_t user_ptr, size_t n, pml4_t *current_pml4) {
+    if (user_ptr == 0) {
+        return -EFAULT;
+    }
+
+    user_walk_t walk;
+    user_walk_init(&walk, current_pml4);
+
+    size_t len = 0;
+
+    while (len < n) {
+        uint64_t addr = user_ptr + len;
+
+        page_t *page = user_walk_page(&walk, addr, false);
+        if (!page) {
+            return -EFAULT;
+        }
+
+        size_t chunk = PAGE_LEN - (addr % PAGE_LEN);
+        if (chunk > n - len) {
+            chunk = n - len;
+        }
+
+        const char *kaddr = (const char *)user_walk_kernel_addr(page, addr);
+        size_t found      = user_find_nul(kaddr, chunk);
+
+        if (found < chunk) {
+            // Copy the terminator too
+            user_copy_bytes(dest + len, kaddr, found + 1);
+            return (ssize_t)(len + found);
+        }
+
+        user_copy_bytes(dest + len, kaddr, chunk);
+        len += chunk;
+    }
+
+    return -ENAMETOOLONG;
+}
+
+static void user_buf_pin_release_frags(struct plenjos_iovec *frags, int nfrags) {
+    for (int i = 0; i < nfrags; i++) {
+        uint64_t phys  = virt_to_phys((uint64_t)frags[i].iov_base) & ~(uint64_t)(PAGE_LEN - 1);
+        uint64_t end   = virt_to_phys((uint64_t)frags[i].iov_base) + frags[i].iov_len;
+
+        for (; phys < end; phys += PAGE_LEN) {
+            phys_mem_unref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(phys));
+        }
+    }
+}
+
+ssize_t pin_user_buf(uint64_t user_ptr, size_t len, bool write, pml4_t *current_pml4, user_buf_pin_t *out) {
+    if (!out) {
+        return -EINVAL;
+    }
+
+    out->frags  = NULL;
+    out->nfrags = 0;
+    out->len    = 0;
+
+    if (len == 0) {
+        return 0;
+    }
+
+    if (user_ptr == 0 || user_ptr + len < user_ptr) {
+        return -EFAULT;
+    }
+
+    // Clamp to the per-call page budget
+    uint64_t first_page = user_ptr & ~(uint64_t)(PAGE_LEN - 1);
+    size_t max_len      = (USER_BUF_PIN_MAX_PAGES * PAGE_LEN) - (user_ptr - first_page);
+    if (len > max_len) {
+        len = max_len;
+    }
+
+    size_t npages = ((user_ptr + len - first_page) + PAGE_LEN - 1) / PAGE_LEN;
+
+    struct plenjos_iovec *frags = kmalloc_heap(sizeof(struct plenjos_iovec) * npages);
+    if (!frags) {
+        return -ENOMEM;
+    }
+
+    user_walk_t walk;
+    user_walk_init(&walk, current_pml4);
+
+    int nfrags  = 0;
+    size_t offs = 0;
+
+    while (offs < len) {
+        uint64_t addr = user_ptr + offs;
+
+        page_t *page = user_walk_page(&walk, addr, write);
+        if (!page) {
+            user_buf_pin_release_frags(frags, nfrags);
+            kfree_heap(frags);
+            return -EFAULT;
+        }
+
+        size_t in_page = PAGE_LEN - (addr % PAGE_LEN);
+        if (in_page > len - offs) {
+            in_page = len - offs;
+        }
+
+        uint64_t phys = (page->frame << 12) + (addr % PAGE_LEN);
+        phys_mem_ref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(phys));
+
+        // Merge with the previous fragment if the frames happen to be physically contiguous
+        if (nfrags > 0 && virt_to_phys((uint64_t)frags[nfrags - 1].iov_base) + frags[nfrags - 1].iov_len == phys) {
+            frags[nfrags - 1].iov_len += in_page;
         } else {
-            // Full page
-            memcpy(dest + offs, (void *)phys_to_virt(page->frame << 12), PAGE_LEN);
-            offs += PAGE_LEN;
+            frags[nfrags].iov_base = (void *)phys_to_virt(phys);
+            frags[nfrags].iov_len  = in_page;
+            nfrags++;
         }
+
+        offs += in_page;
     }
 
-    return 0;
+    out->frags  = frags;
+    out->nfrags = nfrags;
+    out->len    = len;
+    return (ssize_t)len;
+}
+
+void unpin_user_buf(user_buf_pin_t *pin) {
+    if (!pin || !pin->frags) {
+        return;
+    }
+
+    user_buf_pin_release_frags(pin->frags, pin->nfrags);
+    kfree_heap(pin->frags);
+
+    pin->frags  = NULL;
+    pin->nfrags = 0;
+    pin->len    = 0;
 }
 
 int handle_string_arg(pml4_t *current_pml4, uint64_t user_ptr, const char **out) {
@@ -100,24 +324,22 @@ int handle_string_arg(pml4_t *current_pml4, uint64_t user_ptr, const char **out)
         return -EFAULT;
     }
 
-    uint64_t str_ptr = phys_to_virt(get_physaddr(user_ptr, current_pml4));
-
-    if (str_ptr == phys_to_virt(0)) {
-        printf("handle_string_arg: bad pointer passed from userland\n");
-        return -EFAULT;
+    ssize_t len = strnlen_user(user_ptr, USER_STRING_ARG_MAX, current_pml4);
+    if (len < 0) {
+        printf("handle_string_arg: bad string passed from userland\n");
+        return (int)len;
     }
-    
-    uint64_t len     = strlen((char *)str_ptr) + 1;
 
-    char *kstr = kmalloc_heap(len);
+    char *kstr = kmalloc_heap((size_t)len + 1);
     if (!kstr) {
         return -ENOMEM;
     }
 
-    int check = copy_to_kernel_buf(kstr, (void *)user_ptr, len, current_pml4);
+    // The string can change between the two passes; strncpy_from_user fails rather than leave it unterminated
+    ssize_t check = strncpy_from_user(kstr, user_ptr, (size_t)len + 1, current_pml4);
     if (check < 0) {
         kfree_heap(kstr);
-        return check;
+        return (int)check;
     }
 
     *out = kstr;
@@ -8,9 +8,41 @@
 
 #include "memory/mm_common.h"
 
+#include "plenjos/uio.h"
+
 int copy_to_user_buf(void *dest, void *src, size_t count, bool override_write_check, pml4_t *current_pml4);
 int copy_to_kernel_buf(void *dest, void *src, size_t count, pml4_t *current_pml4);
 
+// Upper bound on how many pages a single pin_user_buf() call will take a reference on
+#define USER_BUF_PIN_MAX_PAGES 256
+
+// A user buffer that has been validated once and had every backing frame referenced, so that the kernel can access it
+// through the higher-half direct map without a bounce buffer. Physically contiguous pages are merged into a single
+// fragment. The frames stay referenced (and so can't be reused) until unpin_user_buf(), even if the process unmaps
+// them in the meantime.
+typedef struct user_buf_pin {
+    struct plenjos_iovec *frags;
+    int nfrags;
+    size_t len;
+} user_buf_pin_t;
+
+// Pins up to USER_BUF_PIN_MAX_PAGES pages starting at user_ptr. If write is set, the pages must be writeable (the
+// kernel will store into them). Returns the number of bytes pinned (which may be less than len; callers loop) or a
+// negative errno, in which case nothing is left pinned.
+ssize_t pin_user_buf(uint64_t user_ptr, size_t len, bool write, pml4_t *current_pml4, user_buf_pin_t *out);
+void unpin_user_buf(user_buf_pin_t *pin);
+
+// Returns the length of the NUL-terminated user string at user_ptr (not counting the NUL). Fails with -EFAULT if it
+// runs into an inaccessible page, or -ENAMETOOLONG if there is no NUL within max bytes.
+ssize_t strnlen_user(uint64_t user_ptr, size_t max, pml4_t *current_pml4);
+
+// Copies a NUL-terminated user string into dest (at most n bytes, including the NUL). Returns the string length (not
+// counting the NUL), -EFAULT, or -ENAMETOOLONG if no NUL was found within n bytes (dest is then unterminated).
+ssize_t strncpy_from_user(char *dest, uint64_t user_ptr, size_t n, pml4_t *current_pml4);
+
+// Longest string handle_string_arg() will accept
+#define USER_STRING_ARG_MAX (1024 * 1024)
+
 // This must be freed!
 int handle_string_arg(pml4_t *current_pml4, uint64_t user_ptr, const char **out);
 
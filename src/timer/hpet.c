@@ -4,18 +4,58 @@
 
 #include "arch/x86_64/acpi/acpi.h"
 #include "lib/stdio.h"
+#include "memory/mm.h"
+#include "plenjos/errno.h"
 
-#define HPET_FREQ (uint64_t)2000000000000000000
+static volatile uint64_t *hpet_regs = NULL;
+static uint64_t hpet_period_fs      = 0; // Femtoseconds per counter tick
+static uint64_t hpet_base           = 0;
 
-GenericAddressStructure hpet_addr;
+static inline uint64_t hpet_read(uint32_t reg) {
+    return hpet_regs[reg / sizeof(uint64_t)];
+}
+
+static inline void hpet_write(uint32_t reg, uint64_t value) {
+    hpet_regs[reg / sizeof(uint64_t)] = value;
+}
 
 int hpet_init() {
     if (!hpet_header_global) {
         printf("Can't initialize HPET timer: no HPET detected.\n");
-        return 1;
+        return -ENODEV;
     }
 
-    printf("HPET status: %x\n", hpet_header_global->legacy_replacement);
+    uint64_t phys = hpet_header_global->address.Address;
+    map_virtual_memory(phys, 4096, PAGE_FLAG_PRESENT | PAGE_FLAG_WRITE, kernel_pml4);
+    hpet_regs = (volatile uint64_t *)phys_to_virt(phys);
+
+    uint64_t caps = hpet_read(HPET_REG_CAPABILITIES);
+    if (!(caps & HPET_CAP_COUNT_SIZE_64)) {
+        printf("Can't use HPET timer: its main counter is only 32 bits wide.\n");
+        hpet_regs = NULL;
+        return -ENODEV;
+    }
+
+    hpet_period_fs = caps >> 32;
+    if (hpet_period_fs == 0) {
+        hpet_regs = NULL;
+        return -ENODEV;
+    }
+
+    hpet_write(HPET_REG_CONFIG, hpet_read(HPET_REG_CONFIG) | HPET_CONFIG_ENABLE);
+    hpet_base = hpet_read(HPET_REG_MAIN_COUNTER);
+
+    printf("HPET counter runs at %d kHz\n", (int)(1000000000000ULL / hpet_period_fs));
 
     return 0;
-}
\ No newline at end of file
+}
+
+bool hpet_available() {
+    return hpet_regs != NULL;
+}
+
+uint64_t hpet_now_ns() {
+    uint64_t ticks = hpet_read(HPET_REG_MAIN_COUNTER) - hpet_base;
+    // Split so the multiplication can't overflow however long we've been up
+    return (ticks / HPET_FS_PER_NS) * hpet_period_fs + ((ticks % HPET_FS_PER_NS) * hpet_period_fs) / HPET_FS_PER_NS;
+}
@@ -1,5 +1,21 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
-int hpet_init();
\ No newline at end of file
+// General register offsets
+#define HPET_REG_CAPABILITIES 0x00
+#define HPET_REG_CONFIG       0x10
+#define HPET_REG_MAIN_COUNTER 0xF0
+
+#define HPET_CAP_COUNT_SIZE_64 (1ULL << 13)
+#define HPET_CONFIG_ENABLE     0x1
+
+#define HPET_FS_PER_NS 1000000ULL
+
+// Maps the HPET and starts its main counter. Returns 0, or a negative errno if there is no usable HPET (none at all, or
+// only a 32-bit counter, which would wrap within minutes).
+int hpet_init();
+bool hpet_available();
+// Nanoseconds the main counter has counted since hpet_init()
+uint64_t hpet_now_ns();
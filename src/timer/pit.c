@@ -8,48 +8,15 @@
 #include "arch/x86_64/apic/ioapic.h"
 #include "devices/io/ports.h"
 #include "lib/stdio.h"
-#include "timer.h"
 
 volatile uint64_t pit_count;
 
-void pit_timer_callback(void *data) {
-    struct timer_timeout *timeout = (struct timer_timeout *)data;
-
-    if (timeout->callback) {
-        timeout->callback(timeout);
-    }
-
-    // Mark the timeout as unused
-    atomic_store(&(timeout->milliseconds), 0);
-}
-
+// Only used as a time reference while the TSC and LAPIC timers are calibrated at boot; timeouts live in timer.c
 void pit_irq(registers_t *regs, void *data) {
     if (pit_count >= UINT64_MAX) pit_count = 0;
 
     pit_count++;
 
-    // TODO: separate timers into PIT and HPET ones (or HPET only?)
-    struct timer_timeout *timer;
-    for (int i = 0; i < TIMER_MAX_TIMEOUTS; i++) {
-        timer       = &timer_timeouts[i];
-        uint64_t ms = atomic_load(&(timer->milliseconds));
-        if (ms != 0 && ms != UINT64_MAX) {
-            uint64_t elapsed = pit_count - timer->start_time;
-            if (elapsed >= ms) {
-                // Timeout reached
-                // Clear the timeout first to avoid re-entrancy issues
-                atomic_store(&(timer->milliseconds), UINT64_MAX);
-                if (timer->callback == NULL) {
-                    // IPI wakeup
-                    send_ipi((uint32_t)(timer->core_id), IPI_WAKEUP_IRQ + 32);
-                    atomic_store(&(timer->milliseconds), 0);
-                } else {
-                    delegate_kernel_task(pit_timer_callback, timer);
-                }
-            }
-        }
-    }
-
     apic_send_eoi();
 }
 
@@ -84,6 +51,17 @@ void pit_init() {
     apic_send_eoi();
 }
 
+void pit_stop() {
+    asm volatile("cli");
+
+    pit_timer_remove();
+
+    // Mode 0 without a count being written never reaches terminal count, so the PIT stays quiet
+    outb(0x43, 0b00110000);
+
+    asm volatile("sti");
+}
+
 void pit_sleep(uint64_t mills) {
     uint64_t end;
 
@@ -8,5 +8,7 @@
 extern volatile uint64_t pit_count;
 
 void pit_init();
+// Stops the periodic PIT interrupt; pit_count and pit_sleep() don't work after this
+void pit_stop();
 void pit_sleep(uint64_t mills);
 void pit_sleep_nohlt(uint64_t mills);
\ No newline at end of file
@@ -1,73 +1,618 @@
 #include "timer.h"
 
+#include "arch/x86_64/apic/apic.h"
+#include "arch/x86_64/common.h"
+#include "arch/x86_64/irq.h"
+#include "arch/x86_64/tsc.h"
 #include "hpet.h"
 #include "lib/stdio.h"
+#include "memory/kmalloc.h"
 #include "pit.h"
+#include "plenjos/errno.h"
+#include "proc/kthread.h"
 
+#include <cpuid.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 
-struct timer_timeout timer_timeouts[TIMER_MAX_TIMEOUTS] = { 0 };
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_MAX_CHUNKS (1 << (TIMER_ID_INDEX_BITS - TIMER_CHUNK_SHIFT))
 
-int set_core_wakeup_timeout(uint64_t milliseconds, uint32_t core_id, uint64_t *started_at_out) {
-    for (int i = 0; i < TIMER_MAX_TIMEOUTS; i++) {
-        uint64_t expected = 0;
-        if (atomic_compare_exchange_strong(&(timer_timeouts[i].milliseconds), &expected, UINT64_MAX)) {
-            timer_timeouts[i].start_time = pit_count;
-            timer_timeouts[i].callback = NULL;
-            timer_timeouts[i].core_id  = core_id;
-            atomic_store(&(timer_timeouts[i].milliseconds), milliseconds);
-            if (started_at_out) {
-                *started_at_out = timer_timeouts[i].start_time;
-            }
-            return i;
+// CPUID.80000007H:EDX[8]: the TSC runs at a constant rate in every P-, C- and T-state
+#define TIMER_CPUID_POWER_LEAF    0x80000007
+#define TIMER_CPUID_INVARIANT_TSC (1U << 8)
+
+#define TIMER_NS_PER_PIT_IRQ (1000000000ULL / PIT_INTERR_FREQ)
+
+// Where timer_now_ns() gets the time from
+typedef enum {
+    TIMER_CLOCK_NONE, // Before timer_init()
+    TIMER_CLOCK_TSC,
+    TIMER_CLOCK_HPET, // No invariant TSC
+    TIMER_CLOCK_PIT,  // Neither; the PIT keeps interrupting the BSP to count time
+} timer_clock_t;
+
+// Only the core itself arms timeouts on its wheel and programs its LAPIC timer; the lock is for cancel_timeout() from
+// other cores. It is taken with interrupts disabled, as the timer IRQ takes it too.
+struct timer_core {
+    spinlock_t lock;
+
+    uint64_t clk; // Wheel tick up to which everything has fired
+    struct timer_timeout *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t occupied[TIMER_WHEEL_LEVELS]; // Bit s set iff slots[level][s] is non-empty
+    struct timer_timeout *overflow;        // Too far out for the top level
+
+    uint64_t slice_deadline; // End of the running thread's time slice in ns, or UINT64_MAX
+    uint64_t programmed;     // Deadline the LAPIC timer is currently counting down to, or UINT64_MAX
+};
+
+static struct timer_core timer_cores[MAX_CORES];
+
+// Timeouts are never freed back to the heap, so a pointer from an old id always stays valid to look at
+static struct timer_timeout *timer_chunks[TIMER_MAX_CHUNKS];
+static uint32_t timer_n_chunks           = 0;
+static struct timer_timeout *timer_free  = NULL;
+static spinlock_t timer_alloc_lock       = SPINLOCK_INIT;
+
+static timer_clock_t timer_clock = TIMER_CLOCK_NONE;
+
+static uint64_t tsc_per_ms = 0;
+static uint64_t tsc_base   = 0;
+static uint64_t pit_base   = 0;
+
+uint64_t timer_now_ns() {
+    switch (timer_clock) {
+    case TIMER_CLOCK_TSC: {
+        // Split so the multiplication can't overflow however long we've been up
+        uint64_t cycles = rdtsc() - tsc_base;
+        return (cycles / tsc_per_ms) * TIMER_NS_PER_MS + ((cycles % tsc_per_ms) * TIMER_NS_PER_MS) / tsc_per_ms;
+    }
+    case TIMER_CLOCK_HPET:
+        return hpet_now_ns();
+    case TIMER_CLOCK_PIT:
+        return (pit_count - pit_base) * TIMER_NS_PER_PIT_IRQ;
+    default:
+        return 0;
+    }
+}
+
+static bool timer_tsc_is_invariant() {
+    uint32_t unused, edx;
+    // Fails if the leaf isn't supported
+    if (!__get_cpuid(TIMER_CPUID_POWER_LEAF, &unused, &unused, &unused, &edx)) {
+        return false;
+    }
+    return edx & TIMER_CPUID_INVARIANT_TSC;
+}
+
+// Busy-waits until timer_now_ns() reaches end, whether or not interrupts are enabled
+static void timer_spin_until(uint64_t end) {
+    if (timer_clock != TIMER_CLOCK_PIT) {
+        while (timer_now_ns() < end) {
+            asm volatile("pause");
         }
+        return;
+    }
+
+    // The PIT count stands still while the BSP has interrupts disabled, so count TSC cycles at the rate measured at
+    // boot instead. Without an invariant TSC that rate is only approximate.
+    uint64_t now = timer_now_ns();
+    if (now >= end) {
+        return;
+    }
+    uint64_t ns     = end - now;
+    uint64_t cycles = (ns / TIMER_NS_PER_MS) * tsc_per_ms + ((ns % TIMER_NS_PER_MS) * tsc_per_ms) / TIMER_NS_PER_MS;
+    uint64_t start  = rdtsc();
+    while (rdtsc() - start < cycles) {
+        asm volatile("pause");
     }
-    return -1;
 }
 
-int set_timeout(uint64_t milliseconds, timer_callback_func_t callback, void *data) {
-    // TODO: make flags for PIT, HPET support
+// Converts a relative timeout to an absolute deadline, saturating instead of wrapping
+static uint64_t timer_deadline_after(uint64_t now, uint64_t ns) {
+    return ns > UINT64_MAX - 1 - now ? UINT64_MAX - 1 : now + ns;
+}
+
+static uint64_t timer_ms_to_ns(uint64_t milliseconds) {
+    return milliseconds > (UINT64_MAX - 1) / TIMER_NS_PER_MS ? UINT64_MAX - 1 : milliseconds * TIMER_NS_PER_MS;
+}
+
+// Rounds up, so a timeout never fires before its deadline
+static uint64_t timer_ns_to_tick(uint64_t ns) {
+    return (ns >> TIMER_WHEEL_TICK_SHIFT) + ((ns & ((1ULL << TIMER_WHEEL_TICK_SHIFT) - 1)) != 0);
+}
+
+static int timer_timeout_id(struct timer_timeout *timeout) {
+    return (int)(((timeout->generation << TIMER_ID_INDEX_BITS) | timeout->index) & INT32_MAX);
+}
+
+// Both of these need interrupts disabled
+
+static struct timer_timeout *timer_alloc() {
+    for (;;) {
+        spin_lock(&timer_alloc_lock);
+        struct timer_timeout *timeout = timer_free;
+        if (timeout) {
+            timer_free = timeout->next;
+            spin_unlock(&timer_alloc_lock);
+
+            timeout->generation++;
+            return timeout;
+        }
+        uint32_t n_chunks = timer_n_chunks;
+        spin_unlock(&timer_alloc_lock);
+
+        if (n_chunks >= TIMER_MAX_CHUNKS) {
+            return NULL;
+        }
+
+        struct timer_timeout *chunk = kmalloc_heap(TIMER_CHUNK_LEN * sizeof(struct timer_timeout));
+        if (!chunk) {
+            return NULL;
+        }
+        memset(chunk, 0, TIMER_CHUNK_LEN * sizeof(struct timer_timeout));
 
-    for (int i = 0; i < TIMER_MAX_TIMEOUTS; i++) {
-        uint64_t expected = 0;
-        if (atomic_compare_exchange_strong(&(timer_timeouts[i].milliseconds), &expected, UINT64_MAX)) {
-            timer_timeouts[i].start_time = pit_count;
-            timer_timeouts[i].callback   = callback;
-            timer_timeouts[i].data       = data;
-            atomic_store(&(timer_timeouts[i].milliseconds), milliseconds);
-            return i;
+        spin_lock(&timer_alloc_lock);
+        if (timer_n_chunks != n_chunks) {
+            // Another core added a chunk in the meantime; use that one
+            spin_unlock(&timer_alloc_lock);
+            kfree_heap(chunk);
+            continue;
         }
+
+        for (uint32_t i = 0; i < TIMER_CHUNK_LEN; i++) {
+            chunk[i].index = (n_chunks << TIMER_CHUNK_SHIFT) | i;
+            chunk[i].next  = i + 1 < TIMER_CHUNK_LEN ? &chunk[i + 1] : timer_free;
+        }
+        timer_free                   = chunk;
+        timer_chunks[timer_n_chunks] = chunk;
+        __atomic_store_n(&timer_n_chunks, n_chunks + 1, __ATOMIC_RELEASE);
+
+        spin_unlock(&timer_alloc_lock);
     }
-    return -1;
 }
 
-// TODO: have some way of actually keeping track of this
-#define INTERRUPT_CORE 0
+static void timer_release(struct timer_timeout *timeout) {
+    atomic_store(&timeout->state, TIMER_TIMEOUT_FREE);
 
-uint64_t ksleep_nonblocking_ms(uint64_t milliseconds, uint32_t priority) {
-    // TODO: make this actually non-blocking
-    uint32_t curr_core = get_curr_core();
+    spin_lock(&timer_alloc_lock);
+    timeout->next = timer_free;
+    timer_free    = timeout;
+    spin_unlock(&timer_alloc_lock);
+}
 
-    if (curr_core == (uint32_t)-1) {
-        panic("FATAL ERROR: curr_core = -1 in ksleep_nonblocking_ms\n");
+// The following timer_wheel_* functions need tc->lock held
+
+// Needs timeout->expires > tc->clk
+static void timer_wheel_insert(struct timer_core *tc, struct timer_timeout *timeout) {
+    uint64_t diff = timeout->expires ^ tc->clk;
+    uint32_t level = (63 - __builtin_clzll(diff)) / TIMER_WHEEL_BITS;
+
+    struct timer_timeout **head;
+    if (level >= TIMER_WHEEL_LEVELS) {
+        timeout->level = TIMER_WHEEL_LEVELS;
+        timeout->slot  = 0;
+        head           = &tc->overflow;
+    } else {
+        uint32_t slot  = (timeout->expires >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+        timeout->level = (uint8_t)level;
+        timeout->slot  = (uint8_t)slot;
+        head           = &tc->slots[level][slot];
+
+        tc->occupied[level] |= 1ULL << slot;
+    }
+
+    timeout->next  = *head;
+    timeout->pprev = head;
+    if (*head) {
+        (*head)->pprev = &timeout->next;
+    }
+    *head = timeout;
+}
+
+static void timer_wheel_remove(struct timer_core *tc, struct timer_timeout *timeout) {
+    *timeout->pprev = timeout->next;
+    if (timeout->next) {
+        timeout->next->pprev = timeout->pprev;
+    }
+
+    if (timeout->level < TIMER_WHEEL_LEVELS && !tc->slots[timeout->level][timeout->slot]) {
+        tc->occupied[timeout->level] &= ~(1ULL << timeout->slot);
+    }
+}
+
+// Appends list (linked through next) to *todo
+static void timer_wheel_splice(struct timer_timeout **todo, struct timer_timeout *list) {
+    if (!list) {
+        return;
+    }
+
+    struct timer_timeout *last = list;
+    while (last->next) {
+        last = last->next;
+    }
+    last->next = *todo;
+    *todo      = list;
+}
+
+/**
+ * Moves the wheel's clock forward to new_clk. Every slot that was passed is emptied: timeouts that are due are returned
+ * (linked through next), the rest go back in at a lower level. Everything in a level shares the clock's digits above
+ * that level and has a larger digit at it, so only the passed part of each level has to be looked at, and the levels
+ * above the highest digit that changed can't have anything due.
+ */
+static struct timer_timeout *timer_wheel_advance(struct timer_core *tc, uint64_t new_clk) {
+    uint64_t old_clk           = tc->clk;
+    struct timer_timeout *todo = NULL;
+
+    if (new_clk <= old_clk) {
+        return NULL;
+    }
+
+    for (uint32_t level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint32_t shift = level * TIMER_WHEEL_BITS;
+        if ((old_clk >> shift) == (new_clk >> shift)) {
+            break;
+        }
+
+        uint64_t passed;
+        if ((old_clk >> (shift + TIMER_WHEEL_BITS)) != (new_clk >> (shift + TIMER_WHEEL_BITS))) {
+            // The whole level came round
+            passed = ~0ULL;
+        } else {
+            // Digits old+1 to new; 2ULL << 63 is 0, which makes the mask all ones as needed
+            uint32_t old_digit = (old_clk >> shift) & TIMER_WHEEL_MASK;
+            uint32_t new_digit = (new_clk >> shift) & TIMER_WHEEL_MASK;
+            passed             = ((2ULL << new_digit) - 1) & ~((2ULL << old_digit) - 1);
+        }
+
+        uint64_t hit = tc->occupied[level] & passed;
+        while (hit) {
+            uint32_t slot = __builtin_ctzll(hit);
+            hit &= hit - 1;
+
+            timer_wheel_splice(&todo, tc->slots[level][slot]);
+            tc->slots[level][slot]  = NULL;
+            tc->occupied[level]    &= ~(1ULL << slot);
+        }
+    }
+
+    if ((old_clk >> (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) != (new_clk >> (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS))) {
+        timer_wheel_splice(&todo, tc->overflow);
+        tc->overflow = NULL;
+    }
+
+    tc->clk = new_clk;
+
+    struct timer_timeout *expired = NULL;
+    while (todo) {
+        struct timer_timeout *timeout = todo;
+        todo                          = timeout->next;
+
+        if (timeout->expires <= new_clk) {
+            atomic_store(&timeout->state, TIMER_TIMEOUT_FIRING);
+            timeout->next = expired;
+            expired       = timeout;
+        } else {
+            timer_wheel_insert(tc, timeout);
+        }
+    }
+
+    return expired;
+}
+
+// Wheel tick at which the next occupied slot has to be looked at, or UINT64_MAX if the wheel is empty. For a slot above
+// level 0 that is when it cascades, which may be before anything in it is due.
+static uint64_t timer_wheel_next_tick(struct timer_core *tc) {
+    uint64_t next = UINT64_MAX;
+
+    for (uint32_t level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint32_t shift = level * TIMER_WHEEL_BITS;
+        uint32_t digit = (tc->clk >> shift) & TIMER_WHEEL_MASK;
+        uint64_t ahead = tc->occupied[level] & ~((2ULL << digit) - 1);
+        if (!ahead) {
+            continue;
+        }
+
+        uint64_t base = (tc->clk >> (shift + TIMER_WHEEL_BITS)) << (shift + TIMER_WHEEL_BITS);
+        uint64_t tick = base | ((uint64_t)__builtin_ctzll(ahead) << shift);
+        if (tick < next) {
+            next = tick;
+        }
+    }
+
+    if (tc->overflow) {
+        uint32_t shift = TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS;
+        uint64_t tick  = ((tc->clk >> shift) + 1) << shift;
+        if (tick < next) {
+            next = tick;
+        }
+    }
+
+    return next;
+}
+
+// Programs this core's LAPIC timer for whatever comes first, or stops it if nothing is pending; needs tc->lock held
+static void timer_core_reprogram(struct timer_core *tc) {
+    uint64_t next      = tc->slice_deadline;
+    uint64_t next_tick = timer_wheel_next_tick(tc);
+    if (next_tick != UINT64_MAX && (next_tick << TIMER_WHEEL_TICK_SHIFT) < next) {
+        next = next_tick << TIMER_WHEEL_TICK_SHIFT;
+    }
+
+    if (next == tc->programmed) {
+        return;
+    }
+    tc->programmed = next;
+
+    if (next == UINT64_MAX) {
+        apic_timer_oneshot_ns(0);
+        return;
     }
 
-    if (curr_core == INTERRUPT_CORE) {
-        pit_sleep(milliseconds);
-        return milliseconds;
+    uint64_t now = timer_now_ns();
+    // A deadline that has already passed still needs an interrupt, as soon as possible
+    apic_timer_oneshot_ns(next > now ? next - now : 1);
+}
+
+static int timer_arm(uint64_t ns, timer_callback_func_t callback, void *data, uint64_t core_id,
+                     uint64_t *started_at_out) {
+    bool ints = are_interrupts_enabled();
+    asm volatile("cli");
+
+    struct timer_timeout *timeout = timer_alloc();
+    if (!timeout) {
+        if (ints) {
+            asm volatile("sti");
+        }
+        return -ENOMEM;
+    }
+
+    uint32_t curr_core    = get_curr_core();
+    struct timer_core *tc = &timer_cores[curr_core];
+    uint64_t now          = timer_now_ns();
+
+    timeout->callback = callback;
+    if (callback) {
+        timeout->data = data;
     } else {
-        uint64_t end = 0;
-        int res = set_core_wakeup_timeout(milliseconds, curr_core, &end);
-        if (res < 0) {
-            printf("WARN: ksleep_nonblocking_ms: couldn't set core wakeup timeout! Falling back to power-intensive sleeping methods.\n");
-            pit_sleep_nohlt(milliseconds);
-            return milliseconds;
+        timeout->core_id = core_id;
+    }
+    timeout->core = curr_core;
+    if (started_at_out) {
+        *started_at_out = now;
+    }
+
+    spin_lock(&tc->lock);
+
+    // The wheel's clock only moves on timer IRQs, so it may lag behind now; anything at or before it goes in the next
+    // tick
+    timeout->expires = timer_ns_to_tick(timer_deadline_after(now, ns));
+    if (timeout->expires <= tc->clk) {
+        timeout->expires = tc->clk + 1;
+    }
+
+    atomic_store(&timeout->state, TIMER_TIMEOUT_PENDING);
+    timer_wheel_insert(tc, timeout);
+    timer_core_reprogram(tc);
+
+    int id = timer_timeout_id(timeout);
+
+    spin_unlock(&tc->lock);
+
+    if (ints) {
+        asm volatile("sti");
+    }
+
+    return id;
+}
+
+int set_core_wakeup_timeout(uint64_t milliseconds, uint32_t core_id, uint64_t *started_at_out) {
+    return timer_arm(timer_ms_to_ns(milliseconds), NULL, NULL, core_id, started_at_out);
+}
+
+int set_timeout(uint64_t milliseconds, timer_callback_func_t callback, void *data) {
+    return timer_arm(timer_ms_to_ns(milliseconds), callback, data, 0, NULL);
+}
+
+int set_timeout_ns(uint64_t ns, timer_callback_func_t callback, void *data) {
+    return timer_arm(ns, callback, data, 0, NULL);
+}
+
+int cancel_timeout(int timeout_id) {
+    if (timeout_id < 0) {
+        return -EINVAL;
+    }
+
+    uint32_t index = (uint32_t)timeout_id & ((1U << TIMER_ID_INDEX_BITS) - 1);
+    if ((index >> TIMER_CHUNK_SHIFT) >= __atomic_load_n(&timer_n_chunks, __ATOMIC_ACQUIRE)) {
+        return -ENOENT;
+    }
+
+    struct timer_timeout *timeout = &timer_chunks[index >> TIMER_CHUNK_SHIFT][index & (TIMER_CHUNK_LEN - 1)];
+
+    bool ints = are_interrupts_enabled();
+    asm volatile("cli");
+
+    int res               = -ENOENT;
+    uint32_t core         = __atomic_load_n(&timeout->core, __ATOMIC_ACQUIRE);
+    struct timer_core *tc = &timer_cores[core];
+
+    spin_lock(&tc->lock);
+
+    // Under the lock of the core that holds it, a pending timeout can't fire, move or be handed out again
+    if (atomic_load(&timeout->state) == TIMER_TIMEOUT_PENDING && timeout->core == core
+        && timer_timeout_id(timeout) == timeout_id) {
+        timer_wheel_remove(tc, timeout);
+        res = 0;
+    }
+
+    spin_unlock(&tc->lock);
+
+    if (res == 0) {
+        timer_release(timeout);
+    }
+
+    if (ints) {
+        asm volatile("sti");
+    }
+
+    // The LAPIC timer may still fire for the cancelled deadline; that interrupt just finds nothing to do
+    return res;
+}
+
+static void timer_run_callback(void *data) {
+    struct timer_timeout *timeout = (struct timer_timeout *)data;
+
+    if (timeout->callback) {
+        timeout->callback(timeout);
+    }
+
+    bool ints = are_interrupts_enabled();
+    asm volatile("cli");
+    timer_release(timeout);
+    if (ints) {
+        asm volatile("sti");
+    }
+}
+
+void timer_irq(registers_t *regs) {
+    uint32_t curr_core    = get_curr_core();
+    struct timer_core *tc = &timer_cores[curr_core];
+    uint64_t now          = timer_now_ns();
+
+    spin_lock(&tc->lock);
+    // This interrupt used up whatever was programmed
+    tc->programmed                = UINT64_MAX;
+    struct timer_timeout *expired = timer_wheel_advance(tc, now >> TIMER_WHEEL_TICK_SHIFT);
+    spin_unlock(&tc->lock);
+
+    while (expired) {
+        struct timer_timeout *timeout = expired;
+        expired                       = timeout->next;
+
+        if (timeout->callback) {
+            if (delegate_kernel_task(timer_run_callback, timeout) < 0) {
+                kout(KERNEL_WARN, "timer: kernel task queue full; dropping a timeout callback\n");
+                timer_release(timeout);
+            }
+            continue;
+        }
+
+        // This interrupt has already woken the current core, so only another one needs an IPI
+        if (timeout->core_id != curr_core) {
+            send_ipi(cpu_cores[timeout->core_id].lapic_id, IPI_WAKEUP_IRQ + 32);
         }
-        end += milliseconds;
-        while (pit_count < end) {
-            asm volatile("hlt");
+        timer_release(timeout);
+    }
+
+    if (tc->slice_deadline <= now) {
+        tc->slice_deadline = UINT64_MAX;
+        // Doesn't return if it preempts the running thread; the scheduler reprograms the timer in that case
+        scheduler_tick(regs);
+    }
+
+    spin_lock(&tc->lock);
+    timer_core_reprogram(tc);
+    spin_unlock(&tc->lock);
+}
+
+void timer_set_slice(uint64_t ns) {
+    struct timer_core *tc = &timer_cores[get_curr_core()];
+
+    spin_lock(&tc->lock);
+    tc->slice_deadline = ns ? timer_deadline_after(timer_now_ns(), ns) : UINT64_MAX;
+    timer_core_reprogram(tc);
+    spin_unlock(&tc->lock);
+}
+
+void timer_start_core() {
+    timer_cores[get_curr_core()].slice_deadline = UINT64_MAX;
+    apic_timer_init();
+}
+
+void timer_init() {
+    for (int i = 0; i < MAX_CORES; i++) {
+        spin_lock_init(&timer_cores[i].lock);
+        timer_cores[i].slice_deadline = UINT64_MAX;
+        timer_cores[i].programmed     = UINT64_MAX;
+    }
+
+    // The PIT is only needed as a reference until the TSC and the LAPIC timer have been measured against it
+    uint64_t start = rdtsc();
+    pit_sleep(TIMER_TSC_CALIBRATION_MS);
+    uint64_t end = rdtsc();
+
+    tsc_per_ms = (end - start) / TIMER_TSC_CALIBRATION_MS;
+    tsc_base   = end;
+    kout(KERNEL_INFO, "TSC runs at %d kHz\n", (int)tsc_per_ms);
+
+    // A TSC whose rate changes with power states can't tell the time
+    if (timer_tsc_is_invariant()) {
+        timer_clock = TIMER_CLOCK_TSC;
+    } else if (hpet_init() == 0) {
+        kout(KERNEL_WARN, "timer: the TSC isn't invariant; using the HPET as the clock\n");
+        timer_clock = TIMER_CLOCK_HPET;
+    } else {
+        kout(KERNEL_WARN, "timer: neither an invariant TSC nor a usable HPET; keeping the PIT running as the clock\n");
+        pit_base    = pit_count;
+        timer_clock = TIMER_CLOCK_PIT;
+    }
+
+    timer_start_core();
+
+    if (timer_clock != TIMER_CLOCK_PIT) {
+        pit_stop();
+    }
+}
+
+uint64_t ksleep_blocking_ms(uint64_t milliseconds, uint32_t *curr_core_if_known) {
+    uint32_t curr_core = curr_core_if_known ? *curr_core_if_known : get_curr_core();
+    bool ints          = are_interrupts_enabled();
+
+    uint64_t start = timer_now_ns();
+    uint64_t end   = timer_deadline_after(start, timer_ms_to_ns(milliseconds));
+
+    if (!ints) {
+        // hlt would need interrupts enabled to wake up, and the caller (holding a spinlock, in a syscall, ...) disabled
+        // them for a reason
+        timer_spin_until(end);
+        return (timer_now_ns() - start) / TIMER_NS_PER_MS;
+    }
+
+    asm volatile("cli");
+
+    int res = set_core_wakeup_timeout(milliseconds, curr_core, NULL);
+
+    if (res < 0) {
+        printf("WARN: ksleep_blocking_ms: couldn't set core wakeup timeout! Falling back to power-intensive sleeping "
+               "methods.\n");
+        timer_spin_until(end);
+    } else {
+        while (timer_now_ns() < end) {
+            // sti only takes effect after hlt has started, so the wakeup can't be lost in between
+            asm volatile("sti; hlt; cli");
         }
+    }
 
-        return (pit_count - end + milliseconds);
+    if (ints) {
+        asm volatile("sti");
     }
-}
\ No newline at end of file
+
+    return (timer_now_ns() - start) / TIMER_NS_PER_MS;
+}
+
+uint64_t ksleep_nonblocking_ms(uint64_t milliseconds, uint32_t priority) {
+    // Only a kernel thread has a stack of its own to block on; everything else still halts the core
+    if (kthread_can_sleep()) {
+        return kthread_sleep_ms(milliseconds);
+    }
+
+    uint32_t curr_core = get_curr_core();
+
+    if (curr_core == (uint32_t)-1) {
+        panic("FATAL ERROR: curr_core = -1 in ksleep_nonblocking_ms\n");
+    }
+
+    return ksleep_blocking_ms(milliseconds, &curr_core);
+}
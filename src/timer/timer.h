@@ -1,33 +1,97 @@
 #pragma once
 
+#include "kernel.h"
+#include "lib/lock.h"
 #include "proc/scheduler.h"
 
 #include <stdatomic.h>
 #include <stdint.h>
 
-#define TIMER_MAX_TIMEOUTS 1024
+/**
+ * Tickless timers. Time is read from the TSC (calibrated against the PIT at boot, after which the PIT is stopped), and
+ * every core's LAPIC timer runs in one-shot mode, programmed for the earliest of that core's pending timeouts and the
+ * running thread's time slice. A core with neither takes no timer interrupts at all. The TSC is only trusted if CPUID
+ * says it is invariant; otherwise the HPET's main counter tells the time, and without one the PIT keeps running (and
+ * interrupting the BSP) to count it.
+ *
+ * Each core keeps its timeouts in a hierarchical timing wheel: level l has TIMER_WHEEL_SLOTS slots, each covering
+ * TIMER_WHEEL_SLOTS^l wheel ticks. A timeout sits in the level of the highest digit where its expiry tick differs from
+ * the wheel's clock, so arming and cancelling are O(1), and advancing the clock only visits occupied slots that were
+ * passed. A timeout moves down at most once per level before it fires.
+ */
+
+// Wheel ticks are 2^16 ns (about 65.5 us)
+#define TIMER_WHEEL_TICK_SHIFT 16
+#define TIMER_WHEEL_BITS       6
+#define TIMER_WHEEL_SLOTS      (1 << TIMER_WHEEL_BITS)
+// Covers 2^36 ticks (about 52 days); anything later waits on an overflow list until the top level wraps
+#define TIMER_WHEEL_LEVELS 6
+
+// Timeout ids are the timeout's index in the low bits and its generation above, so a stale id can't cancel whatever
+// reuses the timeout. Timeouts are allocated in chunks as needed, up to 2^TIMER_ID_INDEX_BITS at once.
+#define TIMER_ID_INDEX_BITS 20
+#define TIMER_CHUNK_SHIFT   8
+#define TIMER_CHUNK_LEN     (1 << TIMER_CHUNK_SHIFT)
+
+#define TIMER_NS_PER_MS 1000000ULL
+
+// How long the TSC is counted against the PIT to calibrate it
+#define TIMER_TSC_CALIBRATION_MS 100
 
 struct timer_timeout;
 typedef void (*timer_callback_func_t)(struct timer_timeout *timeout);
 
+typedef enum {
+    TIMER_TIMEOUT_FREE,
+    TIMER_TIMEOUT_PENDING, // On a core's wheel
+    TIMER_TIMEOUT_FIRING,  // Taken off the wheel; the callback hasn't finished yet
+} timer_timeout_state_t;
+
 struct timer_timeout {
-    _Atomic(uint64_t) milliseconds; // 0 = unused slot; UINT64_MAX = already triggered
-    uint64_t start_time;
     timer_callback_func_t callback; // If this is NULL, we treat this as a call to send an IPI wakeup to core_id instead
     union {
         void *data;
         uint64_t core_id;
     };
-} __attribute__((packed));
 
-extern struct timer_timeout timer_timeouts[TIMER_MAX_TIMEOUTS];
+    // Private to timer.c
+    uint64_t expires;             // Wheel tick at which it fires
+    struct timer_timeout *next;   // In a wheel slot, or the free list
+    struct timer_timeout **pprev; // Whatever points at this one in its wheel slot
+    uint32_t core;                // Core whose wheel holds it
+    uint32_t index;
+    uint32_t generation; // Bumped every time the timeout is handed out
+    uint8_t level;       // TIMER_WHEEL_LEVELS for the overflow list
+    uint8_t slot;
+    _Atomic(uint8_t) state; // timer_timeout_state_t
+};
+
+// Calibrates the TSC and the BSP's LAPIC timer against the PIT, then stops the PIT
+void timer_init();
+// Sets up this core's LAPIC timer; nothing is armed until there is a timeout or a time slice
+void timer_start_core();
+
+// Monotonic nanoseconds since timer_init(); 0 before that
+uint64_t timer_now_ns();
+
+// LAPIC timer IRQ: runs this core's expired timeouts and its scheduler tick, then programs the next deadline
+void timer_irq(registers_t *regs);
+
+// Arms (or, with 0, disarms) a time slice ending ns from now on this core; call with interrupts disabled
+void timer_set_slice(uint64_t ns);
 
+// These return a timeout id for cancel_timeout(), or a negative errno. The timeout fires on the calling core. They may
+// have to allocate, so they can't be used from IRQ handlers.
 int set_core_wakeup_timeout(uint64_t milliseconds, uint32_t core_id, uint64_t *started_at_out);
 
 // Max milliseconds is UINT64_MAX - 1
 int set_timeout(uint64_t milliseconds, timer_callback_func_t callback, void *data);
+int set_timeout_ns(uint64_t ns, timer_callback_func_t callback, void *data);
+// Returns -ENOENT if the timeout has already fired (its callback may still be running) or never existed
 int cancel_timeout(int timeout_id);
 
+// Halts the core until the time has passed; if the caller has interrupts disabled, it spins instead and leaves them off
 uint64_t ksleep_blocking_ms(uint64_t milliseconds, uint32_t *curr_core_if_known);
-// This doesn't require curr_core_if_known because it may not resume on the same core it started on.
-uint64_t ksleep_nonblocking_ms(uint64_t milliseconds, uint32_t priority);
\ No newline at end of file
+// Blocks only the calling kernel thread if it can sleep (see kthread_can_sleep()), and halts the core otherwise. This
+// doesn't require curr_core_if_known because it may not resume on the same core it started on.
+uint64_t ksleep_nonblocking_ms(uint64_t milliseconds, uint32_t priority);
@@ -1,6 +1,9 @@
 #include "fat12.h"
 
+#include "devices/storage/bcache.h"
+#include "lib/lock.h"
 #include "lib/stdio.h"
+#include "lib/string.h"
 #include "memory/kmalloc.h"
 #include "memory/mm.h"
 #include "plenjos/errno.h"
@@ -19,7 +22,8 @@ int fat12_drive_read(struct filesystem_fat12 *fs, uint32_t fat_lba, uint32_t fat
 
     if (fs->factor == 1) {
         // 1:1 mapping; direct read
-        return fs->drive->read_sectors(fs->drive, fs->partition_start_lba + fat_lba, fat_sectors, buffer);
+        ssize_t res = bcache_read(fs->drive, fs->partition_start_lba + fat_lba, fat_sectors, buffer);
+        return res < 0 ? (int)res : 0;
     }
 
     uint8_t *tmp_buffer = kmalloc_heap(fs->drive->logical_sector_size);
@@ -43,7 +47,7 @@ int fat12_drive_read(struct filesystem_fat12 *fs, uint32_t fat_lba, uint32_t fat
         }
 
         // Read one drive sector
-        int ret = fs->drive->read_sectors(fs->drive, drive_lba, 1, tmp_buffer);
+        ssize_t ret = bcache_read(fs->drive, drive_lba, 1, tmp_buffer);
         if (ret < 0) {
             kfree_heap(tmp_buffer);
             return -1;
@@ -62,6 +66,35 @@ int fat12_drive_read(struct filesystem_fat12 *fs, uint32_t fat_lba, uint32_t fat
     return 0;
 }
 
+// This function writes FAT sectors, translating from FAT sector size to drive sector size. Writes are staged in the
+// block cache; they reach the drive when the flusher runs or on fsync.
+int fat12_drive_write(struct filesystem_fat12 *fs, uint32_t fat_lba, uint32_t fat_sectors, const void *buffer) {
+    if (!fs || !buffer || fat_sectors == 0) {
+        return -1;
+    }
+
+    if (fs->factor == 1) {
+        ssize_t res = bcache_write(fs->drive, fs->partition_start_lba + fat_lba, fat_sectors, buffer);
+        return res < 0 ? (int)res : 0;
+    }
+
+    uint32_t fat_bytes_per_sector = fs->boot_sector.generic.bytes_per_sector;
+    const uint8_t *in_ptr         = (const uint8_t *)buffer;
+
+    for (uint32_t i = 0; i < fat_sectors; i++) {
+        uint32_t drive_lba = fs->partition_start_lba + (fat_lba + i) / fs->factor;
+        uint32_t offset    = (fat_lba + i) % fs->factor;
+
+        int ret = bcache_write_bytes(fs->drive, drive_lba, offset * fat_bytes_per_sector, fat_bytes_per_sector,
+                                     in_ptr + i * fat_bytes_per_sector);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
 // Reads a cluster's worth of data into buffer
 int fat12_read_entry(struct filesystem_fat12 *fs, uint16_t cluster, void *buffer) {
     if (!fs || cluster < 2) {
@@ -191,26 +224,388 @@ int fat12_parse_root(struct filesystem_fat12 *fs) {
     return 0;
 }
 
-// TODO: optimize this function to use instance_data->current_cluster
+static vfs_ops_block_t *fat12_directory_fsops = NULL;
+static vfs_ops_block_t *fat12_file_fsops      = NULL;
+
+// Partitions are probed in parallel, so two setups can race to initialize the fsops
+static mutex fat12_fsops_lock = MUTEX_INIT;
+
+static inline uint32_t fat12_bytes_per_cluster(struct filesystem_fat12 *fs) {
+    return fs->boot_sector.generic.bytes_per_sector * fs->boot_sector.generic.sectors_per_cluster;
+}
+
+// Writes a cluster's worth of data from buffer
+int fat12_write_entry(struct filesystem_fat12 *fs, uint16_t cluster, const void *buffer) {
+    if (!fs || cluster < 2) {
+        return -1;
+    }
+
+    uint32_t sector = fs->cluster_heap_start_lba + (cluster - 2) * fs->boot_sector.generic.sectors_per_cluster;
+    return fat12_drive_write(fs, sector, fs->boot_sector.generic.sectors_per_cluster, buffer);
+}
+
+// Updates the FAT entry for cluster in every copy of the FAT
+int fat12_set_cluster(struct filesystem_fat12 *fs, uint16_t cluster, uint16_t value) {
+    if (!fs || cluster < 2) {
+        return -EINVAL;
+    }
+
+    uint32_t bytes_per_sector = fs->boot_sector.generic.bytes_per_sector;
+    uint32_t fat_offset       = (cluster * 3) / 2;
+    uint32_t offset_in_sector = fat_offset % bytes_per_sector;
+    bool straddles            = offset_in_sector == bytes_per_sector - 1;
+    uint32_t sectors          = straddles ? 2 : 1;
+
+    uint8_t *sector_buf = kmalloc_heap(bytes_per_sector * 2);
+    if (!sector_buf) {
+        printf("OOM Error in fat12_set_cluster\n");
+        return -ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < fs->boot_sector.generic.num_fats; i++) {
+        uint32_t fat_sector = fs->fat_start_lba + i * fs->fat_sectors + (fat_offset / bytes_per_sector);
+
+        if (fat12_drive_read(fs, fat_sector, sectors, sector_buf) < 0) {
+            kfree_heap(sector_buf);
+            return -EIO;
+        }
+
+        uint16_t entry = sector_buf[offset_in_sector] | ((uint16_t)sector_buf[offset_in_sector + 1] << 8);
+        if (cluster & 0x0001) {
+            // Odd cluster
+            entry = (entry & 0x000F) | (uint16_t)(value << 4);
+        } else {
+            // Even cluster
+            entry = (entry & 0xF000) | (value & 0x0FFF);
+        }
+        sector_buf[offset_in_sector]     = (uint8_t)(entry & 0xFF);
+        sector_buf[offset_in_sector + 1] = (uint8_t)(entry >> 8);
+
+        if (fat12_drive_write(fs, fat_sector, sectors, sector_buf) < 0) {
+            kfree_heap(sector_buf);
+            return -EIO;
+        }
+    }
+
+    kfree_heap(sector_buf);
+    return 0;
+}
+
+// Allocates a zeroed cluster and marks it as the end of a chain. fs->lock must be held.
+int fat12_alloc_cluster(struct filesystem_fat12 *fs, uint16_t *out) {
+    if (!fs || !out) {
+        return -EINVAL;
+    }
+
+    uint32_t first = fs->next_free_cluster;
+    if (first < 2 || first >= fs->total_clusters + 2) {
+        first = 2;
+    }
+
+    uint32_t cluster = first;
+    do {
+        uint16_t value;
+        if (fat12_next_cluster(fs, (uint16_t)cluster, &value) < 0) {
+            return -EIO;
+        }
+
+        if (value == FAT12_CLUSTER_FREE) {
+            int res = fat12_set_cluster(fs, (uint16_t)cluster, FAT12_CLUSTER_EOC_WRITE);
+            if (res < 0) {
+                return res;
+            }
+
+            uint8_t *zero = kmalloc_heap(fat12_bytes_per_cluster(fs));
+            if (!zero) {
+                printf("OOM Error in fat12_alloc_cluster\n");
+                return -ENOMEM;
+            }
+            memset(zero, 0, fat12_bytes_per_cluster(fs));
+            res = fat12_write_entry(fs, (uint16_t)cluster, zero);
+            kfree_heap(zero);
+            if (res < 0) {
+                return -EIO;
+            }
+
+            fs->next_free_cluster = cluster + 1;
+            *out                  = (uint16_t)cluster;
+            return 0;
+        }
+
+        cluster++;
+        if (cluster >= fs->total_clusters + 2) {
+            cluster = 2;
+        }
+    } while (cluster != first);
+
+    return -ENOSPC;
+}
+
+// Finds the FAT sector and byte offset of the index-th 32-byte entry of a directory. A dir_cluster of 0 refers to the
+// fixed root directory region. Returns -ENOENT if index is past the end of the directory.
+static int fat12_dir_entry_location(struct filesystem_fat12 *fs, uint16_t dir_cluster, uint32_t index,
+                                    uint32_t *sector_out, uint32_t *offset_out) {
+    uint32_t bytes_per_sector = fs->boot_sector.generic.bytes_per_sector;
+    uint32_t byte             = index * sizeof(struct fat16_directory_entry);
+
+    if (dir_cluster == 0) {
+        if (index >= fs->boot_sector.generic.root_entry_count) {
+            return -ENOENT;
+        }
+        *sector_out = fs->root_dir_start_lba + byte / bytes_per_sector;
+        *offset_out = byte % bytes_per_sector;
+        return 0;
+    }
+
+    uint32_t bytes_per_cluster = fat12_bytes_per_cluster(fs);
+    uint32_t hops              = byte / bytes_per_cluster;
+    uint16_t cluster           = dir_cluster;
+
+    while (hops--) {
+        uint16_t next;
+        if (fat12_next_cluster(fs, cluster, &next) < 0) {
+            return -EIO;
+        }
+        if (next >= FAT12_CLUSTER_EOC || next < 2) {
+            return -ENOENT;
+        }
+        cluster = next;
+    }
+
+    uint32_t in_cluster = byte % bytes_per_cluster;
+    *sector_out         = fs->cluster_heap_start_lba + (cluster - 2) * fs->boot_sector.generic.sectors_per_cluster
+                + in_cluster / bytes_per_sector;
+    *offset_out = in_cluster % bytes_per_sector;
+    return 0;
+}
+
+static int fat12_read_dirent(struct filesystem_fat12 *fs, uint32_t sector, uint32_t offset,
+                             struct fat16_directory_entry *entry) {
+    uint8_t *buf = kmalloc_heap(fs->boot_sector.generic.bytes_per_sector);
+    if (!buf) {
+        printf("OOM Error in fat12_read_dirent\n");
+        return -ENOMEM;
+    }
+
+    if (fat12_drive_read(fs, sector, 1, buf) < 0) {
+        kfree_heap(buf);
+        return -EIO;
+    }
+
+    memcpy(entry, buf + offset, sizeof(*entry));
+    kfree_heap(buf);
+    return 0;
+}
+
+static int fat12_write_dirent(struct filesystem_fat12 *fs, uint32_t sector, uint32_t offset,
+                              const struct fat16_directory_entry *entry) {
+    uint8_t *buf = kmalloc_heap(fs->boot_sector.generic.bytes_per_sector);
+    if (!buf) {
+        printf("OOM Error in fat12_write_dirent\n");
+        return -ENOMEM;
+    }
+
+    if (fat12_drive_read(fs, sector, 1, buf) < 0) {
+        kfree_heap(buf);
+        return -EIO;
+    }
+
+    memcpy(buf + offset, entry, sizeof(*entry));
+    int res = fat12_drive_write(fs, sector, 1, buf);
+    kfree_heap(buf);
+    return res < 0 ? -EIO : 0;
+}
+
+// Converts an 8.3 directory entry name into "NAME.EXT"; out must hold at least 13 bytes
+static void fat12_entry_name(const struct fat16_directory_entry *entry, char *out) {
+    size_t n = 0;
+
+    for (int i = 0; i < 8 && entry->name[i] != ' '; i++) {
+        out[n++] = entry->name[i];
+    }
+    if ((uint8_t)out[0] == FAT_DIRENT_E5_NAME) {
+        out[0] = (char)FAT_DIRENT_FREE;
+    }
+
+    if (entry->name[8] != ' ') {
+        out[n++] = '.';
+        for (int i = 8; i < 11 && entry->name[i] != ' '; i++) {
+            out[n++] = entry->name[i];
+        }
+    }
+
+    out[n] = '\0';
+}
+
+static char fat12_upper(char c) {
+    return (c >= 'a' && c <= 'z') ? (char)(c - 'a' + 'A') : c;
+}
+
+static bool fat12_name_equal(const char *a, const char *b) {
+    while (*a && *b) {
+        if (fat12_upper(*a) != fat12_upper(*b)) {
+            return false;
+        }
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+// Builds the space-padded, upper-case 8.3 form of name. Long names aren't supported yet.
+static int fat12_make_short_name(const char *name, char out[11]) {
+    memset(out, ' ', 11);
+
+    if (name[0] == '\0' || name[0] == '.') {
+        return -EINVAL;
+    }
+
+    size_t i   = 0;
+    size_t len = 0;
+    while (name[i] != '\0' && name[i] != '.') {
+        if (len >= 8) {
+            return -ENAMETOOLONG;
+        }
+        out[len++] = fat12_upper(name[i++]);
+    }
+
+    if (name[i] == '.') {
+        i++;
+        len = 0;
+        while (name[i] != '\0') {
+            if (len >= 3 || name[i] == '.') {
+                return -ENAMETOOLONG;
+            }
+            out[8 + len++] = fat12_upper(name[i++]);
+        }
+    }
+
+    for (int j = 0; j < 11; j++) {
+        char c = out[j];
+        if ((uint8_t)c < 0x20 || c == '"' || c == '*' || c == '+' || c == ',' || c == '/' || c == ':' || c == ';'
+            || c == '<' || c == '=' || c == '>' || c == '?' || c == '[' || c == '\\' || c == ']' || c == '|') {
+            return -EINVAL;
+        }
+    }
+
+    if ((uint8_t)out[0] == FAT_DIRENT_FREE) {
+        out[0] = (char)FAT_DIRENT_E5_NAME;
+    }
+
+    return 0;
+}
+
+// Writes the node's start cluster and size back to its directory entry (through the block cache)
+static int fat12_update_dirent(struct filesystem_fat12 *fs, fscache_node_t *node) {
+    vfs_fat12_cache_node_data_t *node_data = (vfs_fat12_cache_node_data_t *)node->internal_data;
+
+    if (node_data->dirent_sector == 0) {
+        // Root directory; nothing to update
+        return 0;
+    }
+
+    struct fat16_directory_entry entry;
+    int res = fat12_read_dirent(fs, (uint32_t)node_data->dirent_sector, (uint32_t)node_data->dirent_offset, &entry);
+    if (res < 0) {
+        return res;
+    }
+
+    entry.first_cluster_low  = (uint16_t)node_data->start_cluster;
+    entry.first_cluster_high = 0;
+    if (!(entry.attr & FAT_ATTR_DIRECTORY)) {
+        entry.file_size = (uint32_t)node->size;
+    }
+
+    return fat12_write_dirent(fs, (uint32_t)node_data->dirent_sector, (uint32_t)node_data->dirent_offset, &entry);
+}
+
+// Finds the index-th cluster of a file, using (and updating) the handle's cached position. If allocate is set, the
+// chain is extended as needed; otherwise -ENOENT is returned past the end of the chain. fs->lock must be held when
+// allocate is set.
+static int fat12_file_cluster_at(struct filesystem_fat12 *fs, fscache_node_t *node,
+                                 vfs_fat12_handle_instance_data_t *instance_data, uint64_t index, bool allocate,
+                                 uint16_t *out) {
+    vfs_fat12_cache_node_data_t *node_data = (vfs_fat12_cache_node_data_t *)node->internal_data;
+
+    uint16_t cluster;
+    uint64_t i;
+
+    if (instance_data->current_cluster >= 2 && instance_data->current_cluster < FAT12_CLUSTER_EOC
+        && instance_data->cluster_index <= index) {
+        cluster = (uint16_t)instance_data->current_cluster;
+        i       = instance_data->cluster_index;
+    } else {
+        cluster = (uint16_t)node_data->start_cluster;
+        i       = 0;
+
+        if (cluster < 2) {
+            if (!allocate) {
+                return -ENOENT;
+            }
+
+            int res = fat12_alloc_cluster(fs, &cluster);
+            if (res < 0) {
+                return res;
+            }
+            node_data->start_cluster = cluster;
+        }
+    }
+
+    while (i < index) {
+        uint16_t next;
+        if (fat12_next_cluster(fs, cluster, &next) < 0) {
+            return -EIO;
+        }
+
+        if (next >= FAT12_CLUSTER_EOC || next < 2) {
+            if (!allocate) {
+                return -ENOENT;
+            }
+
+            int res = fat12_alloc_cluster(fs, &next);
+            if (res < 0) {
+                return res;
+            }
+            res = fat12_set_cluster(fs, cluster, next);
+            if (res < 0) {
+                return res;
+            }
+        }
+
+        cluster = next;
+        i++;
+    }
+
+    instance_data->current_cluster = cluster;
+    instance_data->cluster_index   = index;
+
+    *out = cluster;
+    return 0;
+}
+
 ssize_t fat12_file_read_func(vfs_handle_t *handle, void *buf, size_t len) {
     vfs_fat12_handle_instance_data_t *instance_data = (vfs_fat12_handle_instance_data_t *)handle->instance_data;
 
-    if (!instance_data || !buf || len == 0 || !handle->backing_node || !handle->backing_node->internal_data) {
+    if (!instance_data || !buf || !handle->backing_node) {
         return -EIO;
     }
 
-    vfs_fat12_cache_node_data_t *node_data = (vfs_fat12_cache_node_data_t *)handle->backing_node->internal_data;
+    fscache_node_t *node                   = handle->backing_node;
+    vfs_fat12_cache_node_data_t *node_data = (vfs_fat12_cache_node_data_t *)node->internal_data;
 
     struct filesystem_fat12 *fs = node_data->fs;
     if (!fs) {
         return -EIO;
     }
 
-    if (node_data->start_cluster < 2) {
-        return -EIO;
+    if (instance_data->seek_pos >= (uint64_t)node->size || len == 0) {
+        return 0;
+    }
+    if (len > (uint64_t)node->size - instance_data->seek_pos) {
+        len = (uint64_t)node->size - instance_data->seek_pos;
     }
 
-    uint32_t bytes_per_cluster = fs->boot_sector.generic.bytes_per_sector * fs->boot_sector.generic.sectors_per_cluster;
+    uint32_t bytes_per_cluster = fat12_bytes_per_cluster(fs);
 
     uint8_t *cluster_buf = kmalloc_heap(bytes_per_cluster);
     if (!cluster_buf) {
@@ -218,95 +613,555 @@ ssize_t fat12_file_read_func(vfs_handle_t *handle, void *buf, size_t len) {
     }
 
     uint8_t *out_ptr = (uint8_t *)buf;
-    size_t remaining = len;
-
-    uint16_t cluster         = (uint16_t)instance_data->current_cluster;
-    uint32_t cluster_index   = (uint32_t)instance_data->cluster_index;
-    size_t offset_in_cluster = instance_data->cluster_pos;
+    size_t done      = 0;
+    int err          = 0;
+
+    while (done < len) {
+        uint16_t cluster;
+        err = fat12_file_cluster_at(fs, node, instance_data, instance_data->seek_pos / bytes_per_cluster, false,
+                                    &cluster);
+        if (err < 0) {
+            break;
+        }
 
-    while (remaining > 0 && cluster < FAT12_CLUSTER_EOC) {
-        // Read current cluster if needed
         if (fat12_read_entry(fs, cluster, cluster_buf) < 0) {
-            kfree_heap(cluster_buf);
-            return -EIO;
+            err = -EIO;
+            break;
         }
 
-        size_t to_copy = bytes_per_cluster - offset_in_cluster;
-        if (to_copy > remaining) {
-            to_copy = remaining;
+        size_t offset_in_cluster = instance_data->seek_pos % bytes_per_cluster;
+        size_t to_copy           = bytes_per_cluster - offset_in_cluster;
+        if (to_copy > len - done) {
+            to_copy = len - done;
         }
 
-        memcpy(out_ptr, cluster_buf + offset_in_cluster, to_copy);
+        memcpy(out_ptr + done, cluster_buf + offset_in_cluster, to_copy);
+
+        done                       += to_copy;
+        instance_data->seek_pos    += to_copy;
+        instance_data->cluster_pos  = instance_data->seek_pos % bytes_per_cluster;
+    }
+
+    kfree_heap(cluster_buf);
+
+    if (done == 0 && err < 0) {
+        return err == -ENOENT ? -EIO : err;
+    }
+
+    return (ssize_t)done;
+}
 
-        if (to_copy < bytes_per_cluster - offset_in_cluster) {
-            // Stopped mid-cluster
-            offset_in_cluster += to_copy;
+ssize_t fat12_dir_read_func(vfs_handle_t *handle, void *buf, size_t len) {
+    vfs_fat12_handle_instance_data_t *instance_data = (vfs_fat12_handle_instance_data_t *)handle->instance_data;
+
+    if (!buf || !handle->backing_node) {
+        return -EIO;
+    }
+
+    vfs_fat12_cache_node_data_t *node_data = (vfs_fat12_cache_node_data_t *)handle->backing_node->internal_data;
+    struct filesystem_fat12 *fs            = node_data->fs;
+    if (!fs) {
+        return -EIO;
+    }
+
+    size_t total_bytes_read = 0;
+
+    while (len >= sizeof(struct plenjos_dirent)) {
+        uint32_t sector, offset;
+        int res = fat12_dir_entry_location(fs, (uint16_t)node_data->start_cluster, (uint32_t)instance_data->seek_pos,
+                                           &sector, &offset);
+        if (res == -ENOENT) {
             break;
-        } else {
-            // Move to next cluster
-            offset_in_cluster = 0;
+        } else if (res < 0) {
+            return total_bytes_read ? (ssize_t)total_bytes_read : res;
         }
 
-        remaining              -= to_copy;
-        out_ptr                += to_copy;
+        struct fat16_directory_entry entry;
+        res = fat12_read_dirent(fs, sector, offset, &entry);
+        if (res < 0) {
+            return total_bytes_read ? (ssize_t)total_bytes_read : res;
+        }
 
-        // Move to next cluster if needed
-        if (remaining > 0) {
-            uint16_t next_cluster;
-            if (fat12_next_cluster(fs, cluster, &next_cluster) < 0) {
-                break;
-            }
-            if (next_cluster >= FAT12_CLUSTER_EOC) {
-                cluster = FAT12_CLUSTER_EOC;
-                cluster_index++;
-                break;
-            }
-            cluster = next_cluster;
-            cluster_index++;
+        if (entry.name[0] == 0x00) {
+            // No more entries
+            break;
+        }
+
+        instance_data->seek_pos++;
+
+        if ((uint8_t)entry.name[0] == FAT_DIRENT_FREE || entry.attr == FAT_ATTR_LONG_NAME
+            || (entry.attr & FAT_ATTR_VOLUME_ID) || entry.name[0] == '.') {
+            continue;
+        }
+
+        struct plenjos_dirent *dent = (struct plenjos_dirent *)((uint8_t *)buf + total_bytes_read);
+        memset(dent, 0, sizeof(struct plenjos_dirent));
+        fat12_entry_name(&entry, dent->d_name);
+        dent->type = (entry.attr & FAT_ATTR_DIRECTORY) ? DT_DIR : DT_REG;
+
+        total_bytes_read += sizeof(struct plenjos_dirent);
+        len              -= sizeof(struct plenjos_dirent);
+    }
+
+    return (ssize_t)total_bytes_read;
+}
+
+ssize_t fat12_file_write_func(vfs_handle_t *handle, const void *buf, size_t len) {
+    vfs_fat12_handle_instance_data_t *instance_data = (vfs_fat12_handle_instance_data_t *)handle->instance_data;
+
+    if (!buf || !handle->backing_node) {
+        return -EIO;
+    }
+
+    fscache_node_t *node                   = handle->backing_node;
+    vfs_fat12_cache_node_data_t *node_data = (vfs_fat12_cache_node_data_t *)node->internal_data;
+
+    struct filesystem_fat12 *fs = node_data->fs;
+    if (!fs) {
+        return -EIO;
+    }
+
+    if (len == 0) {
+        return 0;
+    }
+
+    // FAT stores sizes as 32 bits
+    if (instance_data->seek_pos + len > UINT32_MAX) {
+        return -EFBIG;
+    }
+
+    uint32_t bytes_per_cluster = fat12_bytes_per_cluster(fs);
+
+    uint8_t *cluster_buf = kmalloc_heap(bytes_per_cluster);
+    if (!cluster_buf) {
+        return -ENOMEM;
+    }
+
+    const uint8_t *in_ptr = (const uint8_t *)buf;
+    size_t done           = 0;
+    int err               = 0;
+
+    mutex_lock(&fs->lock);
+
+    while (done < len) {
+        uint16_t cluster;
+        err = fat12_file_cluster_at(fs, node, instance_data, instance_data->seek_pos / bytes_per_cluster, true,
+                                    &cluster);
+        if (err < 0) {
+            break;
+        }
+
+        size_t offset_in_cluster = instance_data->seek_pos % bytes_per_cluster;
+        size_t to_copy           = bytes_per_cluster - offset_in_cluster;
+        if (to_copy > len - done) {
+            to_copy = len - done;
+        }
+
+        // Only partial clusters need the old contents
+        if (to_copy != bytes_per_cluster && fat12_read_entry(fs, cluster, cluster_buf) < 0) {
+            err = -EIO;
+            break;
         }
+
+        memcpy(cluster_buf + offset_in_cluster, in_ptr + done, to_copy);
+
+        if (fat12_write_entry(fs, cluster, cluster_buf) < 0) {
+            err = -EIO;
+            break;
+        }
+
+        done                       += to_copy;
+        instance_data->seek_pos    += to_copy;
+        instance_data->cluster_pos  = instance_data->seek_pos % bytes_per_cluster;
     }
 
+    if (done > 0 || err == 0) {
+        if (instance_data->seek_pos > (uint64_t)node->size) {
+            node->size = (off_t)instance_data->seek_pos;
+        }
+
+        // The directory entry is staged now; the node stays dirty until it is fsync'd
+        node->flags |= FSCACHE_FLAG_DIRTY;
+        int res      = fat12_update_dirent(fs, node);
+        if (res < 0 && err == 0) {
+            err = res;
+        }
+    }
+
+    mutex_unlock(&fs->lock);
+
     kfree_heap(cluster_buf);
 
-    size_t bytes_read = len - remaining;
-    instance_data->current_cluster = cluster;
-    instance_data->cluster_pos     = offset_in_cluster + bytes_read % bytes_per_cluster;
-    instance_data->cluster_index   = cluster_index;
-    instance_data->seek_pos       += bytes_read;
+    if (done == 0 && err < 0) {
+        return err;
+    }
 
-    // To be implemented
-    return -EIO;
+    return (ssize_t)done;
 }
 
-ssize_t fat12_dir_read_func(vfs_handle_t *handle, void *buf, size_t len) {
-    // To be implemented
-    return -EIO;
+off_t fat12_file_seek_func(vfs_handle_t *handle, off_t offset, vfs_seek_whence_t whence) {
+    vfs_fat12_handle_instance_data_t *instance_data = (vfs_fat12_handle_instance_data_t *)handle->instance_data;
+
+    if (!handle->backing_node) {
+        return -EIO;
+    }
+
+    off_t base;
+    switch (whence) {
+    case VFS_SEEK_SET:
+        base = 0;
+        break;
+    case VFS_SEEK_CUR:
+        base = (off_t)instance_data->seek_pos;
+        break;
+    case VFS_SEEK_END:
+        base = handle->backing_node->size;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    off_t new_pos = base + offset;
+    if (new_pos < 0 || (uint64_t)new_pos > UINT32_MAX) {
+        return -EINVAL;
+    }
+
+    vfs_fat12_cache_node_data_t *node_data = (vfs_fat12_cache_node_data_t *)handle->backing_node->internal_data;
+    uint64_t index                         = (uint64_t)new_pos / fat12_bytes_per_cluster(node_data->fs);
+
+    // The cached cluster can only be reused when seeking forward
+    if (index < instance_data->cluster_index) {
+        instance_data->current_cluster = 0;
+        instance_data->cluster_index   = 0;
+    }
+
+    instance_data->seek_pos    = (uint64_t)new_pos;
+    instance_data->cluster_pos = (uint64_t)new_pos % fat12_bytes_per_cluster(node_data->fs);
+
+    return new_pos;
 }
 
-ssize_t fat12_file_write_func(vfs_handle_t *handle, const void *buf, size_t len) {
-    // To be implemented
-    return -EIO;
+off_t fat12_dir_seek_func(vfs_handle_t *handle, off_t offset, vfs_seek_whence_t whence) {
+    vfs_fat12_handle_instance_data_t *instance_data = (vfs_fat12_handle_instance_data_t *)handle->instance_data;
+
+    // Directory positions aren't byte offsets; only rewinding is supported
+    if (whence != VFS_SEEK_SET || offset != 0) {
+        return -EINVAL;
+    }
+
+    instance_data->seek_pos = 0;
+    return 0;
 }
 
-off_t fat12_file_seek_func(vfs_handle_t *handle, off_t offset, int whence) {
-    // To be implemented
-    return -EIO;
+// Writes back whatever the block cache holds of the given FAT sectors
+static int fat12_flush_sectors(struct filesystem_fat12 *fs, uint32_t fat_lba, uint32_t fat_sectors) {
+    uint64_t first = fs->partition_start_lba + fat_lba / fs->factor;
+    uint64_t last  = fs->partition_start_lba + (fat_lba + fat_sectors - 1) / fs->factor;
+    return bcache_flush_range(fs->drive, first, last - first + 1);
 }
 
-off_t fat12_dir_seek_func(vfs_handle_t *handle, off_t offset, int whence) {
-    // To be implemented
-    return -EIO;
+// Writes back the node's cluster chain, one flush per run of contiguous clusters
+static int fat12_flush_chain(struct filesystem_fat12 *fs, uint16_t cluster) {
+    uint32_t sectors_per_cluster = fs->boot_sector.generic.sectors_per_cluster;
+    uint16_t run_start           = cluster;
+    uint32_t run_len             = 0;
+
+    // Bounded by the cluster count in case the chain loops
+    for (uint32_t i = 0; i <= fs->total_clusters && cluster >= 2 && cluster < FAT12_CLUSTER_BAD; i++) {
+        uint16_t next;
+        if (fat12_next_cluster(fs, cluster, &next) < 0) {
+            return -EIO;
+        }
+
+        run_len++;
+        if (next != cluster + 1) {
+            int res = fat12_flush_sectors(fs, fs->cluster_heap_start_lba + (run_start - 2) * sectors_per_cluster,
+                                          run_len * sectors_per_cluster);
+            if (res < 0) {
+                return res;
+            }
+            run_start = next;
+            run_len   = 0;
+        }
+
+        cluster = next;
+    }
+
+    return 0;
 }
 
-int fat12_create_child_func(fscache_node_t *parent, const char *name, dirent_type_t type, uid_t uid, gid_t gid,
-                            mode_t mode, fscache_node_t *node) {
-    // To be implemented
-    return -EIO;
+// Writes back only what belongs to the node: its data (or, for the root, the root directory region), the FATs that
+// hold its chain, and the sector with its directory entry. Data goes first, so the entry never points at clusters the
+// drive hasn't seen yet.
+int fat12_fsync_func(vfs_handle_t *handle) {
+    if (!handle->backing_node) {
+        return -EIO;
+    }
+
+    fscache_node_t *node                   = handle->backing_node;
+    vfs_fat12_cache_node_data_t *node_data = (vfs_fat12_cache_node_data_t *)node->internal_data;
+    struct filesystem_fat12 *fs            = node_data->fs;
+    if (!fs) {
+        return -EIO;
+    }
+
+    mutex_lock(&fs->lock);
+
+    int res = 0;
+    if (node->flags & FSCACHE_FLAG_DIRTY) {
+        res = fat12_update_dirent(fs, node);
+    }
+
+    if (res == 0) {
+        if (node_data->dirent_sector == 0) {
+            res = fat12_flush_sectors(fs, fs->root_dir_start_lba, fs->root_dir_sectors);
+        } else {
+            res = fat12_flush_chain(fs, (uint16_t)node_data->start_cluster);
+        }
+    }
+    if (res == 0) {
+        res = fat12_flush_sectors(fs, fs->fat_start_lba, fs->boot_sector.generic.num_fats * fs->fat_sectors);
+    }
+    if (res == 0 && node_data->dirent_sector != 0) {
+        res = fat12_flush_sectors(fs, (uint32_t)node_data->dirent_sector, 1);
+    }
+
+    if (res == 0) {
+        node->flags &= ~FSCACHE_FLAG_DIRTY;
+    }
+
+    mutex_unlock(&fs->lock);
+
+    return res;
 }
 
 int fat12_load_node_func(fscache_node_t *node, const char *name, fscache_node_t *out) {
-    // To be implemented
-    return -EIO;
+    if (!node || !name || !out) {
+        return -EINVAL;
+    }
+
+    if (node->type != DT_DIR) {
+        return -ENOTDIR;
+    }
+
+    vfs_fat12_cache_node_data_t *parent_data = (vfs_fat12_cache_node_data_t *)node->internal_data;
+    struct filesystem_fat12 *fs              = parent_data->fs;
+    if (!fs) {
+        return -EIO;
+    }
+
+    char entry_name[13];
+
+    for (uint32_t i = 0;; i++) {
+        uint32_t sector, offset;
+        int res = fat12_dir_entry_location(fs, (uint16_t)parent_data->start_cluster, i, &sector, &offset);
+        if (res < 0) {
+            return res;
+        }
+
+        struct fat16_directory_entry entry;
+        res = fat12_read_dirent(fs, sector, offset, &entry);
+        if (res < 0) {
+            return res;
+        }
+
+        if (entry.name[0] == 0x00) {
+            return -ENOENT;
+        }
+        if ((uint8_t)entry.name[0] == FAT_DIRENT_FREE || entry.attr == FAT_ATTR_LONG_NAME
+            || (entry.attr & FAT_ATTR_VOLUME_ID)) {
+            continue;
+        }
+
+        fat12_entry_name(&entry, entry_name);
+        if (!fat12_name_equal(entry_name, name)) {
+            continue;
+        }
+
+        vfs_fat12_cache_node_data_t *child_data = (vfs_fat12_cache_node_data_t *)out->internal_data;
+
+        child_data->fs            = fs;
+        child_data->start_cluster = entry.first_cluster_low;
+        child_data->dirent_sector = sector;
+        child_data->dirent_offset = offset;
+
+        bool is_dir = (entry.attr & FAT_ATTR_DIRECTORY) != 0;
+        fscache_node_populate(out, is_dir ? DT_DIR : DT_REG, 0, name, 0, 0, 0755, is_dir ? 0 : entry.file_size,
+                              is_dir ? fat12_directory_fsops : fat12_file_fsops);
+
+        return 0;
+    }
+}
+
+// Links a new, zeroed cluster onto the end of a (non-root) directory. fs->lock must be held.
+static int fat12_dir_extend(struct filesystem_fat12 *fs, uint16_t dir_cluster) {
+    uint16_t cluster = dir_cluster;
+
+    for (;;) {
+        uint16_t next;
+        if (fat12_next_cluster(fs, cluster, &next) < 0) {
+            return -EIO;
+        }
+        if (next >= FAT12_CLUSTER_EOC || next < 2) {
+            break;
+        }
+        cluster = next;
+    }
+
+    uint16_t new_cluster;
+    int res = fat12_alloc_cluster(fs, &new_cluster);
+    if (res < 0) {
+        return res;
+    }
+
+    return fat12_set_cluster(fs, cluster, new_cluster);
+}
+
+int fat12_create_child_func(fscache_node_t *parent, const char *name, dirent_type_t type, uid_t uid, gid_t gid,
+                            mode_t mode, fscache_node_t *node) {
+    (void)uid;
+    (void)gid;
+    (void)mode;
+
+    if (!parent || !name) {
+        return -EINVAL;
+    }
+
+    if (parent->type != DT_DIR) {
+        return -ENOTDIR;
+    }
+
+    if (type != DT_REG && type != DT_DIR) {
+        // FAT has no way to represent anything else
+        return -EINVAL;
+    }
+
+    vfs_fat12_cache_node_data_t *parent_data = (vfs_fat12_cache_node_data_t *)parent->internal_data;
+    struct filesystem_fat12 *fs              = parent_data->fs;
+    if (!fs) {
+        return -EIO;
+    }
+
+    struct fat16_directory_entry new_entry;
+    memset(&new_entry, 0, sizeof(new_entry));
+
+    int res = fat12_make_short_name(name, new_entry.name);
+    if (res < 0) {
+        return res;
+    }
+
+    uint16_t dir_cluster = (uint16_t)parent_data->start_cluster;
+
+    mutex_lock(&fs->lock);
+
+    // Find a free slot, making sure the name isn't already taken
+    uint32_t free_index = UINT32_MAX;
+    uint32_t i          = 0;
+    for (;; i++) {
+        uint32_t sector, offset;
+        res = fat12_dir_entry_location(fs, dir_cluster, i, &sector, &offset);
+        if (res == -ENOENT) {
+            break;
+        } else if (res < 0) {
+            goto unlock;
+        }
+
+        struct fat16_directory_entry entry;
+        res = fat12_read_dirent(fs, sector, offset, &entry);
+        if (res < 0) {
+            goto unlock;
+        }
+
+        if (entry.name[0] == 0x00) {
+            if (free_index == UINT32_MAX) {
+                free_index = i;
+            }
+            break;
+        }
+        if ((uint8_t)entry.name[0] == FAT_DIRENT_FREE) {
+            if (free_index == UINT32_MAX) {
+                free_index = i;
+            }
+            continue;
+        }
+        if (entry.attr != FAT_ATTR_LONG_NAME && memcmp(entry.name, new_entry.name, 11) == 0) {
+            res = -EEXIST;
+            goto unlock;
+        }
+    }
+
+    if (free_index == UINT32_MAX) {
+        if (dir_cluster == 0) {
+            // The root directory has a fixed size
+            res = -ENOSPC;
+            goto unlock;
+        }
+
+        res = fat12_dir_extend(fs, dir_cluster);
+        if (res < 0) {
+            goto unlock;
+        }
+        free_index = i;
+    }
+
+    uint32_t sector, offset;
+    res = fat12_dir_entry_location(fs, dir_cluster, free_index, &sector, &offset);
+    if (res < 0) {
+        goto unlock;
+    }
+
+    if (type == DT_DIR) {
+        uint16_t cluster;
+        res = fat12_alloc_cluster(fs, &cluster);
+        if (res < 0) {
+            goto unlock;
+        }
+
+        new_entry.attr              = FAT_ATTR_DIRECTORY;
+        new_entry.first_cluster_low = cluster;
+
+        // Every directory except the root starts with "." and ".."
+        uint8_t *cluster_buf = kmalloc_heap(fat12_bytes_per_cluster(fs));
+        if (!cluster_buf) {
+            res = -ENOMEM;
+            goto unlock;
+        }
+        memset(cluster_buf, 0, fat12_bytes_per_cluster(fs));
+
+        struct fat16_directory_entry *dot = (struct fat16_directory_entry *)cluster_buf;
+        memset(dot[0].name, ' ', 11);
+        dot[0].name[0]           = '.';
+        dot[0].attr              = FAT_ATTR_DIRECTORY;
+        dot[0].first_cluster_low = cluster;
+        memset(dot[1].name, ' ', 11);
+        dot[1].name[0]           = '.';
+        dot[1].name[1]           = '.';
+        dot[1].attr              = FAT_ATTR_DIRECTORY;
+        dot[1].first_cluster_low = dir_cluster;
+
+        res = fat12_write_entry(fs, cluster, cluster_buf);
+        kfree_heap(cluster_buf);
+        if (res < 0) {
+            res = -EIO;
+            goto unlock;
+        }
+    } else {
+        new_entry.attr = FAT_ATTR_ARCHIVE;
+    }
+
+    res = fat12_write_dirent(fs, sector, offset, &new_entry);
+    if (res == 0) {
+        parent->flags |= FSCACHE_FLAG_DIRTY;
+    }
+
+unlock:
+    mutex_unlock(&fs->lock);
+
+    if (res < 0 || !node) {
+        return res;
+    }
+
+    return fat12_load_node_func(parent, name, node);
 }
 
 bool fat12_vfs_mount_func(const char *device, fscache_node_t *mount_point) {
@@ -330,11 +1185,47 @@ int fat12_get_vfs_filesystem(struct filesystem_fat12 *fs, vfs_filesystem_t *out_
     return 0;
 }
 
+extern fscache_node_t *fscache_root_node;
 int fat12_setup(struct filesystem_fat12 *fs, DRIVE_t *drive, uint32_t partition_start_lba) {
     if (!fs || !drive) {
         return -1;
     }
 
+    mutex_lock(&fat12_fsops_lock);
+    if (!fat12_directory_fsops) {
+        vfs_ops_block_t *dir_fsops = kmalloc_heap(sizeof(vfs_ops_block_t));
+        if (!dir_fsops) {
+            printf("OOM Error: fat12_setup: could not allocate memory for directory fsops\n");
+            mutex_unlock(&fat12_fsops_lock);
+            return -ENOMEM;
+        }
+        memset(dir_fsops, 0, sizeof(vfs_ops_block_t));
+        dir_fsops->fsname       = "fat12";
+        dir_fsops->read         = fat12_dir_read_func;
+        dir_fsops->seek         = fat12_dir_seek_func;
+        dir_fsops->fsync        = fat12_fsync_func;
+        dir_fsops->create_child = fat12_create_child_func;
+        dir_fsops->load_node    = fat12_load_node_func;
+        fat12_directory_fsops   = dir_fsops;
+    }
+    if (!fat12_file_fsops) {
+        vfs_ops_block_t *file_fsops = kmalloc_heap(sizeof(vfs_ops_block_t));
+        if (!file_fsops) {
+            printf("OOM Error: fat12_setup: could not allocate memory for file fsops\n");
+            mutex_unlock(&fat12_fsops_lock);
+            return -ENOMEM;
+        }
+        memset(file_fsops, 0, sizeof(vfs_ops_block_t));
+        file_fsops->fsname    = "fat12";
+        file_fsops->read      = fat12_file_read_func;
+        file_fsops->write     = fat12_file_write_func;
+        file_fsops->seek      = fat12_file_seek_func;
+        file_fsops->fsync     = fat12_fsync_func;
+        file_fsops->load_node = fat12_load_node_func;
+        fat12_file_fsops      = file_fsops;
+    }
+    mutex_unlock(&fat12_fsops_lock);
+
     fs->drive = drive;
 
     if (!(fs->read_status & 0x01)) {
@@ -404,7 +1295,50 @@ int fat12_setup(struct filesystem_fat12 *fs, DRIVE_t *drive, uint32_t partition_
         return -1;
     }
 
+    fs->next_free_cluster = 2;
+    fs->lock              = MUTEX_INIT;
+
     fat12_parse_root(fs);
 
+    fscache_node_t *node = fscache_allocate_node();
+    if (!node) {
+        printf("OOM Error: fat12_setup: could not allocate memory for root cache node\n");
+        return -ENOMEM;
+    }
+
+    node->type  = DT_DIR;
+    node->fsops = fat12_directory_fsops;
+    node->mode  = 0755; // FAT has no ownership or permissions
+    node->uid   = 0;
+    node->gid   = 0;
+    strncpy(node->name, "fat12", NAME_MAX);
+    node->name[NAME_MAX]                   = '\0';
+    vfs_fat12_cache_node_data_t *node_data = (vfs_fat12_cache_node_data_t *)node->internal_data;
+    node_data->fs                          = fs;
+    node_data->start_cluster               = 0;
+    node_data->dirent_sector               = 0;
+    node_data->dirent_offset               = 0;
+
+    // TODO: mount function
+    _fscache_wait_for_node_modifiable(fscache_root_node);
+
+    fscache_node_t *child = fscache_root_node->first_child;
+    node->next_sibling    = NULL;
+    node->parent_node     = fscache_root_node;
+
+    if (child == NULL) {
+        node->prev_sibling             = NULL;
+        fscache_root_node->first_child = node;
+    } else {
+        while (child->next_sibling != NULL) {
+            child = child->next_sibling;
+        }
+        child->next_sibling = node;
+        node->prev_sibling  = child;
+    }
+
+    _fscache_release_node_modifiable(fscache_root_node);
+    _fscache_release_node_readable(node);
+
     return 0;
 }
\ No newline at end of file
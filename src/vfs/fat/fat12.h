@@ -1,6 +1,7 @@
 #pragma once
 
 #include "devices/storage/drive.h"
+#include "lib/lock.h"
 #include "vfs/fat/fat.h"
 #include "vfs/fat/fat16.h"
 #include "vfs/vfs.h"
@@ -8,12 +9,18 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#define FAT12_CLUSTER_FREE 0x000
-#define FAT12_CLUSTER_EOC  0xFF8
-#define FAT12_CLUSTER_BAD  0xFF7
+#define FAT12_CLUSTER_FREE      0x000
+#define FAT12_CLUSTER_EOC       0xFF8 // Anything >= this marks the end of a chain
+#define FAT12_CLUSTER_EOC_WRITE 0xFFF // Value written when terminating a chain
+#define FAT12_CLUSTER_BAD       0xFF7
 
+#define FAT_ATTR_VOLUME_ID 0x08
 #define FAT_ATTR_LONG_NAME 0x0F
 #define FAT_ATTR_DIRECTORY 0x10
+#define FAT_ATTR_ARCHIVE   0x20
+
+#define FAT_DIRENT_FREE    0xE5
+#define FAT_DIRENT_E5_NAME 0x05 // A first byte of 0x05 stands for a literal 0xE5
 
 // Uses same boot sector structure as FAT16
 // All fields are in FAT sectors; translation is handled by fat12_drive_read()
@@ -38,12 +45,18 @@ struct filesystem_fat12 {
 
     uint32_t total_sectors;  // Total sectors in the FAT12 filesystem
     uint32_t total_clusters; // Total clusters in the FAT12 filesystem
+
+    uint32_t next_free_cluster; // Hint for cluster allocation
+
+    // Serializes allocation and directory modification; data reads don't take this
+    mutex lock;
 };
 
 typedef struct vfs_fat12_cache_node_data {
     struct filesystem_fat12 *fs;
-    uint64_t start_cluster;
-    uint64_t unused[2];
+    uint64_t start_cluster; // 0 for the root directory and for empty files
+    uint64_t dirent_sector; // FAT sector (relative to partition start) holding this node's directory entry; 0 for root
+    uint64_t dirent_offset; // Byte offset of the directory entry within dirent_sector
 } __attribute__((packed)) vfs_fat12_cache_node_data_t;
 
 typedef struct vfs_fat12_handle_instance_data {
@@ -52,7 +65,7 @@ typedef struct vfs_fat12_handle_instance_data {
     uint64_t current_cluster; // 16 bits; Current cluster being read
     uint64_t cluster_pos;     // 64 (32?) bits; Offset within current cluster
     uint64_t cluster_index;   // 32 bits; Index of current_cluster within the file
-    uint64_t seek_pos;
+    uint64_t seek_pos;        // Byte offset for files; entry index for directories
 } __attribute__((packed)) vfs_fat12_handle_instance_data_t;
 
 typedef struct vfs_filesystem_fat12_instance_data {
@@ -60,5 +73,8 @@ typedef struct vfs_filesystem_fat12_instance_data {
     uint64_t unused[3];
 } __attribute__((packed)) vfs_filesystem_fat12_t_instance_data;
 
+int fat12_drive_read(struct filesystem_fat12 *fs, uint32_t fat_lba, uint32_t fat_sectors, void *buffer);
+int fat12_drive_write(struct filesystem_fat12 *fs, uint32_t fat_lba, uint32_t fat_sectors, const void *buffer);
+
 int fat12_get_vfs_filesystem(struct filesystem_fat12 *fs, vfs_filesystem_t *out_fs);
 int fat12_setup(struct filesystem_fat12 *fs, DRIVE_t *drive, uint32_t partition_start_lba);
\ No newline at end of file
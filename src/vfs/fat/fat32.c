@@ -1,5 +1,6 @@
 #include "fat32.h"
 
+#include "devices/storage/blkq.h"
 #include "lib/stdio.h"
 #include "memory/kmalloc.h"
 
@@ -17,7 +18,7 @@ int fat32_setup(struct filesystem_fat32 *fs, DRIVE_t *drive, uint32_t partition_
             return -1;
         }
 
-        ssize_t r = drive->read_sectors(drive, partition_start_lba, 1, bs_buf);
+        ssize_t r = blkq_read(drive, partition_start_lba, 1, bs_buf);
         if (r < 0) {
             printf("FAT32: Failed to read boot sector (LBA %u)\n", partition_start_lba);
             kfree_heap(bs_buf);
@@ -67,7 +68,7 @@ int fat32_setup(struct filesystem_fat32 *fs, DRIVE_t *drive, uint32_t partition_
                 printf("Error: Could not allocate memory for FAT32 FSInfo sector read buffer\n");
                 return -1;
             }
-            ssize_t res = drive->read_sectors(drive, (uint64_t)partition_start_lba + (uint64_t)fs->boot_sector.fs_info,
+            ssize_t res = blkq_read(drive, (uint64_t)partition_start_lba + (uint64_t)fs->boot_sector.fs_info,
                                               1, buffer);
             if (res < 0) {
                 printf("Error: Could not read FAT32 FSInfo sector\n");
@@ -123,7 +124,7 @@ int fat32_drive_read(struct filesystem_fat32 *fs, uint32_t fat_lba, uint32_t fat
 
     if (fs->factor == 1) {
         // 1:1 mapping; direct read
-        return fs->drive->read_sectors(fs->drive, fat_lba, fat_sectors, buffer);
+        return blkq_read(fs->drive, fat_lba, fat_sectors, buffer);
     }
 
     uint8_t *tmp_buffer = kmalloc_heap(fs->drive->logical_sector_size);
@@ -154,7 +155,7 @@ int fat32_drive_read(struct filesystem_fat32 *fs, uint32_t fat_lba, uint32_t fat
                                           : (bytes_to_read - bytes_read);
 
         // Read one drive sector
-        int ret = fs->drive->read_sectors(fs->drive, drive_lba, 1, tmp_buffer);
+        int ret = blkq_read(fs->drive, drive_lba, 1, tmp_buffer);
         if (ret < 0) {
             kfree_heap(tmp_buffer);
             return -1;
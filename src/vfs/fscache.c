@@ -1,5 +1,6 @@
 #include "vfs/fscache.h"
 
+#include "cpu/cpu.h"
 #include "lib/mode.h"
 #include "lib/stdio.h"
 #include "lib/string.h"
@@ -19,8 +20,23 @@
  * on BOTH the node's rwlock and the parent's rwlock. This ensures that no other threads can read or write to the node
  * while it is being modified. The parent's rwlock must be acquired to allow for traversal of the tree without having
  * to try to lock each child node individually.
+ *
+ * To load a child that isn't cached yet, a traversing thread turns its read lock on the directory into an upgradeable
+ * one and then into a write lock. Only one thread at a time holds the upgradeable mode, and no writer can get in
+ * between, so the child only has to be looked for again if the thread had to let go of the directory to get it.
+ *
+ * Lookups of cached paths don't take any locks until the final node: they walk first_child/next_sibling with acquire
+ * loads, and check each directory's write generation (see rw_lock_read_begin()) before moving past it. Anything that
+ * isn't cached, isn't allowed, changed under the walk or can't be read-locked straight away at the end sends the lookup
+ * down the locked path above instead. A walk counts as in progress on its core for fscache_synchronize_walks().
  */
 
+// Odd while a lockless walk is in progress on the core. A walk only ever tries locks, so it never blocks inside its
+// epoch and finishes on the core it started on.
+static struct {
+    atomic_uint seq;
+} __attribute__((aligned(64))) fscache_walk_epochs[MAX_CORES];
+
 // This does not include permanent nodes (e.g. kernelfs nodes)
 size_t fscache_cached_nodes_count = 0;
 
@@ -45,9 +61,30 @@ void _fscache_release_node_modifiable(fscache_node_t *node) {
     rw_lock_write_unlock(&node->rwlock);
 }
 
-// This isn't a true upgrade; see rw_lock_upgrade_read_to_write for details
-void _fscache_upgrade_node_to_modifiable(fscache_node_t *node) {
-    rw_lock_upgrade_read_to_write(&node->rwlock);
+/**
+ * Turns a read lock on node into an upgradeable one, which only one thread at a time can hold; returns false if nobody
+ * could have modified node's children meanwhile, so whatever the caller found out under the read lock still holds.
+ */
+static bool _fscache_read_to_upgradeable(fscache_node_t *node) {
+    if (rw_lock_try_read_to_upgradeable(&node->rwlock)) {
+        // We never let go of the node
+        return false;
+    }
+
+    // Another thread is about to modify this node. The reference keeps node from being evicted while we hold no lock.
+    unsigned gen = rw_lock_write_generation(&node->rwlock);
+    atomic_fetch_add(&node->ref_count, 1);
+    _fscache_release_node_readable(node);
+
+    rw_lock_upgradeable_lock(&node->rwlock);
+    atomic_fetch_sub(&node->ref_count, 1);
+
+    return rw_lock_write_generation(&node->rwlock) != gen;
+}
+
+// A true upgrade: nothing else can write to the node between locking it upgradeable and this
+static void _fscache_upgrade_node_to_modifiable(fscache_node_t *node) {
+    rw_lock_upgrade_to_write(&node->rwlock);
 }
 
 // This IS a true downgrade, unlike how the upgrade works; see rw_lock_downgrade_write_to_read for details
@@ -55,15 +92,39 @@ void _fscache_downgrade_node_to_readable(fscache_node_t *node) {
     rw_lock_downgrade_write_to_read(&node->rwlock);
 }
 
+static void _fscache_walk_enter() {
+    atomic_fetch_add(&fscache_walk_epochs[get_curr_core()].seq, 1);
+}
+
+static void _fscache_walk_exit() {
+    atomic_fetch_add_explicit(&fscache_walk_epochs[get_curr_core()].seq, 1, memory_order_release);
+}
+
+void fscache_synchronize_walks() {
+    atomic_thread_fence(memory_order_seq_cst);
+
+    uint32_t n_cores = get_n_cores();
+    for (uint32_t i = 0; i < n_cores && i < MAX_CORES; i++) {
+        unsigned seq = atomic_load_explicit(&fscache_walk_epochs[i].seq, memory_order_acquire);
+        if (!(seq & 1)) {
+            continue;
+        }
+        // Only the walk that was in progress has to finish; later ones can't find whatever was unlinked
+        while (atomic_load_explicit(&fscache_walk_epochs[i].seq, memory_order_acquire) == seq) {
+            __builtin_ia32_pause();
+        }
+    }
+}
+
 bool _fscache_try_lock_node_for_eviction(fscache_node_t *node) {
     if (atomic_compare_exchange_strong(&node->ref_count, &(int) { 0 }, -1)) {
         // Now, we must try to
     }
 }
 
-// The parent node must be read-locked before calling this.
+// The parent node must be read-locked before calling this, or read optimistically and validated afterwards.
 // No locks are modified in this function.
-static fscache_node_t *_fscache_find_in_children(fscache_node_t *parent_node, char *token, size_t token_len) {
+static fscache_node_t *_fscache_find_in_children(fscache_node_t *parent_node, const char *token, size_t token_len) {
     if (!parent_node) return NULL;
     if (!parent_node->first_child) return NULL;
 
@@ -109,6 +170,83 @@ static void _fscache_link_node(fscache_node_t *parent, fscache_node_t *child) {
 // TODO: implement links
 // TODO: implement groups
 
+/**
+ * The lockless side of fscache_request_node(): returns true with the final node read-locked (or released if out is
+ * NULL), or false if the walk couldn't be completed without locks. The locked walk then decides the actual result,
+ * errors included, so nothing here has to report any.
+ */
+static bool _fscache_request_node_lockless(const char *path, uid_t uid, fscache_node_t **out) {
+    fscache_node_t *cur  = fscache_root_node;
+    fscache_node_t *from = NULL; // The directory cur was found through
+    unsigned from_gen    = 0;
+    bool res             = false;
+
+    _fscache_walk_enter();
+
+    const char *token = path;
+    while (*token != '\0') {
+        while (*token == '/') token++;
+
+        const char *next_slash = token;
+        while (*next_slash != '/' && *next_slash != '\0') next_slash++;
+        size_t token_len = next_slash - token;
+
+        if (token_len == 0) break;
+
+        unsigned gen;
+        if (!rw_lock_read_begin(&cur->rwlock, &gen)) {
+            goto out;
+        }
+
+        if (cur->type != DT_DIR || !(access_check(cur->mode, cur->uid, cur->gid, uid) & ACCESS_EXECUTE)) {
+            goto out;
+        }
+
+        fscache_node_t *next;
+        if (token_len == 1 && token[0] == '.') {
+            next = cur;
+        } else if (token_len == 2 && token[0] == '.' && token[1] == '.') {
+            next = atomic_load_explicit(&cur->parent_node, memory_order_acquire);
+        } else {
+            next = _fscache_find_in_children(cur, token, token_len);
+        }
+
+        // Misses (including ".." at the root) are the locked walk's business
+        if (!next || !rw_lock_read_validate(&cur->rwlock, gen)) {
+            goto out;
+        }
+
+        from     = cur;
+        from_gen = gen;
+        cur      = next;
+        token    = next_slash;
+    }
+
+    // Waiting for the read lock could mean waiting out a writer's whole load_node() inside the epoch, which would hold
+    // up fscache_synchronize_walks() just as long; the locked walk does the waiting instead
+    if (!rw_lock_try_read_lock(&cur->rwlock)) {
+        goto out;
+    }
+
+    // cur is pinned now; make sure it was still where we found it when we did
+    if ((from && !rw_lock_read_validate(&from->rwlock, from_gen))
+        || (cur->type != DT_DIR && path[strlen(path) - 1] == '/')) {
+        _fscache_release_node_readable(cur);
+        goto out;
+    }
+
+    if (out != NULL) {
+        *out = cur;
+    } else {
+        _fscache_release_node_readable(cur);
+    }
+    res = true;
+
+out:
+    _fscache_walk_exit();
+    return res;
+}
+
 // During traversal, we must ALWAYS hold a read or modify lock on either the current node, its parent, or both.
 // This prevents external eviction while traversing.
 // IMPORTANT: out is updated to be the last successfully found node (read-locked). The read-lock is released
@@ -131,6 +269,10 @@ int fscache_request_node(const char *path, uid_t uid, fscache_node_t **out) {
         return -EIO;
     }
 
+    if (_fscache_request_node_lockless(path, uid, out)) {
+        return 0;
+    }
+
     size_t path_copy_len = path_len + 1;
     char *path_copy      = kmalloc_heap(path_copy_len);
     if (!path_copy) {
@@ -218,14 +360,15 @@ int fscache_request_node(const char *path, uid_t uid, fscache_node_t **out) {
         fscache_node_t *child = _fscache_find_in_children(cur, token, token_len);
 
         if (!child) {
-            // Node not found; attempt to load it.
-            _fscache_upgrade_node_to_modifiable(cur);
-
-            // Because the upgrade isn't a true upgrade, we have to re-check for the child
-            // After this operation, current_node is read-locked if not NULL
-            child = _fscache_find_in_children(cur, token, token_len);
+            // Node not found; attempt to load it. Only if another thread got to modify this directory first do we have
+            // to look for the child again.
+            if (_fscache_read_to_upgradeable(cur)) {
+                child = _fscache_find_in_children(cur, token, token_len);
+            }
 
             if (!child) {
+                _fscache_upgrade_node_to_modifiable(cur);
+
                 // This node is read-locked if it is not NULL
                 child = fscache_allocate_node();
                 if (!child) {
@@ -253,13 +396,14 @@ int fscache_request_node(const char *path, uid_t uid, fscache_node_t **out) {
                 }
 
                 _fscache_link_node(cur, child);
+
+                // Child is already read-locked
+                _fscache_release_node_modifiable(cur);
             } else {
-                // We found an existing child during the search. Read-lock it now.
+                // Another thread loaded the child while we waited. Read-lock it before releasing the parent's lock.
                 _fscache_wait_for_node_readable(child);
+                rw_lock_upgradeable_unlock(&cur->rwlock);
             }
-
-            // Child is already read-locked
-            _fscache_release_node_modifiable(cur);
             cur = child;
         } else {
             // We found an existing child during the search. Read-lock it before releasing parent's lock.
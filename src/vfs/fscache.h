@@ -70,6 +70,11 @@ struct fscache_block_header {
 
 int fscache_request_node(const char *path, uid_t uid, fscache_node_t **out);
 
+// Waits until every lockless lookup that was in progress has finished. A node unlinked from the tree may only be reused
+// after this, since those lookups could still be looking at it. Nothing calls this yet: nodes are never evicted, and
+// eviction will need it.
+void fscache_synchronize_walks();
+
 void _fscache_wait_for_node_readable(fscache_node_t *node);
 void _fscache_release_node_readable(fscache_node_t *node);
 void _fscache_wait_for_node_modifiable(fscache_node_t *node);
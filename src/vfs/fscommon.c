@@ -1,5 +1,6 @@
 #include "fscommon.h"
 
+#include "devices/storage/blkq.h"
 #include "lib/stdio.h"
 
 int read_first_sector(DRIVE_t *drive, uint32_t partition_start_lba, uint8_t *buffer) {
@@ -8,7 +9,7 @@ int read_first_sector(DRIVE_t *drive, uint32_t partition_start_lba, uint8_t *buf
     }
 
     // Read boot sector
-    ssize_t res = drive->read_sectors(drive, partition_start_lba, 1, buffer);
+    ssize_t res = blkq_read(drive, partition_start_lba, 1, buffer);
     if (res < 0) {
         printf("Error: Could not read FAT boot sector\n");
         return -1;
@@ -0,0 +1,636 @@
+#include "initramfs.h"
+
+#include "lib/stdio.h"
+#include "lib/string.h"
+#include "memory/detect.h"
+#include "memory/kmalloc.h"
+#include "memory/mm.h"
+#include "plenjos/dirent.h"
+#include "plenjos/errno.h"
+#include "plenjos/stat.h"
+
+#include <stdbool.h>
+
+static vfs_ops_block_t *initramfs_directory_fsops = NULL;
+static vfs_ops_block_t *initramfs_file_fsops      = NULL;
+
+static mutex initramfs_fsops_lock = MUTEX_INIT;
+
+static initramfs_inode_t *initramfs_get_inode(fscache_node_t *node) {
+    return ((vfs_initramfs_cache_node_data_t *)node->internal_data)->inode;
+}
+
+// Inodes
+
+static initramfs_inode_t *initramfs_alloc_inode(const char *name, dirent_type_t type, uid_t uid, gid_t gid,
+                                                mode_t mode) {
+    initramfs_inode_t *inode = kmalloc_heap(sizeof(initramfs_inode_t));
+    if (!inode) {
+        return NULL;
+    }
+    memset(inode, 0, sizeof(initramfs_inode_t));
+
+    strncpy(inode->name, name, NAME_MAX);
+    inode->name[NAME_MAX] = '\0';
+    inode->type           = type;
+    inode->uid            = uid;
+    inode->gid            = gid;
+    inode->mode           = mode;
+
+    return inode;
+}
+
+static initramfs_inode_t *initramfs_find_child(initramfs_inode_t *dir, const char *name) {
+    for (initramfs_inode_t *child = dir->first_child; child; child = child->next_sibling) {
+        if (strncmp(child->name, name, NAME_MAX + 1) == 0) {
+            return child;
+        }
+    }
+    return NULL;
+}
+
+static void initramfs_add_child(initramfs_inode_t *dir, initramfs_inode_t *child) {
+    child->parent = dir;
+    if (dir->last_child) {
+        dir->last_child->next_sibling = child;
+    } else {
+        dir->first_child = child;
+    }
+    dir->last_child = child;
+}
+
+static void initramfs_populate_node(fscache_node_t *node, initramfs_inode_t *inode) {
+    // Nothing in an initramfs can be written, whatever the archive says
+    fscache_node_populate(node, inode->type, 0, inode->name, inode->uid, inode->gid, inode->mode & ~0222,
+                          inode->type == DT_REG ? inode->size : 0,
+                          inode->type == DT_DIR ? initramfs_directory_fsops : initramfs_file_fsops);
+
+    ((vfs_initramfs_cache_node_data_t *)node->internal_data)->inode = inode;
+}
+
+/**
+ * Adds the archive entry at path (relative to root; "./" prefixes and doubled slashes are fine) to the tree, creating
+ * any parent directories that the archive doesn't list before their contents. A later entry for the same path replaces
+ * the earlier one, as when unpacking the archive. The tree isn't visible to anyone yet, so no locking is needed.
+ */
+static int initramfs_insert(initramfs_inode_t *root, const char *path, size_t path_len, dirent_type_t type, uid_t uid,
+                            gid_t gid, mode_t mode, const uint8_t *data, off_t size) {
+    initramfs_inode_t *dir = root;
+    char component[NAME_MAX + 1];
+
+    size_t i = 0;
+    while (i < path_len) {
+        while (i < path_len && path[i] == '/') {
+            i++;
+        }
+
+        size_t start = i;
+        while (i < path_len && path[i] != '/' && path[i] != '\0') {
+            i++;
+        }
+
+        size_t len = i - start;
+        if (len == 0) {
+            break;
+        }
+        if (len > NAME_MAX) {
+            return -ENAMETOOLONG;
+        }
+
+        memcpy(component, path + start, len);
+        component[len] = '\0';
+
+        if (len == 1 && component[0] == '.') {
+            continue;
+        }
+        if (len == 2 && component[0] == '.' && component[1] == '.') {
+            return -EINVAL;
+        }
+
+        // Skip any trailing slashes to find out whether this is the last component
+        size_t next = i;
+        while (next < path_len && path[next] == '/') {
+            next++;
+        }
+        bool last = next >= path_len || path[next] == '\0';
+
+        initramfs_inode_t *child = initramfs_find_child(dir, component);
+
+        if (!last) {
+            if (!child) {
+                child = initramfs_alloc_inode(component, DT_DIR, 0, 0, S_DFLT);
+                if (!child) {
+                    return -ENOMEM;
+                }
+                initramfs_add_child(dir, child);
+            } else if (child->type != DT_DIR) {
+                return -ENOTDIR;
+            }
+
+            dir = child;
+            continue;
+        }
+
+        if (child) {
+            if (child->type != type) {
+                return -EEXIST;
+            }
+        } else {
+            child = initramfs_alloc_inode(component, type, uid, gid, mode);
+            if (!child) {
+                return -ENOMEM;
+            }
+            initramfs_add_child(dir, child);
+        }
+
+        child->uid  = uid;
+        child->gid  = gid;
+        child->mode = mode;
+        if (type == DT_REG) {
+            child->data = data;
+            child->size = size;
+        }
+
+        return 0;
+    }
+
+    // The path ended in "." (e.g. the root entry of archives made with find . | cpio -o); adopt its permissions
+    if (type == DT_DIR) {
+        dir->uid  = uid;
+        dir->gid  = gid;
+        dir->mode = mode;
+    }
+    return 0;
+}
+
+// Archive parsing
+
+static bool initramfs_parse_hex(const char *field, size_t len, uint64_t *out) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = field[i];
+        if (c >= '0' && c <= '9') {
+            value = (value << 4) | (uint64_t)(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            value = (value << 4) | (uint64_t)(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            value = (value << 4) | (uint64_t)(c - 'A' + 10);
+        } else {
+            return false;
+        }
+    }
+    *out = value;
+    return true;
+}
+
+// Length of a tar string field, which is only NUL-terminated if it is shorter than the field
+static size_t initramfs_field_len(const char *field, size_t max) {
+    size_t len = 0;
+    while (len < max && field[len] != '\0') {
+        len++;
+    }
+    return len;
+}
+
+// Tar numbers are octal, optionally padded with leading spaces and terminated by a space or NUL
+static bool initramfs_parse_octal(const char *field, size_t len, uint64_t *out) {
+    uint64_t value = 0;
+    size_t i       = 0;
+
+    while (i < len && field[i] == ' ') {
+        i++;
+    }
+    for (; i < len && field[i] != ' ' && field[i] != '\0'; i++) {
+        if (field[i] < '0' || field[i] > '7') {
+            return false;
+        }
+        value = (value << 3) | (uint64_t)(field[i] - '0');
+    }
+
+    *out = value;
+    return true;
+}
+
+static dirent_type_t initramfs_type_from_mode(uint64_t mode) {
+    switch (mode & S_IFMT) {
+    case S_IFREG:
+        return DT_REG;
+    case S_IFDIR:
+        return DT_DIR;
+    default:
+        return DT_UNKNOWN;
+    }
+}
+
+static int initramfs_parse_cpio(initramfs_inode_t *root, const uint8_t *base, uint64_t size) {
+    uint64_t offset = 0;
+    int entries     = 0;
+
+    while (offset + INITRAMFS_CPIO_HEADER_LEN <= size) {
+        const char *header = (const char *)(base + offset);
+
+        if (memcmp(header, INITRAMFS_CPIO_MAGIC, 6) != 0 && memcmp(header, INITRAMFS_CPIO_MAGIC_CRC, 6) != 0) {
+            kout(KERNEL_WARN, "initramfs: bad cpio magic at offset %p\n", (void *)offset);
+            return -EINVAL;
+        }
+
+        // Fields after the magic: ino, mode, uid, gid, nlink, mtime, filesize, devmajor, devminor, rdevmajor,
+        // rdevminor, namesize, check
+        uint64_t mode, uid, gid, filesize, namesize;
+        if (!initramfs_parse_hex(header + 14, 8, &mode) || !initramfs_parse_hex(header + 22, 8, &uid)
+            || !initramfs_parse_hex(header + 30, 8, &gid) || !initramfs_parse_hex(header + 54, 8, &filesize)
+            || !initramfs_parse_hex(header + 94, 8, &namesize)) {
+            kout(KERNEL_WARN, "initramfs: malformed cpio header at offset %p\n", (void *)offset);
+            return -EINVAL;
+        }
+
+        // The name (including its NUL) follows the header, and the data follows that; both are 4-byte aligned
+        uint64_t name_offset = offset + INITRAMFS_CPIO_HEADER_LEN;
+        uint64_t data_offset = (name_offset + namesize + 3) & ~3ULL;
+        if (namesize == 0 || namesize > size - name_offset || filesize > size || data_offset > size - filesize) {
+            kout(KERNEL_WARN, "initramfs: cpio entry at offset %p runs past the end of the archive\n", (void *)offset);
+            return -EINVAL;
+        }
+
+        const char *name = (const char *)(base + name_offset);
+        if (namesize == sizeof(INITRAMFS_CPIO_TRAILER)
+            && memcmp(name, INITRAMFS_CPIO_TRAILER, sizeof(INITRAMFS_CPIO_TRAILER)) == 0) {
+            break;
+        }
+
+        dirent_type_t type = initramfs_type_from_mode(mode);
+        if (type == DT_UNKNOWN) {
+            kout(KERNEL_INFO, "initramfs: skipping %s (unsupported file type)\n", name);
+        } else {
+            int res = initramfs_insert(root, name, namesize - 1, type, (uid_t)uid, (gid_t)gid, (mode_t)(mode & 07777),
+                                       base + data_offset, (off_t)filesize);
+            if (res < 0) {
+                kout(KERNEL_WARN, "initramfs: skipping %s: %d\n", name, res);
+            } else {
+                entries++;
+            }
+        }
+
+        offset = (data_offset + filesize + 3) & ~3ULL;
+    }
+
+    return entries;
+}
+
+static int initramfs_parse_tar(initramfs_inode_t *root, const uint8_t *base, uint64_t size) {
+    static const uint8_t zero_block[INITRAMFS_TAR_BLOCK_LEN] = { 0 };
+
+    uint64_t offset = 0;
+    int entries     = 0;
+
+    // Concatenated names from the prefix and name fields, plus a separator and NUL
+    char path[155 + 1 + 100 + 1];
+
+    while (offset + INITRAMFS_TAR_BLOCK_LEN <= size) {
+        const char *header = (const char *)(base + offset);
+
+        // The archive ends with (at least) two zero blocks; one is enough to stop
+        if (memcmp(header, zero_block, INITRAMFS_TAR_BLOCK_LEN) == 0) {
+            break;
+        }
+
+        if (memcmp(header + INITRAMFS_TAR_MAGIC_OFFSET, INITRAMFS_TAR_MAGIC, 5) != 0) {
+            kout(KERNEL_WARN, "initramfs: bad tar magic at offset %p\n", (void *)offset);
+            return -EINVAL;
+        }
+
+        uint64_t mode, uid, gid, filesize;
+        if (!initramfs_parse_octal(header + 100, 8, &mode) || !initramfs_parse_octal(header + 108, 8, &uid)
+            || !initramfs_parse_octal(header + 116, 8, &gid) || !initramfs_parse_octal(header + 124, 12, &filesize)) {
+            kout(KERNEL_WARN, "initramfs: malformed tar header at offset %p\n", (void *)offset);
+            return -EINVAL;
+        }
+
+        uint64_t data_offset = offset + INITRAMFS_TAR_BLOCK_LEN;
+        if (filesize > size - data_offset) {
+            kout(KERNEL_WARN, "initramfs: tar entry at offset %p runs past the end of the archive\n", (void *)offset);
+            return -EINVAL;
+        }
+
+        size_t path_len   = 0;
+        size_t prefix_len = initramfs_field_len(header + 345, 155);
+        size_t name_len   = initramfs_field_len(header, 100);
+        if (prefix_len > 0) {
+            memcpy(path, header + 345, prefix_len);
+            path[prefix_len] = '/';
+            path_len         = prefix_len + 1;
+        }
+        memcpy(path + path_len, header, name_len);
+        path_len       += name_len;
+        path[path_len]  = '\0';
+
+        dirent_type_t type;
+        switch (header[156]) {
+        case '0':
+        case '\0':
+        case '7': // Contiguous file
+            type = DT_REG;
+            break;
+        case '5':
+            type = DT_DIR;
+            break;
+        default:
+            type = DT_UNKNOWN;
+            break;
+        }
+
+        if (type == DT_UNKNOWN) {
+            kout(KERNEL_INFO, "initramfs: skipping %s (unsupported file type)\n", path);
+        } else {
+            int res = initramfs_insert(root, path, path_len, type, (uid_t)uid, (gid_t)gid, (mode_t)(mode & 07777),
+                                       base + data_offset, type == DT_REG ? (off_t)filesize : 0);
+            if (res < 0) {
+                kout(KERNEL_WARN, "initramfs: skipping %s: %d\n", path, res);
+            } else {
+                entries++;
+            }
+        }
+
+        offset = data_offset + ((filesize + INITRAMFS_TAR_BLOCK_LEN - 1) & ~(uint64_t)(INITRAMFS_TAR_BLOCK_LEN - 1));
+    }
+
+    return entries;
+}
+
+// VFS operations
+
+ssize_t initramfs_file_read_func(vfs_handle_t *handle, void *buf, size_t len) {
+    vfs_initramfs_handle_instance_data_t *instance_data
+        = (vfs_initramfs_handle_instance_data_t *)handle->instance_data;
+
+    if (!buf || !handle->backing_node) {
+        return -EIO;
+    }
+
+    initramfs_inode_t *inode = initramfs_get_inode(handle->backing_node);
+    if (!inode) {
+        return -EIO;
+    }
+
+    if (instance_data->seek_pos >= (uint64_t)inode->size || len == 0) {
+        return 0;
+    }
+    if (len > (uint64_t)inode->size - instance_data->seek_pos) {
+        len = (uint64_t)inode->size - instance_data->seek_pos;
+    }
+
+    memcpy(buf, inode->data + instance_data->seek_pos, len);
+    instance_data->seek_pos += len;
+
+    return (ssize_t)len;
+}
+
+off_t initramfs_file_seek_func(vfs_handle_t *handle, off_t offset, vfs_seek_whence_t whence) {
+    vfs_initramfs_handle_instance_data_t *instance_data
+        = (vfs_initramfs_handle_instance_data_t *)handle->instance_data;
+
+    if (!handle->backing_node) {
+        return -EIO;
+    }
+
+    initramfs_inode_t *inode = initramfs_get_inode(handle->backing_node);
+
+    off_t base;
+    switch (whence) {
+    case VFS_SEEK_SET:
+        base = 0;
+        break;
+    case VFS_SEEK_CUR:
+        base = (off_t)instance_data->seek_pos;
+        break;
+    case VFS_SEEK_END:
+        base = inode->size;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    off_t new_pos = base + offset;
+    if (new_pos < 0) {
+        return -EINVAL;
+    }
+
+    instance_data->seek_pos = (uint64_t)new_pos;
+
+    return new_pos;
+}
+
+int initramfs_file_get_page_func(vfs_handle_t *handle, uint64_t index, uint64_t *phys_out) {
+    if (!handle->backing_node) {
+        return -EIO;
+    }
+
+    initramfs_inode_t *inode = initramfs_get_inode(handle->backing_node);
+    if (!inode) {
+        return -EIO;
+    }
+
+    // Only whole pages that sit on a page boundary in the archive can be mapped in place; the tail page would expose
+    // whatever follows the file, so the page cache copies that one (and any unaligned ones)
+    uint64_t offset = index * PAGE_LEN;
+    if (index >= (uint64_t)inode->size / PAGE_LEN || ((uint64_t)(inode->data + offset) & (PAGE_LEN - 1)) != 0) {
+        return -ENOENT;
+    }
+
+    uint64_t phys = virt_to_phys((uint64_t)(inode->data + offset));
+    if ((phys >> 12) >= phys_mem_frame_map_size / sizeof(phys_mem_free_frame_t)) {
+        return -ENOENT;
+    }
+
+    phys_mem_ref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(phys));
+    *phys_out = phys;
+
+    return 0;
+}
+
+ssize_t initramfs_dir_read_func(vfs_handle_t *handle, void *buf, size_t len) {
+    vfs_initramfs_handle_instance_data_t *instance_data
+        = (vfs_initramfs_handle_instance_data_t *)handle->instance_data;
+
+    if (!buf || !handle->backing_node) {
+        return -EIO;
+    }
+
+    initramfs_inode_t *dir = initramfs_get_inode(handle->backing_node);
+    if (!dir) {
+        return -EIO;
+    }
+
+    size_t total_bytes_read = 0;
+
+    initramfs_inode_t *child = dir->first_child;
+    for (uint64_t i = 0; i < instance_data->seek_pos && child; i++) {
+        child = child->next_sibling;
+    }
+
+    while (child && len >= sizeof(struct plenjos_dirent)) {
+        struct plenjos_dirent *dent = (struct plenjos_dirent *)((uint8_t *)buf + total_bytes_read);
+        memset(dent, 0, sizeof(struct plenjos_dirent));
+        strncpy(dent->d_name, child->name, NAME_MAX + 1);
+        dent->d_name[NAME_MAX] = '\0';
+        dent->type             = child->type;
+
+        instance_data->seek_pos++;
+        total_bytes_read += sizeof(struct plenjos_dirent);
+        len              -= sizeof(struct plenjos_dirent);
+
+        child = child->next_sibling;
+    }
+
+    return (ssize_t)total_bytes_read;
+}
+
+off_t initramfs_dir_seek_func(vfs_handle_t *handle, off_t offset, vfs_seek_whence_t whence) {
+    vfs_initramfs_handle_instance_data_t *instance_data
+        = (vfs_initramfs_handle_instance_data_t *)handle->instance_data;
+
+    // Directory positions aren't byte offsets; only rewinding is supported
+    if (whence != VFS_SEEK_SET || offset != 0) {
+        return -EINVAL;
+    }
+
+    instance_data->seek_pos = 0;
+    return 0;
+}
+
+int initramfs_load_node_func(fscache_node_t *node, const char *name, fscache_node_t *out) {
+    if (!node || !name || !out) {
+        return -EINVAL;
+    }
+
+    if (node->type != DT_DIR) {
+        return -ENOTDIR;
+    }
+
+    initramfs_inode_t *dir = initramfs_get_inode(node);
+    if (!dir) {
+        return -EIO;
+    }
+
+    // The tree never changes after setup, so no locking is needed
+    initramfs_inode_t *child = initramfs_find_child(dir, name);
+    if (!child) {
+        return -ENOENT;
+    }
+
+    initramfs_populate_node(out, child);
+
+    return 0;
+}
+
+ssize_t initramfs_file_data(fscache_node_t *node, const void **data_out) {
+    if (!node || !data_out || node->type != DT_REG || node->fsops != initramfs_file_fsops || !initramfs_file_fsops) {
+        return -EINVAL;
+    }
+
+    initramfs_inode_t *inode = initramfs_get_inode(node);
+    if (!inode) {
+        return -EINVAL;
+    }
+
+    *data_out = inode->data;
+    return (ssize_t)inode->size;
+}
+
+extern fscache_node_t *fscache_root_node;
+int initramfs_setup(const void *base, uint64_t size, const char *name) {
+    if (!base || !name) {
+        return -EINVAL;
+    }
+
+    mutex_lock(&initramfs_fsops_lock);
+    if (!initramfs_directory_fsops) {
+        vfs_ops_block_t *dir_fsops = kmalloc_heap(sizeof(vfs_ops_block_t));
+        if (!dir_fsops) {
+            printf("OOM Error: initramfs_setup: could not allocate memory for directory fsops\n");
+            mutex_unlock(&initramfs_fsops_lock);
+            return -ENOMEM;
+        }
+        memset(dir_fsops, 0, sizeof(vfs_ops_block_t));
+        dir_fsops->fsname         = "initramfs";
+        dir_fsops->read           = initramfs_dir_read_func;
+        dir_fsops->seek           = initramfs_dir_seek_func;
+        dir_fsops->load_node      = initramfs_load_node_func;
+        initramfs_directory_fsops = dir_fsops;
+    }
+    if (!initramfs_file_fsops) {
+        vfs_ops_block_t *file_fsops = kmalloc_heap(sizeof(vfs_ops_block_t));
+        if (!file_fsops) {
+            printf("OOM Error: initramfs_setup: could not allocate memory for file fsops\n");
+            mutex_unlock(&initramfs_fsops_lock);
+            return -ENOMEM;
+        }
+        memset(file_fsops, 0, sizeof(vfs_ops_block_t));
+        file_fsops->fsname    = "initramfs";
+        file_fsops->read      = initramfs_file_read_func;
+        file_fsops->seek      = initramfs_file_seek_func;
+        file_fsops->get_page  = initramfs_file_get_page_func;
+        file_fsops->load_node = initramfs_load_node_func;
+        initramfs_file_fsops  = file_fsops;
+    }
+    mutex_unlock(&initramfs_fsops_lock);
+
+    initramfs_inode_t *root = initramfs_alloc_inode(name, DT_DIR, 0, 0, S_DFLT);
+    if (!root) {
+        printf("OOM Error: initramfs_setup: could not allocate memory for root inode\n");
+        return -ENOMEM;
+    }
+
+    const uint8_t *archive = (const uint8_t *)base;
+
+    int entries;
+    if (size >= 6
+        && (memcmp(archive, INITRAMFS_CPIO_MAGIC, 6) == 0 || memcmp(archive, INITRAMFS_CPIO_MAGIC_CRC, 6) == 0)) {
+        entries = initramfs_parse_cpio(root, archive, size);
+    } else if (size >= INITRAMFS_TAR_BLOCK_LEN
+               && memcmp(archive + INITRAMFS_TAR_MAGIC_OFFSET, INITRAMFS_TAR_MAGIC, 5) == 0) {
+        entries = initramfs_parse_tar(root, archive, size);
+    } else {
+        kout(KERNEL_WARN, "initramfs: %s is neither a newc cpio nor a ustar archive (compressed archives are not "
+                          "supported)\n", name);
+        entries = -EINVAL;
+    }
+
+    // A damaged archive still mounts whatever was parsed before the damage
+    if (entries < 0 && !root->first_child) {
+        kfree_heap(root);
+        return entries;
+    }
+
+    fscache_node_t *node = fscache_allocate_node();
+    if (!node) {
+        printf("OOM Error: initramfs_setup: could not allocate memory for root cache node\n");
+        return -ENOMEM;
+    }
+
+    initramfs_populate_node(node, root);
+
+    _fscache_wait_for_node_modifiable(fscache_root_node);
+
+    fscache_node_t *child = fscache_root_node->first_child;
+    node->next_sibling    = NULL;
+    node->parent_node     = fscache_root_node;
+
+    if (child == NULL) {
+        node->prev_sibling             = NULL;
+        fscache_root_node->first_child = node;
+    } else {
+        while (child->next_sibling != NULL) {
+            child = child->next_sibling;
+        }
+        child->next_sibling = node;
+        node->prev_sibling  = child;
+    }
+
+    _fscache_release_node_modifiable(fscache_root_node);
+    _fscache_release_node_readable(node);
+
+    printf("initramfs mounted read-only at /%s\n", root->name);
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "plenjos/limits.h"
+#include "vfs/fscache.h"
+#include "vfs/vfs.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Read-only filesystem over an uncompressed cpio (newc) or ustar archive that the bootloader loaded into memory. The
+ * archive is parsed once into a tree of initramfs_inode_t; file data is never copied, inodes point straight into the
+ * archive. Pages of a file that happen to be page-aligned in the archive are handed to the page cache as they are, so
+ * mapping them costs nothing.
+ */
+
+#define INITRAMFS_MODULE_STRING "initramfs"
+
+// cpio "new ASCII" format (as written by cpio -H newc); every field is 8 hex digits
+#define INITRAMFS_CPIO_MAGIC       "070701"
+#define INITRAMFS_CPIO_MAGIC_CRC   "070702"
+#define INITRAMFS_CPIO_HEADER_LEN  110
+#define INITRAMFS_CPIO_TRAILER     "TRAILER!!!"
+#define INITRAMFS_TAR_BLOCK_LEN    512
+#define INITRAMFS_TAR_MAGIC        "ustar"
+#define INITRAMFS_TAR_MAGIC_OFFSET 257
+
+typedef struct initramfs_inode initramfs_inode_t;
+
+struct initramfs_inode {
+    char name[NAME_MAX + 1];
+    dirent_type_t type;
+
+    uid_t uid;
+    gid_t gid;
+    mode_t mode;
+
+    // Regular files: the contents, inside the archive
+    const uint8_t *data;
+    off_t size;
+
+    // Directories; children are kept in archive order
+    initramfs_inode_t *parent;
+    initramfs_inode_t *first_child;
+    initramfs_inode_t *last_child;
+    initramfs_inode_t *next_sibling;
+};
+
+typedef struct vfs_initramfs_cache_node_data {
+    initramfs_inode_t *inode;
+    uint64_t unused[3];
+} __attribute__((packed)) vfs_initramfs_cache_node_data_t;
+
+typedef struct vfs_initramfs_handle_instance_data {
+    uint64_t seek_pos; // Byte offset for files; entry index for directories
+    uint64_t unused[3];
+} __attribute__((packed)) vfs_initramfs_handle_instance_data_t;
+
+/**
+ * Parses the archive at base (size bytes, which must stay mapped for good) and attaches it read-only under the fscache
+ * root as name. Unsupported entries (links, devices) are skipped.
+ */
+int initramfs_setup(const void *base, uint64_t size, const char *name);
+
+/**
+ * If node is a regular file in an initramfs, stores a pointer to its contents in *data_out and returns its size.
+ * Returns -EINVAL for any other node.
+ */
+ssize_t initramfs_file_data(fscache_node_t *node, const void **data_out);
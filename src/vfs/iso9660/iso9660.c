@@ -1,5 +1,7 @@
 #include "iso9660.h"
 
+#include "devices/storage/blkq.h"
+#include "lib/lock.h"
 #include "lib/stdio.h"
 #include "lib/string.h"
 #include "memory/kmalloc.h"
@@ -13,6 +15,9 @@ ssize_t iso9660_directory_read_func(vfs_handle_t *handle, void *buf, size_t len)
 const vfs_ops_block_t *iso9660_file_fsops      = NULL;
 const vfs_ops_block_t *iso9660_directory_fsops = NULL;
 
+// Partitions are probed in parallel, so two setups can race to initialize the fsops
+static mutex iso9660_fsops_lock = MUTEX_INIT;
+
 /**
  * For caching purposes, we will ignore the path table, as it's easier to only cache directory records (all directories
  * are in both path table and directory records).
@@ -89,8 +94,8 @@ ssize_t iso9660_file_read_func(vfs_handle_t *handle, void *buf, size_t len) {
     uint64_t cur_block  = pos / block_size;
     uint64_t block_off  = pos % block_size;
 
-    uint8_t *block_buf = kmalloc_heap(block_size);
-    if (!block_buf) return -ENOMEM;
+    // Only allocated if a partial (or misaligned) block has to be staged
+    uint8_t *block_buf = NULL;
 
     size_t remaining = len;
     size_t copied    = 0;
@@ -98,10 +103,30 @@ ssize_t iso9660_file_read_func(vfs_handle_t *handle, void *buf, size_t len) {
     while (remaining > 0) {
         uint64_t lba = fs->partition_start_lba + start_lba + cur_block;
 
-        ssize_t res = fs->drive->read_sectors(fs->drive, lba, 1, block_buf);
+        // Whole blocks go straight into the destination (usually a pinned user page), skipping the staging copy
+        if (block_off == 0 && remaining >= block_size && ((uint64_t)buf + copied) % 2 == 0) {
+            ssize_t res = blkq_read(fs->drive, lba, 1, (uint8_t *)buf + copied);
+            if (res < 0) {
+                if (block_buf) kfree_heap(block_buf);
+                return copied ? (ssize_t)copied : -EIO;
+            }
+
+            copied    += block_size;
+            remaining -= block_size;
+            cur_block++;
+            instance_data->seek_pos += block_size;
+            continue;
+        }
+
+        if (!block_buf) {
+            block_buf = kmalloc_heap(block_size);
+            if (!block_buf) return copied ? (ssize_t)copied : -ENOMEM;
+        }
+
+        ssize_t res = blkq_read(fs->drive, lba, 1, block_buf);
         if (res < 0) {
             kfree_heap(block_buf);
-            return -EIO;
+            return copied ? (ssize_t)copied : -EIO;
         }
 
         size_t avail   = block_size - block_off;
@@ -113,10 +138,10 @@ ssize_t iso9660_file_read_func(vfs_handle_t *handle, void *buf, size_t len) {
         remaining -= to_copy;
         block_off  = 0;
         cur_block++;
+        instance_data->seek_pos += to_copy;
     }
 
-    instance_data->seek_pos += copied;
-    kfree_heap(block_buf);
+    if (block_buf) kfree_heap(block_buf);
     return (ssize_t)copied;
 }
 
@@ -172,7 +197,7 @@ ssize_t iso9660_directory_read_func(vfs_handle_t *handle, void *buf, size_t len)
 
     while (dir_size > 0 && len >= sizeof(struct plenjos_dirent)) {
         // Read current logical block
-        res = fs->drive->read_sectors(fs->drive, dir_extent_lba, 1, buffer);
+        res = blkq_read(fs->drive, dir_extent_lba, 1, buffer);
         if (res < 0) {
             printf("iso9660_directory_read_func: error reading directory sector\n");
             kfree_heap(buffer);
@@ -295,7 +320,7 @@ int iso9660_load_func(fscache_node_t *node, const char *name, fscache_node_t *ou
     char buf[NAME_MAX + 1];
 
     while (dir_size > 0) {
-        ssize_t res = fs->drive->read_sectors(fs->drive, dir_extent_lba, 1, dir_buffer);
+        ssize_t res = blkq_read(fs->drive, dir_extent_lba, 1, dir_buffer);
         if (res < 0) {
             printf("iso9660: error reading directory sector\n");
             kfree_heap(dir_buffer);
@@ -361,11 +386,13 @@ int iso9660_create_child_func(fscache_node_t *parent, const char *name, dirent_t
 // TODO: mount function
 extern fscache_node_t *fscache_root_node;
 int iso9660_setup(struct filesystem_iso9660 *fs, DRIVE_t *drive, uint32_t partition_start_lba) {
+    mutex_lock(&iso9660_fsops_lock);
     if (!iso9660_directory_fsops) {
         // Initialize directory fsops
         vfs_ops_block_t *dir_fsops = kmalloc_heap(sizeof(vfs_ops_block_t));
         if (!dir_fsops) {
             printf("OOM Error: iso9660_setup: could not allocate memory for directory fsops\n");
+            mutex_unlock(&iso9660_fsops_lock);
             return -ENOMEM;
         }
         memset(dir_fsops, 0, sizeof(vfs_ops_block_t));
@@ -380,6 +407,7 @@ int iso9660_setup(struct filesystem_iso9660 *fs, DRIVE_t *drive, uint32_t partit
         vfs_ops_block_t *file_fsops = kmalloc_heap(sizeof(vfs_ops_block_t));
         if (!file_fsops) {
             printf("OOM Error: iso9660_setup: could not allocate memory for file fsops\n");
+            mutex_unlock(&iso9660_fsops_lock);
             return -ENOMEM;
         }
         memset(file_fsops, 0, sizeof(vfs_ops_block_t));
@@ -388,6 +416,7 @@ int iso9660_setup(struct filesystem_iso9660 *fs, DRIVE_t *drive, uint32_t partit
         file_fsops->unload_node = iso9660_unload_func;
         iso9660_file_fsops      = file_fsops;
     }
+    mutex_unlock(&iso9660_fsops_lock);
 
     if (!fs || !drive || !(fs->read_status & 0x01)) {
         return -EINVAL;
@@ -432,26 +461,24 @@ int iso9660_setup(struct filesystem_iso9660 *fs, DRIVE_t *drive, uint32_t partit
     printf("ISO9660 filesystem mounted: logical block size %d, root directory extent LBA %d, size %d bytes\n",
            fs->logical_block_size, fs->root_directory_extent_location, fs->root_directory_size);
 
-    node->parent_node     = NULL;
+    _fscache_wait_for_node_modifiable(fscache_root_node);
+
     fscache_node_t *child = fscache_root_node->first_child;
+    node->next_sibling    = NULL;
+    node->parent_node     = fscache_root_node;
 
     if (child == NULL) {
-        fscache_root_node->first_child = node;
         node->prev_sibling             = NULL;
-        node->next_sibling             = NULL;
-        node->parent_node              = fscache_root_node;
-        return 0;
-    }
-
-    while (child->next_sibling != NULL) {
-        child = child->next_sibling;
+        fscache_root_node->first_child = node;
+    } else {
+        while (child->next_sibling != NULL) {
+            child = child->next_sibling;
+        }
+        child->next_sibling = node;
+        node->prev_sibling  = child;
     }
 
-    child->next_sibling = node;
-    node->prev_sibling  = child;
-    node->next_sibling  = NULL;
-    node->parent_node   = fscache_root_node;
-
+    _fscache_release_node_modifiable(fscache_root_node);
     _fscache_release_node_readable(node);
 
     return 0;
@@ -334,6 +334,7 @@ int kernelfs_helper_create_file(const char *parent, const char *name, uint8_t ty
         return res;
     }
 
+    vfs_close(parent_handle);
     return 0;
 }
 
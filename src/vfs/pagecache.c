@@ -0,0 +1,231 @@
+#include "vfs/pagecache.h"
+
+#include "kernel.h"
+#include "lib/lock.h"
+#include "lib/stdio.h"
+#include "lib/string.h"
+#include "memory/kmalloc.h"
+#include "memory/mm.h"
+#include "plenjos/errno.h"
+#include "plenjos/uio.h"
+
+static pagecache_page_t *pagecache_buckets[PAGECACHE_HASH_BUCKETS];
+static pagecache_owner_t *pagecache_owners = NULL;
+static size_t pagecache_pages              = 0;
+static size_t pagecache_clock              = 0;
+
+static mutex pagecache_lock = MUTEX_INIT;
+
+static inline size_t pagecache_hash(fscache_node_t *node, uint64_t index) {
+    uint64_t h = ((uint64_t)node >> 4) ^ (index * 0x9E3779B97F4A7C15ULL);
+    return (size_t)((h ^ (h >> 29)) % PAGECACHE_HASH_BUCKETS);
+}
+
+static inline uint32_t pagecache_frame_refs(uint64_t phys) {
+    phys_mem_free_frame_t *frame = (phys_mem_free_frame_t *)phys_addr_to_frame_addr(phys);
+    return frame->flags & ~FRAME_FLAG_USABLE;
+}
+
+// Must be called with pagecache_lock held
+static pagecache_page_t *pagecache_lookup(fscache_node_t *node, uint64_t index) {
+    for (pagecache_page_t *p = pagecache_buckets[pagecache_hash(node, index)]; p; p = p->hash_next) {
+        if (p->node == node && p->index == index) {
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+// Must be called with pagecache_lock held
+static pagecache_owner_t **pagecache_find_owner(fscache_node_t *node) {
+    pagecache_owner_t **link = &pagecache_owners;
+
+    while (*link && (*link)->node != node) {
+        link = &(*link)->next;
+    }
+
+    return link;
+}
+
+// Must be called with pagecache_lock held. Accounts for a page leaving the cache and releases the node once its last
+// page is gone.
+static void pagecache_owner_put(fscache_node_t *node) {
+    pagecache_owner_t **link = pagecache_find_owner(node);
+    pagecache_owner_t *owner = *link;
+
+    if (!owner) {
+        return;
+    }
+
+    if (--owner->pages == 0) {
+        *link = owner->next;
+        kfree_heap(owner);
+        atomic_fetch_sub(&node->ref_count, 1);
+    }
+}
+
+// Must be called with pagecache_lock held. Frees one page that no mapping is using, if there is one.
+static bool pagecache_evict_one() {
+    for (size_t n = 0; n < PAGECACHE_HASH_BUCKETS; n++) {
+        size_t bucket           = (pagecache_clock + n) % PAGECACHE_HASH_BUCKETS;
+        pagecache_page_t **link = &pagecache_buckets[bucket];
+
+        while (*link) {
+            pagecache_page_t *p = *link;
+
+            if (pagecache_frame_refs(p->phys) <= 1) {
+                *link = p->hash_next;
+                phys_mem_unref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(p->phys));
+                pagecache_owner_put(p->node);
+                kfree_heap(p);
+                pagecache_pages--;
+
+                pagecache_clock = bucket + 1;
+                return true;
+            }
+
+            link = &p->hash_next;
+        }
+    }
+
+    return false;
+}
+
+int pagecache_get_page(vfs_handle_t *handle, uint64_t index, uint64_t *phys_out) {
+    if (!handle || !handle->backing_node || !phys_out) {
+        return -EINVAL;
+    }
+
+    fscache_node_t *node = handle->backing_node;
+
+    // Memory-backed filesystems can hand out their own pages; there is nothing to cache then
+    if (node->fsops && node->fsops->get_page) {
+        int res = node->fsops->get_page(handle, index, phys_out);
+        if (res != -ENOENT) {
+            return res;
+        }
+    }
+
+    mutex_lock(&pagecache_lock);
+
+    pagecache_page_t *p = pagecache_lookup(node, index);
+    if (p) {
+        phys_mem_ref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(p->phys));
+        *phys_out = p->phys;
+        mutex_unlock(&pagecache_lock);
+        return 0;
+    }
+
+    mutex_unlock(&pagecache_lock);
+
+    // Read it in without holding the lock; the filesystem may need to touch the drive
+    uint64_t frame = find_next_free_frame();
+    if (!frame) {
+        return -ENOMEM;
+    }
+
+    memset((void *)phys_to_virt(frame), 0, PAGE_LEN);
+
+    struct plenjos_iovec iov = { .iov_base = (void *)phys_to_virt(frame), .iov_len = PAGE_LEN };
+    ssize_t res              = vfs_preadv(handle, &iov, 1, (off_t)(index * PAGE_LEN));
+    if (res < 0) {
+        phys_mem_unref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(frame));
+        return (int)res;
+    }
+
+    mutex_lock(&pagecache_lock);
+
+    // Someone else may have read the same page in the meantime; prefer theirs so the frame stays shared
+    p = pagecache_lookup(node, index);
+    if (p) {
+        phys_mem_ref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(p->phys));
+        *phys_out = p->phys;
+        mutex_unlock(&pagecache_lock);
+
+        phys_mem_unref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(frame));
+        return 0;
+    }
+
+    if (pagecache_pages >= PAGECACHE_MAX_PAGES && !pagecache_evict_one()) {
+        // Everything is mapped somewhere; hand out an uncached page (the caller takes over our reference)
+        mutex_unlock(&pagecache_lock);
+        *phys_out = frame;
+        return 0;
+    }
+
+    pagecache_owner_t **link = pagecache_find_owner(node);
+    pagecache_page_t *new_p  = kmalloc_heap(sizeof(pagecache_page_t));
+    if (!new_p) {
+        mutex_unlock(&pagecache_lock);
+        *phys_out = frame;
+        return 0;
+    }
+
+    if (!*link) {
+        pagecache_owner_t *owner = kmalloc_heap(sizeof(pagecache_owner_t));
+        if (!owner) {
+            mutex_unlock(&pagecache_lock);
+            kfree_heap(new_p);
+            *phys_out = frame;
+            return 0;
+        }
+
+        owner->node  = node;
+        owner->pages = 0;
+        owner->next  = NULL;
+        *link        = owner;
+        atomic_fetch_add(&node->ref_count, 1);
+    }
+
+    (*link)->pages++;
+
+    new_p->node      = node;
+    new_p->index     = index;
+    new_p->phys      = frame;
+    size_t bucket    = pagecache_hash(node, index);
+    new_p->hash_next = pagecache_buckets[bucket];
+    pagecache_buckets[bucket] = new_p;
+    pagecache_pages++;
+
+    // One reference stays with the cache; take another for the caller
+    phys_mem_ref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(frame));
+    *phys_out = frame;
+
+    mutex_unlock(&pagecache_lock);
+    return 0;
+}
+
+void pagecache_drop_node(fscache_node_t *node) {
+    if (!node) {
+        return;
+    }
+
+    mutex_lock(&pagecache_lock);
+
+    if (!*pagecache_find_owner(node)) {
+        mutex_unlock(&pagecache_lock);
+        return;
+    }
+
+    for (size_t bucket = 0; bucket < PAGECACHE_HASH_BUCKETS; bucket++) {
+        pagecache_page_t **link = &pagecache_buckets[bucket];
+
+        while (*link) {
+            pagecache_page_t *p = *link;
+
+            if (p->node != node) {
+                link = &p->hash_next;
+                continue;
+            }
+
+            *link = p->hash_next;
+            phys_mem_unref_frame((phys_mem_free_frame_t *)phys_addr_to_frame_addr(p->phys));
+            pagecache_owner_put(node);
+            kfree_heap(p);
+            pagecache_pages--;
+        }
+    }
+
+    mutex_unlock(&pagecache_lock);
+}
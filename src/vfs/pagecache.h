@@ -0,0 +1,48 @@
+#pragma once
+
+#include "vfs/fscache.h"
+#include "vfs/vfs.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Page cache for file-backed mappings, keyed by (fscache node, page index).
+ *
+ * Each cached page holds one frame reference of its own; every mapping of it holds another, so read-only mappings of
+ * the same file page share one frame across processes. A node with cached pages holds one extra ref_count until its
+ * pages are dropped. Writes through the VFS drop the node's pages so later faults see the new data (existing mappings
+ * keep the old frames).
+ */
+
+#define PAGECACHE_HASH_BUCKETS 512
+#define PAGECACHE_MAX_PAGES    4096
+
+typedef struct pagecache_page pagecache_page_t;
+
+struct pagecache_page {
+    fscache_node_t *node;
+    uint64_t index;
+    uint64_t phys;
+
+    pagecache_page_t *hash_next;
+};
+
+typedef struct pagecache_owner pagecache_owner_t;
+
+// One per node that currently has pages cached
+struct pagecache_owner {
+    fscache_node_t *node;
+    size_t pages;
+
+    pagecache_owner_t *next;
+};
+
+// Looks up (or reads in through handle) page index of handle's node. On success, *phys_out is the physical address
+// of the page and the caller owns one frame reference to it (drop it with phys_mem_unref_frame, or hand it to a page
+// table). Bytes past the end of the file read as zero.
+int pagecache_get_page(vfs_handle_t *handle, uint64_t index, uint64_t *phys_out);
+
+// Drops every cached page belonging to node
+void pagecache_drop_node(fscache_node_t *node);
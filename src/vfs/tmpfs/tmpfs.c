@@ -0,0 +1,486 @@
+#include "tmpfs.h"
+
+#include "lib/stdio.h"
+#include "lib/string.h"
+#include "memory/kmalloc.h"
+#include "memory/mm.h"
+#include "plenjos/dirent.h"
+#include "plenjos/errno.h"
+
+static vfs_ops_block_t *tmpfs_directory_fsops = NULL;
+static vfs_ops_block_t *tmpfs_file_fsops      = NULL;
+
+static mutex tmpfs_fsops_lock = MUTEX_INIT;
+
+static tmpfs_inode_t *tmpfs_get_inode(fscache_node_t *node) {
+    return ((vfs_tmpfs_cache_node_data_t *)node->internal_data)->inode;
+}
+
+// Radix tree
+
+static void *tmpfs_alloc_page() {
+    uint64_t phys = find_next_free_frame();
+    if (phys == 0) {
+        return NULL;
+    }
+
+    void *page = (void *)phys_to_virt(phys);
+    memset(page, 0, PAGE_LEN);
+    return page;
+}
+
+static struct tmpfs_radix_node *tmpfs_alloc_radix_node() {
+    struct tmpfs_radix_node *radix = kmalloc_heap(sizeof(struct tmpfs_radix_node));
+    if (radix) {
+        memset(radix, 0, sizeof(struct tmpfs_radix_node));
+    }
+    return radix;
+}
+
+// Returns the page holding page_index, or NULL if it is a hole. The inode's lock must be held.
+static uint8_t *tmpfs_radix_lookup(tmpfs_inode_t *inode, uint64_t page_index) {
+    if (inode->radix_height == 0 || (page_index >> (TMPFS_RADIX_SHIFT * inode->radix_height)) != 0) {
+        return NULL;
+    }
+
+    void *slot = inode->radix_root;
+    for (int level = inode->radix_height - 1; level >= 0 && slot; level--) {
+        size_t i = (page_index >> (TMPFS_RADIX_SHIFT * level)) & (TMPFS_RADIX_FANOUT - 1);
+        slot     = ((struct tmpfs_radix_node *)slot)->slots[i];
+    }
+
+    return (uint8_t *)slot;
+}
+
+// Like tmpfs_radix_lookup, but allocates the page (and any missing radix nodes) if needed. The inode's lock must be
+// held.
+static uint8_t *tmpfs_radix_get_or_create(tmpfs_inode_t *inode, uint64_t page_index) {
+    // Grow the tree upwards until it covers page_index; the old root becomes slot 0 of the new one
+    while (inode->radix_height == 0 || (page_index >> (TMPFS_RADIX_SHIFT * inode->radix_height)) != 0) {
+        if (inode->radix_height == TMPFS_RADIX_MAX_HEIGHT) {
+            return NULL;
+        }
+
+        struct tmpfs_radix_node *new_root = tmpfs_alloc_radix_node();
+        if (!new_root) {
+            return NULL;
+        }
+
+        new_root->slots[0] = inode->radix_root;
+        inode->radix_root  = new_root;
+        inode->radix_height++;
+    }
+
+    struct tmpfs_radix_node *radix = inode->radix_root;
+    for (int level = inode->radix_height - 1; level > 0; level--) {
+        size_t i = (page_index >> (TMPFS_RADIX_SHIFT * level)) & (TMPFS_RADIX_FANOUT - 1);
+        if (!radix->slots[i]) {
+            radix->slots[i] = tmpfs_alloc_radix_node();
+            if (!radix->slots[i]) {
+                return NULL;
+            }
+        }
+        radix = radix->slots[i];
+    }
+
+    size_t i = page_index & (TMPFS_RADIX_FANOUT - 1);
+    if (!radix->slots[i]) {
+        radix->slots[i] = tmpfs_alloc_page();
+    }
+    return radix->slots[i];
+}
+
+// Inodes
+
+static tmpfs_inode_t *tmpfs_alloc_inode(const char *name, dirent_type_t type, uid_t uid, gid_t gid, mode_t mode) {
+    tmpfs_inode_t *inode = kmalloc_heap(sizeof(tmpfs_inode_t));
+    if (!inode) {
+        return NULL;
+    }
+    memset(inode, 0, sizeof(tmpfs_inode_t));
+
+    strncpy(inode->name, name, NAME_MAX);
+    inode->name[NAME_MAX] = '\0';
+    inode->type           = type;
+    inode->uid            = uid;
+    inode->gid            = gid;
+    inode->mode           = mode;
+    inode->lock           = MUTEX_INIT;
+
+    return inode;
+}
+
+// The directory's lock must be held
+static tmpfs_inode_t *tmpfs_find_child(tmpfs_inode_t *dir, const char *name) {
+    for (tmpfs_inode_t *child = dir->first_child; child; child = child->next_sibling) {
+        if (strncmp(child->name, name, NAME_MAX + 1) == 0) {
+            return child;
+        }
+    }
+    return NULL;
+}
+
+static void tmpfs_populate_node(fscache_node_t *node, tmpfs_inode_t *inode) {
+    fscache_node_populate(node, inode->type, 0, inode->name, inode->uid, inode->gid, inode->mode,
+                          inode->type == DT_REG ? inode->size : 0,
+                          inode->type == DT_DIR ? tmpfs_directory_fsops : tmpfs_file_fsops);
+
+    ((vfs_tmpfs_cache_node_data_t *)node->internal_data)->inode = inode;
+}
+
+// VFS operations
+
+ssize_t tmpfs_file_read_func(vfs_handle_t *handle, void *buf, size_t len) {
+    vfs_tmpfs_handle_instance_data_t *instance_data = (vfs_tmpfs_handle_instance_data_t *)handle->instance_data;
+
+    if (!buf || !handle->backing_node) {
+        return -EIO;
+    }
+
+    tmpfs_inode_t *inode = tmpfs_get_inode(handle->backing_node);
+    if (!inode) {
+        return -EIO;
+    }
+
+    mutex_lock(&inode->lock);
+
+    if (instance_data->seek_pos >= (uint64_t)inode->size || len == 0) {
+        mutex_unlock(&inode->lock);
+        return 0;
+    }
+    if (len > (uint64_t)inode->size - instance_data->seek_pos) {
+        len = (uint64_t)inode->size - instance_data->seek_pos;
+    }
+
+    uint8_t *out_ptr = (uint8_t *)buf;
+    size_t done      = 0;
+
+    while (done < len) {
+        uint64_t offset_in_page = instance_data->seek_pos % PAGE_LEN;
+        size_t to_copy          = PAGE_LEN - offset_in_page;
+        if (to_copy > len - done) {
+            to_copy = len - done;
+        }
+
+        uint8_t *page = tmpfs_radix_lookup(inode, instance_data->seek_pos / PAGE_LEN);
+        if (page) {
+            memcpy(out_ptr + done, page + offset_in_page, to_copy);
+        } else {
+            memset(out_ptr + done, 0, to_copy);
+        }
+
+        done                    += to_copy;
+        instance_data->seek_pos += to_copy;
+    }
+
+    mutex_unlock(&inode->lock);
+
+    return (ssize_t)done;
+}
+
+ssize_t tmpfs_file_write_func(vfs_handle_t *handle, const void *buf, size_t len) {
+    vfs_tmpfs_handle_instance_data_t *instance_data = (vfs_tmpfs_handle_instance_data_t *)handle->instance_data;
+
+    if (!buf || !handle->backing_node) {
+        return -EIO;
+    }
+
+    tmpfs_inode_t *inode = tmpfs_get_inode(handle->backing_node);
+    if (!inode) {
+        return -EIO;
+    }
+
+    if (len == 0) {
+        return 0;
+    }
+
+    if (instance_data->seek_pos >= (uint64_t)TMPFS_MAX_FILE_SIZE) {
+        return -EFBIG;
+    }
+    if (len > (uint64_t)TMPFS_MAX_FILE_SIZE - instance_data->seek_pos) {
+        len = (uint64_t)TMPFS_MAX_FILE_SIZE - instance_data->seek_pos;
+    }
+
+    const uint8_t *in_ptr = (const uint8_t *)buf;
+    size_t done           = 0;
+
+    mutex_lock(&inode->lock);
+
+    while (done < len) {
+        uint64_t offset_in_page = instance_data->seek_pos % PAGE_LEN;
+        size_t to_copy          = PAGE_LEN - offset_in_page;
+        if (to_copy > len - done) {
+            to_copy = len - done;
+        }
+
+        uint8_t *page = tmpfs_radix_get_or_create(inode, instance_data->seek_pos / PAGE_LEN);
+        if (!page) {
+            break;
+        }
+
+        memcpy(page + offset_in_page, in_ptr + done, to_copy);
+
+        done                    += to_copy;
+        instance_data->seek_pos += to_copy;
+    }
+
+    if (instance_data->seek_pos > (uint64_t)inode->size) {
+        inode->size = (off_t)instance_data->seek_pos;
+    }
+    handle->backing_node->size = inode->size;
+
+    mutex_unlock(&inode->lock);
+
+    if (done == 0) {
+        return -ENOSPC;
+    }
+
+    return (ssize_t)done;
+}
+
+off_t tmpfs_file_seek_func(vfs_handle_t *handle, off_t offset, vfs_seek_whence_t whence) {
+    vfs_tmpfs_handle_instance_data_t *instance_data = (vfs_tmpfs_handle_instance_data_t *)handle->instance_data;
+
+    if (!handle->backing_node) {
+        return -EIO;
+    }
+
+    tmpfs_inode_t *inode = tmpfs_get_inode(handle->backing_node);
+
+    off_t base;
+    switch (whence) {
+    case VFS_SEEK_SET:
+        base = 0;
+        break;
+    case VFS_SEEK_CUR:
+        base = (off_t)instance_data->seek_pos;
+        break;
+    case VFS_SEEK_END:
+        mutex_lock(&inode->lock);
+        base = inode->size;
+        mutex_unlock(&inode->lock);
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    off_t new_pos = base + offset;
+    if (new_pos < 0 || new_pos > TMPFS_MAX_FILE_SIZE) {
+        return -EINVAL;
+    }
+
+    instance_data->seek_pos = (uint64_t)new_pos;
+
+    return new_pos;
+}
+
+ssize_t tmpfs_dir_read_func(vfs_handle_t *handle, void *buf, size_t len) {
+    vfs_tmpfs_handle_instance_data_t *instance_data = (vfs_tmpfs_handle_instance_data_t *)handle->instance_data;
+
+    if (!buf || !handle->backing_node) {
+        return -EIO;
+    }
+
+    tmpfs_inode_t *dir = tmpfs_get_inode(handle->backing_node);
+    if (!dir) {
+        return -EIO;
+    }
+
+    size_t total_bytes_read = 0;
+
+    mutex_lock(&dir->lock);
+
+    tmpfs_inode_t *child = dir->first_child;
+    for (uint64_t i = 0; i < instance_data->seek_pos && child; i++) {
+        child = child->next_sibling;
+    }
+
+    while (child && len >= sizeof(struct plenjos_dirent)) {
+        struct plenjos_dirent *dent = (struct plenjos_dirent *)((uint8_t *)buf + total_bytes_read);
+        memset(dent, 0, sizeof(struct plenjos_dirent));
+        strncpy(dent->d_name, child->name, NAME_MAX + 1);
+        dent->d_name[NAME_MAX] = '\0';
+        dent->type             = child->type;
+
+        instance_data->seek_pos++;
+        total_bytes_read += sizeof(struct plenjos_dirent);
+        len              -= sizeof(struct plenjos_dirent);
+
+        child = child->next_sibling;
+    }
+
+    mutex_unlock(&dir->lock);
+
+    return (ssize_t)total_bytes_read;
+}
+
+off_t tmpfs_dir_seek_func(vfs_handle_t *handle, off_t offset, vfs_seek_whence_t whence) {
+    vfs_tmpfs_handle_instance_data_t *instance_data = (vfs_tmpfs_handle_instance_data_t *)handle->instance_data;
+
+    // Directory positions aren't byte offsets; only rewinding is supported
+    if (whence != VFS_SEEK_SET || offset != 0) {
+        return -EINVAL;
+    }
+
+    instance_data->seek_pos = 0;
+    return 0;
+}
+
+int tmpfs_load_node_func(fscache_node_t *node, const char *name, fscache_node_t *out) {
+    if (!node || !name || !out) {
+        return -EINVAL;
+    }
+
+    if (node->type != DT_DIR) {
+        return -ENOTDIR;
+    }
+
+    tmpfs_inode_t *dir = tmpfs_get_inode(node);
+    if (!dir) {
+        return -EIO;
+    }
+
+    mutex_lock(&dir->lock);
+    tmpfs_inode_t *child = tmpfs_find_child(dir, name);
+    mutex_unlock(&dir->lock);
+
+    if (!child) {
+        return -ENOENT;
+    }
+
+    // Children are never removed, so the inode stays valid without the lock
+    mutex_lock(&child->lock);
+    tmpfs_populate_node(out, child);
+    mutex_unlock(&child->lock);
+
+    return 0;
+}
+
+int tmpfs_create_child_func(fscache_node_t *parent, const char *name, dirent_type_t type, uid_t uid, gid_t gid,
+                            mode_t mode, fscache_node_t *node) {
+    if (!parent || !name) {
+        return -EINVAL;
+    }
+
+    if (parent->type != DT_DIR) {
+        return -ENOTDIR;
+    }
+
+    if (type != DT_REG && type != DT_DIR) {
+        return -EINVAL;
+    }
+
+    size_t name_len = strlen(name);
+    if (name_len == 0 || name_len > NAME_MAX) {
+        return -EINVAL;
+    }
+
+    tmpfs_inode_t *dir = tmpfs_get_inode(parent);
+    if (!dir) {
+        return -EIO;
+    }
+
+    tmpfs_inode_t *inode = tmpfs_alloc_inode(name, type, uid, gid, mode & 07777);
+    if (!inode) {
+        return -ENOMEM;
+    }
+
+    mutex_lock(&dir->lock);
+
+    if (tmpfs_find_child(dir, name)) {
+        mutex_unlock(&dir->lock);
+        kfree_heap(inode);
+        return -EEXIST;
+    }
+
+    inode->parent = dir;
+    if (dir->last_child) {
+        dir->last_child->next_sibling = inode;
+    } else {
+        dir->first_child = inode;
+    }
+    dir->last_child = inode;
+
+    mutex_unlock(&dir->lock);
+
+    if (node) {
+        tmpfs_populate_node(node, inode);
+    }
+
+    return 0;
+}
+
+extern fscache_node_t *fscache_root_node;
+int tmpfs_setup(const char *name, uid_t uid, gid_t gid, mode_t mode) {
+    mutex_lock(&tmpfs_fsops_lock);
+    if (!tmpfs_directory_fsops) {
+        vfs_ops_block_t *dir_fsops = kmalloc_heap(sizeof(vfs_ops_block_t));
+        if (!dir_fsops) {
+            printf("OOM Error: tmpfs_setup: could not allocate memory for directory fsops\n");
+            mutex_unlock(&tmpfs_fsops_lock);
+            return -ENOMEM;
+        }
+        memset(dir_fsops, 0, sizeof(vfs_ops_block_t));
+        dir_fsops->fsname       = "tmpfs";
+        dir_fsops->read         = tmpfs_dir_read_func;
+        dir_fsops->seek         = tmpfs_dir_seek_func;
+        dir_fsops->create_child = tmpfs_create_child_func;
+        dir_fsops->load_node    = tmpfs_load_node_func;
+        tmpfs_directory_fsops   = dir_fsops;
+    }
+    if (!tmpfs_file_fsops) {
+        vfs_ops_block_t *file_fsops = kmalloc_heap(sizeof(vfs_ops_block_t));
+        if (!file_fsops) {
+            printf("OOM Error: tmpfs_setup: could not allocate memory for file fsops\n");
+            mutex_unlock(&tmpfs_fsops_lock);
+            return -ENOMEM;
+        }
+        memset(file_fsops, 0, sizeof(vfs_ops_block_t));
+        file_fsops->fsname    = "tmpfs";
+        file_fsops->read      = tmpfs_file_read_func;
+        file_fsops->write     = tmpfs_file_write_func;
+        file_fsops->seek      = tmpfs_file_seek_func;
+        file_fsops->load_node = tmpfs_load_node_func;
+        tmpfs_file_fsops      = file_fsops;
+    }
+    mutex_unlock(&tmpfs_fsops_lock);
+
+    tmpfs_inode_t *root = tmpfs_alloc_inode(name, DT_DIR, uid, gid, mode);
+    if (!root) {
+        printf("OOM Error: tmpfs_setup: could not allocate memory for root inode\n");
+        return -ENOMEM;
+    }
+
+    fscache_node_t *node = fscache_allocate_node();
+    if (!node) {
+        printf("OOM Error: tmpfs_setup: could not allocate memory for root cache node\n");
+        kfree_heap(root);
+        return -ENOMEM;
+    }
+
+    tmpfs_populate_node(node, root);
+
+    _fscache_wait_for_node_modifiable(fscache_root_node);
+
+    fscache_node_t *child = fscache_root_node->first_child;
+    node->next_sibling    = NULL;
+    node->parent_node     = fscache_root_node;
+
+    if (child == NULL) {
+        node->prev_sibling             = NULL;
+        fscache_root_node->first_child = node;
+    } else {
+        while (child->next_sibling != NULL) {
+            child = child->next_sibling;
+        }
+        child->next_sibling = node;
+        node->prev_sibling  = child;
+    }
+
+    _fscache_release_node_modifiable(fscache_root_node);
+    _fscache_release_node_readable(node);
+
+    printf("tmpfs mounted at /%s\n", root->name);
+
+    return 0;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "lib/lock.h"
+#include "plenjos/limits.h"
+#include "vfs/fscache.h"
+#include "vfs/vfs.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Memory-backed filesystem. The tree lives in tmpfs_inode_t structures that outlive any fscache node pointing at them;
+ * file data is kept in page-sized chunks (never allocated for holes, which read as zeroes) indexed by a radix tree
+ * keyed on the page number.
+ */
+
+// Each radix tree level resolves this many bits of the page number
+#define TMPFS_RADIX_SHIFT  6
+#define TMPFS_RADIX_FANOUT (1 << TMPFS_RADIX_SHIFT)
+
+// Enough levels to index every page of a file up to TMPFS_MAX_FILE_SIZE
+#define TMPFS_RADIX_MAX_HEIGHT 6
+#define TMPFS_MAX_FILE_SIZE    ((off_t)1 << (TMPFS_RADIX_SHIFT * TMPFS_RADIX_MAX_HEIGHT + 12))
+
+typedef struct tmpfs_inode tmpfs_inode_t;
+
+struct tmpfs_radix_node {
+    void *slots[TMPFS_RADIX_FANOUT]; // Child radix nodes, or pages at the bottom level
+};
+
+struct tmpfs_inode {
+    char name[NAME_MAX + 1];
+    dirent_type_t type;
+
+    uid_t uid;
+    gid_t gid;
+    mode_t mode;
+    off_t size; // Regular files only
+
+    // Protects the data pages and size (files) or the child list (directories)
+    mutex lock;
+
+    // Files: a tree of height radix_height covers pages [0, TMPFS_RADIX_FANOUT ^ radix_height)
+    struct tmpfs_radix_node *radix_root;
+    uint8_t radix_height;
+
+    // Directories; new children are added at the end so directory offsets stay stable
+    tmpfs_inode_t *parent;
+    tmpfs_inode_t *first_child;
+    tmpfs_inode_t *last_child;
+    tmpfs_inode_t *next_sibling;
+};
+
+typedef struct vfs_tmpfs_cache_node_data {
+    tmpfs_inode_t *inode;
+    uint64_t unused[3];
+} __attribute__((packed)) vfs_tmpfs_cache_node_data_t;
+
+typedef struct vfs_tmpfs_handle_instance_data {
+    uint64_t seek_pos; // Byte offset for files; entry index for directories
+    uint64_t unused[3];
+} __attribute__((packed)) vfs_tmpfs_handle_instance_data_t;
+
+// Creates an empty tmpfs and attaches its root under the fscache root as name (e.g. "tmp")
+int tmpfs_setup(const char *name, uid_t uid, gid_t gid, mode_t mode);
@@ -6,12 +6,19 @@
 #include "plenjos/errno.h"
 #include "plenjos/syscall.h"
 #include "vfs/kernelfs.h"
+#include "vfs/pagecache.h"
+#include "vfs/tmpfs/tmpfs.h"
 
 #include <stdint.h>
 
 void vfs_init() {
     kernelfs_init();
     fscache_init();
+
+    // Scratch space that never touches a disk
+    if (tmpfs_setup("tmp", 0, 0, 01777) < 0) {
+        printf("vfs_init: failed to set up tmpfs at /tmp\n");
+    }
 }
 
 int vfs_close(vfs_handle_t *f) {
@@ -27,47 +34,138 @@ int vfs_close(vfs_handle_t *f) {
     return f->backing_node->fsops->close(f);
 }
 
-ssize_t vfs_read(vfs_handle_t *f, void *buf, size_t len) {
+// Checks that f can be read from (or written to, if write is set)
+static int vfs_helper_check_rw(vfs_handle_t *f, bool write) {
     if (!f) {
         return -EINVAL;
     }
 
-    if ((f->access & ACCESS_READ) == 0) {
+    if ((f->access & (write ? ACCESS_WRITE : ACCESS_READ)) == 0) {
         return -EACCES;
     }
 
     if (f->backing_node == NULL) {
-        printf("vfs_read: backing_node is NULL\n");
+        printf("vfs_%s: backing_node is NULL\n", write ? "write" : "read");
         return -EIO;
     }
 
     if (f->backing_node->fsops == NULL) {
-        printf("vfs_read: fsops is NULL\n");
+        printf("vfs_%s: fsops is NULL\n", write ? "write" : "read");
         return -EIO;
     }
 
-    if (f->backing_node->fsops->read == NULL) {
-        printf("vfs_read: read function is NULL\n");
+    bool has_op = write ? f->backing_node->fsops->write != NULL : f->backing_node->fsops->read != NULL;
+    if (!has_op) {
+        if (!write) {
+            printf("vfs_read: read function is NULL\n");
+        }
         return -EIO;
     }
 
-    return f->backing_node->fsops->read(f, buf, len);
+    return 0;
 }
 
-ssize_t vfs_write(vfs_handle_t *f, const void *buf, size_t len) {
-    if (!f) {
+// Runs the filesystem's read/write over each segment in turn. The handle must already have been checked.
+static ssize_t vfs_helper_transfer(vfs_handle_t *f, const struct plenjos_iovec *iov, int iovcnt, bool write) {
+    if (iovcnt < 0 || iovcnt > PLENJOS_IOV_MAX || (iovcnt > 0 && !iov)) {
         return -EINVAL;
     }
 
-    if ((f->access & ACCESS_WRITE) == 0) {
-        return -EACCES;
+    // The total has to be representable in the return value
+    size_t total_len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len > (size_t)INT64_MAX - total_len) {
+            return -EINVAL;
+        }
+        total_len += iov[i].iov_len;
     }
 
-    if (f->backing_node == NULL || f->backing_node->fsops == NULL || f->backing_node->fsops->write == NULL) {
-        return -EIO;
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) {
+            continue;
+        }
+
+        ssize_t res = write ? f->backing_node->fsops->write(f, iov[i].iov_base, iov[i].iov_len)
+                            : f->backing_node->fsops->read(f, iov[i].iov_base, iov[i].iov_len);
+        if (res < 0) {
+            return total ? (ssize_t)total : res;
+        }
+
+        total += (size_t)res;
+        if ((size_t)res < iov[i].iov_len) {
+            break;
+        }
+    }
+
+    if (write && total > 0) {
+        // Later faults on file mappings must see the new contents
+        pagecache_drop_node(f->backing_node);
+    }
+
+    return (ssize_t)total;
+}
+
+// Positional transfers work on a copy of the handle so that the shared seek position is never modified
+static ssize_t vfs_helper_positional_transfer(vfs_handle_t *f, const struct plenjos_iovec *iov, int iovcnt,
+                                              off_t offset, bool write) {
+    int res = vfs_helper_check_rw(f, write);
+    if (res < 0) {
+        return res;
+    }
+
+    if (offset < 0) {
+        return -EINVAL;
     }
 
-    return f->backing_node->fsops->write(f, buf, len);
+    if (f->backing_node->fsops->seek == NULL) {
+        return -ESPIPE;
+    }
+
+    vfs_handle_t shadow = *f;
+
+    off_t pos = f->backing_node->fsops->seek(&shadow, offset, VFS_SEEK_SET);
+    if (pos < 0) {
+        return pos;
+    }
+
+    return vfs_helper_transfer(&shadow, iov, iovcnt, write);
+}
+
+ssize_t vfs_read(vfs_handle_t *f, void *buf, size_t len) {
+    struct plenjos_iovec iov = { .iov_base = buf, .iov_len = len };
+    return vfs_readv(f, &iov, 1);
+}
+
+ssize_t vfs_write(vfs_handle_t *f, const void *buf, size_t len) {
+    struct plenjos_iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+    return vfs_writev(f, &iov, 1);
+}
+
+ssize_t vfs_readv(vfs_handle_t *f, const struct plenjos_iovec *iov, int iovcnt) {
+    int res = vfs_helper_check_rw(f, false);
+    if (res < 0) {
+        return res;
+    }
+
+    return vfs_helper_transfer(f, iov, iovcnt, false);
+}
+
+ssize_t vfs_writev(vfs_handle_t *f, const struct plenjos_iovec *iov, int iovcnt) {
+    int res = vfs_helper_check_rw(f, true);
+    if (res < 0) {
+        return res;
+    }
+
+    return vfs_helper_transfer(f, iov, iovcnt, true);
+}
+
+ssize_t vfs_preadv(vfs_handle_t *f, const struct plenjos_iovec *iov, int iovcnt, off_t offset) {
+    return vfs_helper_positional_transfer(f, iov, iovcnt, offset, false);
+}
+
+ssize_t vfs_pwritev(vfs_handle_t *f, const struct plenjos_iovec *iov, int iovcnt, off_t offset) {
+    return vfs_helper_positional_transfer(f, iov, iovcnt, offset, true);
 }
 
 off_t vfs_seek(vfs_handle_t *f, off_t offset, vfs_seek_whence_t whence) {
@@ -82,6 +180,23 @@ off_t vfs_seek(vfs_handle_t *f, off_t offset, vfs_seek_whence_t whence) {
     return f->backing_node->fsops->seek(f, offset, whence);
 }
 
+int vfs_fsync(vfs_handle_t *f) {
+    if (!f) {
+        return -EINVAL;
+    }
+
+    if (f->backing_node == NULL || f->backing_node->fsops == NULL) {
+        return -EIO;
+    }
+
+    if (f->backing_node->fsops->fsync == NULL) {
+        // Nothing is staged for this filesystem
+        return 0;
+    }
+
+    return f->backing_node->fsops->fsync(f);
+}
+
 // Helper function to create a vfs_handle_t; DOES NOT check permissions. out MUST NOT be NULL.
 static int vfs_helper_create_handle(fscache_node_t *node, access_t access, vfs_handle_t **out) {
     if (!node) {
@@ -111,6 +226,21 @@ static int vfs_helper_create_handle(fscache_node_t *node, access_t access, vfs_h
     return 0;
 }
 
+int vfs_dup(vfs_handle_t *f, vfs_handle_t **out) {
+    if (!f || !out || !f->backing_node) {
+        return -EINVAL;
+    }
+
+    int res = vfs_helper_create_handle(f->backing_node, f->access, out);
+    if (res < 0) {
+        return res;
+    }
+
+    // Carry over the filesystem's per-handle state (seek position and any cached lookups)
+    memcpy((*out)->instance_data, f->instance_data, sizeof(f->instance_data));
+    return 0;
+}
+
 // If out is NULL, we just check for existence and permissions
 // Permissions are ONLY checked upon file opening
 // TODO: implement groups
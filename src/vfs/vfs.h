@@ -7,6 +7,7 @@
 #include "plenjos/dirent.h"
 #include "plenjos/stat.h"
 #include "plenjos/syscall.h"
+#include "plenjos/uio.h"
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -39,6 +40,15 @@ typedef off_t (*vfs_seek_func_t)(vfs_handle_t *handle, off_t offset, vfs_seek_wh
 // The close function closes the file handle
 typedef int (*vfs_close_func_t)(vfs_handle_t *handle);
 
+// The fsync function writes any staged data and metadata for the handle's node back to the backing device. If it is
+// NULL, the filesystem has nothing to write back.
+typedef int (*vfs_fsync_func_t)(vfs_handle_t *handle);
+
+// Optional. Returns the physical address of page index of the handle's node if the file's data already lives in memory
+// (the caller owns one frame reference to it, as with pagecache_get_page). Returns -ENOENT to have the page cache read
+// the page in instead.
+typedef int (*vfs_get_page_func_t)(vfs_handle_t *handle, uint64_t index, uint64_t *phys_out);
+
 // fscache functions:
 
 // Create child; this can be used to create files or directories (but NOT links). The resulting node is read-locked
@@ -77,6 +87,8 @@ struct vfs_ops_block {
     vfs_write_func_t write;
     vfs_seek_func_t seek;
     vfs_close_func_t close;
+    vfs_fsync_func_t fsync;
+    vfs_get_page_func_t get_page;
 
     // fscache functions
     vfs_create_child_func_t create_child;
@@ -95,11 +107,27 @@ void vfs_init();
 
 int vfs_close(vfs_handle_t *f);
 
+// Creates a second handle on f's node with the same access and a copy of f's filesystem state. Used by kernel code that
+// must keep a file open independently of a descriptor (e.g. file mappings).
+int vfs_dup(vfs_handle_t *f, vfs_handle_t **out);
+
 ssize_t vfs_read(vfs_handle_t *f, void *buf, size_t len);
 ssize_t vfs_write(vfs_handle_t *f, const void *buf, size_t len);
 
+// Vectored variants of vfs_read and vfs_write. The segments must be kernel-accessible; they are processed in order and
+// the transfer stops at the first short read/write. Returns the total number of bytes transferred.
+ssize_t vfs_readv(vfs_handle_t *f, const struct plenjos_iovec *iov, int iovcnt);
+ssize_t vfs_writev(vfs_handle_t *f, const struct plenjos_iovec *iov, int iovcnt);
+
+// Positional variants; these start at offset and leave f's own seek position untouched. The filesystem must support
+// seeking (-ESPIPE otherwise).
+ssize_t vfs_preadv(vfs_handle_t *f, const struct plenjos_iovec *iov, int iovcnt, off_t offset);
+ssize_t vfs_pwritev(vfs_handle_t *f, const struct plenjos_iovec *iov, int iovcnt, off_t offset);
+
 off_t vfs_seek(vfs_handle_t *f, off_t offset, vfs_seek_whence_t whence);
 
+int vfs_fsync(vfs_handle_t *f);
+
 /**
  * If we create, only the lower 12 bits of mode_if_create (3 special bits + rwxrwxrwx) are honored.
  * The special bits are setuid, setgid, and sticky.
@@ -29,19 +29,34 @@ void init_dso_base() {
     loaded_dsos[0] = (struct elf_object) { 0 };
 }
 
-// TODO: read-only ELF pages, along with .dynsym and .dynstr, should be shared across processes (use file-backed
-// mappings w/ memmap)
-
 // TODO: unmap mappings on unload
 
+// Rounds up to a whole number of pages
+static uint64_t page_round_up(uint64_t x) {
+    return (x % PAGE_LEN) ? (x + PAGE_LEN - (x % PAGE_LEN)) : x;
+}
+
+// Read-only segments whose file offset lines up with their address are mapped straight from the file, so every
+// process shares the kernel's page cache copy. They must not need relocations (no DT_TEXTREL), which holds for the
+// -fPIC libraries we build.
+static int segment_can_map_from_file(ELF_program_header_t *p) {
+    return !(p->flags & ELF_PHDR_W) && (p->offset % PAGE_LEN) == (p->vaddr % PAGE_LEN) && p->filesz == p->memsz;
+}
+
+static int load_mapped_library(struct elf_object *obj, int fd, uint8_t *file_buf, uint64_t *out_index);
+
 int load_library_from_disk(const char *path, uint64_t *out_index) {
     // Linker is single-threaded for now; no locking needed. We will increment dso_count when done.
 
     struct elf_object *obj = &loaded_dsos[dso_count];
     *obj                   = (struct elf_object) { 0 };
 
-    // First, load the ELF file from the given path.
+    // First, map the ELF file from the given path.
     int fd = syscall_open(path, SYSCALL_OPEN_FLAG_READ, 0);
+    if (fd < 0) {
+        syscall_print("load_library_from_disk: failed to open ELF file\n");
+        return fd;
+    }
 
     struct kstat stat;
     syscall_fstat(fd, &stat);
@@ -50,26 +65,40 @@ int load_library_from_disk(const char *path, uint64_t *out_index) {
         // Handle error: file size is invalid
         // For simplicity, we return an empty elf_object here.
         syscall_print("load_library_from_disk: invalid file size\n");
+        syscall_close(fd);
         return -EIO;
     }
 
     size_t file_size = (size_t)stat.size;
 
-    // TODO: use ulimit to determine this
-    // TODO: use mmap or something when this is to large for the stack
-    if (file_size >= 0x80000 /* 512 KiB */) {
-        syscall_print("load_library_from_disk: ELF file too large\n");
-        return -EIO;
+    // The whole file is mapped read-only (and faulted in on demand) so the headers can be parsed and the remaining
+    // segments copied out without reading it into memory first
+    uint8_t *file_buf  = (uint8_t *)next_dso_base;
+    next_dso_base     += page_round_up(file_size) + PAGE_LEN;
+
+    int res = syscall_memmap_file(file_buf, file_size, 0, fd, 0);
+    if (res < 0) {
+        syscall_print("load_library_from_disk: failed to map ELF file\n");
+        syscall_close(fd);
+        return res;
     }
 
-    uint8_t file_buf[file_size]; // 512 KiB buffer on stack
+    res = load_mapped_library(obj, fd, file_buf, out_index);
 
-    ssize_t read = syscall_read(fd, file_buf, file_size);
-    if (read < 0 || (size_t)read != file_size) {
-        syscall_print("load_library_from_disk: failed to read entire ELF file\n");
-        return -EIO;
+    // Everything needed from the file has been copied or mapped by now, so the image (and its page cache pages) can go
+    obj->ehdr  = NULL;
+    obj->phdrs = NULL;
+    if (syscall_memunmap(file_buf, file_size) < 0) {
+        syscall_print("load_library_from_disk: failed to unmap ELF file\n");
     }
 
+    return res;
+}
+
+// Closes fd once the segments are mapped
+static int load_mapped_library(struct elf_object *obj, int fd, uint8_t *file_buf, uint64_t *out_index) {
+    int res = 0;
+
     ELF_header_t *ehdr         = (ELF_header_t *)file_buf;
     ELF_program_header_t *phdr = (ELF_program_header_t *)(file_buf + ehdr->ph_offset);
 
@@ -90,13 +119,7 @@ int load_library_from_disk(const char *path, uint64_t *out_index) {
         if (p->type != PT_LOAD) continue;
 
         uint64_t min_vaddr_new = p->vaddr - (p->vaddr % PAGE_LEN);
-        uint64_t max_vaddr_new = p->vaddr + p->memsz;
-
-        if (max_vaddr_new % PAGE_LEN) {
-            // Round up to the next page
-            max_vaddr_new -= (max_vaddr_new % PAGE_LEN);
-            max_vaddr_new += PAGE_LEN;
-        }
+        uint64_t max_vaddr_new = page_round_up(p->vaddr + p->memsz);
 
         if (min_vaddr_new < min_vaddr) {
             min_vaddr = min_vaddr_new;
@@ -117,22 +140,34 @@ int load_library_from_disk(const char *path, uint64_t *out_index) {
 
         if (p->type != PT_LOAD) continue;
 
-        // Map with full permissions; we will adjust later if needed
-        int res = syscall_memmap_from_buffer((void *)(base + p->vaddr), (size_t)p->memsz,
+        if (segment_can_map_from_file(p)) {
+            uint64_t page_offs = p->vaddr % PAGE_LEN;
+
+            res = syscall_memmap_file((void *)(base + p->vaddr - page_offs), (size_t)(p->filesz + page_offs),
+                                      (p->flags & ELF_PHDR_EX) ? SYSCALL_MEMMAP_FLAG_EX : 0, fd,
+                                      (size_t)(p->offset - page_offs));
+        } else {
+            // Map with full permissions; we will adjust later if needed
+            res = syscall_memmap_from_buffer((void *)(base + p->vaddr), (size_t)p->memsz,
                                              SYSCALL_MEMMAP_FLAG_WR | SYSCALL_MEMMAP_FLAG_EX,
                                              (void *)(file_buf + p->offset), (size_t)p->filesz);
+        }
 
         if (res < 0) {
-            syscall_print("load_library_from_disk: failed to map PT_LOAD segment from buffer\n");
+            syscall_print("load_library_from_disk: failed to map PT_LOAD segment\n");
             // TODO: unmap previously mapped segments
+            syscall_close(fd);
             return res;
         }
     }
 
+    // The mappings hold their own references to the file
+    syscall_close(fd);
+
     obj->base = base;
 
     // Locate dynamic section
-    int res = parse_dynamic_section(obj);
+    res = parse_dynamic_section(obj);
     if (res < 0) {
         syscall_print("load_library_from_disk: failed to parse dynamic section\n");
         return res;
@@ -163,9 +198,9 @@ int load_library_from_disk(const char *path, uint64_t *out_index) {
     for (size_t i = 0; i < ehdr->ph_entries; i++) {
         ELF_program_header_t *p = &phdr[i];
 
-        if (p->type != PT_LOAD) continue;
+        // File-backed segments were mapped with their final permissions
+        if (p->type != PT_LOAD || segment_can_map_from_file(p)) continue;
 
-        // Map with full permissions; we will adjust later if needed
         int res = syscall_memprotect((void *)(base + p->vaddr), (size_t)p->memsz,
                                      ((p->flags & ELF_PHDR_W) ? SYSCALL_MEMMAP_FLAG_WR : 0)
                                          | ((p->flags & ELF_PHDR_EX) ? SYSCALL_MEMMAP_FLAG_EX : 0));
@@ -29,6 +29,15 @@ int syscall_memmap_from_buffer(void *addr, size_t length, syscall_memmap_flags_t
                         (uint64_t)buffer_length);
 }
 
+int syscall_memmap_file(void *addr, size_t length, syscall_memmap_flags_t flags, int fd, size_t file_offset) {
+    return (int)syscall(SYSCALL_MEMMAP_FILE, (uint64_t)addr, (uint64_t)length, (uint64_t)flags, (uint64_t)fd,
+                        (uint64_t)file_offset);
+}
+
+int syscall_memunmap(void *addr, size_t length) {
+    return (int)syscall(SYSCALL_MEMUNMAP, (uint64_t)addr, (uint64_t)length, 0, 0, 0);
+}
+
 int syscall_memprotect(void *addr, size_t length, syscall_memmap_flags_t flags) {
     return (int)syscall(SYSCALL_MEMPROTECT, (uint64_t)addr, (uint64_t)length, (uint64_t)flags, 0, 0);
 }
@@ -6,6 +6,7 @@
 #include "plenjos/dirent.h"
 #include "plenjos/syscall.h"
 #include "plenjos/types.h"
+#include "plenjos/uio.h"
 #include "types.h"
 
 #include <stdint.h>
@@ -17,16 +18,25 @@ ssize_t syscall_read(int fd, void *buf, size_t count);
 ssize_t syscall_write(int fd, const void *buf, size_t count);
 off_t syscall_lseek(int fd, off_t offset, int whence);
 
+ssize_t syscall_readv(int fd, const struct plenjos_iovec *iov, int iovcnt);
+ssize_t syscall_writev(int fd, const struct plenjos_iovec *iov, int iovcnt);
+ssize_t syscall_preadv(int fd, const struct plenjos_iovec *iov, int iovcnt, off_t offset);
+ssize_t syscall_pwritev(int fd, const struct plenjos_iovec *iov, int iovcnt, off_t offset);
+
 ssize_t syscall_getdents(int fd, struct plenjos_dirent *buf, size_t nbytes);
 
 int syscall_close(int fd);
 
+int syscall_fsync(int fd);
+
 uint64_t syscall_get_fb(fb_info_t *out_fb_info);
 kbd_buffer_state_t *syscall_get_kb();
 
 int syscall_memmap(void *addr, size_t length, syscall_memmap_flags_t flags);
 int syscall_memmap_from_buffer(void *addr, size_t length, syscall_memmap_flags_t flags, void *buffer,
                                size_t buffer_length);
+int syscall_memmap_file(void *addr, size_t length, syscall_memmap_flags_t flags, int fd, size_t file_offset);
+int syscall_memunmap(void *addr, size_t length);
 
 void syscall_sleep(uint32_t ms);
 
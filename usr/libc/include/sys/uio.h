@@ -0,0 +1,18 @@
+#pragma once
+
+#include "plenjos/uio.h"
+#include "stddef.h"
+
+#include "types.h"
+
+#define IOV_MAX PLENJOS_IOV_MAX
+
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt);
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt);
+ssize_t preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+ssize_t pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
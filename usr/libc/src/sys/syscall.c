@@ -39,6 +39,22 @@ ssize_t syscall_write(int fd, const void *buf, size_t count) {
     return (ssize_t)syscall(SYSCALL_WRITE, (uint64_t)fd, (uint64_t)buf, (uint64_t)count, 0, 0);
 }
 
+ssize_t syscall_readv(int fd, const struct plenjos_iovec *iov, int iovcnt) {
+    return (ssize_t)syscall(SYSCALL_READV, (uint64_t)fd, (uint64_t)iov, (uint64_t)iovcnt, 0, 0);
+}
+
+ssize_t syscall_writev(int fd, const struct plenjos_iovec *iov, int iovcnt) {
+    return (ssize_t)syscall(SYSCALL_WRITEV, (uint64_t)fd, (uint64_t)iov, (uint64_t)iovcnt, 0, 0);
+}
+
+ssize_t syscall_preadv(int fd, const struct plenjos_iovec *iov, int iovcnt, off_t offset) {
+    return (ssize_t)syscall(SYSCALL_PREADV, (uint64_t)fd, (uint64_t)iov, (uint64_t)iovcnt, (uint64_t)offset, 0);
+}
+
+ssize_t syscall_pwritev(int fd, const struct plenjos_iovec *iov, int iovcnt, off_t offset) {
+    return (ssize_t)syscall(SYSCALL_PWRITEV, (uint64_t)fd, (uint64_t)iov, (uint64_t)iovcnt, (uint64_t)offset, 0);
+}
+
 ssize_t syscall_getdents(int fd, struct plenjos_dirent *buf, size_t nbytes) {
     return (ssize_t)syscall(SYSCALL_GETDENTS, (uint64_t)fd, (uint64_t)buf, (uint64_t)nbytes, 0, 0);
 }
@@ -51,6 +67,10 @@ int syscall_close(int fd) {
     return (int)syscall(SYSCALL_CLOSE, (uint64_t)fd, 0, 0, 0, 0);
 }
 
+int syscall_fsync(int fd) {
+    return (int)syscall(SYSCALL_FSYNC, (uint64_t)fd, 0, 0, 0, 0);
+}
+
 uint64_t syscall_get_fb(fb_info_t *out_fb_info) {
     return syscall(SYSCALL_GET_FB, (uint64_t)out_fb_info, 0, 0, 0, 0);
 }
@@ -69,6 +89,15 @@ int syscall_memmap_from_buffer(void *addr, size_t length, syscall_memmap_flags_t
                         (uint64_t)buffer_length);
 }
 
+int syscall_memmap_file(void *addr, size_t length, syscall_memmap_flags_t flags, int fd, size_t file_offset) {
+    return (int)syscall(SYSCALL_MEMMAP_FILE, (uint64_t)addr, (uint64_t)length, (uint64_t)flags, (uint64_t)fd,
+                        (uint64_t)file_offset);
+}
+
+int syscall_memunmap(void *addr, size_t length) {
+    return (int)syscall(SYSCALL_MEMUNMAP, (uint64_t)addr, (uint64_t)length, 0, 0, 0);
+}
+
 void syscall_sleep(uint32_t ms) {
     syscall(SYSCALL_SLEEP, (uint64_t)ms, 0, 0, 0, 0);
 }
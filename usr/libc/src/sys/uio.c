@@ -0,0 +1,51 @@
+#include "sys/uio.h"
+
+#include "errno.h"
+#include "sys/syscall.h"
+
+// struct iovec is passed straight through to the kernel
+_Static_assert(sizeof(struct iovec) == sizeof(struct plenjos_iovec), "struct iovec layout mismatch");
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
+    ssize_t res = syscall_readv(fd, (const struct plenjos_iovec *)iov, iovcnt);
+
+    if (res < 0) {
+        errno = (int)-res;
+        return -1;
+    }
+
+    return res;
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+    ssize_t res = syscall_writev(fd, (const struct plenjos_iovec *)iov, iovcnt);
+
+    if (res < 0) {
+        errno = (int)-res;
+        return -1;
+    }
+
+    return res;
+}
+
+ssize_t preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+    ssize_t res = syscall_preadv(fd, (const struct plenjos_iovec *)iov, iovcnt, offset);
+
+    if (res < 0) {
+        errno = (int)-res;
+        return -1;
+    }
+
+    return res;
+}
+
+ssize_t pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+    ssize_t res = syscall_pwritev(fd, (const struct plenjos_iovec *)iov, iovcnt, offset);
+
+    if (res < 0) {
+        errno = (int)-res;
+        return -1;
+    }
+
+    return res;
+}
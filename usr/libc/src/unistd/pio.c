@@ -0,0 +1,13 @@
+#include "errno.h"
+#include "sys/uio.h"
+#include "unistd.h"
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+    struct iovec iov = { .iov_base = buf, .iov_len = count };
+    return preadv(fd, &iov, 1, offset);
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = count };
+    return pwritev(fd, &iov, 1, offset);
+}